@@ -303,6 +303,14 @@ typedef void (MDB_rel_func)(MDB_val *item, void *oldptr, void *newptr, void *rel
 #define MDB_NORDAHEAD	0x800000
 	/** don't initialize malloc'd memory before writing to datafile */
 #define MDB_NOMEMINIT	0x1000000
+	/** record which pages each write txn changes, for #MDB_CP_DELTA */
+#define MDB_TRACKPAGES	0x2000000
+	/** collect latency histograms and page counters, see #mdb_env_opstat() */
+#define MDB_OPSTATS		0x4000000
+	/** keep a checksum of every page, verified when it is read */
+#define MDB_CHECKSUM	0x40000000
+	/** map the data file in windows on demand, see #mdb_env_set_mapwindow() */
+#define MDB_WINDOWMAP	0x8000
 /** @} */
 
 /**	@defgroup	mdb_dbi_open	Database Flags
@@ -321,6 +329,10 @@ typedef void (MDB_rel_func)(MDB_val *item, void *oldptr, void *newptr, void *rel
 #define MDB_INTEGERDUP	0x20
 	/** with #MDB_DUPSORT, use reverse string dups */
 #define MDB_REVERSEDUP	0x40
+	/** store the key prefix shared by a leaf page once per page */
+#define MDB_PREFIXKEY	0x80
+	/** with #MDB_DUPSORT, store the dup prefix shared by a page once */
+#define MDB_PREFIXDUP	0x100
 	/** create DB if not already existing */
 #define MDB_CREATE		0x40000
 /** @} */
@@ -356,6 +368,12 @@ typedef void (MDB_rel_func)(MDB_val *item, void *oldptr, void *newptr, void *rel
  * pages sequentially.
  */
 #define MDB_CP_COMPACT	0x01
+/** Start recording changed pages anew at the copied snapshot. */
+#define MDB_CP_MARK	0x02
+/** Copy only the pages changed since the last #MDB_CP_MARK or
+ * #MDB_CP_DELTA copy.
+ */
+#define MDB_CP_DELTA	0x04
 /*	@} */
 
 /** @brief Cursor Get operations.
@@ -473,6 +491,45 @@ typedef struct MDB_envinfo {
 	unsigned int me_numreaders;		/**< max reader slots used in the environment */
 } MDB_envinfo;
 
+	/** Number of buckets in an #MDB_ophist */
+#define MDB_HIST_BUCKETS	40
+
+	/** @brief Latency histogram of an operation, see #mdb_env_opstat() */
+typedef struct MDB_ophist {
+	unsigned long long	oh_count;	/**< number of calls */
+	unsigned long long	oh_nsec;	/**< total time spent, in nanoseconds */
+	unsigned long long	oh_max;		/**< longest call, in nanoseconds */
+	/** Calls by duration. Bucket i counts the calls that took from
+	 *	2^i up to 2^(i+1)-1 nanoseconds. The first bucket also counts
+	 *	shorter calls, the last one longer calls.
+	 */
+	unsigned long long	oh_hist[MDB_HIST_BUCKETS];
+} MDB_ophist;
+
+	/** @brief Operations timed by #MDB_OPSTATS */
+enum {
+	MDB_OPS_BEGIN,	/**< #mdb_txn_begin() and #mdb_txn_renew() */
+	MDB_OPS_GET,	/**< #mdb_get() and #mdb_cursor_get() */
+	MDB_OPS_PUT,	/**< #mdb_put() and #mdb_cursor_put() */
+	MDB_OPS_COMMIT,	/**< #mdb_txn_commit() */
+	MDB_OPS_FLUSH,	/**< writing out the dirty pages of a commit */
+	MDB_OPS_SYNC,	/**< syncing the data and writing the meta page of a commit */
+	MDB_OPS_NUM
+};
+
+	/** @brief Operation statistics of an environment, see #mdb_env_opstat() */
+typedef struct MDB_opstat {
+	MDB_ophist	os_op[MDB_OPS_NUM];	/**< indexed by MDB_OPS_* */
+	/** Major page faults taken during transactions. Only counted where
+	 *	the OS reports them per thread, and only if a transaction ends
+	 *	in the thread that began it.
+	 */
+	unsigned long long	os_faults;
+	unsigned long long	os_dirtied;	/**< pages dirtied by write transactions */
+	unsigned long long	os_spilled;	/**< dirty pages spilled before commit */
+	unsigned long long	os_reused;	/**< pages reused from the freelist */
+} MDB_opstat;
+
 	/** @brief Return the LMDB library version information.
 	 *
 	 * @param[out] major if non-NULL, the library major version number is copied here
@@ -614,6 +671,46 @@ int  mdb_env_create(MDB_env **env);
 	 *		caller is expected to overwrite all of the memory that was
 	 *		reserved in that case.
 	 *		This flag may be changed at any time using #mdb_env_set_flags().
+	 *	<li>#MDB_TRACKPAGES
+	 *		Keep a map of the pages written by each transaction in a file
+	 *		next to the data file, "track.mdb" or \b path with "-track"
+	 *		appended when #MDB_NOSUBDIR is used. The map is what lets
+	 *		#mdb_env_copy2() write incremental copies with #MDB_CP_DELTA.
+	 *		Every process writing to the environment must use this flag,
+	 *		otherwise the next delta copy fails with #MDB_INCOMPATIBLE and
+	 *		a new #MDB_CP_MARK copy must be made. The flag is not supported
+	 *		with #MDB_NOLOCK, nor on Windows.
+	 *	<li>#MDB_OPSTATS
+	 *		Time the main operations and count page activity, for
+	 *		#mdb_env_opstat(). This costs two clock reads per operation,
+	 *		and two getrusage() calls per transaction where per thread
+	 *		fault counts are available.
+	 *		This flag may be changed at any time using #mdb_env_set_flags().
+	 *	<li>#MDB_CHECKSUM
+	 *		Keep a CRC32C checksum of every page in a file next to the data
+	 *		file, "cksum.mdb" or \b path with "-cksum" appended when
+	 *		#MDB_NOSUBDIR is used. Checksums are computed as pages are written
+	 *		at commit, and a page is verified the first time it is read
+	 *		after it changed; a page that does not match fails the operation
+	 *		with #MDB_CORRUPTED. #mdb_scrub() verifies all pages of a database.
+	 *		Pages written since the file was created, or by a process that
+	 *		did not use this flag, are not verified until they are written
+	 *		again. The file must be removed when the data file is replaced,
+	 *		e.g. by a restored backup. After a system crash with #MDB_NOSYNC,
+	 *		it should be removed unless #mdb_env_sync() was called since the
+	 *		last commit. The flag is not supported on Windows.
+	 *	<li>#MDB_WINDOWMAP
+	 *		Don't map the whole data file. Only the meta pages stay mapped,
+	 *		other pages are mapped on demand in windows of a few pages, which
+	 *		stay mapped until the transaction that used them ends. Unused
+	 *		windows are kept as a cache up to the size set with
+	 *		#mdb_env_set_mapwindow(). This bounds the address space used by
+	 *		the environment to that size plus what the open transactions
+	 *		touch, at the cost of a lookup per page access. The map size
+	 *		then only limits the size of the data file loosely: it grows
+	 *		as needed instead of failing with #MDB_MAP_FULL, and
+	 *		#MDB_MAP_RESIZED is not returned. Not compatible with
+	 *		#MDB_WRITEMAP or #MDB_FIXEDMAP, and not supported on Windows.
 	 * </ul>
 	 * @param[in] mode The UNIX permissions to set on created files and semaphores.
 	 * This parameter is ignored on Windows.
@@ -681,7 +778,20 @@ int  mdb_env_copyfd(MDB_env *env, mdb_filehandle_t fd);
 	 *		pages and sequentially renumber all pages in output. This option
 	 *		consumes more CPU and runs more slowly than the default.
 	 *		Currently it fails if the environment has suffered a page leak.
+	 *	<li>#MDB_CP_MARK - Make a full copy and start recording the pages
+	 *		changed after the copied snapshot, so that it can serve as the
+	 *		base of later #MDB_CP_DELTA copies. The environment must have
+	 *		been opened with #MDB_TRACKPAGES.
+	 *	<li>#MDB_CP_DELTA - Write only the pages changed since the snapshot
+	 *		of the previous #MDB_CP_MARK or #MDB_CP_DELTA copy, in a format
+	 *		that #mdb_env_patch() applies to a copy of that snapshot. Each
+	 *		delta copy also starts a new recording, so a chain of deltas can
+	 *		be applied in turn to the base copy. With this flag \b path names
+	 *		the output file rather than a directory. It fails with
+	 *		#MDB_INCOMPATIBLE if there is no recording to go from, or if
+	 *		some changes were made without #MDB_TRACKPAGES.
 	 * </ul>
+	 * #MDB_CP_COMPACT cannot be combined with the other flags.
 	 * @return A non-zero error value on failure and 0 on success.
 	 */
 int  mdb_env_copy2(MDB_env *env, const char *path, unsigned int flags);
@@ -705,6 +815,95 @@ int  mdb_env_copy2(MDB_env *env, const char *path, unsigned int flags);
 	 */
 int  mdb_env_copyfd2(MDB_env *env, mdb_filehandle_t fd, unsigned int flags);
 
+	/** @brief Apply an incremental copy to an LMDB environment.
+	 *
+	 * Reads a copy written with #MDB_CP_DELTA from \b fd and writes its
+	 * pages into the environment, bringing it from the snapshot the delta
+	 * starts at to the one it was made from. The environment must be at
+	 * exactly that starting snapshot, i.e. it is a #MDB_CP_MARK copy with
+	 * all the previous deltas of the chain applied.
+	 * No other transactions may be active in the environment while this
+	 * runs, and it should be closed afterwards. If the call fails after
+	 * starting to write pages, the environment is unusable and must be
+	 * restored from the base copy again.
+	 * @param[in] env An environment handle returned by #mdb_env_create(). It
+	 * must have already been opened successfully, without #MDB_RDONLY.
+	 * @param[in] fd The filedescriptor to read the delta from.
+	 * @return A non-zero error value on failure and 0 on success. Some possible
+	 * errors are:
+	 * <ul>
+	 *	<li>#MDB_INCOMPATIBLE - the environment is not at the snapshot the
+	 *		delta starts at, or uses a different page size.
+	 *	<li>#MDB_CORRUPTED - the delta is truncated or malformed.
+	 * </ul>
+	 */
+int  mdb_env_patch(MDB_env *env, mdb_filehandle_t fd);
+
+	/** @brief Opaque structure for an online compaction */
+typedef struct MDB_compact MDB_compact;
+
+	/** @brief Start compacting an LMDB environment while it stays in use.
+	 *
+	 * Writes a copy of the environment as with #MDB_CP_COMPACT next to its
+	 * data file, in "compact.mdb", or in the \b path of #mdb_env_open()
+	 * suffixed with "-compact" when #MDB_NOSUBDIR is used. From the start
+	 * of the copy until #mdb_env_compact_end(), the keys written by every
+	 * write transaction of this process are recorded, and
+	 * #mdb_env_compact_replay() brings the copy up to date by reading
+	 * their current values. Other transactions may run meanwhile.
+	 * Only one compaction may run at a time. Closing a DBI handle with
+	 * #mdb_dbi_close() or emptying the main DB while it runs makes it fail.
+	 * @param[in] env An environment handle returned by #mdb_env_create(). It
+	 * must have already been opened successfully, without #MDB_RDONLY.
+	 * @param[out] cp Address where the compaction handle will be stored.
+	 * @return A non-zero error value on failure and 0 on success. Some possible
+	 * errors are:
+	 * <ul>
+	 *	<li>EBUSY - another process has the environment open, or a
+	 *		compaction is already running.
+	 *	<li>EINVAL - the environment uses #MDB_NOLOCK or #MDB_FIXEDMAP.
+	 * </ul>
+	 */
+int  mdb_env_compact_begin(MDB_env *env, MDB_compact **cp);
+
+	/** @brief Apply the writes recorded so far to a compacted copy.
+	 *
+	 * Briefly takes the writer lock to start a new recording, then
+	 * replays the previous one into the copy in a single transaction.
+	 * Calling this until little is left keeps the final step of
+	 * #mdb_env_compact_end() short.
+	 * @param[in] cp A handle returned by #mdb_env_compact_begin()
+	 * @param[out] count If non-NULL, the number of writes replayed
+	 * @return A non-zero error value on failure and 0 on success. After
+	 * a failure the compaction can only be ended without switching.
+	 */
+int  mdb_env_compact_replay(MDB_compact *cp, size_t *count);
+
+	/** @brief End a compaction, switching the environment to the copy.
+	 *
+	 * If \b commit is zero, the copy is discarded. Otherwise the remaining
+	 * writes are replayed while holding the writer lock, the copy replaces
+	 * the data file and the environment maps it in place of the old one,
+	 * with the same transaction ID. No read transactions may be active in
+	 * this process at that point; read transactions that were reset may
+	 * be renewed afterwards. Incremental copies of #MDB_TRACKPAGES must
+	 * start over from a new #MDB_CP_MARK copy, and the checksums of
+	 * #MDB_CHECKSUM are recomputed as pages are written again.
+	 * Unless EBUSY is returned, the handle is freed.
+	 * @param[in] cp A handle returned by #mdb_env_compact_begin()
+	 * @param[in] commit Non-zero to switch to the copy
+	 * @return A non-zero error value on failure and 0 on success. Some possible
+	 * errors are:
+	 * <ul>
+	 *	<li>EBUSY - a read transaction is active, or another process has
+	 *		opened the environment. Nothing was switched and the compaction
+	 *		may be retried.
+	 *	<li>#MDB_PANIC - the switch failed after the data file was replaced,
+	 *		the environment must be closed and opened again.
+	 * </ul>
+	 */
+int  mdb_env_compact_end(MDB_compact *cp, int commit);
+
 	/** @brief Return statistics about the LMDB environment.
 	 *
 	 * @param[in] env An environment handle returned by #mdb_env_create()
@@ -721,6 +920,21 @@ int  mdb_env_stat(MDB_env *env, MDB_stat *stat);
 	 */
 int  mdb_env_info(MDB_env *env, MDB_envinfo *stat);
 
+	/** @brief Return the operation statistics of the LMDB environment.
+	 *
+	 * Statistics are only collected while the environment has the
+	 * #MDB_OPSTATS flag set, which can be changed with #mdb_env_set_flags().
+	 * They cover the operations of this process only. Counters are
+	 * updated without locks where the compiler lacks atomic builtins,
+	 * so concurrent readers may lose some counts there.
+	 * @param[in] env An environment handle returned by #mdb_env_create()
+	 * @param[out] stat The address of an #MDB_opstat structure
+	 * 	where the statistics will be copied
+	 * @param[in] reset If non-zero, zero the statistics after copying them
+	 * @return A non-zero error value on failure and 0 on success.
+	 */
+int  mdb_env_opstat(MDB_env *env, MDB_opstat *stat, int reset);
+
 	/** @brief Flush the data buffers to disk.
 	 *
 	 * Data is always written to disk when #mdb_txn_commit() is called,
@@ -810,6 +1024,17 @@ int  mdb_env_get_path(MDB_env *env, const char **path);
 	 */
 int  mdb_env_get_fd(MDB_env *env, mdb_filehandle_t *fd);
 
+	/** @brief Check whether a value points into the memory map.
+	 *
+	 * Values that do not, were uncompressed into a buffer as described
+	 * under #mdb_set_compress(). With #MDB_WINDOWMAP, this checks the
+	 * windows mapped at the time.
+	 * @param[in] env An environment handle returned by #mdb_env_create()
+	 * @param[in] val A value returned by a database operation.
+	 * @return Non-zero if the value is in the map.
+	 */
+int  mdb_env_inmap(MDB_env *env, const MDB_val *val);
+
 	/** @brief Set the size of the memory map to use for this environment.
 	 *
 	 * The size should be a multiple of the OS page size. The default is
@@ -844,6 +1069,23 @@ int  mdb_env_get_fd(MDB_env *env, mdb_filehandle_t *fd);
 	 */
 int  mdb_env_set_mapsize(MDB_env *env, size_t size);
 
+	/** @brief Set the size of the map windows kept for this environment.
+	 *
+	 * With #MDB_WINDOWMAP, windows of the data file no transaction uses any
+	 * more stay mapped until their total size exceeds this, then the least
+	 * recently used ones are unmapped. The default is 268435456 bytes.
+	 * This function may be called at any time, a smaller size takes effect
+	 * as transactions end.
+	 * @param[in] env An environment handle returned by #mdb_env_create()
+	 * @param[in] size The size in bytes
+	 * @return A non-zero error value on failure and 0 on success. Some possible
+	 * errors are:
+	 * <ul>
+	 *	<li>EINVAL - an invalid parameter was specified.
+	 * </ul>
+	 */
+int  mdb_env_set_mapwindow(MDB_env *env, size_t size);
+
 	/** @brief Set the maximum number of threads/reader slots for the environment.
 	 *
 	 * This defines the number of slots in the lock table that is used to track readers in the
@@ -1112,6 +1354,20 @@ int  mdb_txn_renew(MDB_txn *txn);
 	 *	<li>#MDB_REVERSEDUP
 	 *		This option specifies that duplicate data items should be compared as
 	 *		strings in reverse order.
+	 *	<li>#MDB_PREFIXKEY
+	 *		Keys on a leaf page are stored without the prefix they all share,
+	 *		which is kept once at the end of the page. This saves space when
+	 *		keys have long common prefixes, such as DNs or path names, and
+	 *		works best when the comparison function keeps such keys adjacent
+	 *		as the default one does. #MDB_REVERSEKEY and #MDB_INTEGERKEY are
+	 *		not allowed. Keys returned by this database's cursors are rebuilt
+	 *		in the cursor, and are only valid until its next operation.
+	 *	<li>#MDB_PREFIXDUP
+	 *		This option may only be used in combination with #MDB_DUPSORT and
+	 *		applies #MDB_PREFIXKEY to the duplicate data items. Dups kept in
+	 *		a sub-page are not compressed; those of keys with enough dups to
+	 *		need their own sub-database are. #MDB_DUPFIXED, #MDB_INTEGERDUP
+	 *		and #MDB_REVERSEDUP are not allowed.
 	 *	<li>#MDB_CREATE
 	 *		Create the named database if it doesn't exist. This option is not
 	 *		allowed in a read-only transaction or a read-only environment.
@@ -1223,6 +1479,36 @@ int  mdb_set_compare(MDB_txn *txn, MDB_dbi dbi, MDB_cmp_func *cmp);
 	 */
 int  mdb_set_dupsort(MDB_txn *txn, MDB_dbi dbi, MDB_cmp_func *cmp);
 
+	/** Smallest value size accepted by #mdb_set_compress() */
+#define MDB_COMPRESS_MIN	64
+
+	/** @brief Store large values of a database compressed.
+	 *
+	 * Values of at least \b minsize bytes written through this handle are
+	 * compressed, and stored that way if it saves at least an eighth of
+	 * their size. This mostly reduces the number of overflow pages used by
+	 * large values. Values written with #MDB_RESERVE are never compressed.
+	 *
+	 * Compressed values are uncompressed when they are read, into a buffer
+	 * owned by the cursor, or by the transaction for #mdb_get() and
+	 * #mdb_put(). Such a value is only valid until the next operation on
+	 * the same cursor, or the next #mdb_get() or #mdb_put() in the same
+	 * transaction. Use #mdb_env_inmap() to tell whether a value needs to be
+	 * copied to be kept longer. Values already stored compressed are read
+	 * correctly whether this is set or not.
+	 * @param[in] txn A transaction handle returned by #mdb_txn_begin()
+	 * @param[in] dbi A database handle returned by #mdb_dbi_open()
+	 * @param[in] minsize The size from which to compress values, at least
+	 * #MDB_COMPRESS_MIN, or 0 to store all values as they are.
+	 * @return A non-zero error value on failure and 0 on success. Some possible
+	 * errors are:
+	 * <ul>
+	 *	<li>#MDB_INCOMPATIBLE - the database uses #MDB_DUPSORT.
+	 *	<li>EINVAL - an invalid parameter was specified.
+	 * </ul>
+	 */
+int  mdb_set_compress(MDB_txn *txn, MDB_dbi dbi, unsigned int minsize);
+
 	/** @brief Set a relocation function for a #MDB_FIXEDMAP database.
 	 *
 	 * @todo The relocation function is called whenever it is necessary to move the data
@@ -1274,6 +1560,8 @@ int  mdb_set_relctx(MDB_txn *txn, MDB_dbi dbi, void *ctx);
 	 * any modification attempts will cause a SIGSEGV.
 	 * @note Values returned from the database are valid only until a
 	 * subsequent update operation, or the end of the transaction.
+	 * Compressed values are only valid until the next #mdb_get(), see
+	 * #mdb_set_compress().
 	 * @param[in] txn A transaction handle returned by #mdb_txn_begin()
 	 * @param[in] dbi A database handle returned by #mdb_dbi_open()
 	 * @param[in] key The key to search for in the database
@@ -1287,6 +1575,77 @@ int  mdb_set_relctx(MDB_txn *txn, MDB_dbi dbi, void *ctx);
 	 */
 int  mdb_get(MDB_txn *txn, MDB_dbi dbi, MDB_val *key, MDB_val *data);
 
+	/** @brief Ask the OS to read in the pages holding a key in advance.
+	 *
+	 * This is meant for readers that are about to fetch many keys which
+	 * may not be in memory: prefetching the next few keys lets their I/O
+	 * proceed while the current one is processed. The branch pages down
+	 * to the key's leaf page are read, then the leaf page is handed to
+	 * madvise(MADV_WILLNEED) without being touched. With
+	 * #MDB_PREFETCH_DATA the leaf page is read as well, and the overflow
+	 * pages of a large value are advised instead. A useful pattern is to
+	 * prefetch a key without the flag first, and with it once the leaf
+	 * page had time to come in.
+	 *
+	 * Pages dirtied by a write transaction are skipped. On systems without
+	 * madvise() this only reads the branch pages.
+	 * @param[in] txn A transaction handle returned by #mdb_txn_begin()
+	 * @param[in] dbi A database handle returned by #mdb_dbi_open()
+	 * @param[in] key The key to prefetch
+	 * @param[in] flags 0 or #MDB_PREFETCH_DATA
+	 * @return A non-zero error value on failure and 0 on success. Some possible
+	 * errors are:
+	 * <ul>
+	 *	<li>#MDB_NOTFOUND - the database is empty, or with #MDB_PREFETCH_DATA
+	 *		the key was not in the database.
+	 *	<li>EINVAL - an invalid parameter was specified.
+	 * </ul>
+	 */
+int  mdb_prefetch(MDB_txn *txn, MDB_dbi dbi, MDB_val *key, unsigned int flags);
+
+	/** Also read the leaf page and prefetch overflow pages, see #mdb_prefetch() */
+#define MDB_PREFETCH_DATA	0x01
+
+	/** @brief Progress of #mdb_scrub() */
+typedef struct MDB_scrub {
+	size_t		ms_pages;	/**< in: pages to verify, out: pages verified */
+	size_t		ms_corrupt;	/**< out: number of corrupt pages found */
+	size_t		ms_badpg;	/**< out: the last corrupt page found */
+} MDB_scrub;
+
+	/** @brief Verify the pages of a database.
+	 *
+	 * The leaf pages are walked in key order, starting at the leaf page
+	 * holding \b key, and each page on the way is checked: the branch
+	 * pages above it, the leaf itself, its overflow pages and the pages
+	 * of its sub-databases of duplicates. Pages are checked against
+	 * their checksum if the environment was opened with #MDB_CHECKSUM,
+	 * and against their own page number. Unlike normal reads, a corrupt
+	 * page does not end the walk, it is counted and the walk goes on.
+	 * Named databases are not entered when walking the main database,
+	 * they must be scrubbed on their own. The free page database is
+	 * scrubbed with \b dbi 0.
+	 *
+	 * Scrubbing stops at the end of a leaf page once \b sc->ms_pages
+	 * pages were checked, so a large database can be scrubbed in small
+	 * steps, each in a new read-only transaction.
+	 * @param[in] txn A transaction handle returned by #mdb_txn_begin()
+	 * @param[in] dbi A database handle returned by #mdb_dbi_open(), or 0
+	 * @param[in,out] key Where to start, or an empty key (\b mv_size 0) to
+	 * start at the beginning. On return, the key to resume from. It points
+	 * into the database and is only valid as long as \b txn.
+	 * @param[in,out] sc The number of pages to check; on return, the
+	 * pages checked and the corrupt pages found.
+	 * @return A non-zero error value on failure and 0 on success. Some possible
+	 * errors are:
+	 * <ul>
+	 *	<li>#MDB_NOTFOUND - the end of the database was reached.
+	 *	<li>#MDB_CORRUPTED - the tree could not be walked any further.
+	 *	<li>EINVAL - an invalid parameter was specified.
+	 * </ul>
+	 */
+int  mdb_scrub(MDB_txn *txn, MDB_dbi dbi, MDB_val *key, MDB_scrub *sc);
+
 	/** @brief Store items into a database.
 	 *
 	 * This function stores key/data pairs in the database. The default behavior
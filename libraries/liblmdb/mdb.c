@@ -69,6 +69,7 @@
 #include <sys/param.h>
 #include <sys/uio.h>
 #include <sys/mman.h>
+#include <sys/resource.h>
 #ifdef HAVE_SYS_FILE_H
 #include <sys/file.h>
 #endif
@@ -190,6 +191,7 @@ typedef SSIZE_T	ssize_t;
 
 #include "lmdb.h"
 #include "midl.h"
+#include "mdb_blk.h"
 
 #if (BYTE_ORDER == LITTLE_ENDIAN) == (BYTE_ORDER == BIG_ENDIAN)
 # error "Unknown or unsupported endianness (BYTE_ORDER)"
@@ -565,6 +567,11 @@ static txnid_t mdb_debug_start;
 #define ENV_MAXKEY(env)	((env)->me_maxkey)
 #endif
 
+	/**	The size of the buffers keys of #P_PREFIX pages are rebuilt in,
+	 *	and so the largest key such pages are used for.
+	 */
+#define MDB_PFXBUF	((MDB_MAXKEYSIZE) > 0 ? (MDB_MAXKEYSIZE) : 511)
+
 	/**	@brief The maximum size of a data item.
 	 *
 	 *	We only store a 32 bit value for node sizes.
@@ -803,7 +810,8 @@ typedef struct MDB_page {
 		pgno_t		p_pgno;	/**< page number */
 		struct MDB_page *p_next; /**< for in-memory list of freed pages */
 	} mp_p;
-	uint16_t	mp_pad;			/**< key size if this is a LEAF2 page */
+	uint16_t	mp_pad;			/**< key size if this is a LEAF2 page,
+						 *	prefix size if this is a #P_PREFIX page */
 /**	@defgroup mdb_page	Page Flags
  *	@ingroup internal
  *	Flags for the page headers.
@@ -816,6 +824,7 @@ typedef struct MDB_page {
 #define	P_DIRTY		 0x10		/**< dirty page, also set for #P_SUBP pages */
 #define	P_LEAF2		 0x20		/**< for #MDB_DUPFIXED records */
 #define	P_SUBP		 0x40		/**< for #MDB_DUPSORT sub-pages */
+#define	P_PREFIX	 0x80		/**< leaf page with a shared key prefix */
 #define	P_LOOSE		 0x4000		/**< page was dirtied then freed, can be reused */
 #define	P_KEEP		 0x8000		/**< leave this page alone during spill */
 /** @} */
@@ -866,6 +875,16 @@ typedef struct MDB_page {
 #define IS_OVERFLOW(p)	 F_ISSET((p)->mp_flags, P_OVERFLOW)
 	/** Test if a page is a sub page */
 #define IS_SUBP(p)	 F_ISSET((p)->mp_flags, P_SUBP)
+	/** Test if a page has a shared key prefix */
+#define IS_PREFIX(p)	 F_ISSET((p)->mp_flags, P_PREFIX)
+	/** The size of the shared key prefix of a page, 0 if it has none */
+#define PAGEPFXLEN(p)	 (IS_PREFIX(p) ? (p)->mp_pad : 0)
+
+	/** Address of the key prefix shared by the nodes of a #P_PREFIX page.
+	 *	It is kept at the end of the page, below which the nodes start
+	 *	at an even offset. Each node's key only holds what follows it.
+	 */
+#define PAGEPFX(env, p)	 ((char *)(p) + (env)->me_psize - EVEN((p)->mp_pad))
 
 	/** The number of overflow pages needed to store the given size. */
 #define OVPAGES(size, psize)	((PAGEHDRSZ-1 + (size)) / (psize) + 1)
@@ -906,9 +925,10 @@ typedef struct MDB_node {
 #define F_BIGDATA	 0x01			/**< data put on overflow page */
 #define F_SUBDATA	 0x02			/**< data is a sub-database */
 #define F_DUPDATA	 0x04			/**< data has duplicates */
+#define F_COMPRESSED	 0x08		/**< data is compressed, see #mdb_set_compress() */
 
 /** valid flags for #mdb_node_add() */
-#define	NODE_ADD_FLAGS	(F_DUPDATA|F_SUBDATA|MDB_RESERVE|MDB_APPEND)
+#define	NODE_ADD_FLAGS	(F_DUPDATA|F_SUBDATA|F_COMPRESSED|MDB_RESERVE|MDB_APPEND)
 
 /** @} */
 	unsigned short	mn_flags;		/**< @ref mdb_node */
@@ -988,12 +1008,18 @@ typedef struct MDB_node {
 	 */
 #define LEAF2KEY(p, i, ks)	((char *)(p) + PAGEHDRSZ + ((i)*(ks)))
 
-	/** Set the \b node's key into \b keyptr, if requested. */
-#define MDB_GET_KEY(node, keyptr)	{ if ((keyptr) != NULL) { \
-	(keyptr)->mv_size = NODEKSZ(node); (keyptr)->mv_data = NODEKEY(node); } }
+	/** Set the \b node's key into \b keyptr, if requested. The node is
+	 *	on the top page of cursor \b mc, which holds the key if it has to
+	 *	be rebuilt from a #P_PREFIX page.
+	 */
+#define MDB_GET_KEY(mc, node, keyptr)	{ if ((keyptr) != NULL) \
+	mdb_node_key(mc, (mc)->mc_pg[(mc)->mc_top], node, keyptr, (mc)->mc_kbuf); }
 
-	/** Set the \b node's key into \b key. */
-#define MDB_GET_KEY2(node, key)	{ key.mv_size = NODEKSZ(node); key.mv_data = NODEKEY(node); }
+	/** Set the \b node's key into \b key, rebuilding it in \b buf if
+	 *	the node is on a #P_PREFIX page.
+	 */
+#define MDB_GET_KEY2(mc, node, key, buf) \
+	mdb_node_key(mc, (mc)->mc_pg[(mc)->mc_top], node, &(key), buf)
 
 	/** Information about a single database in the environment. */
 typedef struct MDB_db {
@@ -1011,7 +1037,7 @@ typedef struct MDB_db {
 #define PERSISTENT_FLAGS	(0xffff & ~(MDB_VALID))
 	/** #mdb_dbi_open() flags */
 #define VALID_FLAGS	(MDB_REVERSEKEY|MDB_DUPSORT|MDB_INTEGERKEY|MDB_DUPFIXED|\
-	MDB_INTEGERDUP|MDB_REVERSEDUP|MDB_CREATE)
+	MDB_INTEGERDUP|MDB_REVERSEDUP|MDB_PREFIXKEY|MDB_PREFIXDUP|MDB_CREATE)
 
 	/** Handle for the DB used to track free pages. */
 #define	FREE_DBI	0
@@ -1070,8 +1096,31 @@ typedef struct MDB_dbx {
 	MDB_cmp_func	*md_dcmp;	/**< function for comparing data items */
 	MDB_rel_func	*md_rel;	/**< user relocate function */
 	void		*md_relctx;		/**< user-provided context for md_rel */
+	unsigned int	md_cmin;	/**< compress values this large, or 0 */
 } MDB_dbx;
 
+	/** A part of the data file mapped by #MDB_WINDOWMAP. Windows are
+	 *	either aligned chunks of #MDB_env.%me_wpages pages, or the span of
+	 *	an overflow page that crosses the end of its chunk.
+	 */
+typedef struct MDB_window {
+	MDB_ID		mw_key;		/**< first page << 1, | 1 for a span */
+	pgno_t		mw_pgno;	/**< first page mapped */
+	pgno_t		mw_pages;	/**< number of pages mapped */
+	char		*mw_ptr;	/**< address of page \b mw_pgno */
+	char		*mw_base;	/**< start of the mapping */
+	size_t		mw_len;		/**< length of the mapping */
+	unsigned int	mw_refs;	/**< number of txns using the window */
+	/** Neighbors in the LRU list of unused windows */
+	struct MDB_window *mw_prev, *mw_next;
+} MDB_window;
+
+	/** Bytes mapped at a time by #MDB_WINDOWMAP */
+#define MDB_WINDOW_CHUNK	(1024*1024)
+
+	/** Default size of the windows kept by #MDB_WINDOWMAP */
+#define MDB_WINDOW_LIMIT	(256*1024*1024)
+
 	/** A database transaction.
 	 *	Every operation requires a transaction handle.
 	 */
@@ -1086,6 +1135,10 @@ struct MDB_txn {
 	 */
 	txnid_t		mt_txnid;
 	MDB_env		*mt_env;		/**< the DB environment */
+	/** With #MDB_OPSTATS, 1 + the major faults of the thread when
+	 *	the txn began, otherwise 0
+	 */
+	unsigned long	mt_faults;
 	/** The list of pages that became unused during this transaction.
 	 */
 	MDB_IDL		mt_free_pgs;
@@ -1112,6 +1165,16 @@ struct MDB_txn {
 	MDB_db		*mt_dbs;
 	/** Array of sequence numbers for each DB handle */
 	unsigned int	*mt_dbiseqs;
+	/** Buffer for values uncompressed by #mdb_get() */
+	char		*mt_ubuf;
+	size_t		mt_ubufsize;
+	/** With #MDB_WINDOWMAP, the windows this txn uses, sorted by key.
+	 *	Nested txns use those of their top-level txn.
+	 */
+	MDB_window	**mt_wins;
+	unsigned int	mt_wcount;		/**< number of #mt_wins */
+	unsigned int	mt_wmax;		/**< allocated size of #mt_wins */
+	MDB_window	*mt_wlast;		/**< the window used last */
 /** @defgroup mt_dbflag	Transaction DB Flags
  *	@ingroup internal
  * @{
@@ -1147,6 +1210,7 @@ struct MDB_txn {
 #define MDB_TXN_DIRTY		0x04		/**< must write, even if dirty list is empty */
 #define MDB_TXN_SPILLS		0x08		/**< txn or a parent has spilled pages */
 #define MDB_TXN_HAS_CHILD	0x10		/**< txn has an #MDB_txn.%mt_child */
+#define MDB_TXN_CKSUM		0x20		/**< page checksums are valid for this txn */
 	/** most operations on the txn are currently illegal */
 #define MDB_TXN_BLOCKED		(MDB_TXN_FINISHED|MDB_TXN_ERROR|MDB_TXN_HAS_CHILD)
 /** @} */
@@ -1208,6 +1272,11 @@ struct MDB_cursor {
 	unsigned int	mc_flags;	/**< @ref mdb_cursor */
 	MDB_page	*mc_pg[CURSOR_STACK];	/**< stack of pushed pages */
 	indx_t		mc_ki[CURSOR_STACK];	/**< stack of page indices */
+	/** Buffer for the last value uncompressed by this cursor */
+	char		*mc_ubuf;
+	size_t		mc_ubufsize;
+	/** Buffer for the last key rebuilt from a #P_PREFIX page */
+	char		mc_kbuf[MDB_PFXBUF];
 };
 
 	/** Context for sorted-dup records.
@@ -1226,6 +1295,11 @@ typedef struct MDB_xcursor {
 	unsigned char mx_dbflag;
 } MDB_xcursor;
 
+	/** Check if \b val points into the key buffer of cursor \b mc */
+#define IN_KBUF(mc, val) \
+	((char *)(val)->mv_data >= (mc)->mc_kbuf && \
+	 (char *)(val)->mv_data < (mc)->mc_kbuf + MDB_PFXBUF)
+
 	/** Check if there is an inited xcursor */
 #define XCURSOR_INITED(mc) \
 	((mc)->mc_xcursor && ((mc)->mc_xcursor->mx_cursor.mc_flags & C_INITIALIZED))
@@ -1243,10 +1317,35 @@ typedef struct MDB_xcursor {
 		(mc)->mc_xcursor->mx_cursor.mc_pg[0] = NODEDATA(xr_node); \
 } while (0)
 
+	/** A run of contiguous pages in me_pghead[] */
+typedef struct MDB_run {
+	pgno_t		mr_pgno;	/**< first (lowest) page of the run */
+	pgno_t		mr_len;		/**< number of pages in the run */
+} MDB_run;
+
+	/** Number of length classes in an #MDB_runidx. Class k has the runs
+	 *	of 2^(k+1) up to 2^(k+2)-1 pages, the last class all longer ones.
+	 */
+#define MDB_RUNCLASSES	16
+
+	/** Index of the runs of two or more pages in me_pghead[] */
+typedef struct MDB_runidx {
+	MDB_run		*ri_bypg;		/**< all runs by mr_pgno */
+	unsigned	ri_npg;			/**< number of runs */
+	unsigned	ri_maxpg;		/**< allocated length of ri_bypg[] */
+	MDB_run		*ri_runs[MDB_RUNCLASSES];	/**< runs of each class by mr_len, mr_pgno */
+	unsigned	ri_num[MDB_RUNCLASSES];		/**< number of runs of each class */
+	unsigned	ri_max[MDB_RUNCLASSES];		/**< allocated length of ri_runs[] */
+	int			ri_lost;		/**< runs were left out for lack of memory */
+} MDB_runidx;
+
 	/** State of FreeDB old pages, stored in the MDB_env */
 typedef struct MDB_pgstate {
 	pgno_t		*mf_pghead;	/**< Reclaimed freeDB pages, or NULL before use */
 	txnid_t		mf_pglast;	/**< ID of last used record, or 0 if !mf_pghead */
+	MDB_runidx	*mf_runs;	/**< Runs in mf_pghead, or NULL if not built */
+	txnid_t		mf_txnid;	/**< ID of the txn that saved mf_pghead */
+	int			mf_dirty;	/**< mf_pghead changed since it was saved */
 } MDB_pgstate;
 
 	/** The database environment. */
@@ -1254,6 +1353,8 @@ struct MDB_env {
 	HANDLE		me_fd;		/**< The main data file */
 	HANDLE		me_lfd;		/**< The lock file */
 	HANDLE		me_mfd;		/**< For writing and syncing the meta pages */
+	HANDLE		me_tfd;		/**< The page tracking file, see #MDB_TRACKPAGES */
+	HANDLE		me_cfd;		/**< The checksum file, see #MDB_CHECKSUM */
 	/** Failed to update the meta page. Probably an I/O error. */
 #define	MDB_FATAL_ERROR	0x80000000U
 	/** Some fields are initialized. */
@@ -1276,6 +1377,8 @@ struct MDB_env {
 	MDB_txninfo	*me_txns;		/**< the memory map of the lock file or NULL */
 	MDB_meta	*me_metas[NUM_METAS];	/**< pointers to the two meta pages */
 	void		*me_pbuf;		/**< scratch area for DUPSORT put() */
+	char		*me_cbuf;		/**< scratch area for compressing put() data */
+	size_t		me_cbufsize;
 	MDB_txn		*me_txn;		/**< current write transaction */
 	MDB_txn		*me_txn0;		/**< prealloc'd write transaction */
 	size_t		me_mapsize;		/**< size of the data memory map */
@@ -1286,9 +1389,14 @@ struct MDB_env {
 	unsigned int	*me_dbiseqs;	/**< array of dbi sequence numbers */
 	pthread_key_t	me_txkey;	/**< thread-key for readers */
 	txnid_t		me_pgoldest;	/**< ID of oldest reader last time we looked */
+	MDB_opstat	me_opstat;		/**< statistics kept with #MDB_OPSTATS */
+	int			me_oldest_rslot;	/**< reader slot holding me_pgoldest, or -1 */
+	unsigned int	me_rslot_hint;	/**< where to look for a free reader slot */
 	MDB_pgstate	me_pgstate;		/**< state of old pages from freeDB */
+	MDB_compact	*me_compact;	/**< online compaction in progress */
 #	define		me_pglast	me_pgstate.mf_pglast
 #	define		me_pghead	me_pgstate.mf_pghead
+#	define		me_runs		me_pgstate.mf_runs
 	MDB_page	*me_dpages;		/**< list of malloc'd blocks for re-use */
 	/** IDL of pages that became unused in a write txn */
 	MDB_IDL		me_free_pgs;
@@ -1314,8 +1422,27 @@ struct MDB_env {
 #endif
 	void		*me_userctx;	 /**< User-settable context */
 	MDB_assert_func *me_assert_func; /**< Callback for assertion failures */
+	void		*me_tmap;		/**< the memory map of the tracking file */
+	size_t		me_tsize;		/**< size of the tracking map */
+	void		*me_cmap;		/**< the memory map of the checksum file */
+	size_t		me_csize;		/**< size of the checksum map */
+	uint64_t	*me_cverified;	/**< pages verified since they changed */
+	/** With #MDB_WINDOWMAP, the mapped windows sorted by key */
+	MDB_window	**me_wins;
+	unsigned int	me_wcount;		/**< number of #me_wins */
+	unsigned int	me_wmax;		/**< allocated size of #me_wins */
+	pgno_t		me_wpages;		/**< pages in a chunk */
+	size_t		me_wsize;		/**< bytes mapped by the windows */
+	size_t		me_wlimit;		/**< #mdb_env_set_mapwindow() */
+	/** Unused windows, least recently used first */
+	MDB_window	*me_whead, *me_wtail;
+	pthread_mutex_t	me_wlock;	/**< protects the windows of the env */
 };
 
+	/** Length of the mapping at #MDB_env.%me_map */
+#define MDB_MAPLEN(env)	(((env)->me_flags & MDB_WINDOWMAP) ? \
+	(size_t)(env)->me_psize * NUM_METAS : (env)->me_mapsize)
+
 	/** Nested transaction */
 typedef struct MDB_ntxn {
 	MDB_txn		mnt_txn;		/**< the transaction */
@@ -1375,6 +1502,25 @@ static int	mdb_page_split(MDB_cursor *mc, MDB_val *newkey, MDB_val *newdata,
 static int  mdb_env_read_header(MDB_env *env, MDB_meta *meta);
 static MDB_meta *mdb_env_pick_meta(const MDB_env *env);
 static int  mdb_env_write_meta(MDB_txn *txn);
+static int  mdb_fsize(HANDLE fd, size_t *size);
+#ifndef _WIN32
+static unsigned int mdb_cksum_start(MDB_env *env, MDB_meta *meta, int rdonly);
+static int  mdb_cksum_check(MDB_txn *txn, MDB_page *mp, pgno_t pgno,
+	int force);
+static int  mdb_win_page(MDB_txn *txn, pgno_t pgno, MDB_page **ret);
+static int  mdb_env_copyrange(MDB_env *env, HANDLE fd, off_t off, size_t len);
+static void mdb_win_release(MDB_txn *txn);
+static void mdb_win_unmapall(MDB_env *env);
+static void mdb_win_evict(MDB_env *env, int all);
+#endif
+static void mdb_journal_add(MDB_txn *txn, MDB_dbi dbi, unsigned int op,
+	MDB_val *key, MDB_val *data);
+static void mdb_journal_put(MDB_cursor *mc, MDB_val *key, MDB_val *data,
+	unsigned int flags);
+static void mdb_journal_del(MDB_cursor *mc, unsigned int flags);
+#ifndef _WIN32
+static void mdb_compact_free(MDB_compact *cp);
+#endif
 #ifdef MDB_USE_POSIX_MUTEX /* Drop unused excl arg */
 # define mdb_env_close0(env, excl) mdb_env_close1(env)
 #endif
@@ -1385,6 +1531,11 @@ static int  mdb_node_add(MDB_cursor *mc, indx_t indx,
 			    MDB_val *key, MDB_val *data, pgno_t pgno, unsigned int flags);
 static void mdb_node_del(MDB_cursor *mc, int ksize);
 static void mdb_node_shrink(MDB_page *mp, indx_t indx);
+static void mdb_node_key(MDB_cursor *mc, MDB_page *mp, MDB_node *node,
+			    MDB_val *key, char *buf);
+static unsigned int mdb_pfx_match(MDB_cursor *mc, MDB_page *mp, MDB_val *key);
+static ssize_t mdb_pfx_grow(MDB_page *mp, unsigned int plen);
+static int	mdb_pfx_shrink(MDB_cursor *mc, unsigned int plen);
 static int	mdb_node_move(MDB_cursor *csrc, MDB_cursor *cdst, int fromleft);
 static int  mdb_node_read(MDB_cursor *mc, MDB_node *leaf, MDB_val *data);
 static size_t	mdb_leaf_size(MDB_env *env, MDB_val *key, MDB_val *data);
@@ -1396,6 +1547,10 @@ static int	mdb_update_key(MDB_cursor *mc, MDB_val *key);
 static void	mdb_cursor_pop(MDB_cursor *mc);
 static int	mdb_cursor_push(MDB_cursor *mc, MDB_page *mp);
 
+static int	mdb_cursor_get0(MDB_cursor *mc, MDB_val *key, MDB_val *data,
+				MDB_cursor_op op);
+static int	mdb_cursor_put0(MDB_cursor *mc, MDB_val *key, MDB_val *data,
+				unsigned int flags);
 static int	mdb_cursor_del0(MDB_cursor *mc);
 static int	mdb_del0(MDB_txn *txn, MDB_dbi dbi, MDB_val *key, MDB_val *data, unsigned flags);
 static int	mdb_cursor_sibling(MDB_cursor *mc, int move_right);
@@ -1700,7 +1855,7 @@ static void mdb_audit(MDB_txn *txn)
 
 	freecount = 0;
 	mdb_cursor_init(&mc, txn, FREE_DBI, NULL);
-	while ((rc = mdb_cursor_get(&mc, &key, &data, MDB_NEXT)) == 0)
+	while ((rc = mdb_cursor_get0(&mc, &key, &data, MDB_NEXT)) == 0)
 		freecount += *(MDB_ID *)data.mv_data;
 	mdb_tassert(txn, rc == MDB_NOTFOUND);
 
@@ -1960,6 +2115,71 @@ mdb_pages_xkeep(MDB_cursor *mc, unsigned pflags, int all)
 
 static int mdb_page_flush(MDB_txn *txn, int keep);
 
+/** @defgroup opstats	Operation statistics
+ *	Kept in #MDB_env.%me_opstat while #MDB_OPSTATS is set.
+ *	@{
+ */
+#if defined(__GNUC__) && (defined(__LP64__) || defined(_WIN64))
+#define MDB_OPSTAT_ADD(var, n)	__sync_fetch_and_add(&(var), (n))
+#else
+#define MDB_OPSTAT_ADD(var, n)	((var) += (n))
+#endif
+
+	/** Start timing an operation, if statistics are kept */
+#define MDB_OPSTAT_START(env)	(((env)->me_flags & MDB_OPSTATS) ? mdb_clock() : 0)
+
+/** Return a monotonic time in nanoseconds */
+static unsigned long long
+mdb_clock(void)
+{
+#ifdef _WIN32
+	LARGE_INTEGER c, f;
+	QueryPerformanceCounter(&c);
+	QueryPerformanceFrequency(&f);
+	return (c.QuadPart / f.QuadPart) * 1000000000ULL +
+		(c.QuadPart % f.QuadPart) * 1000000000ULL / f.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+/** Account for an operation started at \b start.
+ *	Does nothing if \b start is 0, i.e. statistics were off then.
+ */
+static void
+mdb_opstat_add(MDB_env *env, int op, unsigned long long start)
+{
+	MDB_ophist *oh = &env->me_opstat.os_op[op];
+	unsigned long long ns, v;
+	int b;
+
+	if (!start)
+		return;
+	ns = mdb_clock() - start;
+	for (b = 0, v = ns >> 1; v && b < MDB_HIST_BUCKETS-1; v >>= 1)
+		b++;
+	MDB_OPSTAT_ADD(oh->oh_count, 1);
+	MDB_OPSTAT_ADD(oh->oh_nsec, ns);
+	MDB_OPSTAT_ADD(oh->oh_hist[b], 1);
+	if (ns > oh->oh_max)
+		oh->oh_max = ns;
+}
+
+/** Return 1 + the major page faults of the calling thread, or 0 if unknown */
+static unsigned long
+mdb_thread_faults(void)
+{
+#ifdef RUSAGE_THREAD
+	struct rusage ru;
+	if (getrusage(RUSAGE_THREAD, &ru) == 0)
+		return ru.ru_majflt + 1;
+#endif
+	return 0;
+}
+/** @} */
+
 /**	Spill pages from the dirty list back to disk.
  * This is intended to prevent running into #MDB_TXN_FULL situations,
  * but note that they may still occur in a few cases:
@@ -1998,7 +2218,7 @@ mdb_page_spill(MDB_cursor *m0, MDB_val *key, MDB_val *data)
 	MDB_txn *txn = m0->mc_txn;
 	MDB_page *dp;
 	MDB_ID2L dl = txn->mt_u.dirty_list;
-	unsigned int i, j, need;
+	unsigned int i, j, need, spilled = 0;
 	int rc;
 
 	if (m0->mc_flags & C_SUB)
@@ -2075,8 +2295,11 @@ mdb_page_spill(MDB_cursor *m0, MDB_val *key, MDB_val *data)
 		if ((rc = mdb_midl_append(&txn->mt_spill_pgs, pn)))
 			goto done;
 		need--;
+		spilled++;
 	}
 	mdb_midl_sort(txn->mt_spill_pgs);
+	if (txn->mt_env->me_flags & MDB_OPSTATS)
+		MDB_OPSTAT_ADD(txn->mt_env->me_opstat.os_spilled, spilled);
 
 	/* Flush the spilled part of dirty list */
 	if ((rc = mdb_page_flush(txn, i)) != MDB_SUCCESS)
@@ -2090,22 +2313,38 @@ done:
 	return rc;
 }
 
-/** Find oldest txnid still referenced. Expects txn->mt_txnid > 0. */
+/** Find oldest txnid still referenced. Expects txn->mt_txnid > 0.
+ *
+ *	The oldest txnid held by a reader never decreases, since readers
+ *	always start with the latest snapshot. So while the reader found
+ *	holding it by the last scan still holds the same snapshot, it is
+ *	still the oldest one, and the reader table need not be scanned.
+ */
 static txnid_t
 mdb_find_oldest(MDB_txn *txn)
 {
-	int i;
+	MDB_env *env = txn->mt_env;
+	int i, slot = -1;
 	txnid_t mr, oldest = txn->mt_txnid - 1;
-	if (txn->mt_env->me_txns) {
-		MDB_reader *r = txn->mt_env->me_txns->mti_readers;
-		for (i = txn->mt_env->me_txns->mti_numreaders; --i >= 0; ) {
+	if (env->me_txns) {
+		MDB_reader *r = env->me_txns->mti_readers;
+		i = env->me_oldest_rslot;
+		if (i >= 0 && (unsigned)i < env->me_txns->mti_numreaders && r[i].mr_pid) {
+			mr = r[i].mr_txnid;
+			if (mr == env->me_pgoldest && mr <= oldest)
+				return mr;
+		}
+		for (i = env->me_txns->mti_numreaders; --i >= 0; ) {
 			if (r[i].mr_pid) {
 				mr = r[i].mr_txnid;
-				if (oldest > mr)
+				if (oldest > mr) {
 					oldest = mr;
+					slot = i;
+				}
 			}
 		}
 	}
+	env->me_oldest_rslot = slot;
 	return oldest;
 }
 
@@ -2126,8 +2365,372 @@ mdb_page_dirty(MDB_txn *txn, MDB_page *mp)
 	rc = insert(txn->mt_u.dirty_list, &mid);
 	mdb_tassert(txn, rc == 0);
 	txn->mt_dirty_room--;
+	if (txn->mt_env->me_flags & MDB_OPSTATS)
+		MDB_OPSTAT_ADD(txn->mt_env->me_opstat.os_dirtied, 1);
+}
+
+/** @defgroup runidx	Free page run index
+ *	Multi-page allocations need a contiguous run of pages from
+ *	me_pghead[]. Rather than scanning the whole list for one each
+ *	time, the runs of two or more pages are indexed. Each length class
+ *	is sorted by length then first page, so that the shortest run
+ *	that fits is found by a binary search. All runs are also sorted by
+ *	first page, to find the one a page is taken from.
+ *
+ *	The index is built by the first multi-page allocation that needs
+ *	it, and kept up to date as pages are taken from or returned to
+ *	me_pghead[]. Like me_pghead[], it is kept in the environment
+ *	across write txns, see #mdb_pgstate_drop(). When there is no
+ *	memory to index a run, the run is left out and the index is
+ *	rebuilt when a lookup misses.
+ *	@{
+ */
+static int
+mdb_run_class(pgno_t len)
+{
+	int k = 0;
+
+	while ((len >>= 1) > 1 && k < MDB_RUNCLASSES-1)
+		k++;
+	return k;
+}
+
+/** Return the position of the first run starting at or after pgno */
+static unsigned
+mdb_run_search(MDB_run *runs, unsigned num, pgno_t pgno)
+{
+	unsigned lo = 0, hi = num, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) >> 1;
+		if (runs[mid].mr_pgno < pgno)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/** Return the position of the first run of a class not before
+ *	a run of len pages starting at pgno
+ */
+static unsigned
+mdb_run_lsearch(MDB_run *runs, unsigned num, pgno_t len, pgno_t pgno)
+{
+	unsigned lo = 0, hi = num, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) >> 1;
+		if (runs[mid].mr_len < len ||
+			(runs[mid].mr_len == len && runs[mid].mr_pgno < pgno))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static int
+mdb_run_cmp(const void *a, const void *b)
+{
+	const MDB_run *ra = a, *rb = b;
+
+	if (ra->mr_len != rb->mr_len)
+		return ra->mr_len < rb->mr_len ? -1 : 1;
+	return ra->mr_pgno < rb->mr_pgno ? -1 : ra->mr_pgno > rb->mr_pgno;
+}
+
+/** Make room for one more run in runs[] */
+static int
+mdb_run_grow(MDB_run **runs, unsigned num, unsigned *max)
+{
+	MDB_run *r;
+	unsigned m;
+
+	if (num < *max)
+		return MDB_SUCCESS;
+	m = *max ? *max * 2 : 64;
+	if (!(r = realloc(*runs, m * sizeof(MDB_run))))
+		return ENOMEM;
+	*runs = r;
+	*max = m;
+	return MDB_SUCCESS;
+}
+
+/** Index a run. Without memory for it, it is left out. */
+static void
+mdb_run_add(MDB_runidx *ri, pgno_t pgno, pgno_t len)
+{
+	MDB_run *runs;
+	unsigned i;
+	int k;
+
+	if (len < 2)
+		return;
+	k = mdb_run_class(len);
+	if (mdb_run_grow(&ri->ri_bypg, ri->ri_npg, &ri->ri_maxpg) ||
+		mdb_run_grow(&ri->ri_runs[k], ri->ri_num[k], &ri->ri_max[k])) {
+		ri->ri_lost = 1;
+		return;
+	}
+	runs = ri->ri_bypg;
+	i = mdb_run_search(runs, ri->ri_npg, pgno);
+	memmove(runs + i + 1, runs + i, (ri->ri_npg - i) * sizeof(MDB_run));
+	runs[i].mr_pgno = pgno;
+	runs[i].mr_len = len;
+	ri->ri_npg++;
+	runs = ri->ri_runs[k];
+	i = mdb_run_lsearch(runs, ri->ri_num[k], len, pgno);
+	memmove(runs + i + 1, runs + i, (ri->ri_num[k] - i) * sizeof(MDB_run));
+	runs[i].mr_pgno = pgno;
+	runs[i].mr_len = len;
+	ri->ri_num[k]++;
+}
+
+static void
+mdb_run_del(MDB_runidx *ri, pgno_t pgno, pgno_t len)
+{
+	MDB_run *runs;
+	unsigned i;
+	int k;
+
+	if (len < 2)
+		return;
+	runs = ri->ri_bypg;
+	i = mdb_run_search(runs, ri->ri_npg, pgno);
+	if (i == ri->ri_npg || runs[i].mr_pgno != pgno || runs[i].mr_len != len)
+		return;	/* left out */
+	ri->ri_npg--;
+	memmove(runs + i, runs + i + 1, (ri->ri_npg - i) * sizeof(MDB_run));
+	k = mdb_run_class(len);
+	runs = ri->ri_runs[k];
+	i = mdb_run_lsearch(runs, ri->ri_num[k], len, pgno);
+	ri->ri_num[k]--;
+	memmove(runs + i, runs + i + 1, (ri->ri_num[k] - i) * sizeof(MDB_run));
+}
+
+static void
+mdb_run_free(MDB_runidx *ri)
+{
+	int k;
+
+	if (ri) {
+		free(ri->ri_bypg);
+		for (k = 0; k < MDB_RUNCLASSES; k++)
+			free(ri->ri_runs[k]);
+		free(ri);
+	}
+}
+
+/** Index the runs of me_pghead[] mop.
+ *	@return the index, or NULL without memory for it.
+ */
+static MDB_runidx *
+mdb_run_build(pgno_t *mop)
+{
+	MDB_runidx *ri;
+	MDB_run *run;
+	unsigned i, j;
+	int k;
+
+	if (!(ri = calloc(1, sizeof(MDB_runidx))))
+		return NULL;
+	/* Count first, so that the arrays are allocated once */
+	for (i = mop[0]; i; i = j) {
+		for (j = i-1; j && mop[j] == mop[j+1]+1; j--)
+			;
+		if (i-j > 1) {
+			ri->ri_max[mdb_run_class(i-j)]++;
+			ri->ri_maxpg++;
+		}
+	}
+	if (ri->ri_maxpg &&
+		!(ri->ri_bypg = malloc(ri->ri_maxpg * sizeof(MDB_run))))
+		goto fail;
+	for (k = 0; k < MDB_RUNCLASSES; k++) {
+		if (ri->ri_max[k] &&
+			!(ri->ri_runs[k] = malloc(ri->ri_max[k] * sizeof(MDB_run))))
+			goto fail;
+	}
+	/* me_pghead[] is in descending order, runs come by ascending pgno */
+	for (i = mop[0]; i; i = j) {
+		for (j = i-1; j && mop[j] == mop[j+1]+1; j--)
+			;
+		if (i-j > 1) {
+			run = &ri->ri_bypg[ri->ri_npg++];
+			run->mr_pgno = mop[i];
+			run->mr_len = i-j;
+			k = mdb_run_class(i-j);
+			ri->ri_runs[k][ri->ri_num[k]++] = *run;
+		}
+	}
+	for (k = 0; k < MDB_RUNCLASSES; k++)
+		qsort(ri->ri_runs[k], ri->ri_num[k], sizeof(MDB_run), mdb_run_cmp);
+	return ri;
+
+fail:
+	mdb_run_free(ri);
+	return NULL;
+}
+
+/** Copy a parent txn's index for a nested txn.
+ *	@return the copy, or NULL if there is none.
+ */
+static MDB_runidx *
+mdb_run_copy(MDB_runidx *src)
+{
+	MDB_runidx *ri;
+	int k;
+
+	if (!src || !(ri = calloc(1, sizeof(MDB_runidx))))
+		return NULL;
+	ri->ri_lost = src->ri_lost;
+	if (src->ri_npg) {
+		if (!(ri->ri_bypg = malloc(src->ri_npg * sizeof(MDB_run))))
+			goto fail;
+		memcpy(ri->ri_bypg, src->ri_bypg, src->ri_npg * sizeof(MDB_run));
+		ri->ri_npg = ri->ri_maxpg = src->ri_npg;
+	}
+	for (k = 0; k < MDB_RUNCLASSES; k++) {
+		if (!src->ri_num[k])
+			continue;
+		if (!(ri->ri_runs[k] = malloc(src->ri_num[k] * sizeof(MDB_run))))
+			goto fail;
+		memcpy(ri->ri_runs[k], src->ri_runs[k], src->ri_num[k] * sizeof(MDB_run));
+		ri->ri_num[k] = ri->ri_max[k] = src->ri_num[k];
+	}
+	return ri;
+
+fail:
+	mdb_run_free(ri);
+	return NULL;
+}
+
+/** Find the shortest run of at least num pages, the lowest one among
+ *	those of the same length. Only the class of num may have runs too
+ *	short, any run of a longer class fits.
+ *	@return the first page of the run, or 0 if there is none.
+ */
+static pgno_t
+mdb_run_find(MDB_runidx *ri, pgno_t num)
+{
+	unsigned i;
+	int k = mdb_run_class(num);
+
+	i = mdb_run_lsearch(ri->ri_runs[k], ri->ri_num[k], num, 0);
+	if (i < ri->ri_num[k])
+		return ri->ri_runs[k][i].mr_pgno;
+	while (++k < MDB_RUNCLASSES) {
+		if (ri->ri_num[k])
+			return ri->ri_runs[k][0].mr_pgno;
+	}
+	return 0;
+}
+
+/** Look up a run of num pages, building the index if needed. If runs
+ *	were left out of the index, a miss rebuilds it.
+ *	@param[out] pgno the first page of the run, or 0 if there is none.
+ *	@return 0, or ENOMEM if the index cannot tell.
+ */
+static int
+mdb_run_lookup(MDB_env *env, pgno_t num, pgno_t *pgno)
+{
+	MDB_runidx *ri = env->me_runs;
+
+	if (ri && (*pgno = mdb_run_find(ri, num)) != 0)
+		return MDB_SUCCESS;
+	if (!ri || ri->ri_lost) {
+		if (!(ri = mdb_run_build(env->me_pghead)))
+			return ENOMEM;
+		mdb_run_free(env->me_runs);
+		env->me_runs = ri;
+		*pgno = mdb_run_find(ri, num);
+	}
+	return MDB_SUCCESS;
+}
+
+/** Take num pages from the start of the run starting at pgno */
+static void
+mdb_run_shift(MDB_runidx *ri, pgno_t pgno, pgno_t num)
+{
+	unsigned i;
+	pgno_t len;
+
+	i = mdb_run_search(ri->ri_bypg, ri->ri_npg, pgno);
+	if (i < ri->ri_npg && ri->ri_bypg[i].mr_pgno == pgno) {
+		len = ri->ri_bypg[i].mr_len;
+		mdb_run_del(ri, pgno, len);
+		mdb_run_add(ri, pgno + num, len - num);
+	}
+}
+
+/** Join pages pg..pg+num-1, just added to me_pghead[], with their neighbors */
+static void
+mdb_run_insert(MDB_runidx *ri, pgno_t *mop, pgno_t pg, pgno_t num)
+{
+	unsigned lo, hi;
+	pgno_t first, last;
+
+	lo = mdb_midl_search(mop, pg);
+	hi = lo - (num - 1);
+	while (lo < mop[0] && mop[lo+1] == mop[lo]-1)
+		lo++;
+	while (hi > 1 && mop[hi-1] == mop[hi]+1)
+		hi--;
+	first = mop[lo];
+	last = mop[hi];
+	mdb_run_del(ri, first, pg - first);
+	mdb_run_del(ri, pg + num, last - (pg + num - 1));
+	mdb_run_add(ri, first, last - first + 1);
+}
+
+/** Update the index after the IDL idl was merged into me_pghead[] */
+static void
+mdb_run_merge(MDB_runidx *ri, pgno_t *mop, pgno_t *idl)
+{
+	unsigned x, y, lo, hi;
+	pgno_t first, last, pg, seg;
+
+	/* idl[x] is the lowest new page not in a run handled yet */
+	for (x = idl[0]; x; x = y) {
+		lo = hi = mdb_midl_search(mop, idl[x]);
+		while (lo < mop[0] && mop[lo+1] == mop[lo]-1)
+			lo++;
+		while (hi > 1 && mop[hi-1] == mop[hi]+1)
+			hi--;
+		first = mop[lo];
+		last = mop[hi];
+		/* Drop the old runs between the new pages of this one */
+		seg = first;
+		for (y = x, pg = first; pg <= last; pg++) {
+			if (y && idl[y] == pg) {
+				mdb_run_del(ri, seg, pg - seg);
+				seg = pg + 1;
+				y--;
+			}
+		}
+		mdb_run_del(ri, seg, last + 1 - seg);
+		mdb_run_add(ri, first, last - first + 1);
+	}
 }
 
+/** Forget the old pages known from the freeDB. They are kept from one
+ *	write txn to the next, as long as the records up to me_pglast hold
+ *	just the pages of me_pghead[]: that is, until a txn that changed
+ *	them is aborted, or another process commits a txn.
+ */
+static void
+mdb_pgstate_drop(MDB_env *env)
+{
+	mdb_midl_free(env->me_pghead);
+	mdb_run_free(env->me_runs);
+	env->me_pghead = NULL;
+	env->me_pglast = 0;
+	env->me_runs = NULL;
+	env->me_pgstate.mf_dirty = 0;
+}
+/** @} */
+
 /** Allocate page numbers and memory for writing.  Maintain me_pglast,
  * me_pghead and mt_next_pgno.  Set #MDB_TXN_ERROR on failure.
  *
@@ -2192,16 +2795,24 @@ mdb_page_alloc(MDB_cursor *mc, int num, MDB_page **mp)
 		MDB_node *leaf;
 		pgno_t *idl;
 
-		/* Seek a big enough contiguous page range. Prefer
-		 * pages at the tail, just truncating the list.
+		/* Seek a big enough contiguous page range in the run
+		 * index. Single pages come from the tail, just truncating
+		 * the list. Without an index, fall back to a scan.
 		 */
 		if (mop_len > n2) {
-			i = mop_len;
-			do {
-				pgno = mop[i];
-				if (mop[i-n2] == pgno+n2)
+			if (n2 && mdb_run_lookup(env, num, &pgno) == MDB_SUCCESS) {
+				if (pgno) {
+					i = mdb_midl_search(mop, pgno);
 					goto search_done;
-			} while (--i > n2);
+				}
+			} else {
+				i = mop_len;
+				do {
+					pgno = mop[i];
+					if (mop[i-n2] == pgno+n2)
+						goto search_done;
+				} while (--i > n2);
+			}
 			if (--retry < 0)
 				break;
 		}
@@ -2233,7 +2844,7 @@ mdb_page_alloc(MDB_cursor *mc, int num, MDB_page **mp)
 			if (oldest <= last)
 				break;
 		}
-		rc = mdb_cursor_get(&m2, &key, NULL, op);
+		rc = mdb_cursor_get0(&m2, &key, NULL, op);
 		if (rc) {
 			if (rc == MDB_NOTFOUND)
 				break;
@@ -2267,6 +2878,7 @@ mdb_page_alloc(MDB_cursor *mc, int num, MDB_page **mp)
 			mop = env->me_pghead;
 		}
 		env->me_pglast = last;
+		env->me_pgstate.mf_dirty = 1;
 #if (MDB_DEBUG) > 1
 		DPRINTF(("IDL read txn %"Z"u root %"Z"u num %u",
 			last, txn->mt_dbs[FREE_DBI].md_root, i));
@@ -2276,15 +2888,38 @@ mdb_page_alloc(MDB_cursor *mc, int num, MDB_page **mp)
 		/* Merge in descending sorted order */
 		mdb_midl_xmerge(mop, idl);
 		mop_len = mop[0];
+		if (env->me_runs)
+			mdb_run_merge(env->me_runs, mop, idl);
 	}
 
 	/* Use new pages from the map when nothing suitable in the freeDB */
 	i = 0;
 	pgno = txn->mt_next_pgno;
 	if (pgno + num >= env->me_maxpg) {
+#ifndef _WIN32
+		if (env->me_flags & MDB_WINDOWMAP) {
+			/* Nothing maps the whole file, just let it grow. The
+			 * new size is recorded in the meta at commit.
+			 */
+			pgno_t grow = env->me_maxpg / 4, maxpg;
+			if (grow < env->me_wpages)
+				grow = env->me_wpages;
+			maxpg = pgno + num + grow;
+			maxpg = (maxpg + env->me_wpages - 1) & ~(env->me_wpages - 1);
+			if (maxpg > ~(size_t)0 / env->me_psize) {
+				DPUTS("DB size maxed out");
+				rc = MDB_MAP_FULL;
+				goto fail;
+			}
+			env->me_maxpg = maxpg;
+			env->me_mapsize = (size_t)maxpg * env->me_psize;
+		} else
+#endif
+		{
 			DPUTS("DB size maxed out");
 			rc = MDB_MAP_FULL;
 			goto fail;
+		}
 	}
 
 search_done:
@@ -2297,7 +2932,13 @@ search_done:
 		}
 	}
 	if (i) {
+		/* Single pages come from the tail, which may start a run */
+		if (env->me_runs && (n2 || (i > 1 && mop[i-1] == pgno+1)))
+			mdb_run_shift(env->me_runs, pgno, num);
 		mop[0] = mop_len -= num;
+		env->me_pgstate.mf_dirty = 1;
+		if (env->me_flags & MDB_OPSTATS)
+			MDB_OPSTAT_ADD(env->me_opstat.os_reused, num);
 		/* Move any stragglers down */
 		for (j = i-num; j < mop_len; )
 			mop[++j] = mop[++i];
@@ -2529,6 +3170,12 @@ mdb_env_sync(MDB_env *env, int force)
 			if (MDB_FDATASYNC(env->me_fd))
 				rc = ErrCode();
 		}
+#ifndef _WIN32
+		/* Commits don't sync the checksums either with MDB_NOSYNC */
+		if (!rc && force && env->me_cmap &&
+			msync(env->me_cmap, env->me_csize, MS_SYNC))
+			rc = ErrCode();
+#endif
 	}
 	return rc;
 }
@@ -2598,12 +3245,18 @@ mdb_cursors_close(MDB_txn *txn, unsigned merge)
 					if ((mx = mc->mc_xcursor) != NULL)
 						mx->mx_cursor.mc_txn = bk->mc_txn;
 				} else {
-					/* Abort nested txn */
+					/* Abort nested txn, but keep the current buffer */
+					char *ubuf = mc->mc_ubuf;
+					size_t ubufsize = mc->mc_ubufsize;
 					*mc = *bk;
+					mc->mc_ubuf = ubuf;
+					mc->mc_ubufsize = ubufsize;
 					if ((mx = mc->mc_xcursor) != NULL)
 						*mx = *(MDB_xcursor *)(bk+1);
 				}
 				mc = bk;
+			} else {
+				free(mc->mc_ubuf);
 			}
 			/* Only malloced cursors are permanently tracked. */
 			free(mc);
@@ -2676,10 +3329,12 @@ mdb_txn_renew0(MDB_txn *txn)
 	MDB_env *env = txn->mt_env;
 	MDB_txninfo *ti = env->me_txns;
 	MDB_meta *meta;
-	unsigned int i, nr, flags = txn->mt_flags;
+	unsigned int i, n, nr, flags = txn->mt_flags, cksum = 0;
 	uint16_t x;
 	int rc, new_notls = 0;
 
+	txn->mt_faults = (env->me_flags & MDB_OPSTATS) ? mdb_thread_faults() : 0;
+
 	if ((flags &= MDB_TXN_RDONLY) != 0) {
 		if (!ti) {
 			meta = mdb_env_pick_meta(env);
@@ -2706,9 +3361,21 @@ mdb_txn_renew0(MDB_txn *txn)
 				if (LOCK_MUTEX(rc, env, rmutex))
 					return rc;
 				nr = ti->mti_numreaders;
-				for (i=0; i<nr; i++)
+				/* Start looking after the slot we last claimed, so
+				 * that threads registering one after another don't
+				 * rescan the slots they already took.
+				 */
+				i = env->me_rslot_hint;
+				if (i > nr)
+					i = 0;
+				for (n = nr; n; n--, i++) {
+					if (i == nr)
+						i = 0;
 					if (ti->mti_readers[i].mr_pid == 0)
 						break;
+				}
+				if (!n)
+					i = nr;
 				if (i == env->me_maxreaders) {
 					UNLOCK_MUTEX(rmutex);
 					return MDB_READERS_FULL;
@@ -2726,6 +3393,7 @@ mdb_txn_renew0(MDB_txn *txn)
 				if (i == nr)
 					ti->mti_numreaders = ++nr;
 				env->me_close_readers = nr;
+				env->me_rslot_hint = i + 1;
 				r->mr_pid = pid;
 				UNLOCK_MUTEX(rmutex);
 
@@ -2754,6 +3422,11 @@ mdb_txn_renew0(MDB_txn *txn)
 			meta = mdb_env_pick_meta(env);
 			txn->mt_txnid = meta->mm_txnid;
 		}
+		/* Old pages kept from our last commit are stale if
+		 * something else was committed since
+		 */
+		if (env->me_pghead && env->me_pgstate.mf_txnid != txn->mt_txnid)
+			mdb_pgstate_drop(env);
 		txn->mt_txnid++;
 #if MDB_DEBUG
 		if (txn->mt_txnid == mdb_debug_start)
@@ -2772,13 +3445,18 @@ mdb_txn_renew0(MDB_txn *txn)
 		memcpy(txn->mt_dbiseqs, env->me_dbiseqs, env->me_maxdbs * sizeof(unsigned int));
 	}
 
+#ifndef _WIN32
+	if (env->me_cmap)
+		cksum = mdb_cksum_start(env, meta, flags);
+#endif
+
 	/* Copy the DB info and flags */
 	memcpy(txn->mt_dbs, meta->mm_dbs, CORE_DBS * sizeof(MDB_db));
 
 	/* Moved to here to avoid a data race in read TXNs */
 	txn->mt_next_pgno = meta->mm_last_pg+1;
 
-	txn->mt_flags = flags;
+	txn->mt_flags = flags | cksum;
 
 	/* Setup db info */
 	txn->mt_numdbs = env->me_numdbs;
@@ -2793,7 +3471,8 @@ mdb_txn_renew0(MDB_txn *txn)
 	if (env->me_flags & MDB_FATAL_ERROR) {
 		DPUTS("environment had fatal error, must shutdown!");
 		rc = MDB_PANIC;
-	} else if (env->me_maxpg < txn->mt_next_pgno) {
+	} else if (env->me_maxpg < txn->mt_next_pgno &&
+		!(env->me_flags & MDB_WINDOWMAP)) {
 		rc = MDB_MAP_RESIZED;
 	} else {
 		return MDB_SUCCESS;
@@ -2807,10 +3486,14 @@ mdb_txn_renew(MDB_txn *txn)
 {
 	int rc;
 
+	unsigned long long start;
+
 	if (!txn || !F_ISSET(txn->mt_flags, MDB_TXN_RDONLY|MDB_TXN_FINISHED))
 		return EINVAL;
 
+	start = MDB_OPSTAT_START(txn->mt_env);
 	rc = mdb_txn_renew0(txn);
+	mdb_opstat_add(txn->mt_env, MDB_OPS_BEGIN, start);
 	if (rc == MDB_SUCCESS) {
 		DPRINTF(("renew txn %"Z"u%c %p on mdbenv %p, root page %"Z"u",
 			txn->mt_txnid, (txn->mt_flags & MDB_TXN_RDONLY) ? 'r' : 'w',
@@ -2819,8 +3502,8 @@ mdb_txn_renew(MDB_txn *txn)
 	return rc;
 }
 
-int
-mdb_txn_begin(MDB_env *env, MDB_txn *parent, unsigned int flags, MDB_txn **ret)
+static int
+mdb_txn_begin0(MDB_env *env, MDB_txn *parent, unsigned int flags, MDB_txn **ret)
 {
 	MDB_txn *txn;
 	MDB_ntxn *ntxn;
@@ -2889,6 +3572,8 @@ mdb_txn_begin(MDB_env *env, MDB_txn *parent, unsigned int flags, MDB_txn **ret)
 		rc = 0;
 		ntxn = (MDB_ntxn *)txn;
 		ntxn->mnt_pgstate = env->me_pgstate; /* save parent me_pghead & co */
+		/* Without memory for a copy, the index is rebuilt if needed */
+		env->me_runs = mdb_run_copy(env->me_runs);
 		if (env->me_pghead) {
 			size = MDB_IDL_SIZEOF(env->me_pghead);
 			env->me_pghead = mdb_midl_alloc(env->me_pghead[0]);
@@ -2920,6 +3605,20 @@ renew:
 	return rc;
 }
 
+int
+mdb_txn_begin(MDB_env *env, MDB_txn *parent, unsigned int flags, MDB_txn **ret)
+{
+	unsigned long long start;
+	int rc;
+
+	if (!env)
+		return EINVAL;
+	start = MDB_OPSTAT_START(env);
+	rc = mdb_txn_begin0(env, parent, flags, ret);
+	mdb_opstat_add(env, MDB_OPS_BEGIN, start);
+	return rc;
+}
+
 MDB_env *
 mdb_txn_env(MDB_txn *txn)
 {
@@ -2979,11 +3678,24 @@ mdb_txn_end(MDB_txn *txn, unsigned mode)
 	/* Export or close DBI handles opened in this txn */
 	mdb_dbis_update(txn, mode & MDB_END_UPDATE);
 
+	if (txn->mt_faults) {
+		unsigned long faults = mdb_thread_faults();
+		/* ignore it if the txn moved to another thread */
+		if (faults >= txn->mt_faults)
+			MDB_OPSTAT_ADD(env->me_opstat.os_faults, faults - txn->mt_faults);
+		txn->mt_faults = 0;
+	}
+
 	DPRINTF(("%s txn %"Z"u%c %p on mdbenv %p, root page %"Z"u",
 		names[mode & MDB_END_OPMASK],
 		txn->mt_txnid, (txn->mt_flags & MDB_TXN_RDONLY) ? 'r' : 'w',
 		(void *) txn, (void *)env, txn->mt_dbs[MAIN_DBI].md_root));
 
+#ifndef _WIN32
+	if (txn->mt_wcount)
+		mdb_win_release(txn);
+#endif
+
 	if (F_ISSET(txn->mt_flags, MDB_TXN_RDONLY)) {
 		if (txn->mt_u.reader) {
 			txn->mt_u.reader->mr_txnid = (txnid_t)-1;
@@ -2999,6 +3711,7 @@ mdb_txn_end(MDB_txn *txn, unsigned mode)
 
 	} else if (!F_ISSET(txn->mt_flags, MDB_TXN_FINISHED)) {
 		pgno_t *pghead = env->me_pghead;
+		MDB_runidx *runs = env->me_runs;
 
 		if (!(mode & MDB_END_UPDATE)) /* !(already closed cursors) */
 			mdb_cursors_close(txn, 0);
@@ -3012,9 +3725,18 @@ mdb_txn_end(MDB_txn *txn, unsigned mode)
 		if (!txn->mt_parent) {
 			mdb_midl_shrink(&txn->mt_free_pgs);
 			env->me_free_pgs = txn->mt_free_pgs;
-			/* me_pgstate: */
-			env->me_pghead = NULL;
-			env->me_pglast = 0;
+			/* me_pgstate is kept for the next txn, unless this
+			 * txn changed it and did not save it
+			 */
+			if (env->me_pgstate.mf_dirty) {
+				env->me_pghead = NULL;
+				env->me_pglast = 0;
+				env->me_runs = NULL;
+				env->me_pgstate.mf_dirty = 0;
+			} else {
+				pghead = NULL;
+				runs = NULL;
+			}
 
 			env->me_txn = NULL;
 			mode = 0;	/* txn == env->me_txn0, do not free() it */
@@ -3032,10 +3754,14 @@ mdb_txn_end(MDB_txn *txn, unsigned mode)
 		}
 
 		mdb_midl_free(pghead);
+		mdb_run_free(runs);
 	}
 
-	if (mode & MDB_END_FREE)
+	if (mode & MDB_END_FREE) {
+		free(txn->mt_ubuf);
+		free(txn->mt_wins);
 		free(txn);
+	}
 }
 
 void
@@ -3065,6 +3791,9 @@ mdb_txn_abort(MDB_txn *txn)
 
 /** Save the freelist as of this transaction to the freeDB.
  * This changes the freelist. Keep trying until it stabilizes.
+ *
+ * The records up to me_pglast are rewritten with all of me_pghead[],
+ * unless this txn left me_pghead[] as the last commit saved it.
  */
 static int
 mdb_freelist_save(MDB_txn *txn)
@@ -3075,6 +3804,7 @@ mdb_freelist_save(MDB_txn *txn)
 	 */
 	MDB_cursor mc;
 	MDB_env	*env = txn->mt_env;
+	MDB_pgstate *ps = &env->me_pgstate;
 	int rc, maxfree_1pg = env->me_maxfree_1pg, more = 1;
 	txnid_t	pglast = 0, head_id = 0;
 	pgno_t	freecnt = 0, *free_pgs, *mop;
@@ -3082,16 +3812,17 @@ mdb_freelist_save(MDB_txn *txn)
 
 	mdb_cursor_init(&mc, txn, FREE_DBI, NULL);
 
-	if (env->me_pghead) {
+	if (env->me_pghead && ps->mf_dirty) {
 		/* Make sure first page of freeDB is touched and on freelist */
 		rc = mdb_page_search(&mc, NULL, MDB_PS_FIRST|MDB_PS_MODIFY);
 		if (rc && rc != MDB_NOTFOUND)
 			return rc;
 	}
 
-	if (!env->me_pghead && txn->mt_loose_pgs) {
+	if ((!env->me_pghead || !ps->mf_dirty) && txn->mt_loose_pgs) {
 		/* Put loose page numbers in mt_free_pgs, since
-		 * we may be unable to return them to me_pghead.
+		 * we may be unable to return them to me_pghead,
+		 * or would have to save all of it again.
 		 */
 		MDB_page *mp = txn->mt_loose_pgs;
 		if ((rc = mdb_midl_need(&txn->mt_free_pgs, txn->mt_loose_count)) != 0)
@@ -3115,13 +3846,20 @@ mdb_freelist_save(MDB_txn *txn)
 		/* If using records from freeDB which we have not yet
 		 * deleted, delete them and any we reserved for me_pghead.
 		 */
-		while (pglast < env->me_pglast) {
+		while (pglast < env->me_pglast && ps->mf_dirty) {
 			rc = mdb_cursor_first(&mc, &key, NULL);
-			if (rc)
+			if (rc && rc != MDB_NOTFOUND)
 				return rc;
+			if (rc || *(txnid_t *)key.mv_data > env->me_pglast) {
+				/* An empty me_pghead kept from the last commit
+				 * left no records, any key up to me_pglast is free
+				 */
+				pglast = head_id = env->me_pglast;
+				total_room = head_room = 0;
+				break;
+			}
 			pglast = head_id = *(txnid_t *)key.mv_data;
 			total_room = head_room = 0;
-			mdb_tassert(txn, pglast <= env->me_pglast);
 			rc = mdb_cursor_del(&mc, 0);
 			if (rc)
 				return rc;
@@ -3142,7 +3880,7 @@ mdb_freelist_save(MDB_txn *txn)
 			do {
 				freecnt = free_pgs[0];
 				data.mv_size = MDB_IDL_SIZEOF(free_pgs);
-				rc = mdb_cursor_put(&mc, &key, &data, MDB_RESERVE);
+				rc = mdb_cursor_put0(&mc, &key, &data, MDB_RESERVE);
 				if (rc)
 					return rc;
 				/* Retry if mt_free_pgs[] grew during the Put() */
@@ -3162,6 +3900,12 @@ mdb_freelist_save(MDB_txn *txn)
 			continue;
 		}
 
+		/* The freeDB already has an unchanged me_pghead */
+		if (!ps->mf_dirty) {
+			mop_len = 0;
+			break;
+		}
+
 		mop = env->me_pghead;
 		mop_len = (mop ? mop[0] : 0) + txn->mt_loose_count;
 
@@ -3191,7 +3935,7 @@ mdb_freelist_save(MDB_txn *txn)
 		key.mv_size = sizeof(head_id);
 		key.mv_data = &head_id;
 		data.mv_size = (head_room + 1) * sizeof(pgno_t);
-		rc = mdb_cursor_put(&mc, &key, &data, MDB_RESERVE);
+		rc = mdb_cursor_put0(&mc, &key, &data, MDB_RESERVE);
 		if (rc)
 			return rc;
 		/* IDL is initially empty, zero out at least the length */
@@ -3220,6 +3964,9 @@ mdb_freelist_save(MDB_txn *txn)
 		loose[0] = count;
 		mdb_midl_sort(loose);
 		mdb_midl_xmerge(mop, loose);
+		if (env->me_runs)
+			mdb_run_merge(env->me_runs, mop, loose);
+		env->me_pgstate.mf_dirty = 1;
 		txn->mt_loose_pgs = NULL;
 		txn->mt_loose_count = 0;
 		mop_len = mop[0];
@@ -3246,7 +3993,7 @@ mdb_freelist_save(MDB_txn *txn)
 			data.mv_data = mop -= len;
 			save = mop[0];
 			mop[0] = len;
-			rc = mdb_cursor_put(&mc, &key, &data, MDB_CURRENT);
+			rc = mdb_cursor_put0(&mc, &key, &data, MDB_CURRENT);
 			mop[0] = save;
 			if (rc || !(mop_len -= len))
 				break;
@@ -3255,28 +4002,660 @@ mdb_freelist_save(MDB_txn *txn)
 	return rc;
 }
 
-/** Flush (some) dirty pages to the map, after clearing their dirty flag.
- * @param[in] txn the transaction that's being committed
- * @param[in] keep number of initial pages in dirty_list to keep dirty.
- * @return 0 on success, non-zero on failure.
+#ifndef _WIN32
+/** @defgroup track	Changed page tracking
+ *	With #MDB_TRACKPAGES, a file next to the data file keeps a bitmap
+ *	of the pages written since a marked snapshot, from which
+ *	#mdb_env_copy2() writes incremental copies (#MDB_CP_DELTA).
+ *
+ *	Each page has two bits, one per generation. Writers set the bit
+ *	of the current generation for every page they flush. Marking a
+ *	snapshot switches to the other generation after clearing it, so
+ *	the old generation stays intact for the copy that is being made.
+ *	The file is only changed while holding the writer mutex.
+ *	@{
  */
-static int
-mdb_page_flush(MDB_txn *txn, int keep)
+#define MDB_TRACK_MAGIC	0xBEEF7AC5
+#define MDB_TRACK_VERSION	1
+	/** Size of the header in front of the bitmap */
+#define TRACK_HDRSIZE	64
+
+	/** Header of the tracking file */
+typedef struct MDB_trackhdr {
+	uint32_t	mt_magic;
+	uint32_t	mt_version;
+	uint32_t	mt_psize;		/**< page size of the environment */
+	uint32_t	mt_gen;			/**< generation being recorded, 0 or 1 */
+	txnid_t		mt_base;		/**< snapshot it starts at, or 0 if none */
+	txnid_t		mt_last;		/**< last txn whose pages were recorded */
+} MDB_trackhdr;
+
+	/** The previous recording, restored if a copy fails */
+typedef struct MDB_trackstate {
+	uint32_t	ts_gen;
+	txnid_t		ts_base;
+	txnid_t		ts_last;
+} MDB_trackstate;
+
+#define TRACK_HDR(env)	((MDB_trackhdr *)(env)->me_tmap)
+#define TRACK_BITS(env)	((unsigned char *)(env)->me_tmap + TRACK_HDRSIZE)
+	/** Number of pages covered by the current map */
+#define TRACK_NPAGES(env)	(((env)->me_tsize - TRACK_HDRSIZE) * 4)
+#define TRACK_BIT(pg, gen)	(1 << ((((pg) & 3) << 1) + (gen)))
+
+	/** Map at least enough of the tracking file for \b npages pages,
+	 *	growing the file if needed. Another process may have grown it
+	 *	further, then all of it is mapped.
+	 */
+static int ESECT
+mdb_track_map(MDB_env *env, pgno_t npages)
 {
-	MDB_env		*env = txn->mt_env;
-	MDB_ID2L	dl = txn->mt_u.dirty_list;
-	unsigned	psize = env->me_psize, j;
-	int			i, pagecount = dl[0].mid, rc;
-	size_t		size = 0, pos = 0;
-	pgno_t		pgno = 0;
-	MDB_page	*dp = NULL;
-#ifdef _WIN32
-	OVERLAPPED	ov;
-#else
-	struct iovec iov[MDB_COMMIT_PAGES];
-	ssize_t		wpos = 0, wsize = 0, wres;
-	size_t		next_pos = 1; /* impossible pos, so pos != next_pos */
-	int			n = 0;
+	size_t size, fsize = 0;
+	void *p;
+	int rc;
+
+	size = TRACK_HDRSIZE + (npages + 3) / 4;
+	size = (size + env->me_os_psize - 1) & ~(size_t)(env->me_os_psize - 1);
+	if ((rc = mdb_fsize(env->me_tfd, &fsize)))
+		return rc;
+	if (fsize < size) {
+		if (ftruncate(env->me_tfd, size) < 0)
+			return ErrCode();
+	} else {
+		size = fsize;
+	}
+	if (size == env->me_tsize)
+		return MDB_SUCCESS;
+	if (env->me_tmap)
+		munmap(env->me_tmap, env->me_tsize);
+	p = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, env->me_tfd, 0);
+	if (p == MAP_FAILED) {
+		env->me_tmap = NULL;
+		env->me_tsize = 0;
+		return ErrCode();
+	}
+	env->me_tmap = p;
+	env->me_tsize = size;
+	return MDB_SUCCESS;
+}
+
+	/** Open the tracking file, creating it if it does not exist */
+static int ESECT
+mdb_track_open(MDB_env *env, mdb_mode_t mode)
+{
+	MDB_trackhdr *th;
+	mdb_mutexref_t wmutex;
+	char *path;
+	int rc;
+
+	if (!env->me_txns)
+		return EINVAL;
+	path = malloc(strlen(env->me_path) + sizeof("/track.mdb"));
+	if (!path)
+		return ENOMEM;
+	sprintf(path, "%s%s", env->me_path,
+		(env->me_flags & MDB_NOSUBDIR) ? "-track" : "/track.mdb");
+	env->me_tfd = open(path, O_RDWR|O_CREAT, mode);
+	rc = env->me_tfd == INVALID_HANDLE_VALUE ? ErrCode() : MDB_SUCCESS;
+	free(path);
+	if (rc)
+		return rc;
+	/* Like the lockfile, nothing the user could close after fork() */
+	if ((rc = fcntl(env->me_tfd, F_GETFD)) != -1)
+		(void) fcntl(env->me_tfd, F_SETFD, rc | FD_CLOEXEC);
+
+	wmutex = env->me_wmutex;
+	if (LOCK_MUTEX(rc, env, wmutex))
+		return rc;
+	rc = mdb_track_map(env, env->me_maxpg);
+	if (rc == MDB_SUCCESS) {
+		th = TRACK_HDR(env);
+		if (th->mt_magic != MDB_TRACK_MAGIC ||
+			th->mt_version != MDB_TRACK_VERSION ||
+			th->mt_psize != env->me_psize) {
+			/* New or unusable, nothing is marked yet */
+			memset(env->me_tmap, 0, env->me_tsize);
+			th->mt_magic = MDB_TRACK_MAGIC;
+			th->mt_version = MDB_TRACK_VERSION;
+			th->mt_psize = env->me_psize;
+			th->mt_last = mdb_env_pick_meta(env)->mm_txnid;
+		}
+	}
+	UNLOCK_MUTEX(wmutex);
+	return rc;
+}
+
+	/** Record the pages #mdb_page_flush() is about to write */
+static int
+mdb_track_flush(MDB_txn *txn, int keep)
+{
+	MDB_env		*env = txn->mt_env;
+	MDB_ID2L	dl = txn->mt_u.dirty_list;
+	MDB_page	*dp;
+	unsigned char *bits;
+	pgno_t		pgno, n;
+	int			i, gen, rc;
+
+	if (txn->mt_next_pgno > TRACK_NPAGES(env) &&
+		(rc = mdb_track_map(env, txn->mt_next_pgno > env->me_maxpg ?
+			txn->mt_next_pgno : env->me_maxpg)))
+		return rc;
+	bits = TRACK_BITS(env);
+	gen = TRACK_HDR(env)->mt_gen;
+	for (i = keep; ++i <= (int)dl[0].mid; ) {
+		dp = dl[i].mptr;
+		if (dp->mp_flags & (P_LOOSE|P_KEEP))
+			continue;
+		pgno = dl[i].mid;
+		for (n = IS_OVERFLOW(dp) ? dp->mp_pages : 1; n; n--, pgno++)
+			bits[pgno >> 2] |= TRACK_BIT(pgno, gen);
+	}
+	return MDB_SUCCESS;
+}
+
+	/** Note a committed txn in the tracking file, before its meta page
+	 *	is written. A gap in the txn IDs means some txn was not recorded,
+	 *	and the current recording cannot be used for a delta copy.
+	 */
+static int
+mdb_track_commit(MDB_txn *txn)
+{
+	MDB_env *env = txn->mt_env;
+	MDB_trackhdr *th = TRACK_HDR(env);
+
+	if (th->mt_last != txn->mt_txnid - 1)
+		th->mt_base = 0;
+	th->mt_last = txn->mt_txnid;
+	if (!(env->me_flags & MDB_NOSYNC) &&
+		msync(env->me_tmap, env->me_tsize,
+			(env->me_flags & MDB_MAPASYNC) ? MS_ASYNC : MS_SYNC))
+		return ErrCode();
+	return MDB_SUCCESS;
+}
+	/** Start a new recording at the snapshot of \b txn.
+	 *	The caller holds the writer mutex.
+	 *	@param[in] delta if set, the previous recording must reach
+	 *	up to this snapshot.
+	 *	@param[out] ts the previous recording.
+	 */
+static int ESECT
+mdb_track_mark(MDB_env *env, MDB_txn *txn, MDB_trackstate *ts, int delta)
+{
+	MDB_trackhdr *th;
+	unsigned char *bits, clear;
+	size_t i, len;
+	int rc, gen;
+
+	if ((rc = mdb_track_map(env, txn->mt_next_pgno)))
+		return rc;
+	th = TRACK_HDR(env);
+	ts->ts_gen = th->mt_gen;
+	ts->ts_base = th->mt_base;
+	ts->ts_last = th->mt_last;
+	if (delta && (!th->mt_base || th->mt_last != txn->mt_txnid))
+		return MDB_INCOMPATIBLE;
+
+	gen = th->mt_gen ^ 1;
+	clear = ~(0x55 << gen);
+	bits = TRACK_BITS(env);
+	len = env->me_tsize - TRACK_HDRSIZE;
+	for (i = 0; i < len; i++)
+		bits[i] &= clear;
+	th->mt_gen = gen;
+	th->mt_base = txn->mt_txnid;
+	th->mt_last = txn->mt_txnid;
+	return MDB_SUCCESS;
+}
+
+	/** Undo #mdb_track_mark() after a failed copy. The pages of the
+	 *	abandoned recording are folded into the current one.
+	 */
+static void ESECT
+mdb_track_unmark(MDB_env *env, MDB_trackstate *ts)
+{
+	mdb_mutexref_t wmutex = env->me_wmutex;
+	MDB_trackhdr *th;
+	unsigned char *bits;
+	size_t i, len;
+	int rc;
+
+	if (LOCK_MUTEX(rc, env, wmutex))
+		return;
+	th = TRACK_HDR(env);
+	/* Leave it alone if another copy has marked since */
+	if (th->mt_gen != ts->ts_gen) {
+		bits = TRACK_BITS(env);
+		len = env->me_tsize - TRACK_HDRSIZE;
+		for (i = 0; i < len; i++) {
+			if (ts->ts_gen)
+				bits[i] |= (bits[i] & 0x55) << 1;
+			else
+				bits[i] |= (bits[i] & 0xaa) >> 1;
+		}
+		th->mt_gen = ts->ts_gen;
+		/* The old recording is only whole if it reached the
+		 * marked snapshot and nothing was missed since then.
+		 */
+		if (th->mt_base && th->mt_base == ts->ts_last)
+			th->mt_base = ts->ts_base;
+		else
+			th->mt_base = 0;
+	}
+	UNLOCK_MUTEX(wmutex);
+}
+
+/** @} */
+
+/** @defgroup cksum	Page checksums
+ *	With #MDB_CHECKSUM, a file next to the data file holds a checksum
+ *	of every page, computed by #mdb_page_flush() as the page is written.
+ *	A checksum of 0 means none is known for the page.
+ *
+ *	A page is checksummed with CRC32C in #CKSUM_LANES lanes, each one
+ *	a part of the page, and the lane CRCs are folded into one. The lanes
+ *	don't depend on each other, so the SSE4.2 crc32 instruction runs at
+ *	its full throughput instead of waiting on its own latency.
+ *
+ *	Readers verify a mapped page the first time they see it after its
+ *	checksum changed, and remember that in a per-process cache. The
+ *	checksum of a page only changes while no snapshot can see the page,
+ *	so readers need no locking. The header records the last txn whose
+ *	pages were checksummed: a newer snapshot was committed by a process
+ *	not using #MDB_CHECKSUM and is not verified, and the next writer
+ *	forgets all checksums, which may be stale by then.
+ *	@{
+ */
+#define MDB_CKSUM_MAGIC	0xBEEFC5C5
+#define MDB_CKSUM_VERSION	1
+	/** Size of the header in front of the checksums */
+#define CKSUM_HDRSIZE	64
+	/** Number of lanes of a page checksum */
+#define CKSUM_LANES	4
+	/** Entries in the cache of verified pages, a power of 2 */
+#define CKSUM_CACHE	65536
+
+	/** Header of the checksum file */
+typedef struct MDB_cksumhdr {
+	uint32_t	ck_magic;
+	uint32_t	ck_version;
+	uint32_t	ck_psize;		/**< page size of the environment */
+	uint32_t	ck_pad;
+	txnid_t		ck_last;		/**< last txn whose pages were checksummed */
+	pgno_t		ck_lastpg;		/**< last page of that txn's snapshot */
+} MDB_cksumhdr;
+
+#define CKSUM_HDR(env)	((MDB_cksumhdr *)(env)->me_cmap)
+#define CKSUM_SUMS(env)	((uint32_t *)((char *)(env)->me_cmap + CKSUM_HDRSIZE))
+	/** Number of pages covered by the current map */
+#define CKSUM_NPAGES(env)	(((env)->me_csize - CKSUM_HDRSIZE) / sizeof(uint32_t))
+
+static uint32_t mdb_crc32c_tab[8][256];
+
+	/** CRC32C of \b len bytes, table driven, 8 bytes per step */
+static uint32_t
+mdb_crc32c_sw(uint32_t crc, const unsigned char *p, size_t len)
+{
+	for (; len >= 8; len -= 8, p += 8) {
+		crc ^= p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+		crc = mdb_crc32c_tab[7][crc & 0xff] ^
+			mdb_crc32c_tab[6][(crc >> 8) & 0xff] ^
+			mdb_crc32c_tab[5][(crc >> 16) & 0xff] ^
+			mdb_crc32c_tab[4][crc >> 24] ^
+			mdb_crc32c_tab[3][p[4]] ^ mdb_crc32c_tab[2][p[5]] ^
+			mdb_crc32c_tab[1][p[6]] ^ mdb_crc32c_tab[0][p[7]];
+	}
+	while (len--)
+		crc = (crc >> 8) ^ mdb_crc32c_tab[0][(crc ^ *p++) & 0xff];
+	return crc;
+}
+
+	/** Update the lane CRCs \b crc with the \b len bytes at \b p */
+static void
+mdb_cksum_lanes_sw(const char *p, size_t len, uint32_t *crc)
+{
+	int i;
+
+	len /= CKSUM_LANES;
+	for (i = 0; i < CKSUM_LANES; i++)
+		crc[i] = mdb_crc32c_sw(crc[i], (const unsigned char *)p + i * len, len);
+}
+
+#if defined(__x86_64__) && (defined(__clang__) || __GNUC__ >= 5)
+#define MDB_CKSUM_SSE42	1
+__attribute__((target("sse4.2")))
+static void
+mdb_cksum_lanes_sse42(const char *p, size_t len, uint32_t *crc)
+{
+	unsigned long long c0 = crc[0], c1 = crc[1], c2 = crc[2], c3 = crc[3];
+	unsigned long long w0, w1, w2, w3;
+	size_t i;
+
+	len /= CKSUM_LANES;
+	for (i = 0; i < len; i += 8) {
+		memcpy(&w0, p + i, 8);
+		memcpy(&w1, p + len + i, 8);
+		memcpy(&w2, p + 2 * len + i, 8);
+		memcpy(&w3, p + 3 * len + i, 8);
+		c0 = __builtin_ia32_crc32di(c0, w0);
+		c1 = __builtin_ia32_crc32di(c1, w1);
+		c2 = __builtin_ia32_crc32di(c2, w2);
+		c3 = __builtin_ia32_crc32di(c3, w3);
+	}
+	crc[0] = c0;
+	crc[1] = c1;
+	crc[2] = c2;
+	crc[3] = c3;
+}
+#endif
+
+static void (*mdb_cksum_lanes)(const char *p, size_t len, uint32_t *crc);
+
+	/** Set up the CRC tables and pick the fastest lane function */
+static void ESECT
+mdb_cksum_init(void)
+{
+	uint32_t c;
+	int i, j;
+
+	if (mdb_cksum_lanes)
+		return;
+	for (i = 0; i < 256; i++) {
+		c = i;
+		for (j = 0; j < 8; j++)
+			c = (c >> 1) ^ (0x82F63B78 & -(c & 1));
+		mdb_crc32c_tab[0][i] = c;
+	}
+	for (i = 0; i < 256; i++) {
+		for (j = 1; j < 8; j++) {
+			c = mdb_crc32c_tab[j-1][i];
+			mdb_crc32c_tab[j][i] = (c >> 8) ^ mdb_crc32c_tab[0][c & 0xff];
+		}
+	}
+#ifdef MDB_CKSUM_SSE42
+	if (__builtin_cpu_supports("sse4.2"))
+		mdb_cksum_lanes = mdb_cksum_lanes_sse42;
+	else
+#endif
+	mdb_cksum_lanes = mdb_cksum_lanes_sw;
+}
+
+	/** The checksum of one page, never 0 */
+static uint32_t
+mdb_cksum_page(MDB_env *env, const char *p)
+{
+	uint32_t crc[CKSUM_LANES], c;
+	int i;
+
+	for (i = 0; i < CKSUM_LANES; i++)
+		crc[i] = ~0U;
+	mdb_cksum_lanes(p, env->me_psize, crc);
+	c = ~mdb_crc32c_sw(~0U, (unsigned char *)crc, sizeof(crc));
+	return c ? c : 1;
+}
+
+	/** Map the checksum file, growing it to hold \b npages checksums.
+	 *	Another process may have grown it further, then all of it is
+	 *	mapped. A read-only environment maps what is there.
+	 */
+static int ESECT
+mdb_cksum_map(MDB_env *env, pgno_t npages)
+{
+	size_t size, fsize = 0;
+	void *p;
+	int rc, prot = PROT_READ;
+
+	if ((rc = mdb_fsize(env->me_cfd, &fsize)))
+		return rc;
+	size = fsize;
+	if (!(env->me_flags & MDB_RDONLY)) {
+		prot |= PROT_WRITE;
+		size = CKSUM_HDRSIZE + npages * sizeof(uint32_t);
+		size = (size + env->me_os_psize - 1) & ~(size_t)(env->me_os_psize - 1);
+		if (fsize < size) {
+			if (ftruncate(env->me_cfd, size) < 0)
+				return ErrCode();
+		} else {
+			size = fsize;
+		}
+	}
+	if (size == env->me_csize)
+		return MDB_SUCCESS;
+	if (env->me_cmap)
+		munmap(env->me_cmap, env->me_csize);
+	p = mmap(NULL, size, prot, MAP_SHARED, env->me_cfd, 0);
+	if (p == MAP_FAILED) {
+		env->me_cmap = NULL;
+		env->me_csize = 0;
+		return ErrCode();
+	}
+	env->me_cmap = p;
+	env->me_csize = size;
+	return MDB_SUCCESS;
+}
+
+	/** Make sure the checksums are those of the snapshot of \b meta,
+	 *	which a write txn is about to start from. If some txn was
+	 *	committed without them, they are all forgotten.
+	 *	The caller holds the writer mutex.
+	 */
+static void
+mdb_cksum_begin(MDB_env *env, MDB_meta *meta)
+{
+	MDB_cksumhdr *ck = CKSUM_HDR(env);
+	size_t n;
+
+	if (ck->ck_last == meta->mm_txnid && ck->ck_lastpg == meta->mm_last_pg)
+		return;
+	n = meta->mm_last_pg + 1;
+	if (n > CKSUM_NPAGES(env))
+		n = CKSUM_NPAGES(env);
+	memset(CKSUM_SUMS(env), 0, n * sizeof(uint32_t));
+	ck->ck_last = meta->mm_txnid;
+	ck->ck_lastpg = meta->mm_last_pg;
+}
+
+	/** Set up the checksums for a txn on the snapshot of \b meta.
+	 *	@return #MDB_TXN_CKSUM if the txn can verify its pages.
+	 */
+static unsigned int
+mdb_cksum_start(MDB_env *env, MDB_meta *meta, int rdonly)
+{
+	if (!rdonly)
+		mdb_cksum_begin(env, meta);
+	return CKSUM_HDR(env)->ck_last >= meta->mm_txnid ? MDB_TXN_CKSUM : 0;
+}
+
+	/** Open the checksum file, creating it if it does not exist.
+	 *	Without a usable file, a read-only environment goes on
+	 *	without checksums.
+	 */
+static int ESECT
+mdb_cksum_open(MDB_env *env, mdb_mode_t mode)
+{
+	MDB_cksumhdr ck;
+	mdb_mutexref_t wmutex = NULL;
+	char *path;
+	int rc, rdonly = env->me_flags & MDB_RDONLY;
+
+	path = malloc(strlen(env->me_path) + sizeof("/cksum.mdb"));
+	if (!path)
+		return ENOMEM;
+	sprintf(path, "%s%s", env->me_path,
+		(env->me_flags & MDB_NOSUBDIR) ? "-cksum" : "/cksum.mdb");
+	env->me_cfd = open(path, rdonly ? O_RDONLY : O_RDWR|O_CREAT, mode);
+	rc = env->me_cfd == INVALID_HANDLE_VALUE ? ErrCode() : MDB_SUCCESS;
+	free(path);
+	if (rc)
+		return (rdonly && rc == ENOENT) ? MDB_SUCCESS : rc;
+	if ((rc = fcntl(env->me_cfd, F_GETFD)) != -1)
+		(void) fcntl(env->me_cfd, F_SETFD, rc | FD_CLOEXEC);
+	if (!(env->me_cverified = calloc(CKSUM_CACHE, sizeof(uint64_t))))
+		return ENOMEM;
+	mdb_cksum_init();
+
+	if (!rdonly && env->me_txns) {
+		wmutex = env->me_wmutex;
+		if (LOCK_MUTEX(rc, env, wmutex))
+			return rc;
+	}
+	rc = MDB_SUCCESS;
+	if (pread(env->me_cfd, &ck, sizeof(ck), 0) != sizeof(ck) ||
+		ck.ck_magic != MDB_CKSUM_MAGIC ||
+		ck.ck_version != MDB_CKSUM_VERSION ||
+		ck.ck_psize != env->me_psize) {
+		if (rdonly) {
+			close(env->me_cfd);
+			env->me_cfd = INVALID_HANDLE_VALUE;
+			goto done;
+		}
+		/* New or unusable, start over with no checksums known */
+		memset(&ck, 0, sizeof(ck));
+		ck.ck_magic = MDB_CKSUM_MAGIC;
+		ck.ck_version = MDB_CKSUM_VERSION;
+		ck.ck_psize = env->me_psize;
+		ck.ck_lastpg = P_INVALID;
+		if (ftruncate(env->me_cfd, 0) < 0 ||
+			pwrite(env->me_cfd, &ck, sizeof(ck), 0) != sizeof(ck)) {
+			rc = ErrCode();
+			goto done;
+		}
+	}
+	rc = mdb_cksum_map(env, env->me_maxpg);
+	if (rc == MDB_SUCCESS && !rdonly)
+		mdb_cksum_begin(env, mdb_env_pick_meta(env));
+done:
+	if (wmutex)
+		UNLOCK_MUTEX(wmutex);
+	return rc;
+}
+
+	/** Checksum the pages #mdb_page_flush() is about to write */
+static void
+mdb_cksum_flush(MDB_txn *txn, int keep)
+{
+	MDB_env		*env = txn->mt_env;
+	MDB_ID2L	dl = txn->mt_u.dirty_list;
+	MDB_page	*dp;
+	uint32_t	*sums = CKSUM_SUMS(env);
+	pgno_t		pgno, n, npages = CKSUM_NPAGES(env);
+	uint16_t	flags;
+	char		*p;
+	int			i;
+
+	for (i = keep; ++i <= (int)dl[0].mid; ) {
+		dp = dl[i].mptr;
+		if (dp->mp_flags & (P_LOOSE|P_KEEP))
+			continue;
+		pgno = dl[i].mid;
+		n = IS_OVERFLOW(dp) ? dp->mp_pages : 1;
+		if (pgno + n > npages)
+			continue;
+		/* As it will be on disk, without the dirty flag */
+		flags = dp->mp_flags;
+		dp->mp_flags &= ~P_DIRTY;
+		for (p = (char *)dp; n; n--, pgno++, p += env->me_psize)
+			sums[pgno] = mdb_cksum_page(env, p);
+		dp->mp_flags = flags;
+	}
+}
+
+	/** Note a committed txn in the checksum file and sync it,
+	 *	before its meta page is written.
+	 */
+static int
+mdb_cksum_commit(MDB_txn *txn)
+{
+	MDB_env *env = txn->mt_env;
+	MDB_cksumhdr *ck = CKSUM_HDR(env);
+
+	ck->ck_last = txn->mt_txnid;
+	ck->ck_lastpg = txn->mt_next_pgno - 1;
+	if (!(env->me_flags & MDB_NOSYNC) &&
+		msync(env->me_cmap, env->me_csize,
+			(env->me_flags & MDB_MAPASYNC) ? MS_ASYNC : MS_SYNC))
+		return ErrCode();
+	return MDB_SUCCESS;
+}
+
+	/** Verify a mapped page and its overflow pages against their
+	 *	checksums, unless they were verified since they last changed.
+	 *	Pages with no known checksum pass.
+	 *	@param[in] mp the mapped page.
+	 *	@param[in] pgno its page number.
+	 *	@param[in] force verify even if verified before.
+	 *	@return 0 on success, #MDB_CORRUPTED on a mismatch.
+	 */
+static int
+mdb_cksum_check(MDB_txn *txn, MDB_page *mp, pgno_t pgno, int force)
+{
+	MDB_env		*env = txn->mt_env;
+	uint32_t	*sums, tag;
+	uint64_t	*slot, v;
+	pgno_t		n, i;
+
+	/* Not those this txn is writing in place */
+	if ((mp->mp_flags & P_DIRTY) && !(txn->mt_flags & MDB_TXN_RDONLY))
+		return MDB_SUCCESS;
+	n = 1;
+	if (IS_OVERFLOW(mp)) {
+		n = mp->mp_pages;
+		if (!n || pgno + n > txn->mt_next_pgno)
+			return MDB_CORRUPTED;
+	}
+	if (pgno < NUM_METAS || pgno + n > CKSUM_NPAGES(env))
+		return MDB_SUCCESS;
+
+	sums = CKSUM_SUMS(env) + pgno;
+	tag = n == 1 ? sums[0] :
+		mdb_crc32c_sw(~0U, (unsigned char *)sums, n * sizeof(uint32_t));
+	/* A torn 64-bit store on 32-bit CPUs can only cause a re-verify */
+	v = (uint64_t)pgno << 32 | tag;
+	slot = &env->me_cverified[pgno & (CKSUM_CACHE-1)];
+	if (!force && *slot == v)
+		return MDB_SUCCESS;
+	for (i = 0; i < n; i++) {
+		if (sums[i] &&
+			sums[i] != mdb_cksum_page(env, (char *)mp + i * env->me_psize)) {
+			DPRINTF(("page %"Z"u checksum mismatch", pgno + i));
+			return MDB_CORRUPTED;
+		}
+	}
+	*slot = v;
+	return MDB_SUCCESS;
+}
+
+/** @} */
+#endif /* !_WIN32 */
+
+/** Flush (some) dirty pages to the map, after clearing their dirty flag.
+ * @param[in] txn the transaction that's being committed
+ * @param[in] keep number of initial pages in dirty_list to keep dirty.
+ * @return 0 on success, non-zero on failure.
+ */
+static int
+mdb_page_flush(MDB_txn *txn, int keep)
+{
+	MDB_env		*env = txn->mt_env;
+	MDB_ID2L	dl = txn->mt_u.dirty_list;
+	unsigned	psize = env->me_psize, j;
+	int			i, pagecount = dl[0].mid, rc;
+	size_t		size = 0, pos = 0;
+	pgno_t		pgno = 0;
+	MDB_page	*dp = NULL;
+#ifdef _WIN32
+	OVERLAPPED	ov;
+#else
+	struct iovec iov[MDB_COMMIT_PAGES];
+	ssize_t		wpos = 0, wsize = 0, wres;
+	size_t		next_pos = 1; /* impossible pos, so pos != next_pos */
+	int			n = 0;
+#endif
+
+#ifndef _WIN32
+	if (env->me_tmap && (rc = mdb_track_flush(txn, keep)))
+		return rc;
+	if (env->me_cmap)
+		mdb_cksum_flush(txn, keep);
 #endif
 
 	j = i = keep;
@@ -3407,9 +4786,10 @@ done:
 	return MDB_SUCCESS;
 }
 
-int
-mdb_txn_commit(MDB_txn *txn)
+static int
+mdb_txn_commit0(MDB_txn *txn)
 {
+	unsigned long long start;
 	int		rc;
 	unsigned int i, end_mode;
 	MDB_env	*env;
@@ -3421,7 +4801,7 @@ mdb_txn_commit(MDB_txn *txn)
 	end_mode = MDB_END_EMPTY_COMMIT|MDB_END_UPDATE|MDB_END_SLOT|MDB_END_FREE;
 
 	if (txn->mt_child) {
-		rc = mdb_txn_commit(txn->mt_child);
+		rc = mdb_txn_commit0(txn->mt_child);
 		if (rc)
 			goto fail;
 	}
@@ -3567,6 +4947,7 @@ mdb_txn_commit(MDB_txn *txn)
 
 		parent->mt_child = NULL;
 		mdb_midl_free(((MDB_ntxn *)txn)->mnt_pgstate.mf_pghead);
+		mdb_run_free(((MDB_ntxn *)txn)->mnt_pgstate.mf_runs);
 		free(txn);
 		return rc;
 	}
@@ -3601,7 +4982,7 @@ mdb_txn_commit(MDB_txn *txn)
 					goto fail;
 				}
 				data.mv_data = &txn->mt_dbs[i];
-				rc = mdb_cursor_put(&mc, &txn->mt_dbxs[i].md_name, &data,
+				rc = mdb_cursor_put0(&mc, &txn->mt_dbxs[i].md_name, &data,
 					F_SUBDATA);
 				if (rc)
 					goto fail;
@@ -3613,18 +4994,31 @@ mdb_txn_commit(MDB_txn *txn)
 	if (rc)
 		goto fail;
 
-	mdb_midl_free(env->me_pghead);
-	env->me_pghead = NULL;
 	mdb_midl_shrink(&txn->mt_free_pgs);
 
 #if (MDB_DEBUG) > 2
 	mdb_audit(txn);
 #endif
 
-	if ((rc = mdb_page_flush(txn, 0)) ||
-		(rc = mdb_env_sync(env, 0)) ||
-		(rc = mdb_env_write_meta(txn)))
+	start = MDB_OPSTAT_START(env);
+	if ((rc = mdb_page_flush(txn, 0)))
 		goto fail;
+	mdb_opstat_add(env, MDB_OPS_FLUSH, start);
+	start = MDB_OPSTAT_START(env);
+	if ((rc = mdb_env_sync(env, 0)))
+		goto fail;
+#ifndef _WIN32
+	if (env->me_tmap && (rc = mdb_track_commit(txn)))
+		goto fail;
+	if (env->me_cmap && (rc = mdb_cksum_commit(txn)))
+		goto fail;
+#endif
+	if ((rc = mdb_env_write_meta(txn)))
+		goto fail;
+	mdb_opstat_add(env, MDB_OPS_SYNC, start);
+	/* The freeDB now matches me_pghead */
+	env->me_pgstate.mf_txnid = txn->mt_txnid;
+	env->me_pgstate.mf_dirty = 0;
 	end_mode = MDB_END_COMMITTED|MDB_END_UPDATE;
 
 done:
@@ -3636,6 +5030,20 @@ fail:
 	return rc;
 }
 
+int
+mdb_txn_commit(MDB_txn *txn)
+{
+	unsigned long long start;
+	int rc;
+
+	if (txn == NULL)
+		return EINVAL;
+	start = MDB_OPSTAT_START(txn->mt_env);
+	rc = mdb_txn_commit0(txn);
+	mdb_opstat_add(txn->mt_env, MDB_OPS_COMMIT, start);
+	return rc;
+}
+
 /** Read the environment parameters of a DB environment before
  * mapping it into memory.
  * @param[in] env the environment handle
@@ -3924,11 +5332,18 @@ mdb_env_create(MDB_env **env)
 	e->me_fd = INVALID_HANDLE_VALUE;
 	e->me_lfd = INVALID_HANDLE_VALUE;
 	e->me_mfd = INVALID_HANDLE_VALUE;
+	e->me_tfd = INVALID_HANDLE_VALUE;
+	e->me_cfd = INVALID_HANDLE_VALUE;
 #ifdef MDB_USE_POSIX_SEM
 	e->me_rmutex = SEM_FAILED;
 	e->me_wmutex = SEM_FAILED;
 #endif
+	e->me_oldest_rslot = -1;
 	e->me_pid = getpid();
+#ifndef _WIN32
+	e->me_wlimit = MDB_WINDOW_LIMIT;
+	pthread_mutex_init(&e->me_wlock, NULL);
+#endif
 	GET_PAGESIZE(e->me_os_psize);
 	VGMEMP_CREATE(e,0,0);
 	*env = e;
@@ -3985,14 +5400,14 @@ mdb_env_map(MDB_env *env, void *addr)
 		if (ftruncate(env->me_fd, env->me_mapsize) < 0)
 			return ErrCode();
 	}
-	env->me_map = mmap(addr, env->me_mapsize, prot, MAP_SHARED,
+	env->me_map = mmap(addr, MDB_MAPLEN(env), prot, MAP_SHARED,
 		env->me_fd, 0);
 	if (env->me_map == MAP_FAILED) {
 		env->me_map = NULL;
 		return ErrCode();
 	}
 
-	if (flags & MDB_NORDAHEAD) {
+	if ((flags & (MDB_NORDAHEAD|MDB_WINDOWMAP)) == MDB_NORDAHEAD) {
 		/* Turn off readahead. It's harmful when the DB is larger than RAM. */
 #ifdef MADV_RANDOM
 		madvise(env->me_map, env->me_mapsize, MADV_RANDOM);
@@ -4040,12 +5455,24 @@ mdb_env_set_mapsize(MDB_env *env, size_t size)
 			if (size < minsize)
 				size = minsize;
 		}
+#ifndef _WIN32
+		if (env->me_flags & MDB_WINDOWMAP) {
+			/* Only the metas are mapped, they stay put */
+			env->me_mapsize = size;
+		} else
+#endif
+		{
 		munmap(env->me_map, env->me_mapsize);
 		env->me_mapsize = size;
 		old = (env->me_flags & MDB_FIXEDMAP) ? env->me_map : NULL;
 		rc = mdb_env_map(env, old);
 		if (rc)
 			return rc;
+		}
+#ifndef _WIN32
+		if (env->me_cmap && (rc = mdb_cksum_map(env, size / env->me_psize)))
+			return rc;
+#endif
 	}
 	env->me_mapsize = size;
 	if (env->me_psize)
@@ -4054,11 +5481,25 @@ mdb_env_set_mapsize(MDB_env *env, size_t size)
 }
 
 int ESECT
-mdb_env_set_maxdbs(MDB_env *env, MDB_dbi dbs)
+mdb_env_set_mapwindow(MDB_env *env, size_t size)
 {
-	if (env->me_map)
+	if (!env)
 		return EINVAL;
-	env->me_maxdbs = dbs + CORE_DBS;
+#ifndef _WIN32
+	pthread_mutex_lock(&env->me_wlock);
+	env->me_wlimit = size;
+	mdb_win_evict(env, 0);
+	pthread_mutex_unlock(&env->me_wlock);
+#endif
+	return MDB_SUCCESS;
+}
+
+int ESECT
+mdb_env_set_maxdbs(MDB_env *env, MDB_dbi dbs)
+{
+	if (env->me_map)
+		return EINVAL;
+	env->me_maxdbs = dbs + CORE_DBS;
 	return MDB_SUCCESS;
 }
 
@@ -4383,6 +5824,16 @@ mdb_env_open2(MDB_env *env)
 			env->me_mapsize = minsize;
 	}
 	meta.mm_mapsize = env->me_mapsize;
+#ifndef _WIN32
+	if (flags & MDB_WINDOWMAP) {
+		/* Chunks must be whole OS pages, and a power of two pages */
+		env->me_wpages = MDB_WINDOW_CHUNK / env->me_psize;
+		if (env->me_wpages < env->me_os_psize / env->me_psize)
+			env->me_wpages = env->me_os_psize / env->me_psize;
+		if (!env->me_wpages)
+			env->me_wpages = 1;
+	}
+#endif
 
 	if (newenv && !(flags & MDB_FIXEDMAP)) {
 		/* mdb_env_map() may grow the datafile.  Write the metapages
@@ -4910,9 +6361,11 @@ fail:
 	 *	at runtime. Changing other flags requires closing the
 	 *	environment and re-opening it with the new flags.
 	 */
-#define	CHANGEABLE	(MDB_NOSYNC|MDB_NOMETASYNC|MDB_MAPASYNC|MDB_NOMEMINIT)
+#define	CHANGEABLE	(MDB_NOSYNC|MDB_NOMETASYNC|MDB_MAPASYNC|MDB_NOMEMINIT| \
+	MDB_OPSTATS)
 #define	CHANGELESS	(MDB_FIXEDMAP|MDB_NOSUBDIR|MDB_RDONLY| \
-	MDB_WRITEMAP|MDB_NOTLS|MDB_NOLOCK|MDB_NORDAHEAD)
+	MDB_WRITEMAP|MDB_NOTLS|MDB_NOLOCK|MDB_NORDAHEAD|MDB_TRACKPAGES| \
+	MDB_CHECKSUM|MDB_WINDOWMAP)
 
 #if VALID_FLAGS & PERSISTENT_FLAGS & (CHANGEABLE|CHANGELESS)
 # error "Persistent DB flags & env flags overlap, but both go in mm_flags"
@@ -4926,8 +6379,14 @@ mdb_env_open(MDB_env *env, const char *path, unsigned int flags, mdb_mode_t mode
 
 	if (env->me_fd!=INVALID_HANDLE_VALUE || (flags & ~(CHANGEABLE|CHANGELESS)))
 		return EINVAL;
+#ifdef _WIN32
+	if (flags & (MDB_TRACKPAGES|MDB_CHECKSUM|MDB_WINDOWMAP))
+		return EINVAL;
+#endif
 
 	flags |= env->me_flags;
+	if ((flags & MDB_WINDOWMAP) && (flags & (MDB_WRITEMAP|MDB_FIXEDMAP)))
+		return EINVAL;
 
 	rc = mdb_fname_init(path, flags, &fname);
 	if (rc)
@@ -4989,6 +6448,18 @@ mdb_env_open(MDB_env *env, const char *path, unsigned int flags, mdb_mode_t mode
 			if (rc)
 				goto leave;
 		}
+#ifndef _WIN32
+		if (flags & MDB_TRACKPAGES) {
+			rc = mdb_track_open(env, mode);
+			if (rc)
+				goto leave;
+		}
+		if (flags & MDB_CHECKSUM) {
+			rc = mdb_cksum_open(env, mode);
+			if (rc)
+				goto leave;
+		}
+#endif
 		if (!(flags & MDB_RDONLY)) {
 			MDB_txn *txn;
 			int tsize = sizeof(MDB_txn), size = tsize + env->me_maxdbs *
@@ -5027,6 +6498,14 @@ mdb_env_close0(MDB_env *env, int excl)
 	if (!(env->me_flags & MDB_ENV_ACTIVE))
 		return;
 
+#ifndef _WIN32
+	if (env->me_compact) {
+		mdb_compact_free(env->me_compact);
+		env->me_compact = NULL;
+	}
+#endif
+	mdb_pgstate_drop(env);
+
 	/* Doing this here since me_dbxs may not exist during mdb_env_close */
 	if (env->me_dbxs) {
 		for (i = env->me_maxdbs; --i >= CORE_DBS; )
@@ -5035,10 +6514,15 @@ mdb_env_close0(MDB_env *env, int excl)
 	}
 
 	free(env->me_pbuf);
+	free(env->me_cbuf);
 	free(env->me_dbiseqs);
 	free(env->me_dbflags);
 	free(env->me_path);
 	free(env->me_dirty_list);
+	if (env->me_txn0) {
+		free(env->me_txn0->mt_ubuf);
+		free(env->me_txn0->mt_wins);
+	}
 	free(env->me_txn0);
 	mdb_midl_free(env->me_free_pgs);
 
@@ -5056,12 +6540,29 @@ mdb_env_close0(MDB_env *env, int excl)
 	}
 
 	if (env->me_map) {
-		munmap(env->me_map, env->me_mapsize);
+		munmap(env->me_map, MDB_MAPLEN(env));
 	}
+#ifndef _WIN32
+	mdb_win_unmapall(env);
+	free(env->me_wins);
+	env->me_wins = NULL;
+	env->me_wcount = env->me_wmax = 0;
+#endif
 	if (env->me_mfd != INVALID_HANDLE_VALUE)
 		(void) close(env->me_mfd);
 	if (env->me_fd != INVALID_HANDLE_VALUE)
 		(void) close(env->me_fd);
+#ifndef _WIN32
+	if (env->me_tmap)
+		munmap(env->me_tmap, env->me_tsize);
+	if (env->me_tfd != INVALID_HANDLE_VALUE)
+		(void) close(env->me_tfd);
+	if (env->me_cmap)
+		munmap(env->me_cmap, env->me_csize);
+	if (env->me_cfd != INVALID_HANDLE_VALUE)
+		(void) close(env->me_cfd);
+	free(env->me_cverified);
+#endif
 	if (env->me_txns) {
 		MDB_PID_T pid = env->me_pid;
 		/* Clearing readers is done in this function because
@@ -5131,6 +6632,9 @@ mdb_env_close(MDB_env *env)
 	}
 
 	mdb_env_close0(env, 0);
+#ifndef _WIN32
+	pthread_mutex_destroy(&env->me_wlock);
+#endif
 	free(env);
 }
 
@@ -5229,6 +6733,188 @@ mdb_cmp_memnr(const MDB_val *a, const MDB_val *b)
 	return len_diff<0 ? -1 : len_diff;
 }
 
+/** Get the key of a leaf node.
+ * @param[in] mc The cursor for this operation.
+ * @param[in] mp The page holding the node.
+ * @param[in] node The node.
+ * @param[out] key The key. If \b mp is a #P_PREFIX page, it is rebuilt
+ * in \b buf, which must hold #MDB_PFXBUF bytes. Otherwise it points
+ * into the page.
+ * @param[in] buf The buffer for a rebuilt key.
+ */
+static void
+mdb_node_key(MDB_cursor *mc, MDB_page *mp, MDB_node *node,
+	MDB_val *key, char *buf)
+{
+	if (IS_PREFIX(mp)) {
+		unsigned int plen = mp->mp_pad;
+		memcpy(buf, PAGEPFX(mc->mc_txn->mt_env, mp), plen);
+		memcpy(buf + plen, NODEKEY(node), NODEKSZ(node));
+		key->mv_size = plen + NODEKSZ(node);
+		key->mv_data = buf;
+	} else {
+		key->mv_size = NODEKSZ(node);
+		key->mv_data = NODEKEY(node);
+	}
+}
+
+/** Size of a leaf node on its page, without alignment. */
+#define LEAFNODESZ(node)	(NODESIZE + NODEKSZ(node) + \
+	(F_ISSET((node)->mn_flags, F_BIGDATA) ? sizeof(pgno_t) : NODEDSZ(node)))
+
+/** Get how many bytes of the shared prefix of a page a key starts with.
+ * @return 0 if the page is not a #P_PREFIX page.
+ */
+static unsigned int
+mdb_pfx_match(MDB_cursor *mc, MDB_page *mp, MDB_val *key)
+{
+	unsigned char *pfx, *k = key->mv_data;
+	unsigned int i, n;
+
+	if (!IS_PREFIX(mp))
+		return 0;
+	pfx = (unsigned char *)PAGEPFX(mc->mc_txn->mt_env, mp);
+	n = mp->mp_pad;
+	if (n > key->mv_size)
+		n = key->mv_size;
+	for (i = 0; i < n && pfx[i] == k[i]; i++)
+		;
+	return i;
+}
+
+/** Get the room needed to shorten the shared prefix of a page.
+ * Every node's key gets longer by the bytes dropped from the prefix.
+ * @param[in] mp The #P_PREFIX page.
+ * @param[in] plen The new prefix size, at most the current one.
+ * @return The number of bytes the nodes and prefix will grow by.
+ */
+static ssize_t
+mdb_pfx_grow(MDB_page *mp, unsigned int plen)
+{
+	unsigned int i, d;
+	ssize_t grow;
+
+	if (!IS_PREFIX(mp) || !(d = mp->mp_pad - plen))
+		return 0;
+	grow = (ssize_t)EVEN(plen) - (ssize_t)EVEN(mp->mp_pad);
+	for (i = 0; i < NUMKEYS(mp); i++) {
+		size_t sz = LEAFNODESZ(NODEPTR(mp, i));
+		grow += EVEN(sz + d) - EVEN(sz);
+	}
+	return grow;
+}
+
+/** Shorten the shared prefix of the page pointed to by the cursor.
+ * The caller must have checked with #mdb_pfx_grow() that the
+ * page has room for it. The nodes keep their index but not their
+ * offset, so sub-page pointers of cursors on the page are updated.
+ * @param[in] mc The cursor for this operation.
+ * @param[in] plen The new prefix size, at most the current one.
+ * @return 0 on success, ENOMEM if no temporary page was available.
+ */
+static int
+mdb_pfx_shrink(MDB_cursor *mc, unsigned int plen)
+{
+	MDB_env		*env = mc->mc_txn->mt_env;
+	MDB_page	*mp = mc->mc_pg[mc->mc_top], *tp;
+	MDB_node	*node, *dst;
+	MDB_cursor	*m2;
+	char		*pfx;
+	unsigned int	 i, d = mp->mp_pad - plen;
+	indx_t		 upper;
+	size_t		 sz;
+
+	if (!d)
+		return MDB_SUCCESS;
+	if ((tp = mdb_page_malloc(mc->mc_txn, 1)) == NULL)
+		return ENOMEM;
+	memcpy(tp, mp, env->me_psize);
+	pfx = PAGEPFX(env, tp);
+	upper = env->me_psize - PAGEBASE - EVEN(plen);
+	memcpy((char *)mp + upper + PAGEBASE, pfx, plen);
+	for (i = 0; i < NUMKEYS(tp); i++) {
+		node = NODEPTR(tp, i);
+		sz = LEAFNODESZ(node);
+		upper -= EVEN(sz + d);
+		mp->mp_ptrs[i] = upper;
+		dst = NODEPTR(mp, i);
+		memcpy(dst, node, NODESIZE);
+		dst->mn_ksize = NODEKSZ(node) + d;
+		memcpy(NODEKEY(dst), pfx + plen, d);
+		memcpy((char *)NODEKEY(dst) + d, NODEKEY(node), sz - NODESIZE);
+	}
+	mp->mp_upper = upper;
+	mp->mp_pad = plen;
+	if (!plen)
+		mp->mp_flags &= ~P_PREFIX;
+	mdb_page_free(env, tp);
+
+	if (!(mc->mc_flags & C_SUB) && (mc->mc_db->md_flags & MDB_DUPSORT)) {
+		XCURSOR_REFRESH(mc, mc->mc_top, mp);
+		for (m2 = mc->mc_txn->mt_cursors[mc->mc_dbi]; m2; m2=m2->mc_next) {
+			if (m2->mc_snum < mc->mc_snum || m2->mc_pg[mc->mc_top] != mp)
+				continue;
+			XCURSOR_REFRESH(m2, mc->mc_top, mp);
+		}
+	}
+	return MDB_SUCCESS;
+}
+
+/** Set the shared prefix of an empty leaf page.
+ * @param[in] env The environment handle.
+ * @param[in] mp The page.
+ * @param[in] pfx The prefix.
+ * @param[in] plen The prefix size, 0 to make it a plain leaf page.
+ */
+static void
+mdb_pfx_init(MDB_env *env, MDB_page *mp, const char *pfx, unsigned int plen)
+{
+	mp->mp_upper = env->me_psize - PAGEBASE - EVEN(plen);
+	if (plen) {
+		mp->mp_flags |= P_PREFIX;
+		mp->mp_pad = plen;
+		memmove(PAGEPFX(env, mp), pfx, plen);
+	} else {
+		mp->mp_flags &= ~P_PREFIX;
+		mp->mp_pad = 0;
+	}
+}
+
+/** Check if the nodes of a leaf page fit into another one, whose
+ * shared prefix may have to get shorter for them.
+ * @param[in] csrc Cursor pointing to the source page.
+ * @param[in] cdst Cursor pointing to the destination page.
+ * @return 1 if they fit, 0 otherwise.
+ */
+static int
+mdb_pfx_merge_ok(MDB_cursor *csrc, MDB_cursor *cdst)
+{
+	MDB_page	*psrc = csrc->mc_pg[csrc->mc_top];
+	MDB_page	*pdst = cdst->mc_pg[cdst->mc_top];
+	MDB_node	*node;
+	MDB_val		 key;
+	char		 buf[MDB_PFXBUF];
+	unsigned int i, n, plen;
+	ssize_t		 need;
+
+	if (!NUMKEYS(pdst) || (!IS_PREFIX(psrc) && !IS_PREFIX(pdst)))
+		return 1;
+	plen = PAGEPFXLEN(pdst);
+	for (i = 0; i < NUMKEYS(psrc) && plen; i++) {
+		mdb_node_key(csrc, psrc, NODEPTR(psrc, i), &key, buf);
+		n = mdb_pfx_match(cdst, pdst, &key);
+		if (plen > n)
+			plen = n;
+	}
+	need = mdb_pfx_grow(pdst, plen);
+	for (i = 0; i < NUMKEYS(psrc); i++) {
+		node = NODEPTR(psrc, i);
+		need += EVEN(LEAFNODESZ(node) + PAGEPFXLEN(psrc) - plen) +
+			sizeof(indx_t);
+	}
+	return need <= (ssize_t)SIZELEFT(pdst);
+}
+
 /** Search for key within a page, using binary search.
  * Returns the smallest entry larger or equal to the key.
  * If exactp is non-null, stores whether the found entry was an exact match
@@ -5284,6 +6970,56 @@ mdb_node_search(MDB_cursor *mc, MDB_val *key, int *exactp)
 			else
 				high = i - 1;
 		}
+	} else if (IS_PREFIX(mp)) {
+		char *pfx = PAGEPFX(mc->mc_txn->mt_env, mp);
+		char buf[MDB_PFXBUF];
+		unsigned int plen = mp->mp_pad;
+		MDB_val rest;
+
+		if (cmp == mdb_cmp_memn) {
+			/* Compare the shared prefix once, then only the rest */
+			size_t len = key->mv_size < plen ? key->mv_size : plen;
+			rc = memcmp(key->mv_data, pfx, len);
+			if (!rc && len < plen)
+				rc = -1;
+			if (rc) {
+				/* The key sorts before or after the whole page */
+				if (nkeys) {
+					i = rc < 0 ? 0 : nkeys - 1;
+					node = NODEPTR(mp, i);
+				}
+				low = high + 1;
+			}
+			rest.mv_size = key->mv_size - len;
+			rest.mv_data = (char *)key->mv_data + len;
+			plen = 0;
+		} else {
+			rest = *key;
+			memcpy(buf, pfx, plen);
+		}
+		while (low <= high) {
+			i = (low + high) >> 1;
+
+			node = NODEPTR(mp, i);
+			if (plen) {
+				memcpy(buf + plen, NODEKEY(node), NODEKSZ(node));
+				nodekey.mv_size = plen + NODEKSZ(node);
+				nodekey.mv_data = buf;
+			} else {
+				nodekey.mv_size = NODEKSZ(node);
+				nodekey.mv_data = NODEKEY(node);
+			}
+
+			rc = cmp(&rest, &nodekey);
+			DPRINTF(("found leaf index %u [%s], rc = %i",
+			    i, DKEY(&nodekey), rc));
+			if (rc == 0)
+				break;
+			if (rc > 0)
+				low = i + 1;
+			else
+				high = i - 1;
+		}
 	} else {
 		while (low <= high) {
 			i = (low + high) >> 1;
@@ -5379,6 +7115,257 @@ mdb_cursor_push(MDB_cursor *mc, MDB_page *mp)
 	return MDB_SUCCESS;
 }
 
+#ifndef _WIN32
+/** @defgroup mdb_window	Windowed mapping
+ *	With #MDB_WINDOWMAP only the meta pages are mapped for the life of the
+ *	environment, see #mdb_env_map(). #mdb_page_get() maps other pages in
+ *	windows on demand. A txn holds a reference to every window it used,
+ *	so pages and values it returned stay valid until it ends, like those
+ *	of a full map. Windows no txn holds stay mapped, in LRU order, until
+ *	their total size goes over the limit.
+ *	@{
+ */
+
+	/** Find the first window with a key not below \b key */
+static unsigned int
+mdb_win_search(MDB_window **wins, unsigned int n, MDB_ID key)
+{
+	unsigned int lo = 0, hi = n, i;
+
+	while (lo < hi) {
+		i = (lo + hi) >> 1;
+		if (wins[i]->mw_key < key)
+			lo = i + 1;
+		else
+			hi = i;
+	}
+	return lo;
+}
+
+	/** Insert a window at index \b i of a sorted array, growing it
+	 *	as needed.
+	 *	@return 0 on success, ENOMEM on failure.
+	 */
+static int
+mdb_win_insert(MDB_window ***winsp, unsigned int *countp, unsigned int *maxp,
+	unsigned int i, MDB_window *w)
+{
+	MDB_window **wins = *winsp;
+
+	if (*countp == *maxp) {
+		unsigned int max = *maxp ? *maxp * 2 : 64;
+		if (!(wins = realloc(wins, max * sizeof(MDB_window *))))
+			return ENOMEM;
+		*winsp = wins;
+		*maxp = max;
+	}
+	memmove(wins + i + 1, wins + i, (*countp - i) * sizeof(MDB_window *));
+	wins[i] = w;
+	(*countp)++;
+	return MDB_SUCCESS;
+}
+
+	/** Unmap unused windows while the env has more mapped than its limit,
+	 *	or all of them if \b all is set. The caller holds me_wlock.
+	 */
+static void
+mdb_win_evict(MDB_env *env, int all)
+{
+	MDB_window *w;
+	unsigned int i;
+
+	while ((w = env->me_whead) != NULL &&
+		(all || env->me_wsize > env->me_wlimit)) {
+		env->me_whead = w->mw_next;
+		if (w->mw_next)
+			w->mw_next->mw_prev = NULL;
+		else
+			env->me_wtail = NULL;
+		i = mdb_win_search(env->me_wins, env->me_wcount, w->mw_key);
+		memmove(env->me_wins + i, env->me_wins + i + 1,
+			(env->me_wcount - i - 1) * sizeof(MDB_window *));
+		env->me_wcount--;
+		env->me_wsize -= w->mw_len;
+		munmap(w->mw_base, w->mw_len);
+		free(w);
+	}
+}
+
+	/** Get a reference to a window for \b txn, mapping it if needed.
+	 *	@param[in] txn the top-level txn.
+	 *	@param[in] key the window's key.
+	 *	@param[in] pgno the first page of the window.
+	 *	@param[in] npages the number of pages in the window.
+	 *	@param[out] ret the window.
+	 *	@return 0 on success, non-zero on failure.
+	 */
+static int
+mdb_win_ref(MDB_txn *txn, MDB_ID key, pgno_t pgno, pgno_t npages,
+	MDB_window **ret)
+{
+	MDB_env *env = txn->mt_env;
+	MDB_window *w;
+	unsigned int i, j;
+	off_t off;
+	size_t pad;
+	int rc = MDB_SUCCESS;
+
+	i = mdb_win_search(txn->mt_wins, txn->mt_wcount, key);
+	if (i < txn->mt_wcount && txn->mt_wins[i]->mw_key == key) {
+		*ret = txn->mt_wins[i];
+		return MDB_SUCCESS;
+	}
+	/* Make room first, so a failure leaves no reference behind */
+	if (txn->mt_wcount == txn->mt_wmax) {
+		unsigned int max = txn->mt_wmax ? txn->mt_wmax * 2 : 64;
+		MDB_window **wins = realloc(txn->mt_wins, max * sizeof(MDB_window *));
+		if (!wins)
+			return ENOMEM;
+		txn->mt_wins = wins;
+		txn->mt_wmax = max;
+	}
+
+	pthread_mutex_lock(&env->me_wlock);
+	j = mdb_win_search(env->me_wins, env->me_wcount, key);
+	if (j < env->me_wcount && env->me_wins[j]->mw_key == key) {
+		w = env->me_wins[j];
+		if (!w->mw_refs++) {
+			/* In use again, off the LRU list */
+			if (w->mw_prev)
+				w->mw_prev->mw_next = w->mw_next;
+			else
+				env->me_whead = w->mw_next;
+			if (w->mw_next)
+				w->mw_next->mw_prev = w->mw_prev;
+			else
+				env->me_wtail = w->mw_prev;
+		}
+	} else {
+		if (!(w = malloc(sizeof(MDB_window)))) {
+			rc = ENOMEM;
+			goto leave;
+		}
+		/* mmap wants an offset aligned to the OS page size */
+		off = (size_t)pgno * env->me_psize;
+		pad = off & (env->me_os_psize - 1);
+		w->mw_len = (size_t)npages * env->me_psize + pad;
+		w->mw_base = mmap(NULL, w->mw_len, PROT_READ, MAP_SHARED,
+			env->me_fd, off - pad);
+		if (w->mw_base == MAP_FAILED && env->me_whead) {
+			/* Short of address space, drop the cache and retry */
+			mdb_win_evict(env, 1);
+			w->mw_base = mmap(NULL, w->mw_len, PROT_READ, MAP_SHARED,
+				env->me_fd, off - pad);
+			j = mdb_win_search(env->me_wins, env->me_wcount, key);
+		}
+		if (w->mw_base == MAP_FAILED) {
+			rc = ErrCode();
+			free(w);
+			goto leave;
+		}
+#ifdef MADV_RANDOM
+		if (env->me_flags & MDB_NORDAHEAD)
+			madvise(w->mw_base, w->mw_len, MADV_RANDOM);
+#endif
+		if ((rc = mdb_win_insert(&env->me_wins, &env->me_wcount,
+			&env->me_wmax, j, w))) {
+			munmap(w->mw_base, w->mw_len);
+			free(w);
+			goto leave;
+		}
+		w->mw_key = key;
+		w->mw_pgno = pgno;
+		w->mw_pages = npages;
+		w->mw_ptr = w->mw_base + pad;
+		w->mw_refs = 1;
+		w->mw_prev = w->mw_next = NULL;
+		env->me_wsize += w->mw_len;
+		mdb_win_evict(env, 0);
+	}
+leave:
+	pthread_mutex_unlock(&env->me_wlock);
+	if (rc == MDB_SUCCESS) {
+		mdb_win_insert(&txn->mt_wins, &txn->mt_wcount, &txn->mt_wmax, i, w);
+		*ret = w;
+	}
+	return rc;
+}
+
+	/** Find the address of a mapped page with #MDB_WINDOWMAP.
+	 *	@param[in] txn the txn accessing the page.
+	 *	@param[in] pgno the page number, below the txn's next page.
+	 *	@param[out] ret the address of the page.
+	 *	@return 0 on success, non-zero on failure.
+	 */
+static int
+mdb_win_page(MDB_txn *txn, pgno_t pgno, MDB_page **ret)
+{
+	MDB_env *env = txn->mt_env;
+	MDB_window *w;
+	MDB_page *p;
+	pgno_t pg0, n, last = txn->mt_next_pgno;
+	int rc;
+
+	while (txn->mt_parent)
+		txn = txn->mt_parent;
+	w = txn->mt_wlast;
+	if (!w || pgno < w->mw_pgno || pgno >= w->mw_pgno + w->mw_pages) {
+		pg0 = pgno & ~(env->me_wpages - 1);
+		if ((rc = mdb_win_ref(txn, (MDB_ID)pg0 << 1, pg0, env->me_wpages, &w)))
+			return rc;
+	}
+	p = (MDB_page *)(w->mw_ptr + (pgno - w->mw_pgno) * env->me_psize);
+	if (IS_OVERFLOW(p) && (n = p->mp_pages) > w->mw_pgno + w->mw_pages - pgno) {
+		/* The value must be contiguous, give it a window of its own */
+		if (n > last - pgno)
+			return MDB_CORRUPTED;
+		if ((rc = mdb_win_ref(txn, (MDB_ID)pgno << 1 | 1, pgno, n, &w)))
+			return rc;
+		p = (MDB_page *)w->mw_ptr;
+	}
+	txn->mt_wlast = w;
+	*ret = p;
+	return MDB_SUCCESS;
+}
+
+	/** Drop the references of a top-level txn to its windows */
+static void
+mdb_win_release(MDB_txn *txn)
+{
+	MDB_env *env = txn->mt_env;
+	MDB_window *w;
+	unsigned int i;
+
+	pthread_mutex_lock(&env->me_wlock);
+	for (i = 0; i < txn->mt_wcount; i++) {
+		w = txn->mt_wins[i];
+		if (!--w->mw_refs) {
+			w->mw_next = NULL;
+			w->mw_prev = env->me_wtail;
+			if (env->me_wtail)
+				env->me_wtail->mw_next = w;
+			else
+				env->me_whead = w;
+			env->me_wtail = w;
+		}
+	}
+	mdb_win_evict(env, 0);
+	pthread_mutex_unlock(&env->me_wlock);
+	txn->mt_wcount = 0;
+	txn->mt_wlast = NULL;
+}
+
+	/** Unmap all windows, when no txn holds any */
+static void
+mdb_win_unmapall(MDB_env *env)
+{
+	pthread_mutex_lock(&env->me_wlock);
+	mdb_win_evict(env, 1);
+	pthread_mutex_unlock(&env->me_wlock);
+}
+/** @} */
+#endif /* !_WIN32 */
+
 /** Find the address of the page corresponding to a given page number.
  * Set #MDB_TXN_ERROR on failure.
  * @param[in] mc the cursor accessing the page.
@@ -5410,6 +7397,16 @@ mdb_page_get(MDB_cursor *mc, pgno_t pgno, MDB_page **ret, int *lvl)
 				MDB_ID pn = pgno << 1;
 				x = mdb_midl_search(tx2->mt_spill_pgs, pn);
 				if (x <= tx2->mt_spill_pgs[0] && tx2->mt_spill_pgs[x] == pn) {
+#ifndef _WIN32
+					if (env->me_flags & MDB_WINDOWMAP) {
+						int rc = mdb_win_page(txn, pgno, &p);
+						if (rc) {
+							txn->mt_flags |= MDB_TXN_ERROR;
+							return rc;
+						}
+						goto done;
+					}
+#endif
 					p = (MDB_page *)(env->me_map + env->me_psize * pgno);
 					goto done;
 				}
@@ -5427,7 +7424,22 @@ mdb_page_get(MDB_cursor *mc, pgno_t pgno, MDB_page **ret, int *lvl)
 
 	if (pgno < txn->mt_next_pgno) {
 		level = 0;
+#ifndef _WIN32
+		if (env->me_flags & MDB_WINDOWMAP) {
+			int rc = mdb_win_page(txn, pgno, &p);
+			if (rc) {
+				txn->mt_flags |= MDB_TXN_ERROR;
+				return rc;
+			}
+		} else
+#endif
 		p = (MDB_page *)(env->me_map + env->me_psize * pgno);
+#ifndef _WIN32
+		if ((txn->mt_flags & MDB_TXN_CKSUM) && mdb_cksum_check(txn, p, pgno, 0)) {
+			txn->mt_flags |= MDB_TXN_ERROR;
+			return MDB_CORRUPTED;
+		}
+#endif
 	} else {
 		DPRINTF(("page %"Z"u not found", pgno));
 		txn->mt_flags |= MDB_TXN_ERROR;
@@ -5700,6 +7712,9 @@ release:
 		while (j>i)
 			mop[j--] = pg++;
 		mop[0] += ovpages;
+		if (env->me_runs)
+			mdb_run_insert(env->me_runs, mop, pg - ovpages, ovpages);
+		env->me_pgstate.mf_dirty = 1;
 	} else {
 		rc = mdb_midl_append_range(&txn->mt_free_pgs, pg, ovpages);
 		if (rc)
@@ -5709,6 +7724,93 @@ release:
 	return 0;
 }
 
+/** Uncompress a value read from a node with #F_COMPRESSED.
+ * The stored value starts with the 4 byte length of the original,
+ * which is uncompressed into the cursor's buffer.
+ * @param[in] mc The cursor for this operation.
+ * @param[in,out] data The stored value, updated to the original.
+ * @return 0 on success, non-zero on failure.
+ */
+static int
+mdb_val_uncompress(MDB_cursor *mc, MDB_val *data)
+{
+	unsigned char *src = data->mv_data;
+	size_t len;
+
+	if (data->mv_size < 4)
+		return MDB_CORRUPTED;
+	len = mdb_blk_get32(src);
+	if (len > mc->mc_ubufsize) {
+		char *p = realloc(mc->mc_ubuf, len);
+		if (!p)
+			return ENOMEM;
+		mc->mc_ubuf = p;
+		mc->mc_ubufsize = len;
+	}
+	if (mdb_blk_decompress(src + 4, data->mv_size - 4,
+		(unsigned char *)mc->mc_ubuf, len)) {
+		DPRINTF(("uncompressing %"Z"u bytes failed", data->mv_size));
+		return MDB_CORRUPTED;
+	}
+	data->mv_data = mc->mc_ubuf;
+	data->mv_size = len;
+	return MDB_SUCCESS;
+}
+
+/** Copy a key rebuilt from a #P_PREFIX page into the cursor's value
+ * buffer, for callers that return it after their cursor is gone.
+ * @param[in] mc The cursor for this operation.
+ * @param[in,out] val The key, updated to point to the copy.
+ * @return 0 on success, ENOMEM if the buffer could not grow.
+ */
+static int
+mdb_cursor_keep(MDB_cursor *mc, MDB_val *val)
+{
+	if (val->mv_size > mc->mc_ubufsize) {
+		char *p = realloc(mc->mc_ubuf, val->mv_size);
+		if (!p)
+			return ENOMEM;
+		mc->mc_ubuf = p;
+		mc->mc_ubufsize = val->mv_size;
+	}
+	val->mv_data = memcpy(mc->mc_ubuf, val->mv_data, val->mv_size);
+	return MDB_SUCCESS;
+}
+
+/** Compress a value about to be stored, if that saves at least an
+ * eighth of its size. The result is in the env's scratch buffer.
+ * @param[in] env The environment.
+ * @param[in] data The value to store.
+ * @param[out] cdata The compressed value, its size is 0 if the
+ * value should be stored as is.
+ * @return 0 on success, non-zero on failure.
+ */
+static int
+mdb_val_compress(MDB_env *env, MDB_val *data, MDB_val *cdata)
+{
+	size_t max = data->mv_size - data->mv_size / 8, len;
+
+	cdata->mv_size = 0;
+	/* no room for the size header plus any saving */
+	if (max <= 4)
+		return MDB_SUCCESS;
+	if (max > env->me_cbufsize) {
+		char *p = realloc(env->me_cbuf, max);
+		if (!p)
+			return ENOMEM;
+		env->me_cbuf = p;
+		env->me_cbufsize = max;
+	}
+	len = mdb_blk_compress(data->mv_data, data->mv_size,
+		(unsigned char *)env->me_cbuf + 4, max - 4);
+	if (len) {
+		mdb_blk_put32((unsigned char *)env->me_cbuf, data->mv_size);
+		cdata->mv_data = env->me_cbuf;
+		cdata->mv_size = len + 4;
+	}
+	return MDB_SUCCESS;
+}
+
 /** Return the data associated with a given node.
  * @param[in] mc The cursor for this operation.
  * @param[in] leaf The node being read.
@@ -5725,6 +7827,8 @@ mdb_node_read(MDB_cursor *mc, MDB_node *leaf, MDB_val *data)
 	if (!F_ISSET(leaf->mn_flags, F_BIGDATA)) {
 		data->mv_size = NODEDSZ(leaf);
 		data->mv_data = NODEDATA(leaf);
+		if (F_ISSET(leaf->mn_flags, F_COMPRESSED))
+			return mdb_val_uncompress(mc, data);
 		return MDB_SUCCESS;
 	}
 
@@ -5738,6 +7842,8 @@ mdb_node_read(MDB_cursor *mc, MDB_node *leaf, MDB_val *data)
 	}
 	data->mv_data = METADATA(omp);
 
+	if (F_ISSET(leaf->mn_flags, F_COMPRESSED))
+		return mdb_val_uncompress(mc, data);
 	return MDB_SUCCESS;
 }
 
@@ -5747,7 +7853,8 @@ mdb_get(MDB_txn *txn, MDB_dbi dbi,
 {
 	MDB_cursor	mc;
 	MDB_xcursor	mx;
-	int exact = 0;
+	unsigned long long start;
+	int exact = 0, rc;
 	DKBUF;
 
 	DPRINTF(("===> get db %u key [%s]", dbi, DKEY(key)));
@@ -5759,15 +7866,270 @@ mdb_get(MDB_txn *txn, MDB_dbi dbi,
 		return MDB_BAD_TXN;
 
 	mdb_cursor_init(&mc, txn, dbi, &mx);
-	return mdb_cursor_set(&mc, key, data, MDB_SET, &exact);
+	/* Values are uncompressed into the txn's buffer */
+	mc.mc_ubuf = txn->mt_ubuf;
+	mc.mc_ubufsize = txn->mt_ubufsize;
+	start = MDB_OPSTAT_START(txn->mt_env);
+	rc = mdb_cursor_set(&mc, key, data, MDB_SET, &exact);
+	/* A dup rebuilt in the sub-cursor goes away with it */
+	if (rc == MDB_SUCCESS && IN_KBUF(&mx.mx_cursor, data))
+		rc = mdb_cursor_keep(&mc, data);
+	mdb_opstat_add(txn->mt_env, MDB_OPS_GET, start);
+	txn->mt_ubuf = mc.mc_ubuf;
+	txn->mt_ubufsize = mc.mc_ubufsize;
+	return rc;
 }
 
-/** Find a sibling for a page.
- * Replaces the page at the top of the cursor's stack with the
- * specified sibling, if one exists.
- * @param[in] mc The cursor for this operation.
- * @param[in] move_right Non-zero if the right sibling is requested,
- * otherwise the left sibling.
+/** Advise the OS that a range of mapped pages will be needed. */
+static void
+mdb_page_willneed(MDB_env *env, pgno_t pgno, pgno_t npages)
+{
+	if (env->me_flags & MDB_WINDOWMAP) {
+		/* Most of the file is not mapped, ask for it by offset */
+#ifdef POSIX_FADV_WILLNEED
+		posix_fadvise(env->me_fd, (off_t)pgno * env->me_psize,
+			(off_t)npages * env->me_psize, POSIX_FADV_WILLNEED);
+#endif
+	} else {
+#if defined(MADV_WILLNEED) || defined(POSIX_MADV_WILLNEED)
+	size_t off = (size_t)pgno * env->me_psize;
+	size_t len = (size_t)npages * env->me_psize;
+	/* madvise wants an address aligned to the OS page size */
+	size_t pad = off & (env->me_os_psize - 1);
+	off -= pad;
+	len += pad;
+	if (off + len > env->me_mapsize)
+		len = env->me_mapsize - off;
+#ifdef MADV_WILLNEED
+	madvise(env->me_map + off, len, MADV_WILLNEED);
+#else
+	posix_madvise(env->me_map + off, len, POSIX_MADV_WILLNEED);
+#endif
+#endif
+	}
+}
+
+int
+mdb_prefetch(MDB_txn *txn, MDB_dbi dbi, MDB_val *key, unsigned int flags)
+{
+	MDB_cursor	mc;
+	MDB_xcursor	mx;
+	MDB_page	*mp;
+	MDB_node	*node;
+	pgno_t		pgno;
+	indx_t		i;
+	unsigned int	cksum;
+	int exact, depth, level, rc;
+
+	if (!key || !TXN_DBI_EXIST(txn, dbi, DB_USRVALID))
+		return EINVAL;
+
+	if (txn->mt_flags & MDB_TXN_BLOCKED)
+		return MDB_BAD_TXN;
+
+	mdb_cursor_init(&mc, txn, dbi, &mx);
+	pgno = mc.mc_db->md_root;
+	if (pgno == P_INVALID)
+		return MDB_NOTFOUND;
+
+	/* Like mdb_page_search_root(), but stop short of the leaf */
+	for (depth = mc.mc_db->md_depth; depth > 1; depth--) {
+		if ((rc = mdb_page_get(&mc, pgno, &mp, NULL)) != 0)
+			return rc;
+		if (!IS_BRANCH(mp))
+			return MDB_CORRUPTED;
+		mc.mc_pg[0] = mp;
+		mc.mc_ki[0] = 0;
+		mc.mc_snum = 1;
+		mc.mc_top = 0;
+		node = mdb_node_search(&mc, key, &exact);
+		if (node == NULL)
+			i = NUMKEYS(mp) - 1;
+		else {
+			i = mc.mc_ki[0];
+			if (!exact && i)
+				i--;
+		}
+		pgno = NODEPGNO(NODEPTR(mp, i));
+	}
+
+	if (!(flags & MDB_PREFETCH_DATA)) {
+		/* Verifying the page's checksum would read it right away */
+		cksum = txn->mt_flags & MDB_TXN_CKSUM;
+		txn->mt_flags ^= cksum;
+		rc = mdb_page_get(&mc, pgno, &mp, &level);
+		txn->mt_flags |= cksum;
+		if (rc == MDB_SUCCESS && !level)
+			mdb_page_willneed(txn->mt_env, pgno, 1);
+		return rc;
+	}
+	if ((rc = mdb_page_get(&mc, pgno, &mp, &level)) != 0)
+		return rc;
+
+	if (!IS_LEAF(mp))
+		return MDB_CORRUPTED;
+	mc.mc_pg[0] = mp;
+	mc.mc_ki[0] = 0;
+	mc.mc_snum = 1;
+	mc.mc_top = 0;
+	node = mdb_node_search(&mc, key, &exact);
+	if (node == NULL || !exact)
+		return MDB_NOTFOUND;
+	if (IS_LEAF2(mp) || !F_ISSET(node->mn_flags, F_BIGDATA))
+		return MDB_SUCCESS;
+	memcpy(&pgno, NODEDATA(node), sizeof(pgno));
+	cksum = txn->mt_flags & MDB_TXN_CKSUM;
+	txn->mt_flags ^= cksum;
+	rc = mdb_page_get(&mc, pgno, &mp, &level);
+	txn->mt_flags |= cksum;
+	if (rc == MDB_SUCCESS && !level)
+		mdb_page_willneed(txn->mt_env, pgno,
+			OVPAGES(NODEDSZ(node), txn->mt_env->me_psize));
+	return rc;
+}
+
+	/** Check a page for #mdb_scrub(): against its checksum if \b cksum
+	 *	is set, and against its page number.
+	 */
+static void
+mdb_scrub_page(MDB_txn *txn, MDB_page *mp, pgno_t pgno, int cksum,
+	MDB_scrub *sc)
+{
+	int bad = mp->mp_pgno != pgno;
+
+#ifndef _WIN32
+	if (cksum && !bad)
+		bad = mdb_cksum_check(txn, mp, pgno, 1);
+#endif
+	sc->ms_pages += IS_OVERFLOW(mp) && mp->mp_pages < txn->mt_next_pgno ?
+		mp->mp_pages : 1;
+	if (bad) {
+		DPRINTF(("page %"Z"u is corrupt", pgno));
+		sc->ms_corrupt++;
+		sc->ms_badpg = pgno;
+	}
+}
+
+	/** Check all pages of a sub-database of duplicates for #mdb_scrub() */
+static int
+mdb_scrub_tree(MDB_cursor *mc, pgno_t pgno, int depth, int cksum,
+	MDB_scrub *sc)
+{
+	MDB_page	*mp;
+	indx_t		i;
+	int rc;
+
+	if (depth >= CURSOR_STACK)
+		return MDB_CORRUPTED;
+	if ((rc = mdb_page_get(mc, pgno, &mp, NULL)) != 0)
+		return rc;
+	mdb_scrub_page(mc->mc_txn, mp, pgno, cksum, sc);
+	if (IS_BRANCH(mp)) {
+		for (i = 0; i < NUMKEYS(mp); i++) {
+			rc = mdb_scrub_tree(mc, NODEPGNO(NODEPTR(mp, i)), depth + 1,
+				cksum, sc);
+			if (rc)
+				return rc;
+		}
+	} else if (!IS_LEAF(mp)) {
+		return MDB_CORRUPTED;
+	}
+	return MDB_SUCCESS;
+}
+
+int
+mdb_scrub(MDB_txn *txn, MDB_dbi dbi, MDB_val *key, MDB_scrub *sc)
+{
+	MDB_cursor	mc;
+	MDB_xcursor	mx;
+	MDB_page	*mp, *omp;
+	MDB_node	*node;
+	MDB_db		db;
+	pgno_t		pgno, seen[CURSOR_STACK];
+	size_t		budget;
+	unsigned int	cksum;
+	indx_t		i;
+	int rc;
+
+	if (!key || !sc || !TXN_DBI_EXIST(txn, dbi, DB_VALID))
+		return EINVAL;
+
+	if (txn->mt_flags & MDB_TXN_BLOCKED)
+		return MDB_BAD_TXN;
+
+	budget = sc->ms_pages;
+	sc->ms_pages = 0;
+	sc->ms_corrupt = 0;
+	for (i = 0; i < CURSOR_STACK; i++)
+		seen[i] = P_INVALID;
+	mdb_cursor_init(&mc, txn, dbi, &mx);
+
+	/* Don't verify pages as they are read, so that a corrupt
+	 * page is counted instead of ending the walk.
+	 */
+	cksum = txn->mt_flags & MDB_TXN_CKSUM;
+	txn->mt_flags ^= cksum;
+	rc = mdb_page_search(&mc, key->mv_size ? key : NULL,
+		key->mv_size ? 0 : MDB_PS_FIRST);
+	while (rc == MDB_SUCCESS) {
+		/* The branch pages above the leaf, each one once */
+		for (i = 0; i < mc.mc_snum; i++) {
+			pgno = i ? NODEPGNO(NODEPTR(mc.mc_pg[i-1], mc.mc_ki[i-1])) :
+				mc.mc_db->md_root;
+			if (seen[i] != pgno) {
+				seen[i] = pgno;
+				mdb_scrub_page(txn, mc.mc_pg[i], pgno, cksum, sc);
+			}
+		}
+		mp = mc.mc_pg[mc.mc_top];
+		if (!IS_LEAF(mp) || IS_LEAF2(mp)) {
+			rc = MDB_CORRUPTED;
+			break;
+		}
+		for (i = 0; i < NUMKEYS(mp); i++) {
+			node = NODEPTR(mp, i);
+			if (F_ISSET(node->mn_flags, F_BIGDATA)) {
+				memcpy(&pgno, NODEDATA(node), sizeof(pgno));
+				if ((rc = mdb_page_get(&mc, pgno, &omp, NULL)) != 0)
+					break;
+				mdb_scrub_page(txn, omp, pgno, cksum, sc);
+			} else if (F_ISSET(node->mn_flags, F_SUBDATA|F_DUPDATA)) {
+				memcpy(&db, NODEDATA(node), sizeof(db));
+				if ((rc = mdb_scrub_tree(&mc, db.md_root, 0, cksum, sc)) != 0)
+					break;
+			}
+		}
+		if (rc || (rc = mdb_cursor_sibling(&mc, 1)) != 0)
+			break;
+		if (sc->ms_pages >= budget) {
+			/* Resume at the leaf we just moved to */
+			mp = mc.mc_pg[mc.mc_top];
+			if (!NUMKEYS(mp) || !IS_LEAF(mp) || IS_LEAF2(mp)) {
+				rc = MDB_CORRUPTED;
+				break;
+			}
+			node = NODEPTR(mp, 0);
+			MDB_GET_KEY(&mc, node, key);
+			if (IN_KBUF(&mc, key)) {
+				mc.mc_ubuf = txn->mt_ubuf;
+				mc.mc_ubufsize = txn->mt_ubufsize;
+				rc = mdb_cursor_keep(&mc, key);
+				txn->mt_ubuf = mc.mc_ubuf;
+				txn->mt_ubufsize = mc.mc_ubufsize;
+			}
+			break;
+		}
+	}
+	txn->mt_flags |= cksum;
+	return rc;
+}
+
+/** Find a sibling for a page.
+ * Replaces the page at the top of the cursor's stack with the
+ * specified sibling, if one exists.
+ * @param[in] mc The cursor for this operation.
+ * @param[in] move_right Non-zero if the right sibling is requested,
+ * otherwise the left sibling.
  * @return 0 on success, non-zero on failure.
  */
 static int
@@ -5848,7 +8210,7 @@ mdb_cursor_next(MDB_cursor *mc, MDB_val *key, MDB_val *data, MDB_cursor_op op)
 				rc = mdb_cursor_next(&mc->mc_xcursor->mx_cursor, data, NULL, MDB_NEXT);
 				if (op != MDB_NEXT || rc != MDB_NOTFOUND) {
 					if (rc == MDB_SUCCESS)
-						MDB_GET_KEY(leaf, key);
+						MDB_GET_KEY(mc, leaf, key);
 					return rc;
 				}
 			}
@@ -5904,7 +8266,7 @@ skip:
 		}
 	}
 
-	MDB_GET_KEY(leaf, key);
+	MDB_GET_KEY(mc, leaf, key);
 	return MDB_SUCCESS;
 }
 
@@ -5932,7 +8294,7 @@ mdb_cursor_prev(MDB_cursor *mc, MDB_val *key, MDB_val *data, MDB_cursor_op op)
 				rc = mdb_cursor_prev(&mc->mc_xcursor->mx_cursor, data, NULL, MDB_PREV);
 				if (op != MDB_PREV || rc != MDB_NOTFOUND) {
 					if (rc == MDB_SUCCESS) {
-						MDB_GET_KEY(leaf, key);
+						MDB_GET_KEY(mc, leaf, key);
 						mc->mc_flags &= ~C_EOF;
 					}
 					return rc;
@@ -5987,7 +8349,7 @@ mdb_cursor_prev(MDB_cursor *mc, MDB_val *key, MDB_val *data, MDB_cursor_op op)
 		}
 	}
 
-	MDB_GET_KEY(leaf, key);
+	MDB_GET_KEY(mc, leaf, key);
 	return MDB_SUCCESS;
 }
 
@@ -6010,6 +8372,7 @@ mdb_cursor_set(MDB_cursor *mc, MDB_val *key, MDB_val *data,
 	/* See if we're already on the right page */
 	if (mc->mc_flags & C_INITIALIZED) {
 		MDB_val nodekey;
+		char pbuf[MDB_PFXBUF];
 
 		mp = mc->mc_pg[mc->mc_top];
 		if (!NUMKEYS(mp)) {
@@ -6021,7 +8384,7 @@ mdb_cursor_set(MDB_cursor *mc, MDB_val *key, MDB_val *data,
 			nodekey.mv_data = LEAF2KEY(mp, 0, nodekey.mv_size);
 		} else {
 			leaf = NODEPTR(mp, 0);
-			MDB_GET_KEY2(leaf, nodekey);
+			MDB_GET_KEY2(mc, leaf, nodekey, pbuf);
 		}
 		rc = mc->mc_dbx->md_cmp(key, &nodekey);
 		if (rc == 0) {
@@ -6042,7 +8405,7 @@ mdb_cursor_set(MDB_cursor *mc, MDB_val *key, MDB_val *data,
 						 nkeys-1, nodekey.mv_size);
 				} else {
 					leaf = NODEPTR(mp, nkeys-1);
-					MDB_GET_KEY2(leaf, nodekey);
+					MDB_GET_KEY2(mc, leaf, nodekey, pbuf);
 				}
 				rc = mc->mc_dbx->md_cmp(key, &nodekey);
 				if (rc == 0) {
@@ -6060,7 +8423,7 @@ mdb_cursor_set(MDB_cursor *mc, MDB_val *key, MDB_val *data,
 								 mc->mc_ki[mc->mc_top], nodekey.mv_size);
 						} else {
 							leaf = NODEPTR(mp, mc->mc_ki[mc->mc_top]);
-							MDB_GET_KEY2(leaf, nodekey);
+							MDB_GET_KEY2(mc, leaf, nodekey, pbuf);
 						}
 						rc = mc->mc_dbx->md_cmp(key, &nodekey);
 						if (rc == 0) {
@@ -6185,7 +8548,7 @@ set1:
 
 	/* The key already matches in all other cases */
 	if (op == MDB_SET_RANGE || op == MDB_SET_KEY)
-		MDB_GET_KEY(leaf, key);
+		MDB_GET_KEY(mc, leaf, key);
 	DPRINTF(("==> cursor placed on key [%s]", DKEY(key)));
 
 	return rc;
@@ -6231,7 +8594,7 @@ mdb_cursor_first(MDB_cursor *mc, MDB_val *key, MDB_val *data)
 				return rc;
 		}
 	}
-	MDB_GET_KEY(leaf, key);
+	MDB_GET_KEY(mc, leaf, key);
 	return MDB_SUCCESS;
 }
 
@@ -6274,12 +8637,12 @@ mdb_cursor_last(MDB_cursor *mc, MDB_val *key, MDB_val *data)
 		}
 	}
 
-	MDB_GET_KEY(leaf, key);
+	MDB_GET_KEY(mc, leaf, key);
 	return MDB_SUCCESS;
 }
 
-int
-mdb_cursor_get(MDB_cursor *mc, MDB_val *key, MDB_val *data,
+static int
+mdb_cursor_get0(MDB_cursor *mc, MDB_val *key, MDB_val *data,
     MDB_cursor_op op)
 {
 	int		 rc;
@@ -6310,10 +8673,10 @@ mdb_cursor_get(MDB_cursor *mc, MDB_val *key, MDB_val *data,
 				key->mv_data = LEAF2KEY(mp, mc->mc_ki[mc->mc_top], key->mv_size);
 			} else {
 				MDB_node *leaf = NODEPTR(mp, mc->mc_ki[mc->mc_top]);
-				MDB_GET_KEY(leaf, key);
+				MDB_GET_KEY(mc, leaf, key);
 				if (data) {
 					if (F_ISSET(leaf->mn_flags, F_DUPDATA)) {
-						rc = mdb_cursor_get(&mc->mc_xcursor->mx_cursor, data, NULL, MDB_GET_CURRENT);
+						rc = mdb_cursor_get0(&mc->mc_xcursor->mx_cursor, data, NULL, MDB_GET_CURRENT);
 					} else {
 						rc = mdb_node_read(mc, leaf, data);
 					}
@@ -6436,7 +8799,7 @@ fetchm:
 		{
 			MDB_node *leaf = NODEPTR(mc->mc_pg[mc->mc_top], mc->mc_ki[mc->mc_top]);
 			if (!F_ISSET(leaf->mn_flags, F_DUPDATA)) {
-				MDB_GET_KEY(leaf, key);
+				MDB_GET_KEY(mc, leaf, key);
 				rc = mdb_node_read(mc, leaf, data);
 				break;
 			}
@@ -6465,6 +8828,21 @@ fetchm:
 	return rc;
 }
 
+int
+mdb_cursor_get(MDB_cursor *mc, MDB_val *key, MDB_val *data,
+    MDB_cursor_op op)
+{
+	unsigned long long start;
+	int rc;
+
+	if (mc == NULL)
+		return EINVAL;
+	start = MDB_OPSTAT_START(mc->mc_txn->mt_env);
+	rc = mdb_cursor_get0(mc, key, data, op);
+	mdb_opstat_add(mc->mc_txn->mt_env, MDB_OPS_GET, start);
+	return rc;
+}
+
 /** Touch all the pages in the cursor stack. Set mc_top.
  *	Makes sure all the pages are writable, before attempting a write operation.
  * @param[in] mc The cursor to operate on.
@@ -6499,19 +8877,22 @@ mdb_cursor_touch(MDB_cursor *mc)
 /** Do not spill pages to disk if txn is getting full, may fail instead */
 #define MDB_NOSPILL	0x8000
 
-int
-mdb_cursor_put(MDB_cursor *mc, MDB_val *key, MDB_val *data,
+static int
+mdb_cursor_put0(MDB_cursor *mc, MDB_val *key, MDB_val *data,
     unsigned int flags)
 {
 	MDB_env		*env;
 	MDB_node	*leaf = NULL;
 	MDB_page	*fp, *mp, *sub_root = NULL;
 	uint16_t	fp_flags;
-	MDB_val		xdata, *rdata, dkey, olddata;
+	MDB_val		xdata, *rdata, dkey, olddata, cdata;
+	MDB_val		kcopy, dcopy, *udata = data;
+	char		kbuf[MDB_PFXBUF], dbuf[MDB_PFXBUF];
 	MDB_db dummy;
 	int do_sub = 0, insert_key, insert_data;
 	unsigned int mcount = 0, dcount = 0, nospill;
 	size_t nsize;
+	ssize_t room;
 	int rc, rc2;
 	unsigned int nflags;
 	DKBUF;
@@ -6521,6 +8902,20 @@ mdb_cursor_put(MDB_cursor *mc, MDB_val *key, MDB_val *data,
 
 	env = mc->mc_txn->mt_env;
 
+	/* A key or dup this cursor returned from a #P_PREFIX page is in
+	 * its key buffer, which positioning the cursor overwrites.
+	 */
+	if (IN_KBUF(mc, key)) {
+		kcopy.mv_size = key->mv_size;
+		kcopy.mv_data = memcpy(kbuf, key->mv_data, key->mv_size);
+		key = &kcopy;
+	}
+	if (mc->mc_xcursor && IN_KBUF(&mc->mc_xcursor->mx_cursor, data)) {
+		dcopy.mv_size = data->mv_size;
+		dcopy.mv_data = memcpy(dbuf, data->mv_data, data->mv_size);
+		data = &dcopy;
+	}
+
 	/* Check this first so counter will always be zero on any
 	 * early failures.
 	 */
@@ -6566,9 +8961,15 @@ mdb_cursor_put(MDB_cursor *mc, MDB_val *key, MDB_val *data,
 	} else {
 		int exact = 0;
 		MDB_val d2;
+		MDB_val *dp = &d2;
+		/* The old value is only needed for MDB_NOOVERWRITE and for
+		 * dups, don't fetch or uncompress it otherwise.
+		 */
+		if (!(flags & MDB_NOOVERWRITE) && !(mc->mc_db->md_flags & MDB_DUPSORT))
+			dp = NULL;
 		if (flags & MDB_APPEND) {
 			MDB_val k2;
-			rc = mdb_cursor_last(mc, &k2, &d2);
+			rc = mdb_cursor_last(mc, &k2, dp);
 			if (rc == 0) {
 				rc = mc->mc_dbx->md_cmp(key, &k2);
 				if (rc > 0) {
@@ -6580,11 +8981,11 @@ mdb_cursor_put(MDB_cursor *mc, MDB_val *key, MDB_val *data,
 				}
 			}
 		} else {
-			rc = mdb_cursor_set(mc, key, &d2, MDB_SET, &exact);
+			rc = mdb_cursor_set(mc, key, dp, MDB_SET, &exact);
 		}
 		if ((flags & MDB_NOOVERWRITE) && rc == 0) {
 			DPRINTF(("duplicate key [%s]", DKEY(key)));
-			*data = d2;
+			*udata = d2;
 			return MDB_KEYEXIST;
 		}
 		if (rc && rc != MDB_NOTFOUND)
@@ -6594,6 +8995,17 @@ mdb_cursor_put(MDB_cursor *mc, MDB_val *key, MDB_val *data,
 	if (mc->mc_flags & C_DEL)
 		mc->mc_flags ^= C_DEL;
 
+	/* Store large values compressed, see #mdb_set_compress() */
+	if (mc->mc_dbx->md_cmin && data->mv_size >= mc->mc_dbx->md_cmin &&
+		!(flags & (MDB_RESERVE|F_SUBDATA)) && !(mc->mc_flags & C_SUB)) {
+		if ((rc2 = mdb_val_compress(env, data, &cdata)))
+			return rc2;
+		if (cdata.mv_size) {
+			data = &cdata;
+			flags |= F_COMPRESSED;
+		}
+	}
+
 	/* Cursor is positioned, check for room in the dirty list */
 	if (!nospill) {
 		if (flags & MDB_MULTIPLE) {
@@ -6761,7 +9173,8 @@ more:
 			}
 
 			fp_flags = fp->mp_flags;
-			if (NODESIZE + NODEKSZ(leaf) + xdata.mv_size > env->me_nodemax) {
+			if (NODESIZE + NODEKSZ(leaf) + PAGEPFXLEN(mc->mc_pg[mc->mc_top]) +
+				xdata.mv_size > env->me_nodemax) {
 					/* Too big for a sub-page, convert to sub-DB */
 					fp_flags &= ~P_SUBP;
 prep_subDB:
@@ -6773,7 +9186,8 @@ prep_subDB:
 							dummy.md_flags |= MDB_INTEGERKEY;
 					} else {
 						dummy.md_pad = 0;
-						dummy.md_flags = 0;
+						dummy.md_flags = (mc->mc_db->md_flags & MDB_PREFIXDUP) ?
+							MDB_PREFIXKEY : 0;
 					}
 					dummy.md_depth = 1;
 					dummy.md_branch_pages = 0;
@@ -6873,6 +9287,8 @@ current:
 					omp = np;
 				}
 				SETDSZ(leaf, data->mv_size);
+				leaf->mn_flags = (leaf->mn_flags & ~F_COMPRESSED) |
+					(flags & F_COMPRESSED);
 				if (F_ISSET(flags, MDB_RESERVE))
 					data->mv_data = METADATA(omp);
 				else
@@ -6887,16 +9303,34 @@ current:
 			 * also reuse this node if the new data is smaller,
 			 * but instead we opt to shrink the node in that case.
 			 */
+			leaf->mn_flags = (leaf->mn_flags & ~F_COMPRESSED) |
+				(flags & F_COMPRESSED);
 			if (F_ISSET(flags, MDB_RESERVE))
 				data->mv_data = olddata.mv_data;
 			else if (!(mc->mc_flags & C_SUB))
 				memcpy(olddata.mv_data, data->mv_data, data->mv_size);
 			else {
-				memcpy(NODEKEY(leaf), key->mv_data, key->mv_size);
+				/* Replace the key in place, unless it no longer
+				 * fits with the shared prefix of the page
+				 */
+				mp = mc->mc_pg[mc->mc_top];
+				nsize = mdb_pfx_match(mc, mp, key);
+				if (nsize < PAGEPFXLEN(mp)) {
+					if (mdb_pfx_grow(mp, nsize) > (ssize_t)SIZELEFT(mp))
+						goto replace;
+					if ((rc2 = mdb_pfx_shrink(mc, nsize)) != 0)
+						return rc2;
+					leaf = NODEPTR(mp, mc->mc_ki[mc->mc_top]);
+				}
+				if (key->mv_size - nsize != NODEKSZ(leaf))
+					goto replace;
+				memcpy(NODEKEY(leaf), (char *)key->mv_data + nsize,
+					key->mv_size - nsize);
 				goto fix_parent;
 			}
 			return MDB_SUCCESS;
 		}
+replace:
 		mdb_node_del(mc, 0);
 	}
 
@@ -6904,8 +9338,18 @@ current:
 
 new_sub:
 	nflags = flags & NODE_ADD_FLAGS;
-	nsize = IS_LEAF2(mc->mc_pg[mc->mc_top]) ? key->mv_size : mdb_leaf_size(env, key, rdata);
-	if (SIZELEFT(mc->mc_pg[mc->mc_top]) < nsize) {
+	mp = mc->mc_pg[mc->mc_top];
+	nsize = IS_LEAF2(mp) ? key->mv_size : mdb_leaf_size(env, key, rdata);
+	room = SIZELEFT(mp);
+	if (IS_PREFIX(mp)) {
+		/* The key is stored without the prefix it shares with the
+		 * page, which must get shorter if that's not all of it.
+		 */
+		unsigned int plen = mdb_pfx_match(mc, mp, key);
+		nsize -= plen & ~1U;
+		room -= mdb_pfx_grow(mp, plen);
+	}
+	if (room < (ssize_t)nsize) {
 		if (( flags & (F_DUPDATA|F_SUBDATA)) == F_DUPDATA )
 			nflags &= ~MDB_APPEND; /* sub-page may need room to grow */
 		if (!insert_key)
@@ -6960,7 +9404,7 @@ put_sub:
 			new_dupdata = (int)dkey.mv_size;
 			/* converted, write the original data first */
 			if (dkey.mv_size) {
-				rc = mdb_cursor_put(&mc->mc_xcursor->mx_cursor, &dkey, &xdata, xflags);
+				rc = mdb_cursor_put0(&mc->mc_xcursor->mx_cursor, &dkey, &xdata, xflags);
 				if (rc)
 					goto bad_sub;
 				/* we've done our job */
@@ -6988,7 +9432,7 @@ put_sub:
 			ecount = mc->mc_xcursor->mx_db.md_entries;
 			if (flags & MDB_APPENDDUP)
 				xflags |= MDB_APPEND;
-			rc = mdb_cursor_put(&mc->mc_xcursor->mx_cursor, data, &xdata, xflags);
+			rc = mdb_cursor_put0(&mc->mc_xcursor->mx_cursor, data, &xdata, xflags);
 			if (flags & F_SUBDATA) {
 				void *db = NODEDATA(leaf);
 				memcpy(db, &mc->mc_xcursor->mx_db, sizeof(MDB_db));
@@ -7028,6 +9472,23 @@ bad_sub:
 	return rc;
 }
 
+int
+mdb_cursor_put(MDB_cursor *mc, MDB_val *key, MDB_val *data,
+    unsigned int flags)
+{
+	unsigned long long start;
+	int rc;
+
+	if (mc == NULL)
+		return EINVAL;
+	if (mc->mc_txn->mt_env->me_compact)
+		mdb_journal_put(mc, key, data, flags);
+	start = MDB_OPSTAT_START(mc->mc_txn->mt_env);
+	rc = mdb_cursor_put0(mc, key, data, flags);
+	mdb_opstat_add(mc->mc_txn->mt_env, MDB_OPS_PUT, start);
+	return rc;
+}
+
 int
 mdb_cursor_del(MDB_cursor *mc, unsigned int flags)
 {
@@ -7044,6 +9505,9 @@ mdb_cursor_del(MDB_cursor *mc, unsigned int flags)
 	if (mc->mc_ki[mc->mc_top] >= NUMKEYS(mc->mc_pg[mc->mc_top]))
 		return MDB_NOTFOUND;
 
+	if (mc->mc_txn->mt_env->me_compact)
+		mdb_journal_del(mc, flags);
+
 	if (!(flags & MDB_NOSPILL) && (rc = mdb_page_spill(mc, NULL, NULL)))
 		return rc;
 
@@ -7243,6 +9707,9 @@ mdb_node_add(MDB_cursor *mc, indx_t indx,
 	MDB_page	*mp = mc->mc_pg[mc->mc_top];
 	MDB_page	*ofp = NULL;		/* overflow page */
 	void		*ndata;
+	MDB_val		 pkey;
+	unsigned int	 plen = 0;
+	int			 rc;
 	DKBUF;
 
 	mdb_cassert(mc, mp->mp_upper >= mp->mp_lower);
@@ -7270,6 +9737,16 @@ mdb_node_add(MDB_cursor *mc, indx_t indx,
 	}
 
 	room = (ssize_t)SIZELEFT(mp) - (ssize_t)sizeof(indx_t);
+	if (IS_PREFIX(mp)) {
+		/* Store the key without the page's shared prefix. If it
+		 * doesn't start with all of it, the prefix gets shorter.
+		 */
+		plen = mdb_pfx_match(mc, mp, key);
+		room -= mdb_pfx_grow(mp, plen);
+		pkey.mv_size = key->mv_size - plen;
+		pkey.mv_data = (char *)key->mv_data + plen;
+		key = &pkey;
+	}
 	if (key != NULL)
 		node_size += key->mv_size;
 	if (IS_LEAF(mp)) {
@@ -7277,9 +9754,8 @@ mdb_node_add(MDB_cursor *mc, indx_t indx,
 		if (F_ISSET(flags, F_BIGDATA)) {
 			/* Data already on overflow page. */
 			node_size += sizeof(pgno_t);
-		} else if (node_size + data->mv_size > mc->mc_txn->mt_env->me_nodemax) {
+		} else if (node_size + plen + data->mv_size > mc->mc_txn->mt_env->me_nodemax) {
 			int ovpages = OVPAGES(data->mv_size, mc->mc_txn->mt_env->me_psize);
-			int rc;
 			/* Put data on overflow page. */
 			DPRINTF(("data size is %"Z"u, node would be %"Z"u, put data on overflow page",
 			    data->mv_size, node_size+data->mv_size));
@@ -7300,6 +9776,11 @@ mdb_node_add(MDB_cursor *mc, indx_t indx,
 		goto full;
 
 update:
+	if (plen < PAGEPFXLEN(mp) && (rc = mdb_pfx_shrink(mc, plen)) != 0) {
+		mc->mc_txn->mt_flags |= MDB_TXN_ERROR;
+		return rc;
+	}
+
 	/* Move higher pointers up one slot. */
 	for (i = NUMKEYS(mp); i > indx; i--)
 		mp->mp_ptrs[i] = mp->mp_ptrs[i - 1];
@@ -7581,6 +10062,8 @@ mdb_cursor_init(MDB_cursor *mc, MDB_txn *txn, MDB_dbi dbi, MDB_xcursor *mx)
 	mc->mc_pg[0] = 0;
 	mc->mc_ki[0] = 0;
 	mc->mc_flags = 0;
+	mc->mc_ubuf = NULL;
+	mc->mc_ubufsize = 0;
 	if (txn->mt_dbs[dbi].md_flags & MDB_DUPSORT) {
 		mdb_tassert(txn, mx != NULL);
 		mc->mc_xcursor = mx;
@@ -7639,7 +10122,13 @@ mdb_cursor_renew(MDB_txn *txn, MDB_cursor *mc)
 	if (txn->mt_flags & MDB_TXN_BLOCKED)
 		return MDB_BAD_TXN;
 
-	mdb_cursor_init(mc, txn, mc->mc_dbi, mc->mc_xcursor);
+	{
+		char *ubuf = mc->mc_ubuf;
+		size_t ubufsize = mc->mc_ubufsize;
+		mdb_cursor_init(mc, txn, mc->mc_dbi, mc->mc_xcursor);
+		mc->mc_ubuf = ubuf;
+		mc->mc_ubufsize = ubufsize;
+	}
 	return MDB_SUCCESS;
 }
 
@@ -7693,6 +10182,7 @@ mdb_cursor_close(MDB_cursor *mc)
 			if (*prev == mc)
 				*prev = mc->mc_next;
 		}
+		free(mc->mc_ubuf);
 		free(mc);
 	}
 }
@@ -7805,6 +10295,9 @@ mdb_cursor_copy(const MDB_cursor *csrc, MDB_cursor *cdst);
 } while (0)
 
 /** Move a node from csrc to cdst.
+ * @return 0 on success, #MDB_PAGE_FULL without changing the pages
+ * if the node does not fit into the shared prefix of a #P_PREFIX
+ * destination, other non-zero values on failure.
  */
 static int
 mdb_node_move(MDB_cursor *csrc, MDB_cursor *cdst, int fromleft)
@@ -7815,6 +10308,7 @@ mdb_node_move(MDB_cursor *csrc, MDB_cursor *cdst, int fromleft)
 	MDB_cursor mn;
 	int			 rc;
 	unsigned short flags;
+	char		 pbuf[MDB_PFXBUF], bbuf[MDB_PFXBUF];
 
 	DKBUF;
 
@@ -7847,18 +10341,26 @@ mdb_node_move(MDB_cursor *csrc, MDB_cursor *cdst, int fromleft)
 				key.mv_data = LEAF2KEY(csrc->mc_pg[csrc->mc_top], 0, key.mv_size);
 			} else {
 				s2 = NODEPTR(csrc->mc_pg[csrc->mc_top], 0);
-				key.mv_size = NODEKSZ(s2);
-				key.mv_data = NODEKEY(s2);
+				MDB_GET_KEY2(csrc, s2, key, pbuf);
 			}
 			csrc->mc_snum = snum--;
 			csrc->mc_top = snum;
 		} else {
-			key.mv_size = NODEKSZ(srcnode);
-			key.mv_data = NODEKEY(srcnode);
+			MDB_GET_KEY2(csrc, srcnode, key, pbuf);
 		}
 		data.mv_size = NODEDSZ(srcnode);
 		data.mv_data = NODEDATA(srcnode);
 	}
+	if (IS_PREFIX(cdst->mc_pg[cdst->mc_top])) {
+		/* The prefix of dst may have to get shorter for the key */
+		MDB_page *mp = cdst->mc_pg[cdst->mc_top];
+		unsigned int plen = mdb_pfx_match(cdst, mp, &key);
+		size_t nsize = EVEN(NODESIZE + key.mv_size - plen +
+			(F_ISSET(flags, F_BIGDATA) ? sizeof(pgno_t) : data.mv_size));
+		if ((ssize_t)(nsize + sizeof(indx_t)) + mdb_pfx_grow(mp, plen) >
+			(ssize_t)SIZELEFT(mp))
+			return MDB_PAGE_FULL;
+	}
 	mn.mc_xcursor = NULL;
 	if (IS_BRANCH(cdst->mc_pg[cdst->mc_top]) && cdst->mc_ki[cdst->mc_top] == 0) {
 		unsigned int snum = cdst->mc_snum;
@@ -7874,8 +10376,7 @@ mdb_node_move(MDB_cursor *csrc, MDB_cursor *cdst, int fromleft)
 			bkey.mv_data = LEAF2KEY(mn.mc_pg[mn.mc_top], 0, bkey.mv_size);
 		} else {
 			s2 = NODEPTR(mn.mc_pg[mn.mc_top], 0);
-			bkey.mv_size = NODEKSZ(s2);
-			bkey.mv_data = NODEKEY(s2);
+			MDB_GET_KEY2(&mn, s2, bkey, bbuf);
 		}
 		mn.mc_snum = snum--;
 		mn.mc_top = snum;
@@ -7968,8 +10469,7 @@ mdb_node_move(MDB_cursor *csrc, MDB_cursor *cdst, int fromleft)
 				key.mv_data = LEAF2KEY(csrc->mc_pg[csrc->mc_top], 0, key.mv_size);
 			} else {
 				srcnode = NODEPTR(csrc->mc_pg[csrc->mc_top], 0);
-				key.mv_size = NODEKSZ(srcnode);
-				key.mv_data = NODEKEY(srcnode);
+				MDB_GET_KEY2(csrc, srcnode, key, pbuf);
 			}
 			DPRINTF(("update separator for source page %"Z"u to [%s]",
 				csrc->mc_pg[csrc->mc_top]->mp_pgno, DKEY(&key)));
@@ -7999,8 +10499,7 @@ mdb_node_move(MDB_cursor *csrc, MDB_cursor *cdst, int fromleft)
 				key.mv_data = LEAF2KEY(cdst->mc_pg[cdst->mc_top], 0, key.mv_size);
 			} else {
 				srcnode = NODEPTR(cdst->mc_pg[cdst->mc_top], 0);
-				key.mv_size = NODEKSZ(srcnode);
-				key.mv_data = NODEKEY(srcnode);
+				MDB_GET_KEY2(cdst, srcnode, key, pbuf);
 			}
 			DPRINTF(("update separator for destination page %"Z"u to [%s]",
 				cdst->mc_pg[cdst->mc_top]->mp_pgno, DKEY(&key)));
@@ -8044,6 +10543,7 @@ mdb_page_merge(MDB_cursor *csrc, MDB_cursor *cdst)
 	unsigned	 nkeys;
 	int			 rc;
 	indx_t		 i, j;
+	char		 pbuf[MDB_PFXBUF];
 
 	psrc = csrc->mc_pg[csrc->mc_top];
 	pdst = cdst->mc_pg[cdst->mc_top];
@@ -8060,6 +10560,11 @@ mdb_page_merge(MDB_cursor *csrc, MDB_cursor *cdst)
 	/* get dst page again now that we've touched it. */
 	pdst = cdst->mc_pg[cdst->mc_top];
 
+	/* An empty dst takes the shared prefix of src */
+	if (!NUMKEYS(pdst) && IS_LEAF(pdst) && !IS_LEAF2(pdst))
+		mdb_pfx_init(cdst->mc_txn->mt_env, pdst, PAGEPFX(cdst->mc_txn->mt_env, psrc),
+			PAGEPFXLEN(psrc));
+
 	/* Move all nodes from src to dst.
 	 */
 	j = nkeys = NUMKEYS(pdst);
@@ -8089,12 +10594,10 @@ mdb_page_merge(MDB_cursor *csrc, MDB_cursor *cdst)
 					key.mv_data = LEAF2KEY(mn.mc_pg[mn.mc_top], 0, key.mv_size);
 				} else {
 					s2 = NODEPTR(mn.mc_pg[mn.mc_top], 0);
-					key.mv_size = NODEKSZ(s2);
-					key.mv_data = NODEKEY(s2);
+					MDB_GET_KEY2(&mn, s2, key, pbuf);
 				}
 			} else {
-				key.mv_size = srcnode->mn_ksize;
-				key.mv_data = NODEKEY(srcnode);
+				MDB_GET_KEY2(csrc, srcnode, key, pbuf);
 			}
 
 			data.mv_size = NODEDSZ(srcnode);
@@ -8363,10 +10866,17 @@ mdb_rebalance(MDB_cursor *mc)
 	 */
 	if (PAGEFILL(mc->mc_txn->mt_env, mn.mc_pg[mn.mc_top]) >= thresh && NUMKEYS(mn.mc_pg[mn.mc_top]) > minkeys) {
 		rc = mdb_node_move(&mn, mc, fromleft);
-		if (fromleft) {
+		if (rc == MDB_PAGE_FULL) {
+			/* Not with the prefix of our page, leave it underfilled */
+			rc = MDB_SUCCESS;
+		} else if (fromleft) {
 			/* if we inserted on left, bump position up */
 			oldki++;
 		}
+	} else if (!(fromleft ? mdb_pfx_merge_ok(mc, &mn) :
+		mdb_pfx_merge_ok(&mn, mc))) {
+		/* Both pages keep their nodes, see #mdb_pfx_merge_ok() */
+		rc = MDB_SUCCESS;
 	} else {
 		if (!fromleft) {
 			rc = mdb_page_merge(&mn, mc);
@@ -8543,6 +11053,57 @@ mdb_del0(MDB_txn *txn, MDB_dbi dbi,
 	return rc;
 }
 
+/** Get the prefix shared by some of the keys of a leaf page being split.
+ * A single key is taken with its neighbor, which it likely shares more
+ * with than with keys yet to come.
+ * @param[in] mc The cursor for this operation.
+ * @param[in] mp The page being split.
+ * @param[in] ptrs The offsets of its nodes, with a slot at \b newindx
+ * for the new key.
+ * @param[in] lo The index of the first key.
+ * @param[in] hi The index after the last key.
+ * @param[in] newindx The index of the new key.
+ * @param[in] newkey The new key.
+ * @param[out] pfx The first key, which starts with the prefix.
+ * @param[in] buf The buffer for \b pfx, of #MDB_PFXBUF bytes.
+ * @return The size of the prefix.
+ */
+static unsigned int
+mdb_pfx_split(MDB_cursor *mc, MDB_page *mp, indx_t *ptrs, int lo, int hi,
+	int newindx, MDB_val *newkey, MDB_val *pfx, char *buf)
+{
+	MDB_val	 key;
+	char	 kbuf[MDB_PFXBUF];
+	unsigned int plen = 0, n;
+	int i;
+
+	if (hi - lo == 1) {
+		if (lo)
+			lo--;
+		else
+			hi++;
+	}
+	for (i = lo; i < hi; i++) {
+		if (i == newindx)
+			key = *newkey;
+		else
+			mdb_node_key(mc, mp, (MDB_node *)((char *)mp + ptrs[i] + PAGEBASE),
+				&key, i == lo ? buf : kbuf);
+		if (i == lo) {
+			*pfx = key;
+			plen = key.mv_size;
+			continue;
+		}
+		if (plen > key.mv_size)
+			plen = key.mv_size;
+		for (n = 0; n < plen &&
+			((char *)pfx->mv_data)[n] == ((char *)key.mv_data)[n]; n++)
+			;
+		plen = n;
+	}
+	return plen;
+}
+
 /** Split a page and insert a new node.
  * Set #MDB_TXN_ERROR on failure.
  * @param[in,out] mc Cursor pointing to the page and desired insertion index.
@@ -8565,11 +11126,14 @@ mdb_page_split(MDB_cursor *mc, MDB_val *newkey, MDB_val *newdata, pgno_t newpgno
 	int	 i, j, split_indx, nkeys, pmax;
 	MDB_env 	*env = mc->mc_txn->mt_env;
 	MDB_node	*node;
-	MDB_val	 sepkey, rkey, xdata, *rdata = &xdata;
+	MDB_val	 sepkey, rkey, xdata, *rdata = &xdata, lpfx, rpfx;
 	MDB_page	*copy = NULL;
 	MDB_page	*mp, *rp, *pp;
 	int ptop;
 	MDB_cursor	mn;
+	int		 pfx = 0;
+	unsigned int	 lplen = 0, rplen = 0, d = 0;
+	char		 sbuf[MDB_PFXBUF], lbuf[MDB_PFXBUF], rbuf[MDB_PFXBUF];
 	DKBUF;
 
 	mp = mc->mc_pg[mc->mc_top];
@@ -8586,6 +11150,15 @@ mdb_page_split(MDB_cursor *mc, MDB_val *newkey, MDB_val *newdata, pgno_t newpgno
 	rp->mp_pad = mp->mp_pad;
 	DPRINTF(("new right sibling: page %"Z"u", rp->mp_pgno));
 
+	/* Leaf pages of #MDB_PREFIXKEY DBs get a shared prefix when split.
+	 * \b d is what the prefix of this one lacks for the new key.
+	 */
+	if (IS_LEAF(mp) && !IS_LEAF2(mp) && ENV_MAXKEY(env) <= MDB_PFXBUF &&
+		(IS_PREFIX(mp) || (mc->mc_db->md_flags & MDB_PREFIXKEY))) {
+		pfx = 1;
+		d = PAGEPFXLEN(mp) - mdb_pfx_match(mc, mp, newkey);
+	}
+
 	/* Usually when splitting the root page, the cursor
 	 * height is 1. But when called from mdb_update_key,
 	 * the cursor height may be greater because it walks
@@ -8632,6 +11205,11 @@ mdb_page_split(MDB_cursor *mc, MDB_val *newkey, MDB_val *newdata, pgno_t newpgno
 		sepkey = *newkey;
 		split_indx = newindx;
 		nkeys = 0;
+		if (pfx) {
+			rplen = mdb_pfx_split(mc, mp, mp->mp_ptrs, newindx, newindx+1,
+				newindx, newkey, &rpfx, rbuf);
+			mdb_pfx_init(env, rp, rpfx.mv_data, rplen);
+		}
 	} else {
 
 		split_indx = (nkeys+1) / 2;
@@ -8683,6 +11261,13 @@ mdb_page_split(MDB_cursor *mc, MDB_val *newkey, MDB_val *newdata, pgno_t newpgno
 			else
 				nsize = mdb_branch_size(env, newkey);
 			nsize = EVEN(nsize);
+			if (pfx) {
+				/* Sizes below are counted with the prefix the new key
+				 * shares with this page. The new pages may share more,
+				 * but then need room for it and for alignment.
+				 */
+				pmax -= EVEN(PAGEPFXLEN(mp) - d) + 2;
+			}
 
 			/* grab a page to hold a temporary copy */
 			copy = mdb_page_malloc(mc->mc_txn, 1);
@@ -8718,7 +11303,13 @@ mdb_page_split(MDB_cursor *mc, MDB_val *newkey, MDB_val *newdata, pgno_t newpgno
 			 * the split so the new page is emptier than the old page.
 			 * This yields better packing during sequential inserts.
 			 */
-			if (nkeys < 20 || nsize > pmax/16 || newindx >= nkeys) {
+			if (d && (newindx == 0 || newindx >= nkeys)) {
+				/* The new key lacks part of this page's prefix and sorts
+				 * before or after all its keys. It goes alone on its page,
+				 * so the others need not grow.
+				 */
+				split_indx = newindx ? nkeys : 1;
+			} else if (nkeys < 20 || nsize > pmax/16 || newindx >= nkeys) {
 				/* Find split point */
 				psize = 0;
 				if (newindx <= split_indx || newindx >= nkeys) {
@@ -8734,7 +11325,7 @@ mdb_page_split(MDB_cursor *mc, MDB_val *newkey, MDB_val *newdata, pgno_t newpgno
 						node = NULL;
 					} else {
 						node = (MDB_node *)((char *)mp + copy->mp_ptrs[i] + PAGEBASE);
-						psize += NODESIZE + NODEKSZ(node) + sizeof(indx_t);
+						psize += NODESIZE + NODEKSZ(node) + d + sizeof(indx_t);
 						if (IS_LEAF(mp)) {
 							if (F_ISSET(node->mn_flags, F_BIGDATA))
 								psize += sizeof(pgno_t);
@@ -8754,8 +11345,16 @@ mdb_page_split(MDB_cursor *mc, MDB_val *newkey, MDB_val *newdata, pgno_t newpgno
 				sepkey.mv_data = newkey->mv_data;
 			} else {
 				node = (MDB_node *)((char *)mp + copy->mp_ptrs[split_indx] + PAGEBASE);
-				sepkey.mv_size = node->mn_ksize;
-				sepkey.mv_data = NODEKEY(node);
+				mdb_node_key(mc, mp, node, &sepkey, sbuf);
+			}
+			if (pfx) {
+				/* Each half keeps the prefix its own keys share */
+				lplen = mdb_pfx_split(mc, mp, copy->mp_ptrs, 0, split_indx,
+					newindx, newkey, &lpfx, lbuf);
+				rplen = mdb_pfx_split(mc, mp, copy->mp_ptrs, split_indx,
+					nkeys+1, newindx, newkey, &rpfx, rbuf);
+				mdb_pfx_init(env, copy, lpfx.mv_data, lplen);
+				mdb_pfx_init(env, rp, rpfx.mv_data, rplen);
 			}
 		}
 	}
@@ -8831,8 +11430,7 @@ mdb_page_split(MDB_cursor *mc, MDB_val *newkey, MDB_val *newdata, pgno_t newpgno
 				mc->mc_ki[mc->mc_top] = j;
 			} else {
 				node = (MDB_node *)((char *)mp + copy->mp_ptrs[i] + PAGEBASE);
-				rkey.mv_data = NODEKEY(node);
-				rkey.mv_size = node->mn_ksize;
+				mdb_node_key(mc, mp, node, &rkey, lbuf);
 				if (IS_LEAF(mp)) {
 					xdata.mv_data = NODEDATA(node);
 					xdata.mv_size = NODEDSZ(node);
@@ -8865,6 +11463,11 @@ mdb_page_split(MDB_cursor *mc, MDB_val *newkey, MDB_val *newdata, pgno_t newpgno
 			mp->mp_ptrs[i] = copy->mp_ptrs[i];
 		mp->mp_lower = copy->mp_lower;
 		mp->mp_upper = copy->mp_upper;
+		if (pfx) {
+			mp->mp_flags = (mp->mp_flags & ~P_PREFIX) | (copy->mp_flags & P_PREFIX);
+			mp->mp_pad = copy->mp_pad;
+		}
+		/* This includes the shared prefix at the end */
 		memcpy(NODEPTR(mp, nkeys-1), NODEPTR(copy, nkeys-1),
 			env->me_psize - copy->mp_upper - PAGEBASE);
 
@@ -8974,6 +11577,7 @@ mdb_put(MDB_txn *txn, MDB_dbi dbi,
 {
 	MDB_cursor mc;
 	MDB_xcursor mx;
+	unsigned long long start;
 	int rc;
 
 	if (!key || !data || !TXN_DBI_EXIST(txn, dbi, DB_USRVALID))
@@ -8986,10 +11590,22 @@ mdb_put(MDB_txn *txn, MDB_dbi dbi,
 		return (txn->mt_flags & MDB_TXN_RDONLY) ? EACCES : MDB_BAD_TXN;
 
 	mdb_cursor_init(&mc, txn, dbi, &mx);
+	/* An existing value returned for MDB_NOOVERWRITE may be uncompressed */
+	mc.mc_ubuf = txn->mt_ubuf;
+	mc.mc_ubufsize = txn->mt_ubufsize;
 	mc.mc_next = txn->mt_cursors[dbi];
 	txn->mt_cursors[dbi] = &mc;
-	rc = mdb_cursor_put(&mc, key, data, flags);
+	if (txn->mt_env->me_compact)
+		mdb_journal_put(&mc, key, data, flags);
+	start = MDB_OPSTAT_START(txn->mt_env);
+	rc = mdb_cursor_put0(&mc, key, data, flags);
+	if (rc == MDB_KEYEXIST && IN_KBUF(&mx.mx_cursor, data) &&
+		mdb_cursor_keep(&mc, data) != MDB_SUCCESS)
+		rc = ENOMEM;
+	mdb_opstat_add(txn->mt_env, MDB_OPS_PUT, start);
 	txn->mt_cursors[dbi] = mc.mc_next;
+	txn->mt_ubuf = mc.mc_ubuf;
+	txn->mt_ubufsize = mc.mc_ubufsize;
 	return rc;
 }
 
@@ -9357,7 +11973,7 @@ mdb_env_copyfd1(MDB_env *env, HANDLE fd)
 		MDB_cursor mc;
 		MDB_val key, data;
 		mdb_cursor_init(&mc, txn, FREE_DBI, NULL);
-		while ((rc = mdb_cursor_get(&mc, &key, &data, MDB_NEXT)) == 0)
+		while ((rc = mdb_cursor_get0(&mc, &key, &data, MDB_NEXT)) == 0)
 			freecount += *(MDB_ID *)data.mv_data;
 		if (rc != MDB_NOTFOUND)
 			goto finish;
@@ -9409,11 +12025,14 @@ done2:
 
 	/** Copy environment as-is. */
 static int ESECT
-mdb_env_copyfd0(MDB_env *env, HANDLE fd)
+mdb_env_copyfd0(MDB_env *env, HANDLE fd, unsigned int flags)
 {
 	MDB_txn *txn = NULL;
 	mdb_mutexref_t wmutex = NULL;
-	int rc;
+#ifndef _WIN32
+	MDB_trackstate ts;
+#endif
+	int rc, marked = 0;
 	size_t wsize, w3;
 	char *ptr;
 #ifdef _WIN32
@@ -9446,6 +12065,16 @@ mdb_env_copyfd0(MDB_env *env, HANDLE fd)
 			UNLOCK_MUTEX(wmutex);
 			goto leave;
 		}
+#ifndef _WIN32
+		if (flags & MDB_CP_MARK) {
+			rc = mdb_track_mark(env, txn, &ts, 0);
+			if (rc) {
+				UNLOCK_MUTEX(wmutex);
+				goto leave;
+			}
+			marked = 1;
+		}
+#endif
 	}
 
 	wsize = env->me_psize * NUM_METAS;
@@ -9482,6 +12111,12 @@ mdb_env_copyfd0(MDB_env *env, HANDLE fd)
 			w3 = fsize;
 	}
 	wsize = w3 - wsize;
+#ifndef _WIN32
+	if (env->me_flags & MDB_WINDOWMAP) {
+		rc = mdb_env_copyrange(env, fd, ptr - env->me_map, wsize);
+		goto leave;
+	}
+#endif
 	while (wsize > 0) {
 		if (wsize > MAX_WRITE)
 			w2 = MAX_WRITE;
@@ -9503,52 +12138,1173 @@ mdb_env_copyfd0(MDB_env *env, HANDLE fd)
 	}
 
 leave:
+#ifndef _WIN32
+	if (rc && marked)
+		mdb_track_unmark(env, &ts);
+#endif
 	mdb_txn_abort(txn);
 	return rc;
 }
 
-int ESECT
-mdb_env_copyfd2(MDB_env *env, HANDLE fd, unsigned int flags)
+#ifndef _WIN32
+	/** Header of a #MDB_CP_DELTA copy. It fills the first page of the
+	 *	copy and is followed by the two meta pages of the new snapshot.
+	 *	The changed pages come in groups of an index page, holding the
+	 *	count and the numbers of the pages that follow it, and the pages
+	 *	themselves. An index page with a count of 0 ends the copy.
+	 */
+typedef struct MDB_deltahdr {
+	uint32_t	md_magic;
+	uint32_t	md_version;
+	uint32_t	md_psize;		/**< page size of the environment */
+	uint32_t	md_pad;
+	txnid_t		md_from;		/**< snapshot the delta applies to */
+	txnid_t		md_to;			/**< snapshot it produces */
+	pgno_t		md_next_pgno;	/**< of the produced snapshot */
+} MDB_deltahdr;
+#define MDB_DELTA_MAGIC	0xBEEFDE17
+#define MDB_DELTA_VERSION	1
+
+	/** Write all of a buffer, which may exceed #MAX_WRITE */
+static int ESECT
+mdb_fd_write(HANDLE fd, const char *ptr, size_t size)
 {
-	if (flags & MDB_CP_COMPACT)
-		return mdb_env_copyfd1(env, fd);
-	else
-		return mdb_env_copyfd0(env, fd);
-}
+	ssize_t len;
 
-int ESECT
-mdb_env_copyfd(MDB_env *env, HANDLE fd)
-{
-	return mdb_env_copyfd2(env, fd, 0);
+	while (size > 0) {
+		len = write(fd, ptr, size > MAX_WRITE ? MAX_WRITE : size);
+		if (len < 0)
+			return ErrCode();
+		if (len == 0)
+			return EIO;
+		ptr += len;
+		size -= len;
+	}
+	return MDB_SUCCESS;
 }
 
-int ESECT
-mdb_env_copy2(MDB_env *env, const char *path, unsigned int flags)
+	/** Copy a range of the data file by reading it, for #MDB_WINDOWMAP
+	 *	which does not keep the file mapped.
+	 */
+static int ESECT
+mdb_env_copyrange(MDB_env *env, HANDLE fd, off_t off, size_t len)
 {
-	int rc;
-	MDB_name fname;
-	HANDLE newfd = INVALID_HANDLE_VALUE;
+	size_t bsize = len < MDB_WINDOW_CHUNK ? len : MDB_WINDOW_CHUNK;
+	ssize_t n;
+	char *buf;
+	int rc = MDB_SUCCESS;
 
-	rc = mdb_fname_init(path, env->me_flags | MDB_NOLOCK, &fname);
-	if (rc == MDB_SUCCESS) {
-		rc = mdb_fopen(env, &fname, MDB_O_COPY, 0666, &newfd);
-		mdb_fname_destroy(fname);
+	if (!len)
+		return MDB_SUCCESS;
+	/* Aligned, the copy may have been opened with O_DIRECT */
+#ifdef HAVE_MEMALIGN
+	buf = memalign(env->me_os_psize, bsize);
+	if (buf == NULL)
+		return errno;
+#else
+	{
+		void *p;
+		if ((rc = posix_memalign(&p, env->me_os_psize, bsize)) != 0)
+			return rc;
+		buf = p;
 	}
-	if (rc == MDB_SUCCESS) {
-		rc = mdb_env_copyfd2(env, newfd, flags);
-		if (close(newfd) < 0 && rc == MDB_SUCCESS)
-			rc = ErrCode();
+#endif
+	while (len > 0) {
+		n = pread(env->me_fd, buf, len < bsize ? len : bsize, off);
+		if (n < 0) {
+			if ((rc = ErrCode()) == EINTR)
+				continue;
+			break;
+		}
+		if (n == 0) {
+			rc = EIO;
+			break;
+		}
+		if ((rc = mdb_fd_write(fd, buf, n)))
+			break;
+		off += n;
+		len -= n;
 	}
+	free(buf);
 	return rc;
 }
 
-int ESECT
-mdb_env_copy(MDB_env *env, const char *path)
+	/** Read all of a buffer, a short read means a truncated delta */
+static int ESECT
+mdb_fd_read(HANDLE fd, char *ptr, size_t size)
 {
-	return mdb_env_copy2(env, path, 0);
-}
+	ssize_t len;
 
-int ESECT
+	while (size > 0) {
+		len = read(fd, ptr, size);
+		if (len < 0) {
+			if (ErrCode() == EINTR)
+				continue;
+			return ErrCode();
+		}
+		if (len == 0)
+			return MDB_CORRUPTED;
+		ptr += len;
+		size -= len;
+	}
+	return MDB_SUCCESS;
+}
+
+	/** Write an index page and the pages it lists */
+static int ESECT
+mdb_env_copygroup(MDB_env *env, HANDLE fd, pgno_t *idx)
+{
+	pgno_t i, j;
+	int rc;
+
+	rc = mdb_fd_write(fd, (char *)idx, env->me_psize);
+	for (i = 1; rc == MDB_SUCCESS && i <= idx[0]; i = j) {
+		for (j = i+1; j <= idx[0] && idx[j] == idx[j-1]+1; j++) ;
+		if (env->me_flags & MDB_WINDOWMAP)
+			rc = mdb_env_copyrange(env, fd, (off_t)idx[i] * env->me_psize,
+				(j - i) * env->me_psize);
+		else
+			rc = mdb_fd_write(fd, env->me_map + idx[i] * env->me_psize,
+				(j - i) * env->me_psize);
+	}
+	return rc;
+}
+
+	/** Copy the pages changed since the last mark, see #MDB_deltahdr */
+static int ESECT
+mdb_env_copyfd3(MDB_env *env, HANDLE fd)
+{
+	MDB_txn *txn = NULL;
+	mdb_mutexref_t wmutex = env->me_wmutex;
+	MDB_trackstate ts;
+	MDB_deltahdr *dh;
+	unsigned int psize = env->me_psize;
+	unsigned char *bits, *chg = NULL;
+	pgno_t *idx, pgno, nidx, npages = 0;
+	char *buf;
+	int rc, marked = 0;
+
+#ifdef HAVE_MEMALIGN
+	buf = memalign(env->me_os_psize, psize * 2);
+	if (buf == NULL)
+		return errno;
+#else
+	{
+		void *p;
+		if ((rc = posix_memalign(&p, env->me_os_psize, psize * 2)) != 0)
+			return rc;
+		buf = p;
+	}
+#endif
+	memset(buf, 0, psize * 2);
+	dh = (MDB_deltahdr *)buf;
+	idx = (pgno_t *)(buf + psize);
+	nidx = psize / sizeof(pgno_t) - 1;
+
+	rc = mdb_txn_begin(env, NULL, MDB_RDONLY, &txn);
+	if (rc)
+		goto done;
+	mdb_txn_end(txn, MDB_END_RESET_TMP);
+
+	/* Block writers until the recording is switched and the
+	 * meta pages are written, as in #mdb_env_copyfd0().
+	 */
+	if (LOCK_MUTEX(rc, env, wmutex))
+		goto leave;
+	rc = mdb_txn_renew0(txn);
+	if (rc == MDB_SUCCESS)
+		rc = mdb_track_mark(env, txn, &ts, 1);
+	if (rc == MDB_SUCCESS) {
+		marked = 1;
+		/* Writers may remap the file once we unlock, so keep
+		 * our own copy of the pages of the finished recording.
+		 */
+		npages = txn->mt_next_pgno;
+		chg = calloc(1, (npages + 7) / 8);
+		if (chg == NULL) {
+			rc = ENOMEM;
+		} else {
+			bits = TRACK_BITS(env);
+			for (pgno = NUM_METAS; pgno < npages; pgno++)
+				if (bits[pgno >> 2] & TRACK_BIT(pgno, ts.ts_gen))
+					chg[pgno >> 3] |= 1 << (pgno & 7);
+			dh->md_magic = MDB_DELTA_MAGIC;
+			dh->md_version = MDB_DELTA_VERSION;
+			dh->md_psize = psize;
+			dh->md_from = ts.ts_base;
+			dh->md_to = txn->mt_txnid;
+			dh->md_next_pgno = npages;
+			rc = mdb_fd_write(fd, buf, psize);
+			if (rc == MDB_SUCCESS)
+				rc = mdb_fd_write(fd, env->me_map, psize * NUM_METAS);
+		}
+	}
+	UNLOCK_MUTEX(wmutex);
+	if (rc)
+		goto leave;
+
+	idx[0] = 0;
+	for (pgno = NUM_METAS; pgno < npages; pgno++) {
+		if (!(chg[pgno >> 3] & (1 << (pgno & 7))))
+			continue;
+		idx[++idx[0]] = pgno;
+		if (idx[0] == nidx) {
+			if ((rc = mdb_env_copygroup(env, fd, idx)))
+				goto leave;
+			idx[0] = 0;
+		}
+	}
+	if (idx[0] && (rc = mdb_env_copygroup(env, fd, idx)))
+		goto leave;
+	idx[0] = 0;
+	rc = mdb_fd_write(fd, (char *)idx, psize);
+
+leave:
+	if (rc && marked)
+		mdb_track_unmark(env, &ts);
+	mdb_txn_abort(txn);
+done:
+	free(chg);
+	free(buf);
+	return rc;
+}
+
+int ESECT
+mdb_env_patch(MDB_env *env, HANDLE fd)
+{
+	mdb_mutexref_t wmutex = NULL;
+	MDB_deltahdr dh;
+	MDB_meta *mp;
+	unsigned int psize = env->me_psize;
+	pgno_t *idx, i, j, n, nidx;
+	char *buf, *metas, *pages;
+	size_t fsize = 0;
+	int rc;
+
+	if (!env->me_map || (env->me_flags & MDB_RDONLY))
+		return EINVAL;
+
+	buf = malloc(psize * (2 + NUM_METAS + MDB_COMMIT_PAGES));
+	if (!buf)
+		return ENOMEM;
+	metas = buf + psize;
+	idx = (pgno_t *)(metas + psize * NUM_METAS);
+	pages = (char *)idx + psize;
+	nidx = psize / sizeof(pgno_t) - 1;
+
+	if ((rc = mdb_fd_read(fd, buf, psize)))
+		goto done;
+	memcpy(&dh, buf, sizeof(dh));
+	if (dh.md_magic != MDB_DELTA_MAGIC || dh.md_version != MDB_DELTA_VERSION) {
+		rc = MDB_INVALID;
+		goto done;
+	}
+	if (dh.md_psize != psize) {
+		rc = MDB_INCOMPATIBLE;
+		goto done;
+	}
+	if ((rc = mdb_fd_read(fd, metas, psize * NUM_METAS)))
+		goto done;
+	for (i = 0; i < NUM_METAS; i++) {
+		mp = (MDB_meta *)METADATA((MDB_page *)(metas + i * psize));
+		if (mp->mm_magic != MDB_MAGIC)
+			break;
+		if (mp->mm_txnid == dh.md_to)
+			break;
+	}
+	if (i == NUM_METAS || mp->mm_magic != MDB_MAGIC) {
+		rc = MDB_CORRUPTED;
+		goto done;
+	}
+
+	if (env->me_txns) {
+		wmutex = env->me_wmutex;
+		if (LOCK_MUTEX(rc, env, wmutex)) {
+			wmutex = NULL;
+			goto done;
+		}
+	}
+	if (mdb_env_pick_meta(env)->mm_txnid != dh.md_from) {
+		rc = MDB_INCOMPATIBLE;
+		goto done;
+	}
+	if (env->me_cmap)
+		mdb_cksum_begin(env, mdb_env_pick_meta(env));
+
+	for (;;) {
+		if ((rc = mdb_fd_read(fd, (char *)idx, psize)))
+			goto done;
+		if (idx[0] == 0)
+			break;
+		if (idx[0] > nidx) {
+			rc = MDB_CORRUPTED;
+			goto done;
+		}
+		for (i = 1; i <= idx[0]; i += n) {
+			/* Gather a run of consecutive pages */
+			for (n = 1; i + n <= idx[0] && n < MDB_COMMIT_PAGES &&
+				idx[i+n] == idx[i] + n; n++) ;
+			if (idx[i] < NUM_METAS || idx[i] + n > dh.md_next_pgno) {
+				rc = MDB_CORRUPTED;
+				goto done;
+			}
+			if ((rc = mdb_fd_read(fd, pages, n * psize)))
+				goto done;
+			if (env->me_cmap && idx[i] + n <= CKSUM_NPAGES(env)) {
+				for (j = 0; j < n; j++)
+					CKSUM_SUMS(env)[idx[i] + j] =
+						mdb_cksum_page(env, pages + j * psize);
+			}
+			for (j = 0; j < n * psize; j += rc) {
+				rc = pwrite(env->me_fd, pages + j, n * psize - j,
+					(off_t)idx[i] * psize + j);
+				if (rc <= 0) {
+					rc = rc ? ErrCode() : EIO;
+					goto done;
+				}
+			}
+		}
+	}
+	if ((rc = mdb_fsize(env->me_fd, &fsize)))
+		goto done;
+	if (fsize < (size_t)dh.md_next_pgno * psize &&
+		ftruncate(env->me_fd, (off_t)dh.md_next_pgno * psize) < 0) {
+		rc = ErrCode();
+		goto done;
+	}
+	if (env->me_cmap) {
+		CKSUM_HDR(env)->ck_last = dh.md_to;
+		CKSUM_HDR(env)->ck_lastpg = dh.md_next_pgno - 1;
+		if (msync(env->me_cmap, env->me_csize, MS_SYNC)) {
+			rc = ErrCode();
+			goto done;
+		}
+	}
+	/* The pages must be on disk before the meta pages refer to them */
+	if (MDB_FDATASYNC(env->me_fd) ||
+		pwrite(env->me_fd, metas, psize * NUM_METAS, 0) != (ssize_t)(psize * NUM_METAS) ||
+		MDB_FDATASYNC(env->me_fd)) {
+		rc = ErrCode();
+		goto done;
+	}
+	if (env->me_txns)
+		env->me_txns->mti_txnid = dh.md_to;
+	if (env->me_tmap) {
+		/* The pages we wrote were not recorded */
+		TRACK_HDR(env)->mt_base = 0;
+		TRACK_HDR(env)->mt_last = dh.md_to;
+	}
+	rc = MDB_SUCCESS;
+
+done:
+	if (wmutex)
+		UNLOCK_MUTEX(wmutex);
+	free(buf);
+	return rc;
+}
+#else
+int ESECT
+mdb_env_patch(MDB_env *env, HANDLE fd)
+{
+	return EINVAL;
+}
+#endif /* !_WIN32 */
+
+int ESECT
+mdb_env_copyfd2(MDB_env *env, HANDLE fd, unsigned int flags)
+{
+	if (flags & (MDB_CP_MARK|MDB_CP_DELTA)) {
+		if ((flags & MDB_CP_COMPACT) || !env->me_tmap)
+			return EINVAL;
+#ifndef _WIN32
+		if (flags & MDB_CP_DELTA)
+			return mdb_env_copyfd3(env, fd);
+#endif
+	}
+	if (flags & MDB_CP_COMPACT)
+		return mdb_env_copyfd1(env, fd);
+	else
+		return mdb_env_copyfd0(env, fd, flags);
+}
+
+int ESECT
+mdb_env_copyfd(MDB_env *env, HANDLE fd)
+{
+	return mdb_env_copyfd2(env, fd, 0);
+}
+
+int ESECT
+mdb_env_copy2(MDB_env *env, const char *path, unsigned int flags)
+{
+	int rc;
+	MDB_name fname;
+	HANDLE newfd = INVALID_HANDLE_VALUE;
+
+	/* A delta is a single file, path is its name */
+	rc = mdb_fname_init(path, (flags & MDB_CP_DELTA) ?
+		MDB_NOSUBDIR|MDB_NOLOCK : env->me_flags | MDB_NOLOCK, &fname);
+	if (rc == MDB_SUCCESS) {
+		rc = mdb_fopen(env, &fname, MDB_O_COPY, 0666, &newfd);
+		mdb_fname_destroy(fname);
+	}
+	if (rc == MDB_SUCCESS) {
+		rc = mdb_env_copyfd2(env, newfd, flags);
+		if (close(newfd) < 0 && rc == MDB_SUCCESS)
+			rc = ErrCode();
+	}
+	return rc;
+}
+
+int ESECT
+mdb_env_copy(MDB_env *env, const char *path)
+{
+	return mdb_env_copy2(env, path, 0);
+}
+
+/** @defgroup compact	Online compaction
+ *	While a compaction runs, write txns record in a journal which keys
+ *	they write, and the dups for DUPSORT DBs. Values are not recorded:
+ *	replaying a record reads the current value from a snapshot, which
+ *	also covers #MDB_RESERVE. Replaying a record twice, or one from an
+ *	aborted txn, does no harm. The journal is only appended to while
+ *	holding the writer mutex, and swapped for an empty one under it
+ *	when a read txn for its replay is begun.
+ *
+ *	Records name DBs by DBI. A #MDB_J_BIND record gives the name of a
+ *	DBI before the first other record using it since it was opened.
+ *	@{
+ */
+enum {
+	MDB_J_BIND = 1,	/**< the DBI refers to the DB named by the key */
+	MDB_J_KEY,		/**< the key was written, with all its dups */
+	MDB_J_DUP,		/**< a dup of the key was written */
+	MDB_J_DROP,		/**< the DB was emptied */
+	MDB_J_DELETE	/**< the DB was deleted */
+};
+
+	/** A journal record, followed by the key and the data */
+typedef struct MDB_jrec {
+	unsigned int	jr_op;
+	MDB_dbi		jr_dbi;
+	unsigned int	jr_flags;	/**< persistent DB flags for #MDB_J_BIND */
+	size_t		jr_ksize;
+	size_t		jr_dsize;
+} MDB_jrec;
+
+#define JREC_SIZE(ksize, dsize) \
+	((sizeof(MDB_jrec) + (ksize) + (dsize) + sizeof(size_t)-1) & ~(sizeof(size_t)-1))
+
+struct MDB_compact {
+	MDB_env		*cp_env;
+	MDB_env		*cp_copy;	/**< the compacted copy */
+	char		*cp_path;	/**< the data file of cp_copy */
+	char		*cp_jbuf;	/**< the journal being recorded */
+	size_t		cp_jlen;
+	size_t		cp_jsize;
+	char		*cp_rbuf;	/**< the journal last replayed */
+	size_t		cp_rsize;
+	unsigned int	*cp_jseq;	/**< me_dbiseqs[] of the last #MDB_J_BIND of each DBI */
+	char		**cp_names;	/**< names of the DBIs, as of the replay */
+	MDB_dbi		*cp_cdbi;	/**< DBIs in cp_copy, or 0 if not opened yet */
+	txnid_t		cp_txnid;	/**< snapshot cp_copy is up to date with */
+	int			cp_jerr;	/**< why recording stopped */
+	int			cp_err;		/**< why replaying failed */
+};
+
+	/** Append a record to the journal, after a #MDB_J_BIND for \b dbi
+	 *	if it was not given since the DBI was opened.
+	 */
+static void
+mdb_journal_add(MDB_txn *txn, MDB_dbi dbi, unsigned int op,
+	MDB_val *key, MDB_val *data)
+{
+	MDB_env		*env = txn->mt_env;
+	MDB_compact	*cp = env->me_compact;
+	MDB_jrec	*jr;
+	size_t		ksize, dsize, len, size;
+	char		*p;
+
+	if (cp->cp_jerr)
+		return;
+	if (op != MDB_J_BIND && dbi >= CORE_DBS &&
+		cp->cp_jseq[dbi] != env->me_dbiseqs[dbi]) {
+		mdb_journal_add(txn, dbi, MDB_J_BIND, &txn->mt_dbxs[dbi].md_name, NULL);
+		if (cp->cp_jerr)
+			return;
+	}
+	ksize = key ? key->mv_size : 0;
+	dsize = data ? data->mv_size : 0;
+	len = JREC_SIZE(ksize, dsize);
+	if (cp->cp_jlen + len > cp->cp_jsize) {
+		for (size = cp->cp_jsize ? cp->cp_jsize : 65536;
+			size < cp->cp_jlen + len; size <<= 1) ;
+		if (!(p = realloc(cp->cp_jbuf, size))) {
+			cp->cp_jerr = ENOMEM;
+			return;
+		}
+		cp->cp_jbuf = p;
+		cp->cp_jsize = size;
+	}
+	jr = (MDB_jrec *)(cp->cp_jbuf + cp->cp_jlen);
+	jr->jr_op = op;
+	jr->jr_dbi = dbi;
+	jr->jr_flags = txn->mt_dbs[dbi].md_flags & PERSISTENT_FLAGS;
+	jr->jr_ksize = ksize;
+	jr->jr_dsize = dsize;
+	p = (char *)(jr + 1);
+	if (ksize)
+		memcpy(p, key->mv_data, ksize);
+	if (dsize)
+		memcpy(p + ksize, data->mv_data, dsize);
+	cp->cp_jlen += len;
+	if (op == MDB_J_BIND)
+		cp->cp_jseq[dbi] = env->me_dbiseqs[dbi];
+}
+
+	/** Record a put through \b mc, before it is done */
+static void
+mdb_journal_put(MDB_cursor *mc, MDB_val *key, MDB_val *data,
+	unsigned int flags)
+{
+	MDB_txn		*txn = mc->mc_txn;
+	MDB_val		k, d;
+	int			dupsort = mc->mc_db->md_flags & MDB_DUPSORT;
+	size_t		i;
+
+	if ((txn->mt_flags & (MDB_TXN_RDONLY|MDB_TXN_BLOCKED)) ||
+		(mc->mc_flags & C_SUB) || mc->mc_dbi == FREE_DBI)
+		return;
+	if (flags & MDB_CURRENT) {
+		/* The key is the cursor's, and the dup it replaces goes away */
+		if (mdb_cursor_get0(mc, &k, dupsort ? &d : NULL, MDB_GET_CURRENT))
+			return;
+		key = &k;
+		if (dupsort)
+			mdb_journal_add(txn, mc->mc_dbi, MDB_J_DUP, &k, &d);
+	}
+	if (!dupsort) {
+		mdb_journal_add(txn, mc->mc_dbi, MDB_J_KEY, key, NULL);
+	} else if (flags & MDB_MULTIPLE) {
+		d.mv_size = data[0].mv_size;
+		for (i = 0; i < data[1].mv_size; i++) {
+			d.mv_data = (char *)data[0].mv_data + i * d.mv_size;
+			mdb_journal_add(txn, mc->mc_dbi, MDB_J_DUP, key, &d);
+		}
+	} else {
+		mdb_journal_add(txn, mc->mc_dbi, MDB_J_DUP, key, data);
+	}
+}
+
+	/** Record a delete of the item \b mc points to, before it is done */
+static void
+mdb_journal_del(MDB_cursor *mc, unsigned int flags)
+{
+	MDB_txn		*txn = mc->mc_txn;
+	MDB_val		k, d;
+
+	if ((txn->mt_flags & (MDB_TXN_RDONLY|MDB_TXN_BLOCKED)) ||
+		(mc->mc_flags & C_SUB) || mc->mc_dbi == FREE_DBI ||
+		(flags & F_SUBDATA))
+		return;
+	if (!(mc->mc_db->md_flags & MDB_DUPSORT) || (flags & MDB_NODUPDATA)) {
+		if (!mdb_cursor_get0(mc, &k, NULL, MDB_GET_CURRENT))
+			mdb_journal_add(txn, mc->mc_dbi, MDB_J_KEY, &k, NULL);
+	} else {
+		if (!mdb_cursor_get0(mc, &k, &d, MDB_GET_CURRENT))
+			mdb_journal_add(txn, mc->mc_dbi, MDB_J_DUP, &k, &d);
+	}
+}
+
+#ifndef _WIN32
+	/** The DBI in the copy for replaying a record of \b dbi.
+	 *	@param[in] create Create the DB in the copy if it is missing.
+	 */
+static int
+mdb_compact_dbi(MDB_compact *cp, MDB_txn *ctxn, MDB_dbi dbi,
+	unsigned int flags, int create, MDB_dbi *cdbi)
+{
+	int rc;
+
+	if (dbi < CORE_DBS) {
+		*cdbi = dbi;
+		return MDB_SUCCESS;
+	}
+	if (!cp->cp_names[dbi])
+		return MDB_BAD_DBI;
+	if (!cp->cp_cdbi[dbi]) {
+		rc = mdb_dbi_open(ctxn, cp->cp_names[dbi],
+			(flags & VALID_FLAGS) | (create ? MDB_CREATE : 0), &cp->cp_cdbi[dbi]);
+		if (rc)
+			return rc;
+	}
+	*cdbi = cp->cp_cdbi[dbi];
+	return MDB_SUCCESS;
+}
+
+	/** Bring the copy's value of the key of \b jr up to date with \b rtxn */
+static int
+mdb_compact_key(MDB_txn *rtxn, MDB_txn *ctxn, MDB_dbi cdbi, MDB_jrec *jr)
+{
+	MDB_cursor	*mc;
+	MDB_val		key, data, k2, d2;
+	MDB_dbi		dbi = jr->jr_dbi;
+	int			rc;
+
+	key.mv_size = jr->jr_ksize;
+	key.mv_data = jr + 1;
+	data.mv_size = jr->jr_dsize;
+	data.mv_data = (char *)key.mv_data + key.mv_size;
+
+	/* The copy uses the same comparisons and compression */
+	ctxn->mt_dbxs[cdbi].md_cmp = rtxn->mt_dbxs[dbi].md_cmp;
+	ctxn->mt_dbxs[cdbi].md_dcmp = rtxn->mt_dbxs[dbi].md_dcmp;
+	ctxn->mt_dbxs[cdbi].md_cmin = rtxn->mt_dbxs[dbi].md_cmin;
+
+	if (!(rtxn->mt_dbs[dbi].md_flags & MDB_DUPSORT)) {
+		rc = mdb_get(rtxn, dbi, &key, &d2);
+		if (rc == MDB_SUCCESS)
+			return mdb_put(ctxn, cdbi, &key, &d2, 0);
+		if (rc == MDB_NOTFOUND && (rc = mdb_del(ctxn, cdbi, &key, NULL)) == MDB_NOTFOUND)
+			rc = MDB_SUCCESS;
+		return rc;
+	}
+
+	if ((rc = mdb_cursor_open(rtxn, dbi, &mc)))
+		return rc;
+	if (jr->jr_op == MDB_J_DUP) {
+		d2 = data;
+		rc = mdb_cursor_get(mc, &key, &d2, MDB_GET_BOTH);
+		if (rc == MDB_SUCCESS) {
+			rc = mdb_put(ctxn, cdbi, &key, &d2, MDB_NODUPDATA);
+			/* It compares equal to a dup of the copy, which may still
+			 * differ with a custom comparison. Replace it to be sure.
+			 */
+			if (rc == MDB_KEYEXIST &&
+				(rc = mdb_del(ctxn, cdbi, &key, &d2)) == MDB_SUCCESS)
+				rc = mdb_put(ctxn, cdbi, &key, &d2, 0);
+		} else if (rc == MDB_NOTFOUND &&
+			(rc = mdb_del(ctxn, cdbi, &key, &data)) == MDB_NOTFOUND) {
+			rc = MDB_SUCCESS;
+		}
+	} else {
+		/* Copy all the dups */
+		rc = mdb_del(ctxn, cdbi, &key, NULL);
+		if (rc == MDB_SUCCESS || rc == MDB_NOTFOUND) {
+			k2 = key;
+			rc = mdb_cursor_get(mc, &k2, &d2, MDB_SET);
+		}
+		while (rc == MDB_SUCCESS) {
+			rc = mdb_put(ctxn, cdbi, &key, &d2, MDB_APPENDDUP);
+			if (rc == MDB_SUCCESS)
+				rc = mdb_cursor_get(mc, &k2, &d2, MDB_NEXT_DUP);
+		}
+		if (rc == MDB_NOTFOUND)
+			rc = MDB_SUCCESS;
+	}
+	mdb_cursor_close(mc);
+	return rc;
+}
+
+	/** Replace the contents of a DB of the copy with those of \b rtxn */
+static int
+mdb_compact_db(MDB_txn *rtxn, MDB_txn *ctxn, MDB_dbi dbi, MDB_dbi cdbi)
+{
+	MDB_cursor	*mc;
+	MDB_val		key, data;
+	unsigned int flags;
+	int			rc;
+
+	if ((rc = mdb_drop(ctxn, cdbi, 0)))
+		return rc;
+	ctxn->mt_dbxs[cdbi].md_cmp = rtxn->mt_dbxs[dbi].md_cmp;
+	ctxn->mt_dbxs[cdbi].md_dcmp = rtxn->mt_dbxs[dbi].md_dcmp;
+	ctxn->mt_dbxs[cdbi].md_cmin = rtxn->mt_dbxs[dbi].md_cmin;
+	flags = (rtxn->mt_dbs[dbi].md_flags & MDB_DUPSORT) ? MDB_APPENDDUP : MDB_APPEND;
+	if ((rc = mdb_cursor_open(rtxn, dbi, &mc)))
+		return rc;
+	rc = mdb_cursor_get(mc, &key, &data, MDB_FIRST);
+	while (rc == MDB_SUCCESS) {
+		rc = mdb_put(ctxn, cdbi, &key, &data, flags);
+		if (rc == MDB_SUCCESS)
+			rc = mdb_cursor_get(mc, &key, &data, MDB_NEXT);
+	}
+	mdb_cursor_close(mc);
+	return rc == MDB_NOTFOUND ? MDB_SUCCESS : rc;
+}
+
+	/** Replay a journal into the copy, from the snapshot of \b rtxn.
+	 *	@param[in] final Also create the DBs that were created empty.
+	 *	The caller then holds the writer mutex.
+	 */
+static int
+mdb_compact_apply(MDB_compact *cp, MDB_txn *rtxn, char *buf, size_t len,
+	int final)
+{
+	MDB_txn		*ctxn;
+	MDB_jrec	*jr;
+	MDB_dbi		dbi, cdbi;
+	MDB_val		*name;
+	size_t		off;
+	char		*p;
+	int			rc, skip;
+
+	/* If no write txn committed since the last replay, the copy is up
+	 * to date, only the names are needed. Then the copy does not commit
+	 * more txns than the environment, and its txnid can stay below.
+	 */
+	skip = rtxn->mt_txnid == cp->cp_txnid;
+	if (skip && !final) {
+		ctxn = NULL;
+	} else if ((rc = mdb_txn_begin(cp->cp_copy, NULL, 0, &ctxn)) != 0) {
+		return rc;
+	}
+
+	for (off = 0, rc = MDB_SUCCESS; off < len && !rc; off += JREC_SIZE(jr->jr_ksize, jr->jr_dsize)) {
+		jr = (MDB_jrec *)(buf + off);
+		dbi = jr->jr_dbi;
+		if (jr->jr_op == MDB_J_BIND) {
+			if (!(p = malloc(jr->jr_ksize + 1))) {
+				rc = ENOMEM;
+				break;
+			}
+			memcpy(p, jr + 1, jr->jr_ksize);
+			p[jr->jr_ksize] = '\0';
+			free(cp->cp_names[dbi]);
+			cp->cp_names[dbi] = p;
+			cp->cp_cdbi[dbi] = 0;
+			continue;
+		}
+		if (skip)
+			continue;
+		switch (jr->jr_op) {
+		case MDB_J_DROP:
+		case MDB_J_DELETE:
+			rc = mdb_compact_dbi(cp, ctxn, dbi, jr->jr_flags, 0, &cdbi);
+			if (rc == MDB_NOTFOUND) {
+				rc = MDB_SUCCESS;
+				break;
+			}
+			if (rc)
+				break;
+			/* The txn may have aborted. If the DB is still there,
+			 * copy it whole, else remove it from the copy too.
+			 */
+			name = &rtxn->mt_dbxs[dbi].md_name;
+			if (TXN_DBI_EXIST(rtxn, dbi, DB_USRVALID) &&
+				name->mv_size == strlen(cp->cp_names[dbi]) &&
+				!memcmp(name->mv_data, cp->cp_names[dbi], name->mv_size)) {
+				rc = mdb_compact_db(rtxn, ctxn, dbi, cdbi);
+			} else {
+				rc = mdb_drop(ctxn, cdbi, 1);
+				cp->cp_cdbi[dbi] = 0;
+			}
+			break;
+		default:
+			/* Skip DBs never committed, and DBIs opened on another
+			 * DB since, whose own records come later.
+			 */
+			if (!TXN_DBI_EXIST(rtxn, dbi, DB_USRVALID))
+				break;
+			if (dbi >= CORE_DBS) {
+				name = &rtxn->mt_dbxs[dbi].md_name;
+				if (!cp->cp_names[dbi] || name->mv_size != strlen(cp->cp_names[dbi]) ||
+					memcmp(name->mv_data, cp->cp_names[dbi], name->mv_size))
+					break;
+			}
+			rc = mdb_compact_dbi(cp, ctxn, dbi, jr->jr_flags, 1, &cdbi);
+			if (rc == MDB_SUCCESS)
+				rc = mdb_compact_key(rtxn, ctxn, cdbi, jr);
+			break;
+		}
+	}
+
+	if (final && !rc) {
+		MDB_dbi i;
+		for (i = CORE_DBS; i < rtxn->mt_numdbs && !rc; i++) {
+			name = &rtxn->mt_dbxs[i].md_name;
+			if (!TXN_DBI_EXIST(rtxn, i, DB_USRVALID) || !name->mv_size)
+				continue;
+			if (!(p = malloc(name->mv_size + 1))) {
+				rc = ENOMEM;
+				break;
+			}
+			memcpy(p, name->mv_data, name->mv_size);
+			p[name->mv_size] = '\0';
+			rc = mdb_dbi_open(ctxn, p, (rtxn->mt_dbs[i].md_flags & VALID_FLAGS) |
+				MDB_CREATE, &cdbi);
+			free(p);
+		}
+	}
+	if (ctxn) {
+		if (rc)
+			mdb_txn_abort(ctxn);
+		else
+			rc = mdb_txn_commit(ctxn);
+	}
+	if (rc == MDB_SUCCESS)
+		cp->cp_txnid = rtxn->mt_txnid;
+	return rc;
+}
+
+	/** Begin the snapshot for the next replay and start a new journal.
+	 *	The caller holds the writer mutex.
+	 */
+static int
+mdb_compact_swap(MDB_compact *cp, MDB_txn **rtxn, char **buf, size_t *len)
+{
+	size_t size;
+	int rc;
+
+	if (cp->cp_jerr)
+		return cp->cp_jerr;
+	if ((rc = mdb_txn_begin(cp->cp_env, NULL, MDB_RDONLY, rtxn)) != 0)
+		return rc;
+	*buf = cp->cp_jbuf;
+	*len = cp->cp_jlen;
+	size = cp->cp_jsize;
+	cp->cp_jbuf = cp->cp_rbuf;
+	cp->cp_jsize = cp->cp_rsize;
+	cp->cp_jlen = 0;
+	cp->cp_rbuf = *buf;
+	cp->cp_rsize = size;
+	return MDB_SUCCESS;
+}
+
+	/** Fail with EBUSY if another process has the environment open */
+static int ESECT
+mdb_env_excl_check(MDB_env *env)
+{
+	struct flock lock_info;
+
+	memset((void *)&lock_info, 0, sizeof(lock_info));
+	lock_info.l_type = F_WRLCK;
+	lock_info.l_whence = SEEK_SET;
+	lock_info.l_start = 0;
+	lock_info.l_len = 1;
+	if (fcntl(env->me_lfd, F_GETLK, &lock_info))
+		return ErrCode();
+	return lock_info.l_type == F_UNLCK ? MDB_SUCCESS : EBUSY;
+}
+
+	/** Free a compaction and remove its copy, unless it was switched to */
+static void ESECT
+mdb_compact_free(MDB_compact *cp)
+{
+	unsigned int i;
+
+	if (cp->cp_copy)
+		mdb_env_close(cp->cp_copy);
+	if (cp->cp_path) {
+		unlink(cp->cp_path);
+		free(cp->cp_path);
+	}
+	if (cp->cp_names) {
+		for (i = 0; i < cp->cp_env->me_maxdbs; i++)
+			free(cp->cp_names[i]);
+		free(cp->cp_names);
+	}
+	free(cp->cp_cdbi);
+	free(cp->cp_jseq);
+	free(cp->cp_jbuf);
+	free(cp->cp_rbuf);
+	free(cp);
+}
+
+int ESECT
+mdb_env_compact_begin(MDB_env *env, MDB_compact **ret)
+{
+	MDB_compact *cp;
+	struct stat st;
+	HANDLE fd;
+	int rc;
+
+	if (!env->me_txns || (env->me_flags & (MDB_RDONLY|MDB_FIXEDMAP)))
+		return EINVAL;
+	if ((rc = mdb_env_excl_check(env)))
+		return rc;
+	if (fstat(env->me_fd, &st))
+		return ErrCode();
+
+	if (!(cp = calloc(1, sizeof(MDB_compact))))
+		return ENOMEM;
+	cp->cp_env = env;
+	cp->cp_jseq = calloc(env->me_maxdbs, sizeof(unsigned int));
+	cp->cp_names = calloc(env->me_maxdbs, sizeof(char *));
+	cp->cp_cdbi = calloc(env->me_maxdbs, sizeof(MDB_dbi));
+	cp->cp_path = malloc(strlen(env->me_path) + sizeof("/compact.mdb"));
+	if (!cp->cp_jseq || !cp->cp_names || !cp->cp_cdbi || !cp->cp_path) {
+		mdb_compact_free(cp);
+		return ENOMEM;
+	}
+	sprintf(cp->cp_path, "%s%s", env->me_path,
+		(env->me_flags & MDB_NOSUBDIR) ? "-compact" : "/compact.mdb");
+	fd = open(cp->cp_path, O_WRONLY|O_CREAT|O_TRUNC|MDB_CLOEXEC, st.st_mode & 0777);
+	if (fd == INVALID_HANDLE_VALUE) {
+		rc = ErrCode();
+		free(cp->cp_path);
+		cp->cp_path = NULL;
+		mdb_compact_free(cp);
+		return rc;
+	}
+
+	/* Record from before the snapshot of the copy */
+	if (LOCK_MUTEX(rc, env, env->me_wmutex)) {
+		close(fd);
+		mdb_compact_free(cp);
+		return rc;
+	}
+	if (env->me_compact) {
+		rc = EBUSY;
+	} else {
+		env->me_compact = cp;
+		cp->cp_txnid = env->me_txns->mti_txnid;
+	}
+	UNLOCK_MUTEX(env->me_wmutex);
+	if (rc) {
+		close(fd);
+		free(cp->cp_path);
+		cp->cp_path = NULL;
+		mdb_compact_free(cp);
+		return rc;
+	}
+
+	rc = mdb_env_copyfd1(env, fd);
+	if (close(fd) < 0 && rc == MDB_SUCCESS)
+		rc = ErrCode();
+	if (rc == MDB_SUCCESS && !(rc = mdb_env_create(&cp->cp_copy))) {
+		if (!(rc = mdb_env_set_mapsize(cp->cp_copy, env->me_mapsize)) &&
+			!(rc = mdb_env_set_maxdbs(cp->cp_copy, env->me_maxdbs - CORE_DBS)))
+			rc = mdb_env_open(cp->cp_copy, cp->cp_path,
+				MDB_NOSUBDIR|MDB_NOLOCK|MDB_NOSYNC, st.st_mode & 0777);
+	}
+	if (rc) {
+		mdb_env_compact_end(cp, 0);
+		return rc;
+	}
+	*ret = cp;
+	return MDB_SUCCESS;
+}
+
+int ESECT
+mdb_env_compact_replay(MDB_compact *cp, size_t *count)
+{
+	MDB_env *env = cp->cp_env;
+	MDB_txn *rtxn;
+	MDB_jrec *jr;
+	char *buf;
+	size_t len, off, n = 0;
+	int rc;
+
+	if (cp->cp_err)
+		return cp->cp_err;
+	if (LOCK_MUTEX(rc, env, env->me_wmutex))
+		return rc;
+	rc = mdb_compact_swap(cp, &rtxn, &buf, &len);
+	UNLOCK_MUTEX(env->me_wmutex);
+	if (rc == MDB_SUCCESS) {
+		rc = mdb_compact_apply(cp, rtxn, buf, len, 0);
+		mdb_txn_abort(rtxn);
+	}
+	if (rc) {
+		cp->cp_err = rc;
+		return rc;
+	}
+	if (count) {
+		for (off = 0; off < len; off += JREC_SIZE(jr->jr_ksize, jr->jr_dsize), n++)
+			jr = (MDB_jrec *)(buf + off);
+		*count = n;
+	}
+	return MDB_SUCCESS;
+}
+
+	/** Switch the environment to the up to date copy.
+	 *	The caller holds the writer mutex and checked that nothing uses
+	 *	the current map. Once the data file was replaced, failures are
+	 *	fatal to the environment.
+	 */
+static int ESECT
+mdb_compact_switch(MDB_compact *cp)
+{
+	MDB_env		*env = cp->cp_env;
+	txnid_t		txnid = env->me_txns->mti_txnid;
+	unsigned int psize = env->me_psize;
+	MDB_meta	meta, *mm;
+	MDB_page	*mp;
+	HANDLE		fd = INVALID_HANDLE_VALUE, mfd = INVALID_HANDLE_VALUE;
+	char		*buf, *dpath, *p;
+	int			i, rc;
+
+	if ((rc = mdb_env_sync(cp->cp_copy, 1)))
+		return rc;
+	/* The copy has a freeDB of its own */
+	mdb_pgstate_drop(env);
+	meta = *mdb_env_pick_meta(cp->cp_copy);
+	mdb_env_close(cp->cp_copy);
+	cp->cp_copy = NULL;
+	if (meta.mm_txnid > txnid)
+		return MDB_INCOMPATIBLE;
+
+	/* Continue from the environment's txnid, see mdb_txn_renew0() */
+	if (!(buf = calloc(NUM_METAS, psize)))
+		return ENOMEM;
+	for (i = 0; i < NUM_METAS; i++) {
+		mp = (MDB_page *)(buf + i * psize);
+		mp->mp_pgno = i;
+		mp->mp_flags = P_META;
+		mm = (MDB_meta *)METADATA(mp);
+		*mm = meta;
+		mm->mm_mapsize = env->me_mapsize;
+		mm->mm_txnid = (unsigned)i == (txnid & 1) ? txnid : txnid - 1;
+	}
+	fd = open(cp->cp_path, O_RDWR);
+	if (fd == INVALID_HANDLE_VALUE ||
+		pwrite(fd, buf, NUM_METAS * psize, 0) != (ssize_t)(NUM_METAS * psize) ||
+		MDB_FDATASYNC(fd))
+		rc = ErrCode();
+	free(buf);
+	if (rc == MDB_SUCCESS && env->me_mfd != INVALID_HANDLE_VALUE &&
+		(mfd = open(cp->cp_path, MDB_O_META & MDB_O_MASK)) == INVALID_HANDLE_VALUE)
+		rc = ErrCode();
+	dpath = malloc(strlen(env->me_path) + sizeof("/data.mdb"));
+	if (rc == MDB_SUCCESS && !dpath)
+		rc = ENOMEM;
+	if (rc)
+		goto fail;
+	sprintf(dpath, "%s%s", env->me_path,
+		(env->me_flags & MDB_NOSUBDIR) ? "" : "/data.mdb");
+
+	/* The side files describe the pages of the old file */
+	if (env->me_tmap) {
+		TRACK_HDR(env)->mt_base = 0;
+		TRACK_HDR(env)->mt_last = txnid;
+	}
+	if (env->me_cmap) {
+		CKSUM_HDR(env)->ck_last = 0;
+		CKSUM_HDR(env)->ck_lastpg = P_INVALID;
+		if (msync(env->me_cmap, env->me_csize, MS_SYNC)) {
+			rc = ErrCode();
+			goto fail;
+		}
+	}
+
+	if (rename(cp->cp_path, dpath) < 0) {
+		rc = ErrCode();
+		goto fail;
+	}
+	free(cp->cp_path);
+	cp->cp_path = NULL;
+	/* Make the rename durable */
+	if ((p = strrchr(dpath, '/')) != NULL) {
+		HANDLE dfd;
+		*p = '\0';
+		if ((dfd = open(p == dpath ? "/" : dpath, O_RDONLY)) != INVALID_HANDLE_VALUE) {
+			(void) fsync(dfd);
+			close(dfd);
+		}
+	}
+	free(dpath);
+
+	munmap(env->me_map, MDB_MAPLEN(env));
+	env->me_map = NULL;
+	mdb_win_unmapall(env);
+	close(env->me_fd);
+	env->me_fd = fd;
+	if (mfd != INVALID_HANDLE_VALUE) {
+		close(env->me_mfd);
+		env->me_mfd = mfd;
+	}
+	if ((rc = mdb_env_map(env, NULL))) {
+		env->me_flags |= MDB_FATAL_ERROR;
+		return MDB_PANIC;
+	}
+	return MDB_SUCCESS;
+
+fail:
+	free(dpath);
+	if (fd != INVALID_HANDLE_VALUE)
+		close(fd);
+	if (mfd != INVALID_HANDLE_VALUE)
+		close(mfd);
+	return rc;
+}
+
+int ESECT
+mdb_env_compact_end(MDB_compact *cp, int commit)
+{
+	MDB_env		*env = cp->cp_env;
+	MDB_txninfo	*ti = env->me_txns;
+	MDB_txn		*rtxn;
+	char		*buf;
+	size_t		len;
+	unsigned int i;
+	int			rc, rc2;
+
+	if (!commit || cp->cp_err) {
+		rc = commit ? cp->cp_err : MDB_SUCCESS;
+		goto done;
+	}
+	if (LOCK_MUTEX(rc, env, env->me_wmutex))
+		goto done;
+	rc = mdb_compact_swap(cp, &rtxn, &buf, &len);
+	if (rc == MDB_SUCCESS) {
+		rc = mdb_compact_apply(cp, rtxn, buf, len, 1);
+		mdb_txn_abort(rtxn);
+	}
+	if (rc == MDB_SUCCESS) {
+		/* Nothing may be using the current map */
+		mdb_reader_check0(env, 0, NULL);
+		rc = mdb_env_excl_check(env);
+		for (i = 0; rc == MDB_SUCCESS && i < ti->mti_numreaders; i++) {
+			if (ti->mti_readers[i].mr_pid &&
+				ti->mti_readers[i].mr_txnid != (txnid_t)-1)
+				rc = EBUSY;
+		}
+		if (rc == EBUSY) {
+			UNLOCK_MUTEX(env->me_wmutex);
+			return rc;
+		}
+	}
+	if (rc == MDB_SUCCESS)
+		rc = mdb_compact_switch(cp);
+	env->me_compact = NULL;
+	UNLOCK_MUTEX(env->me_wmutex);
+	mdb_compact_free(cp);
+	return rc;
+
+done:
+	if (LOCK_MUTEX(rc2, env, env->me_wmutex) == 0) {
+		env->me_compact = NULL;
+		UNLOCK_MUTEX(env->me_wmutex);
+	} else {
+		env->me_compact = NULL;
+		if (!rc)
+			rc = rc2;
+	}
+	mdb_compact_free(cp);
+	return rc;
+}
+#else
+int ESECT
+mdb_env_compact_begin(MDB_env *env, MDB_compact **ret)
+{
+	return EINVAL;
+}
+
+int ESECT
+mdb_env_compact_replay(MDB_compact *cp, size_t *count)
+{
+	return EINVAL;
+}
+
+int ESECT
+mdb_env_compact_end(MDB_compact *cp, int commit)
+{
+	return EINVAL;
+}
+#endif /* !_WIN32 */
+/** @} */
+
+int ESECT
 mdb_env_set_flags(MDB_env *env, unsigned int flag, int onoff)
 {
 	if (flag & ~CHANGEABLE)
@@ -9648,6 +13404,18 @@ mdb_env_stat(MDB_env *env, MDB_stat *arg)
 	return mdb_stat0(env, &meta->mm_dbs[MAIN_DBI], arg);
 }
 
+int ESECT
+mdb_env_opstat(MDB_env *env, MDB_opstat *arg, int reset)
+{
+	if (env == NULL || arg == NULL)
+		return EINVAL;
+
+	*arg = env->me_opstat;
+	if (reset)
+		memset(&env->me_opstat, 0, sizeof(env->me_opstat));
+	return MDB_SUCCESS;
+}
+
 int ESECT
 mdb_env_info(MDB_env *env, MDB_envinfo *arg)
 {
@@ -9703,6 +13471,12 @@ int mdb_dbi_open(MDB_txn *txn, const char *name, unsigned int flags, MDB_dbi *db
 
 	if (flags & ~VALID_FLAGS)
 		return EINVAL;
+	/* Prefixes are taken from the front of keys as they are stored */
+	if ((flags & MDB_PREFIXKEY) && (flags & (MDB_REVERSEKEY|MDB_INTEGERKEY)))
+		return EINVAL;
+	if ((flags & MDB_PREFIXDUP) && (!(flags & MDB_DUPSORT) ||
+		(flags & (MDB_DUPFIXED|MDB_INTEGERDUP|MDB_REVERSEDUP))))
+		return EINVAL;
 	if (txn->mt_flags & MDB_TXN_BLOCKED)
 		return MDB_BAD_TXN;
 
@@ -9779,7 +13553,7 @@ int mdb_dbi_open(MDB_txn *txn, const char *name, unsigned int flags, MDB_dbi *db
 		dummy.md_root = P_INVALID;
 		dummy.md_flags = flags & PERSISTENT_FLAGS;
 		WITH_CURSOR_TRACKING(mc,
-			rc = mdb_cursor_put(&mc, &key, &data, F_SUBDATA));
+			rc = mdb_cursor_put0(&mc, &key, &data, F_SUBDATA));
 		dbflag |= DB_DIRTY;
 	}
 
@@ -9791,6 +13565,7 @@ int mdb_dbi_open(MDB_txn *txn, const char *name, unsigned int flags, MDB_dbi *db
 		txn->mt_dbxs[slot].md_name.mv_data = namedup;
 		txn->mt_dbxs[slot].md_name.mv_size = len;
 		txn->mt_dbxs[slot].md_rel = NULL;
+		txn->mt_dbxs[slot].md_cmin = 0;
 		txn->mt_dbflags[slot] = dbflag;
 		/* txn-> and env-> are the same in read txns, use
 		 * tmp variable to avoid undefined assignment
@@ -9827,7 +13602,8 @@ mdb_stat(MDB_txn *txn, MDB_dbi dbi, MDB_stat *arg)
 	return mdb_stat0(txn->mt_env, &txn->mt_dbs[dbi], arg);
 }
 
-void mdb_dbi_close(MDB_env *env, MDB_dbi dbi)
+static void
+mdb_dbi_close0(MDB_env *env, MDB_dbi dbi)
 {
 	char *ptr;
 	if (dbi < CORE_DBS || dbi >= env->me_maxdbs)
@@ -9843,6 +13619,17 @@ void mdb_dbi_close(MDB_env *env, MDB_dbi dbi)
 	}
 }
 
+void mdb_dbi_close(MDB_env *env, MDB_dbi dbi)
+{
+	/* Unsynchronized with write txns, so a compaction could not
+	 * tell which DB their records refer to.
+	 */
+	if (env->me_compact && dbi >= CORE_DBS && dbi < env->me_maxdbs &&
+		env->me_dbxs[dbi].md_name.mv_data)
+		env->me_compact->cp_jerr = MDB_BAD_DBI;
+	mdb_dbi_close0(env, dbi);
+}
+
 int mdb_dbi_flags(MDB_txn *txn, MDB_dbi dbi, unsigned int *flags)
 {
 	/* We could return the flags for the FREE_DBI too but what's the point? */
@@ -9978,14 +13765,23 @@ int mdb_drop(MDB_txn *txn, MDB_dbi dbi, int del)
 
 	/* Can't delete the main DB */
 	if (del && dbi >= CORE_DBS) {
+		if (txn->mt_env->me_compact)
+			mdb_journal_add(txn, dbi, MDB_J_DELETE, NULL, NULL);
 		rc = mdb_del0(txn, MAIN_DBI, &mc->mc_dbx->md_name, NULL, F_SUBDATA);
 		if (!rc) {
 			txn->mt_dbflags[dbi] = DB_STALE;
-			mdb_dbi_close(txn->mt_env, dbi);
+			mdb_dbi_close0(txn->mt_env, dbi);
 		} else {
 			txn->mt_flags |= MDB_TXN_ERROR;
 		}
 	} else {
+		if (txn->mt_env->me_compact) {
+			/* Replaying would empty the named DBs of the copy too */
+			if (dbi < CORE_DBS)
+				txn->mt_env->me_compact->cp_jerr = MDB_INCOMPATIBLE;
+			else
+				mdb_journal_add(txn, dbi, MDB_J_DROP, NULL, NULL);
+		}
 		/* reset the DB record, mark it dirty */
 		txn->mt_dbflags[dbi] |= DB_DIRTY;
 		txn->mt_dbs[dbi].md_depth = 0;
@@ -10011,6 +13807,40 @@ int mdb_set_compare(MDB_txn *txn, MDB_dbi dbi, MDB_cmp_func *cmp)
 	return MDB_SUCCESS;
 }
 
+int mdb_set_compress(MDB_txn *txn, MDB_dbi dbi, unsigned int minsize)
+{
+	if (!TXN_DBI_EXIST(txn, dbi, DB_USRVALID))
+		return EINVAL;
+
+	if (minsize && minsize < MDB_COMPRESS_MIN)
+		return EINVAL;
+
+	if (txn->mt_dbs[dbi].md_flags & MDB_DUPSORT)
+		return MDB_INCOMPATIBLE;
+
+	txn->mt_dbxs[dbi].md_cmin = minsize;
+	return MDB_SUCCESS;
+}
+
+int mdb_env_inmap(MDB_env *env, const MDB_val *val)
+{
+#ifndef _WIN32
+	if (env->me_flags & MDB_WINDOWMAP) {
+		char *ptr = val->mv_data;
+		unsigned int i;
+		int ret = ptr >= env->me_map && ptr < env->me_map + MDB_MAPLEN(env);
+		pthread_mutex_lock(&env->me_wlock);
+		for (i = 0; !ret && i < env->me_wcount; i++)
+			ret = ptr >= env->me_wins[i]->mw_base &&
+				ptr < env->me_wins[i]->mw_base + env->me_wins[i]->mw_len;
+		pthread_mutex_unlock(&env->me_wlock);
+		return ret;
+	}
+#endif
+	return (char *)val->mv_data >= env->me_map &&
+		(char *)val->mv_data < env->me_map + env->me_mapsize;
+}
+
 int mdb_set_dupsort(MDB_txn *txn, MDB_dbi dbi, MDB_cmp_func *cmp)
 {
 	if (!TXN_DBI_EXIST(txn, dbi, DB_USRVALID))
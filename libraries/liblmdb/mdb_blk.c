@@ -0,0 +1,250 @@
+/* mdb_blk.c - binary block format of mdb_dump and mdb_load, and value compression */
+/*
+ * Copyright 2011-2018 Howard Chu, Symas Corp.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+#include <string.h>
+#include "mdb_blk.h"
+
+void mdb_blk_put32(unsigned char *buf, unsigned int v)
+{
+	buf[0] = v;
+	buf[1] = v >> 8;
+	buf[2] = v >> 16;
+	buf[3] = v >> 24;
+}
+
+unsigned int mdb_blk_get32(const unsigned char *buf)
+{
+	return buf[0] | (buf[1] << 8) | (buf[2] << 16) | ((unsigned int)buf[3] << 24);
+}
+
+void mdb_blk_put64(unsigned char *buf, size_t v)
+{
+	mdb_blk_put32(buf, v & 0xffffffffU);
+	mdb_blk_put32(buf+4, (unsigned long long)v >> 32);
+}
+
+size_t mdb_blk_get64(const unsigned char *buf)
+{
+	return mdb_blk_get32(buf) |
+		((unsigned long long)mdb_blk_get32(buf+4) << 32);
+}
+
+void mdb_blk_puthdr(unsigned char *buf, mdb_blkhdr *bh)
+{
+	buf[0] = bh->bh_type;
+	buf[1] = bh->bh_comp;
+	buf[2] = bh->bh_dbno;
+	buf[3] = bh->bh_dbno >> 8;
+	mdb_blk_put32(buf+4, bh->bh_rawlen);
+	mdb_blk_put32(buf+8, bh->bh_len);
+	mdb_blk_put32(buf+12, bh->bh_cksum);
+}
+
+void mdb_blk_gethdr(const unsigned char *buf, mdb_blkhdr *bh)
+{
+	bh->bh_type = buf[0];
+	bh->bh_comp = buf[1];
+	bh->bh_dbno = buf[2] | (buf[3] << 8);
+	bh->bh_rawlen = mdb_blk_get32(buf+4);
+	bh->bh_len = mdb_blk_get32(buf+8);
+	bh->bh_cksum = mdb_blk_get32(buf+12);
+}
+
+size_t mdb_blk_putnum(unsigned char *buf, size_t v)
+{
+	size_t n = 0;
+
+	while (v >= 0x80) {
+		buf[n++] = (v & 0x7f) | 0x80;
+		v >>= 7;
+	}
+	buf[n++] = v;
+	return n;
+}
+
+int mdb_blk_getnum(const unsigned char **ptr, const unsigned char *end, size_t *v)
+{
+	const unsigned char *p = *ptr;
+	size_t r = 0;
+	int shift = 0;
+
+	do {
+		if (p >= end || shift > 63)
+			return -1;
+		r |= (size_t)(*p & 0x7f) << shift;
+		shift += 7;
+	} while (*p++ & 0x80);
+	*ptr = p;
+	*v = r;
+	return 0;
+}
+
+/* CRC-32 (IEEE 802.3), four bits at a time */
+static const unsigned int crctab[16] = {
+	0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac,
+	0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+	0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
+	0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c
+};
+
+unsigned int mdb_blk_crc(const void *buf, size_t len)
+{
+	const unsigned char *p = buf;
+	unsigned int crc = 0xffffffffU;
+
+	while (len--) {
+		crc ^= *p++;
+		crc = (crc >> 4) ^ crctab[crc & 0x0f];
+		crc = (crc >> 4) ^ crctab[crc & 0x0f];
+	}
+	return ~crc;
+}
+
+/*	A simple LZ77 coder. The output is a sequence of runs, each with
+ *	a token byte giving the literal length in its high nibble and the
+ *	match length minus #MINMATCH in its low nibble. A nibble of 15 is
+ *	followed by bytes of 255 and a final byte smaller than 255 which
+ *	are added to it. The literals follow the literal length, then a
+ *	2 byte match offset and the extra match length bytes. The last
+ *	run has no match; the decoder recognizes it by running out of input.
+ */
+#define MINMATCH	4
+#define MAXOFF	65535
+#define HASHBITS	14
+
+static unsigned int rd32(const unsigned char *p)
+{
+	unsigned int v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+#define HASH(v)	(((v) * 2654435761U) >> (32 - HASHBITS))
+
+static unsigned char *putlen(unsigned char *op, size_t len)
+{
+	while (len >= 255) {
+		*op++ = 255;
+		len -= 255;
+	}
+	*op++ = len;
+	return op;
+}
+
+size_t mdb_blk_compress(const unsigned char *src, size_t len,
+	unsigned char *dst, size_t dlen)
+{
+	unsigned int tab[1 << HASHBITS];
+	const unsigned char *ip = src, *anchor = src;
+	const unsigned char *iend = src + len, *ilimit;
+	unsigned char *op = dst, *oend = dst + dlen;
+	size_t lit, mlen;
+
+	if (len > MINMATCH) {
+		memset(tab, 0, sizeof(tab));
+		ilimit = iend - MINMATCH;
+		while (ip <= ilimit) {
+			unsigned int v = rd32(ip), h = HASH(v);
+			const unsigned char *ref = src + tab[h];
+			tab[h] = ip - src;
+			if (ref >= ip || ip - ref > MAXOFF || rd32(ref) != v) {
+				ip++;
+				continue;
+			}
+			mlen = MINMATCH;
+			while (ip + mlen < iend && ref[mlen] == ip[mlen])
+				mlen++;
+			lit = ip - anchor;
+			/* token, literals, offset and both length extensions */
+			if ((size_t)(oend - op) < 1 + lit + lit/255 + 1 + 2 + mlen/255 + 1)
+				return 0;
+			*op = (lit < 15 ? lit : 15) << 4;
+			*op++ |= mlen - MINMATCH < 15 ? mlen - MINMATCH : 15;
+			if (lit >= 15)
+				op = putlen(op, lit - 15);
+			memcpy(op, anchor, lit);
+			op += lit;
+			*op++ = (ip - ref) & 0xff;
+			*op++ = (ip - ref) >> 8;
+			if (mlen - MINMATCH >= 15)
+				op = putlen(op, mlen - MINMATCH - 15);
+			ip += mlen;
+			anchor = ip;
+		}
+	}
+	lit = iend - anchor;
+	if (lit) {
+		if ((size_t)(oend - op) < 1 + lit + lit/255 + 1)
+			return 0;
+		*op++ = (lit < 15 ? lit : 15) << 4;
+		if (lit >= 15)
+			op = putlen(op, lit - 15);
+		memcpy(op, anchor, lit);
+		op += lit;
+	}
+	return op - dst;
+}
+
+static int getlen(const unsigned char **ip, const unsigned char *iend, size_t *len)
+{
+	const unsigned char *p = *ip;
+	unsigned char c;
+
+	do {
+		if (p >= iend)
+			return -1;
+		c = *p++;
+		*len += c;
+	} while (c == 255);
+	*ip = p;
+	return 0;
+}
+
+int mdb_blk_decompress(const unsigned char *src, size_t len,
+	unsigned char *dst, size_t dlen)
+{
+	const unsigned char *ip = src, *iend = src + len;
+	unsigned char *op = dst, *oend = dst + dlen;
+	const unsigned char *ref;
+	size_t lit, mlen, off;
+	unsigned char token;
+
+	while (ip < iend) {
+		token = *ip++;
+		lit = token >> 4;
+		if (lit == 15 && getlen(&ip, iend, &lit))
+			return -1;
+		if ((size_t)(iend - ip) < lit || (size_t)(oend - op) < lit)
+			return -1;
+		memcpy(op, ip, lit);
+		ip += lit;
+		op += lit;
+		if (ip == iend)
+			break;
+		if (iend - ip < 2)
+			return -1;
+		off = ip[0] | (ip[1] << 8);
+		ip += 2;
+		mlen = (token & 0x0f);
+		if (mlen == 15 && getlen(&ip, iend, &mlen))
+			return -1;
+		mlen += MINMATCH;
+		if (off == 0 || off > (size_t)(op - dst) || (size_t)(oend - op) < mlen)
+			return -1;
+		/* may overlap the output, copy forward a byte at a time */
+		ref = op - off;
+		while (mlen--)
+			*op++ = *ref++;
+	}
+	return op == oend ? 0 : -1;
+}
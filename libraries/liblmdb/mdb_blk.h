@@ -0,0 +1,94 @@
+/* mdb_blk.h - binary block format of mdb_dump and mdb_load, and value compression */
+/*
+ * Copyright 2011-2018 Howard Chu, Symas Corp.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+#ifndef _MDB_BLK_H_
+#define _MDB_BLK_H_
+
+#include <stddef.h>
+
+/*	A binary dump starts with an 8 byte magic, a 4 byte format
+ *	version and the 4 byte number of databases in the stream.
+ *	Everything after that is a sequence of frames. Each frame has
+ *	a 16 byte header giving its type, the compression used for its
+ *	payload, the number of the database it belongs to, the raw and
+ *	stored payload lengths and a CRC-32 of the raw payload. All
+ *	integers are little-endian.
+ *
+ *	Frames of different databases may be interleaved, but the frames
+ *	of any one database are in key order, so that they can be loaded
+ *	with #MDB_APPEND.
+ */
+#define MDB_BLK_MAGIC	"\211MDBDUMP"
+#define MDB_BLK_MAGICLEN	8
+#define MDB_BLK_VERSION	1
+#define MDB_BLK_HDRLEN	16
+
+	/** Database header: flags, maxreaders, mapsize and name */
+#define MDB_BLK_DBHDR	'H'
+	/** Key/data records, each prefixed by their lengths */
+#define MDB_BLK_DATA	'D'
+	/** End of a database: number of records dumped */
+#define MDB_BLK_DBEND	'E'
+	/** End of stream, no payload */
+#define MDB_BLK_END	'Z'
+
+	/** Payload is stored as is */
+#define MDB_BLK_RAW	0
+	/** Payload is compressed with #mdb_blk_compress() */
+#define MDB_BLK_LZ	1
+
+	/** Raw size at which a data frame is written out */
+#define MDB_BLK_SIZE	(256*1024)
+
+	/** Name length in a database header meaning the main DB */
+#define MDB_BLK_NONAME	0xffffffffU
+
+typedef struct mdb_blkhdr {
+	unsigned char	bh_type;
+	unsigned char	bh_comp;
+	unsigned short	bh_dbno;
+	unsigned int	bh_rawlen;
+	unsigned int	bh_len;
+	unsigned int	bh_cksum;
+} mdb_blkhdr;
+
+void mdb_blk_puthdr(unsigned char *buf, mdb_blkhdr *bh);
+void mdb_blk_gethdr(const unsigned char *buf, mdb_blkhdr *bh);
+
+void mdb_blk_put32(unsigned char *buf, unsigned int v);
+unsigned int mdb_blk_get32(const unsigned char *buf);
+void mdb_blk_put64(unsigned char *buf, size_t v);
+size_t mdb_blk_get64(const unsigned char *buf);
+
+	/** Store a variable length number, return the bytes used (at most 10) */
+size_t mdb_blk_putnum(unsigned char *buf, size_t v);
+	/** Fetch a variable length number, return -1 if it overruns end */
+int mdb_blk_getnum(const unsigned char **ptr, const unsigned char *end, size_t *v);
+
+unsigned int mdb_blk_crc(const void *buf, size_t len);
+
+	/** Compress len bytes of src into dst, which has room for dlen bytes.
+	 *	This is also used for values of databases set up with
+	 *	#mdb_set_compress().
+	 *	Returns the compressed size, or 0 if the result would not
+	 *	fit in dlen bytes.
+	 */
+size_t mdb_blk_compress(const unsigned char *src, size_t len,
+	unsigned char *dst, size_t dlen);
+	/** Decompress len bytes of src into exactly dlen bytes of dst.
+	 *	Returns 0 on success, -1 if the input is corrupted.
+	 */
+int mdb_blk_decompress(const unsigned char *src, size_t len,
+	unsigned char *dst, size_t dlen);
+
+#endif /* _MDB_BLK_H_ */
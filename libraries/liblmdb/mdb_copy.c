@@ -40,6 +40,13 @@ int main(int argc,char * argv[])
 			flags |= MDB_NOSUBDIR;
 		else if (argv[1][1] == 'c' && argv[1][2] == '\0')
 			cpflags |= MDB_CP_COMPACT;
+		else if (argv[1][1] == 'm' && argv[1][2] == '\0') {
+			cpflags |= MDB_CP_MARK;
+			flags |= MDB_TRACKPAGES;
+		} else if (argv[1][1] == 'd' && argv[1][2] == '\0') {
+			cpflags |= MDB_CP_DELTA;
+			flags |= MDB_TRACKPAGES;
+		}
 		else if (argv[1][1] == 'V' && argv[1][2] == '\0') {
 			printf("%s\n", MDB_VERSION_STRING);
 			exit(0);
@@ -48,7 +55,7 @@ int main(int argc,char * argv[])
 	}
 
 	if (argc<2 || argc>3) {
-		fprintf(stderr, "usage: %s [-V] [-c] [-n] srcpath [dstpath]\n", progname);
+		fprintf(stderr, "usage: %s [-V] [-c|-m|-d] [-n] srcpath [dstpath]\n", progname);
 		exit(EXIT_FAILURE);
 	}
 
@@ -19,6 +19,12 @@
 #include <unistd.h>
 #include <signal.h>
 #include "lmdb.h"
+#include "mdb_blk.h"
+
+#ifndef _WIN32
+#include <pthread.h>
+#define BLK_THREADS	1
+#endif
 
 #ifdef _WIN32
 #define Z	"I"
@@ -27,6 +33,8 @@
 #endif
 
 #define PRINT	1
+#define BINARY	2
+#define COMPRESS	4
 static int mode;
 
 typedef struct flagbit {
@@ -41,6 +49,8 @@ flagbit dbflags[] = {
 	{ MDB_DUPFIXED, "dupfixed" },
 	{ MDB_INTEGERDUP, "integerdup" },
 	{ MDB_REVERSEDUP, "reversedup" },
+	{ MDB_PREFIXKEY, "prefixkey" },
+	{ MDB_PREFIXDUP, "prefixdup" },
 	{ 0, NULL }
 };
 
@@ -153,9 +163,327 @@ static int dumpit(MDB_txn *txn, MDB_dbi dbi, char *name)
 	return rc;
 }
 
+/* Binary format, see mdb_blk.h */
+typedef struct dumpdb {
+	char *name;
+	MDB_dbi dbi;
+} dumpdb;
+
+typedef struct blkbuf {
+	unsigned char *raw;
+	size_t rsize, rlen;
+	unsigned char *cbuf;
+	size_t csize;
+} blkbuf;
+
+static dumpdb *dbs;
+static int ndbs, nextdb;
+static int dumprc;
+
+#ifdef BLK_THREADS
+static pthread_mutex_t blkmutex = PTHREAD_MUTEX_INITIALIZER;
+#define BLK_LOCK()	pthread_mutex_lock(&blkmutex)
+#define BLK_UNLOCK()	pthread_mutex_unlock(&blkmutex)
+#else
+#define BLK_LOCK()
+#define BLK_UNLOCK()
+#endif
+
+static int blkroom(blkbuf *bb, size_t len)
+{
+	if (bb->rlen + len > bb->rsize) {
+		size_t size = bb->rsize ? bb->rsize : MDB_BLK_SIZE + MDB_BLK_SIZE/4;
+		unsigned char *p;
+		while (size < bb->rlen + len)
+			size *= 2;
+		p = realloc(bb->raw, size);
+		if (!p)
+			return ENOMEM;
+		bb->raw = p;
+		bb->rsize = size;
+	}
+	return 0;
+}
+
+/* Write out the buffered payload as one frame */
+static int putframe(blkbuf *bb, int type, int dbno)
+{
+	mdb_blkhdr bh;
+	unsigned char hdr[MDB_BLK_HDRLEN];
+	unsigned char *out = bb->raw;
+	size_t len = bb->rlen;
+	int rc = 0;
+
+	bh.bh_type = type;
+	bh.bh_comp = MDB_BLK_RAW;
+	bh.bh_dbno = dbno;
+	bh.bh_rawlen = len;
+	bh.bh_cksum = mdb_blk_crc(bb->raw, len);
+
+	if ((mode & COMPRESS) && len > 1) {
+		size_t clen;
+		if (bb->csize < len) {
+			unsigned char *p = realloc(bb->cbuf, bb->rsize);
+			if (!p)
+				return ENOMEM;
+			bb->cbuf = p;
+			bb->csize = bb->rsize;
+		}
+		/* only keep it if it saves something */
+		clen = mdb_blk_compress(bb->raw, len, bb->cbuf, len - 1);
+		if (clen) {
+			out = bb->cbuf;
+			len = clen;
+			bh.bh_comp = MDB_BLK_LZ;
+		}
+	}
+	bh.bh_len = len;
+	mdb_blk_puthdr(hdr, &bh);
+
+	BLK_LOCK();
+	if (fwrite(hdr, sizeof(hdr), 1, stdout) != 1 ||
+		(len && fwrite(out, len, 1, stdout) != 1))
+		rc = errno ? errno : EIO;
+	BLK_UNLOCK();
+	bb->rlen = 0;
+	return rc;
+}
+
+/* Dump one DB as a header frame, data frames and an end frame */
+static int dumpbin(MDB_txn *txn, int dbno, blkbuf *bb)
+{
+	MDB_cursor *mc;
+	MDB_val key, data;
+	MDB_envinfo info;
+	unsigned int flags, namelen;
+	char *name = dbs[dbno].name;
+	size_t count = 0;
+	int rc;
+
+	rc = mdb_dbi_flags(txn, dbs[dbno].dbi, &flags);
+	if (rc) return rc;
+
+	rc = mdb_env_info(mdb_txn_env(txn), &info);
+	if (rc) return rc;
+
+	namelen = name ? strlen(name) : 0;
+	rc = blkroom(bb, 20 + namelen);
+	if (rc) return rc;
+	mdb_blk_put32(bb->raw, flags);
+	mdb_blk_put32(bb->raw+4, info.me_maxreaders);
+	mdb_blk_put64(bb->raw+8, info.me_mapsize);
+	mdb_blk_put32(bb->raw+16, name ? namelen : MDB_BLK_NONAME);
+	memcpy(bb->raw+20, name, namelen);
+	bb->rlen = 20 + namelen;
+	rc = putframe(bb, MDB_BLK_DBHDR, dbno);
+	if (rc) return rc;
+
+	rc = mdb_cursor_open(txn, dbs[dbno].dbi, &mc);
+	if (rc) return rc;
+
+	while ((rc = mdb_cursor_get(mc, &key, &data, MDB_NEXT)) == MDB_SUCCESS) {
+		if (gotsig) {
+			rc = EINTR;
+			break;
+		}
+		if (dumprc) {
+			/* another thread failed, just stop */
+			rc = dumprc;
+			break;
+		}
+		/* frame lengths are 32 bits */
+		if (bb->rlen && bb->rlen + 20 + key.mv_size + data.mv_size > 0xffffffffU) {
+			rc = putframe(bb, MDB_BLK_DATA, dbno);
+			if (rc)
+				break;
+		}
+		rc = blkroom(bb, 20 + key.mv_size + data.mv_size);
+		if (rc)
+			break;
+		bb->rlen += mdb_blk_putnum(bb->raw + bb->rlen, key.mv_size);
+		bb->rlen += mdb_blk_putnum(bb->raw + bb->rlen, data.mv_size);
+		memcpy(bb->raw + bb->rlen, key.mv_data, key.mv_size);
+		bb->rlen += key.mv_size;
+		memcpy(bb->raw + bb->rlen, data.mv_data, data.mv_size);
+		bb->rlen += data.mv_size;
+		count++;
+		if (bb->rlen >= MDB_BLK_SIZE) {
+			rc = putframe(bb, MDB_BLK_DATA, dbno);
+			if (rc)
+				break;
+		}
+	}
+	mdb_cursor_close(mc);
+	if (rc != MDB_NOTFOUND)
+		return rc;
+
+	rc = 0;
+	if (bb->rlen)
+		rc = putframe(bb, MDB_BLK_DATA, dbno);
+	if (!rc) {
+		mdb_blk_put64(bb->raw, count);
+		bb->rlen = 8;
+		rc = putframe(bb, MDB_BLK_DBEND, dbno);
+	}
+	return rc;
+}
+
+/* Dump DBs until there are none left or somebody failed */
+static void *dumpthr(void *arg)
+{
+	MDB_txn *txn = arg;
+	blkbuf bb = {0};
+	int i, rc;
+
+	for (;;) {
+		BLK_LOCK();
+		i = dumprc ? ndbs : nextdb++;
+		BLK_UNLOCK();
+		if (i >= ndbs)
+			break;
+		rc = dumpbin(txn, i, &bb);
+		if (rc) {
+			BLK_LOCK();
+			if (!dumprc)
+				dumprc = rc;
+			BLK_UNLOCK();
+			break;
+		}
+	}
+	free(bb.raw);
+	free(bb.cbuf);
+	return NULL;
+}
+
+/* Count the candidate subDB names, using a throwaway env that is
+ * closed again before returning.
+ */
+static int countdbs(MDB_env *env, char *envname, int envflags)
+{
+	MDB_txn *txn;
+	MDB_cursor *mc;
+	MDB_val key;
+	MDB_dbi dbi;
+	int rc, count = 0;
+
+	rc = mdb_env_open(env, envname, envflags | MDB_RDONLY, 0664);
+	if (!rc)
+		rc = mdb_txn_begin(env, NULL, MDB_RDONLY, &txn);
+	if (rc) {
+		fprintf(stderr, "mdb_env_open failed, error %d %s\n", rc, mdb_strerror(rc));
+		mdb_env_close(env);
+		return -1;
+	}
+	rc = mdb_open(txn, NULL, 0, &dbi);
+	if (!rc)
+		rc = mdb_cursor_open(txn, dbi, &mc);
+	if (!rc) {
+		while (mdb_cursor_get(mc, &key, NULL, MDB_NEXT_NODUP) == 0) {
+			if (!memchr(key.mv_data, '\0', key.mv_size))
+				count++;
+		}
+		mdb_cursor_close(mc);
+	}
+	mdb_txn_abort(txn);
+	mdb_env_close(env);
+	if (rc) {
+		fprintf(stderr, "mdb_cursor_open failed, error %d %s\n", rc, mdb_strerror(rc));
+		return -1;
+	}
+	return count;
+}
+
+/* Dump all collected DBs using nthreads read txns on the same snapshot.
+ * The main txn is consumed.
+ */
+static int dumpall(MDB_env *env, MDB_txn *txn, int nthreads)
+{
+	unsigned char hdr[MDB_BLK_MAGICLEN + 8];
+	blkbuf bb = {0};
+	int i, rc = 0;
+
+	memcpy(hdr, MDB_BLK_MAGIC, MDB_BLK_MAGICLEN);
+	mdb_blk_put32(hdr + MDB_BLK_MAGICLEN, MDB_BLK_VERSION);
+	mdb_blk_put32(hdr + MDB_BLK_MAGICLEN + 4, ndbs);
+	if (fwrite(hdr, sizeof(hdr), 1, stdout) != 1)
+		return errno ? errno : EIO;
+
+	if (nthreads > ndbs)
+		nthreads = ndbs;
+#ifdef BLK_THREADS
+	if (nthreads > 1) {
+		MDB_txn **txns;
+		pthread_t *thr;
+		size_t id;
+
+		/* the DBI handles become visible to other txns on commit */
+		rc = mdb_txn_commit(txn);
+		if (rc)
+			return rc;
+		txns = calloc(nthreads, sizeof(MDB_txn *));
+		thr = calloc(nthreads, sizeof(pthread_t));
+		if (!txns || !thr) {
+			free(txns);
+			free(thr);
+			return ENOMEM;
+		}
+		/* all threads must see the same snapshot; retry if
+		 * a writer committed while the txns were being set up
+		 */
+		do {
+			for (i=0; i<nthreads; i++) {
+				rc = mdb_txn_begin(env, NULL, MDB_RDONLY, &txns[i]);
+				if (rc)
+					break;
+				id = mdb_txn_id(txns[0]);
+				if (mdb_txn_id(txns[i]) != id) {
+					i++;
+					rc = MDB_BAD_TXN;
+					break;
+				}
+			}
+			if (rc) {
+				while (i--)
+					mdb_txn_abort(txns[i]);
+			}
+		} while (rc == MDB_BAD_TXN);
+
+		if (!rc) {
+			int nthr;
+			for (nthr=0; nthr<nthreads; nthr++) {
+				rc = pthread_create(&thr[nthr], NULL, dumpthr, txns[nthr]);
+				if (rc) {
+					BLK_LOCK();
+					dumprc = rc;
+					BLK_UNLOCK();
+					break;
+				}
+			}
+			for (i=0; i<nthr; i++)
+				pthread_join(thr[i], NULL);
+			for (i=0; i<nthreads; i++)
+				mdb_txn_abort(txns[i]);
+		}
+		free(txns);
+		free(thr);
+		if (rc)
+			return rc;
+	} else
+#endif
+	{
+		dumpthr(txn);
+		mdb_txn_abort(txn);
+	}
+
+	rc = dumprc;
+	if (!rc)
+		rc = putframe(&bb, MDB_BLK_END, 0);
+	return rc;
+}
+
 static void usage(char *prog)
 {
-	fprintf(stderr, "usage: %s [-V] [-f output] [-l] [-n] [-p] [-a|-s subdb] dbpath\n", prog);
+	fprintf(stderr, "usage: %s [-V] [-f output] [-l] [-n] [-p] [-b [-z] [-j threads]] [-a|-s subdb] dbpath\n", prog);
 	exit(EXIT_FAILURE);
 }
 
@@ -169,6 +497,7 @@ int main(int argc, char *argv[])
 	char *envname;
 	char *subname = NULL;
 	int alldbs = 0, envflags = 0, list = 0;
+	int nthreads = 1;
 
 	if (argc < 2) {
 		usage(prog);
@@ -178,11 +507,14 @@ int main(int argc, char *argv[])
 	 * -s: dump only the named subDB
 	 * -n: use NOSUBDIR flag on env_open
 	 * -p: use printable characters
+	 * -b: use binary format
+	 * -z: compress binary output
+	 * -j: number of threads for binary output
 	 * -f: write to file instead of stdout
 	 * -V: print version and exit
 	 * (default) dump only the main DB
 	 */
-	while ((i = getopt(argc, argv, "af:lnps:V")) != EOF) {
+	while ((i = getopt(argc, argv, "abf:j:lnps:zV")) != EOF) {
 		switch(i) {
 		case 'V':
 			printf("%s\n", MDB_VERSION_STRING);
@@ -209,6 +541,17 @@ int main(int argc, char *argv[])
 		case 'p':
 			mode |= PRINT;
 			break;
+		case 'b':
+			mode |= BINARY;
+			break;
+		case 'z':
+			mode |= BINARY|COMPRESS;
+			break;
+		case 'j':
+			nthreads = atoi(optarg);
+			if (nthreads < 1)
+				usage(prog);
+			break;
 		case 's':
 			if (alldbs)
 				usage(prog);
@@ -221,6 +564,8 @@ int main(int argc, char *argv[])
 
 	if (optind != argc - 1)
 		usage(prog);
+	if ((mode & (BINARY|PRINT)) == (BINARY|PRINT))
+		usage(prog);
 
 #ifdef SIGPIPE
 	signal(SIGPIPE, dumpsig);
@@ -238,9 +583,24 @@ int main(int argc, char *argv[])
 		return EXIT_FAILURE;
 	}
 
-	if (alldbs || subname) {
+	if (alldbs && (mode & BINARY) && !list) {
+		/* all DBs are kept open for the binary dump */
+		ndbs = countdbs(env, envname, envflags);
+		if (ndbs < 0)
+			return EXIT_FAILURE;
+		rc = mdb_env_create(&env);
+		if (rc) {
+			fprintf(stderr, "mdb_env_create failed, error %d %s\n", rc, mdb_strerror(rc));
+			return EXIT_FAILURE;
+		}
+		mdb_env_set_maxdbs(env, ndbs + 1);
+		ndbs = 0;
+	} else if (alldbs || subname) {
 		mdb_env_set_maxdbs(env, 2);
 	}
+	/* allow several read txns in the main thread */
+	if ((mode & BINARY) && nthreads > 1)
+		envflags |= MDB_NOTLS;
 
 	rc = mdb_env_open(env, envname, envflags | MDB_RDONLY, 0664);
 	if (rc) {
@@ -284,6 +644,16 @@ int main(int argc, char *argv[])
 				if (list) {
 					printf("%s\n", str);
 					list++;
+				} else if (mode & BINARY) {
+					dumpdb *d = realloc(dbs, (ndbs+1) * sizeof(dumpdb));
+					if (!d) {
+						rc = ENOMEM;
+						break;
+					}
+					dbs = d;
+					dbs[ndbs].name = str;
+					dbs[ndbs++].dbi = db2;
+					continue;
 				} else {
 					rc = dumpit(txn, db2, str);
 					if (rc)
@@ -301,9 +671,30 @@ int main(int argc, char *argv[])
 		} else if (rc == MDB_NOTFOUND) {
 			rc = MDB_SUCCESS;
 		}
+	} else if (mode & BINARY) {
+		dbs = malloc(sizeof(dumpdb));
+		if (dbs) {
+			dbs[0].name = subname ? strdup(subname) : NULL;
+			dbs[0].dbi = dbi;
+			ndbs = 1;
+		} else {
+			rc = ENOMEM;
+		}
 	} else {
 		rc = dumpit(txn, dbi, subname);
 	}
+	if ((mode & BINARY) && !list && !rc) {
+		rc = dumpall(env, txn, nthreads);
+		txn = NULL;
+		if (!rc && fflush(stdout))
+			rc = errno;
+	}
+	for (i=0; i<ndbs; i++) {
+		if (alldbs)
+			mdb_close(env, dbs[i].dbi);
+		free(dbs[i].name);
+	}
+	free(dbs);
 	if (rc && rc != MDB_NOTFOUND)
 		fprintf(stderr, "%s: %s: %s\n", prog, envname, mdb_strerror(rc));
 
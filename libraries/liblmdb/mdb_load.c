@@ -18,9 +18,16 @@
 #include <ctype.h>
 #include <unistd.h>
 #include "lmdb.h"
+#include "mdb_blk.h"
+
+#ifndef _WIN32
+#include <pthread.h>
+#define BLK_THREADS	1
+#endif
 
 #define PRINT	1
 #define NOHDR	2
+#define APPEND	4
 static int mode;
 
 static char *subname = NULL;
@@ -61,6 +68,8 @@ flagbit dbflags[] = {
 	{ MDB_DUPFIXED, S("dupfixed") },
 	{ MDB_INTEGERDUP, S("integerdup") },
 	{ MDB_REVERSEDUP, S("reversedup") },
+	{ MDB_PREFIXKEY, S("prefixkey") },
+	{ MDB_PREFIXDUP, S("prefixdup") },
 	{ 0, NULL, 0 }
 };
 
@@ -275,9 +284,407 @@ badend:
 	return 0;
 }
 
+static int appflag(int dbflags)
+{
+	if (!(mode & APPEND))
+		return 0;
+	return (dbflags & MDB_DUPSORT) ? MDB_APPENDDUP : MDB_APPEND;
+}
+
+/* Binary format, see mdb_blk.h */
+
+	/** Frames buffered ahead of the loader by the reader thread */
+#define NFRAMES	4
+	/** Payload bytes to load in one txn */
+#define BLK_TXNSIZE	(64*1024*1024)
+
+#define DBFLAGS	(MDB_REVERSEKEY|MDB_DUPSORT|MDB_INTEGERKEY|MDB_DUPFIXED|\
+	MDB_INTEGERDUP|MDB_REVERSEDUP|MDB_PREFIXKEY|MDB_PREFIXDUP)
+
+typedef struct blkframe {
+	mdb_blkhdr bf_hdr;
+	unsigned char *bf_data;
+	size_t bf_size;
+	unsigned char *bf_cbuf;
+	size_t bf_csize;
+	int bf_rc;
+} blkframe;
+
+typedef struct loaddb {
+	MDB_dbi ld_dbi;
+	MDB_cursor *ld_mc;
+	size_t ld_count;
+	int ld_flags;
+	int ld_state;
+#define LD_NEW	0
+#define LD_OPEN	1
+#define LD_DONE	2
+} loaddb;
+
+static blkframe frames[NFRAMES];
+static size_t frameno;
+
+#ifdef BLK_THREADS
+static pthread_mutex_t fmutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t fnotempty = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t fnotfull = PTHREAD_COND_INITIALIZER;
+static int fhead, ftail, fcount, fheld, fstop;
+#endif
+
+static int growbuf(unsigned char **buf, size_t *size, size_t len)
+{
+	if (len > *size) {
+		unsigned char *p = realloc(*buf, len);
+		if (!p)
+			return ENOMEM;
+		*buf = p;
+		*size = len;
+	}
+	return 0;
+}
+
+/* Read, decompress and verify the next frame of input */
+static int readframe(blkframe *bf)
+{
+	unsigned char hdr[MDB_BLK_HDRLEN];
+	mdb_blkhdr *bh = &bf->bf_hdr;
+	unsigned char *in;
+
+	frameno++;
+	if (fread(hdr, sizeof(hdr), 1, stdin) != 1)
+		goto badend;
+	mdb_blk_gethdr(hdr, bh);
+	if ((bh->bh_type != MDB_BLK_DBHDR && bh->bh_type != MDB_BLK_DATA &&
+		bh->bh_type != MDB_BLK_DBEND && bh->bh_type != MDB_BLK_END) ||
+		(bh->bh_comp != MDB_BLK_RAW && bh->bh_comp != MDB_BLK_LZ) ||
+		(bh->bh_comp == MDB_BLK_RAW && bh->bh_len != bh->bh_rawlen)) {
+		fprintf(stderr, "%s: frame %" Z "u: invalid frame header\n",
+			prog, frameno);
+		return EINVAL;
+	}
+	if (growbuf(&bf->bf_data, &bf->bf_size, (size_t)bh->bh_rawlen + 1))
+		goto nomem;
+	in = bf->bf_data;
+	if (bh->bh_comp != MDB_BLK_RAW) {
+		if (growbuf(&bf->bf_cbuf, &bf->bf_csize, bh->bh_len))
+			goto nomem;
+		in = bf->bf_cbuf;
+	}
+	if (bh->bh_len && fread(in, bh->bh_len, 1, stdin) != 1)
+		goto badend;
+	if (bh->bh_comp != MDB_BLK_RAW &&
+		mdb_blk_decompress(in, bh->bh_len, bf->bf_data, bh->bh_rawlen)) {
+		fprintf(stderr, "%s: frame %" Z "u: corrupted compressed data\n",
+			prog, frameno);
+		return EINVAL;
+	}
+	if (mdb_blk_crc(bf->bf_data, bh->bh_rawlen) != bh->bh_cksum) {
+		fprintf(stderr, "%s: frame %" Z "u: checksum mismatch\n",
+			prog, frameno);
+		return EINVAL;
+	}
+	return 0;
+
+badend:
+	if (ferror(stdin)) {
+		fprintf(stderr, "%s: frame %" Z "u: read error: %s\n",
+			prog, frameno, strerror(errno));
+		return EIO;
+	}
+	fprintf(stderr, "%s: frame %" Z "u: unexpected end of input\n",
+		prog, frameno);
+	return EINVAL;
+nomem:
+	fprintf(stderr, "%s: frame %" Z "u: out of memory\n",
+		prog, frameno);
+	return ENOMEM;
+}
+
+#ifdef BLK_THREADS
+/* Read frames ahead of the loader, so input and decompression
+ * overlap with the database writes.
+ */
+static void *readthr(void *arg)
+{
+	blkframe *bf;
+	int rc;
+
+	for (;;) {
+		pthread_mutex_lock(&fmutex);
+		while (fcount == NFRAMES && !fstop)
+			pthread_cond_wait(&fnotfull, &fmutex);
+		if (fstop) {
+			pthread_mutex_unlock(&fmutex);
+			break;
+		}
+		bf = &frames[ftail];
+		pthread_mutex_unlock(&fmutex);
+
+		rc = readframe(bf);
+		bf->bf_rc = rc;
+
+		pthread_mutex_lock(&fmutex);
+		ftail = (ftail + 1) % NFRAMES;
+		fcount++;
+		pthread_cond_signal(&fnotempty);
+		pthread_mutex_unlock(&fmutex);
+		if (rc || bf->bf_hdr.bh_type == MDB_BLK_END)
+			break;
+	}
+	return NULL;
+}
+#endif
+
+/* Return the next frame, or NULL if it could not be read */
+static blkframe *nextframe(void)
+{
+	blkframe *bf;
+#ifdef BLK_THREADS
+	pthread_mutex_lock(&fmutex);
+	if (fheld) {
+		fhead = (fhead + 1) % NFRAMES;
+		fcount--;
+		pthread_cond_signal(&fnotfull);
+	}
+	while (!fcount)
+		pthread_cond_wait(&fnotempty, &fmutex);
+	fheld = 1;
+	bf = &frames[fhead];
+	pthread_mutex_unlock(&fmutex);
+#else
+	bf = &frames[0];
+	bf->bf_rc = readframe(bf);
+#endif
+	return bf->bf_rc ? NULL : bf;
+}
+
+static int loadbin(char *envname, int envflags, int putflags)
+{
+	unsigned char hdr[MDB_BLK_MAGICLEN + 8];
+	MDB_env *env = NULL;
+	MDB_txn *txn = NULL;
+	loaddb *ldbs = NULL;
+	blkframe *bf;
+	mdb_blkhdr *bh;
+	size_t batch = 0;
+	unsigned int ndbs, dbflags;
+	int i, rc = EINVAL;
+#ifdef BLK_THREADS
+	pthread_t thr;
+#endif
+
+	if (fread(hdr, sizeof(hdr), 1, stdin) != 1 ||
+		memcmp(hdr, MDB_BLK_MAGIC, MDB_BLK_MAGICLEN)) {
+		fprintf(stderr, "%s: unrecognized input format\n", prog);
+		return EXIT_FAILURE;
+	}
+	version = mdb_blk_get32(hdr + MDB_BLK_MAGICLEN);
+	if (version > MDB_BLK_VERSION) {
+		fprintf(stderr, "%s: unsupported binary VERSION %d\n",
+			prog, version);
+		return EXIT_FAILURE;
+	}
+	ndbs = mdb_blk_get32(hdr + MDB_BLK_MAGICLEN + 4);
+	if (subname && ndbs != 1) {
+		fprintf(stderr, "%s: -s requires input with a single database\n",
+			prog);
+		return EXIT_FAILURE;
+	}
+	ldbs = calloc(ndbs ? ndbs : 1, sizeof(loaddb));
+	if (!ldbs)
+		return EXIT_FAILURE;
+
+#ifdef BLK_THREADS
+	if (pthread_create(&thr, NULL, readthr, NULL)) {
+		fprintf(stderr, "%s: unable to start reader thread\n", prog);
+		return EXIT_FAILURE;
+	}
+#endif
+
+	while ((bf = nextframe()) != NULL) {
+		const unsigned char *ptr, *end;
+		loaddb *ld;
+		char *name;
+
+		bh = &bf->bf_hdr;
+		if (bh->bh_type == MDB_BLK_END)
+			break;
+		if (bh->bh_dbno >= ndbs) {
+			fprintf(stderr, "%s: frame %" Z "u: invalid database number %u\n",
+				prog, frameno, bh->bh_dbno);
+			goto fail;
+		}
+		ld = &ldbs[bh->bh_dbno];
+
+		switch (bh->bh_type) {
+		case MDB_BLK_DBHDR:
+			if (ld->ld_state != LD_NEW || bh->bh_rawlen < 20)
+				goto badframe;
+			dbflags = mdb_blk_get32(bf->bf_data) & DBFLAGS;
+			i = mdb_blk_get32(bf->bf_data+16);
+			if ((unsigned int)i != MDB_BLK_NONAME &&
+				(unsigned int)i != bh->bh_rawlen - 20)
+				goto badframe;
+			if (subname) {
+				name = subname;
+			} else if ((unsigned int)i != MDB_BLK_NONAME) {
+				name = (char *)bf->bf_data + 20;
+				name[i] = '\0';
+			} else {
+				name = NULL;
+			}
+			if (!env) {
+				/* the environment is set up from the first header */
+				info.me_maxreaders = mdb_blk_get32(bf->bf_data+4);
+				info.me_mapsize = mdb_blk_get64(bf->bf_data+8);
+				rc = mdb_env_create(&env);
+				if (rc) {
+					fprintf(stderr, "mdb_env_create failed, error %d %s\n", rc, mdb_strerror(rc));
+					goto fail;
+				}
+				mdb_env_set_maxdbs(env, ndbs < 2 ? 2 : ndbs);
+				if (info.me_maxreaders)
+					mdb_env_set_maxreaders(env, info.me_maxreaders);
+				if (info.me_mapsize)
+					mdb_env_set_mapsize(env, info.me_mapsize);
+				rc = mdb_env_open(env, envname, envflags, 0664);
+				if (rc) {
+					fprintf(stderr, "mdb_env_open failed, error %d %s\n", rc, mdb_strerror(rc));
+					goto fail;
+				}
+			}
+			if (!txn) {
+				rc = mdb_txn_begin(env, NULL, 0, &txn);
+				if (rc) {
+					fprintf(stderr, "mdb_txn_begin failed, error %d %s\n", rc, mdb_strerror(rc));
+					goto fail;
+				}
+			}
+			rc = mdb_dbi_open(txn, name, dbflags|MDB_CREATE, &ld->ld_dbi);
+			if (rc) {
+				fprintf(stderr, "mdb_open failed, error %d %s\n", rc, mdb_strerror(rc));
+				goto fail;
+			}
+			rc = mdb_cursor_open(txn, ld->ld_dbi, &ld->ld_mc);
+			if (rc) {
+				fprintf(stderr, "mdb_cursor_open failed, error %d %s\n", rc, mdb_strerror(rc));
+				goto fail;
+			}
+			ld->ld_flags = putflags | appflag(dbflags);
+			ld->ld_state = LD_OPEN;
+			break;
+
+		case MDB_BLK_DATA:
+			if (ld->ld_state != LD_OPEN)
+				goto badframe;
+			ptr = bf->bf_data;
+			end = ptr + bh->bh_rawlen;
+			while (ptr < end) {
+				MDB_val key, data;
+				if (mdb_blk_getnum(&ptr, end, &key.mv_size) ||
+					mdb_blk_getnum(&ptr, end, &data.mv_size) ||
+					key.mv_size > (size_t)(end - ptr) ||
+					data.mv_size > (size_t)(end - ptr - key.mv_size))
+					goto badframe;
+				key.mv_data = (void *)ptr;
+				ptr += key.mv_size;
+				data.mv_data = (void *)ptr;
+				ptr += data.mv_size;
+				ld->ld_count++;
+				rc = mdb_cursor_put(ld->ld_mc, &key, &data, ld->ld_flags);
+				if (rc == MDB_KEYEXIST && putflags)
+					continue;
+				if (rc) {
+					fprintf(stderr, "%s: frame %" Z "u: mdb_cursor_put failed, error %d %s\n",
+						prog, frameno, rc, mdb_strerror(rc));
+					goto fail;
+				}
+			}
+			batch += bh->bh_rawlen;
+			if (batch >= BLK_TXNSIZE) {
+				rc = mdb_txn_commit(txn);
+				txn = NULL;
+				if (rc) {
+					fprintf(stderr, "%s: frame %" Z "u: txn_commit: %s\n",
+						prog, frameno, mdb_strerror(rc));
+					goto fail;
+				}
+				rc = mdb_txn_begin(env, NULL, 0, &txn);
+				if (rc) {
+					fprintf(stderr, "mdb_txn_begin failed, error %d %s\n", rc, mdb_strerror(rc));
+					goto fail;
+				}
+				for (i=0; i<(int)ndbs; i++) {
+					if (ldbs[i].ld_state != LD_OPEN)
+						continue;
+					rc = mdb_cursor_open(txn, ldbs[i].ld_dbi, &ldbs[i].ld_mc);
+					if (rc) {
+						fprintf(stderr, "mdb_cursor_open failed, error %d %s\n", rc, mdb_strerror(rc));
+						goto fail;
+					}
+				}
+				batch = 0;
+			}
+			break;
+
+		case MDB_BLK_DBEND:
+			if (ld->ld_state != LD_OPEN || bh->bh_rawlen != 8)
+				goto badframe;
+			if (mdb_blk_get64(bf->bf_data) != ld->ld_count) {
+				fprintf(stderr, "%s: frame %" Z "u: expected %" Z "u records, got %" Z "u\n",
+					prog, frameno, mdb_blk_get64(bf->bf_data), ld->ld_count);
+				goto fail;
+			}
+			mdb_cursor_close(ld->ld_mc);
+			ld->ld_mc = NULL;
+			ld->ld_state = LD_DONE;
+			break;
+		}
+	}
+	if (!bf)
+		goto fail;
+
+	for (i=0; i<(int)ndbs; i++) {
+		if (ldbs[i].ld_state != LD_DONE) {
+			fprintf(stderr, "%s: database %d is incomplete\n", prog, i);
+			goto fail;
+		}
+	}
+	rc = 0;
+	if (txn) {
+		rc = mdb_txn_commit(txn);
+		txn = NULL;
+		if (rc)
+			fprintf(stderr, "%s: txn_commit: %s\n", prog, mdb_strerror(rc));
+	}
+#ifdef BLK_THREADS
+	pthread_join(thr, NULL);
+#endif
+	goto done;
+
+badframe:
+	fprintf(stderr, "%s: frame %" Z "u: unexpected frame\n", prog, frameno);
+fail:
+	rc = EINVAL;
+	/* the reader may be blocked on input; it goes away at exit */
+#ifdef BLK_THREADS
+	pthread_mutex_lock(&fmutex);
+	fstop = 1;
+	pthread_cond_signal(&fnotfull);
+	pthread_mutex_unlock(&fmutex);
+#endif
+done:
+	if (txn)
+		mdb_txn_abort(txn);
+	if (env)
+		mdb_env_close(env);
+	free(ldbs);
+	return rc ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
 static void usage(void)
 {
-	fprintf(stderr, "usage: %s [-V] [-f input] [-n] [-s name] [-N] [-T] dbpath\n", prog);
+	fprintf(stderr, "usage: %s [-V] [-a] [-f input] [-n] [-s name] [-N] [-T] dbpath\n", prog);
 	exit(EXIT_FAILURE);
 }
 
@@ -298,19 +705,23 @@ int main(int argc, char *argv[])
 		usage();
 	}
 
-	/* -f: load file instead of stdin
+	/* -a: append records in input order
+	 * -f: load file instead of stdin
 	 * -n: use NOSUBDIR flag on env_open
 	 * -s: load into named subDB
 	 * -N: use NOOVERWRITE on puts
 	 * -T: read plaintext
 	 * -V: print version and exit
 	 */
-	while ((i = getopt(argc, argv, "f:ns:NTV")) != EOF) {
+	while ((i = getopt(argc, argv, "af:ns:NTV")) != EOF) {
 		switch(i) {
 		case 'V':
 			printf("%s\n", MDB_VERSION_STRING);
 			exit(0);
 			break;
+		case 'a':
+			mode |= APPEND;
+			break;
 		case 'f':
 			if (freopen(optarg, "r", stdin) == NULL) {
 				fprintf(stderr, "%s: %s: reopen: %s\n",
@@ -338,13 +749,26 @@ int main(int argc, char *argv[])
 	if (optind != argc - 1)
 		usage();
 
+	envname = argv[optind];
+
+	/* binary dumps start with a non-printable magic */
+	if (!(mode & NOHDR)) {
+		i = getc(stdin);
+		if (i == EOF && ferror(stdin)) {
+			fprintf(stderr, "%s: read error: %s\n", prog, strerror(errno));
+			return EXIT_FAILURE;
+		}
+		ungetc(i, stdin);
+		if (i == (unsigned char)MDB_BLK_MAGIC[0])
+			return loadbin(envname, envflags, putflags);
+	}
+
 	dbuf.mv_size = 4096;
 	dbuf.mv_data = malloc(dbuf.mv_size);
 
 	if (!(mode & NOHDR))
 		readhdr();
 
-	envname = argv[optind];
 	rc = mdb_env_create(&env);
 	if (rc) {
 		fprintf(stderr, "mdb_env_create failed, error %d %s\n", rc, mdb_strerror(rc));
@@ -374,12 +798,13 @@ int main(int argc, char *argv[])
 	while(!Eof) {
 		MDB_val key, data;
 		int batch = 0;
-		flags = 0;
 
 		if (!dohdr) {
 			dohdr = 1;
-		} else if (!(mode & NOHDR))
+		} else if (!(mode & NOHDR)) {
+			flags = 0;
 			readhdr();
+		}
 		
 		rc = mdb_txn_begin(env, NULL, 0, &txn);
 		if (rc) {
@@ -410,7 +835,7 @@ int main(int argc, char *argv[])
 				goto txn_abort;
 			}
 
-			rc = mdb_cursor_put(mc, &key, &data, putflags);
+			rc = mdb_cursor_put(mc, &key, &data, putflags | appflag(flags));
 			if (rc == MDB_KEYEXIST && putflags)
 				continue;
 			if (rc) {
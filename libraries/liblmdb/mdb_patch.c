@@ -0,0 +1,82 @@
+/* mdb_patch.c - memory-mapped database incremental restore tool */
+/*
+ * Copyright 2012-2018 Howard Chu, Symas Corp.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "lmdb.h"
+
+static void
+usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-V] [-n] [-f delta] envpath\n", prog);
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	int i, rc, fd = 0;
+	MDB_env *env;
+	const char *progname = argv[0], *act, *fname = NULL;
+	unsigned flags = 0;
+
+	while ((i = getopt(argc, argv, "f:nV")) != EOF) {
+		switch(i) {
+		case 'V':
+			printf("%s\n", MDB_VERSION_STRING);
+			exit(0);
+			break;
+		case 'f':
+			fname = optarg;
+			break;
+		case 'n':
+			flags |= MDB_NOSUBDIR;
+			break;
+		default:
+			usage(progname);
+		}
+	}
+
+	if (optind != argc - 1)
+		usage(progname);
+
+	if (fname) {
+		fd = open(fname, O_RDONLY);
+		if (fd < 0) {
+			fprintf(stderr, "%s: %s: open: %s\n",
+				progname, fname, strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	act = "opening environment";
+	rc = mdb_env_create(&env);
+	if (rc == MDB_SUCCESS) {
+		rc = mdb_env_open(env, argv[optind], flags, 0664);
+	}
+	if (rc == MDB_SUCCESS) {
+		act = "applying delta";
+		rc = mdb_env_patch(env, fd);
+	}
+	if (rc)
+		fprintf(stderr, "%s: %s failed, error %d (%s)\n",
+			progname, act, rc, mdb_strerror(rc));
+	mdb_env_close(env);
+	if (fname)
+		close(fd);
+
+	return rc ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -35,9 +35,55 @@ static void prstat(MDB_stat *ms)
 	printf("  Entries: %"Z"u\n", ms->ms_entries);
 }
 
+/* Upper bound in nanoseconds of the bucket holding fraction p of the calls */
+static double histpct(MDB_ophist *oh, double p)
+{
+	unsigned long long n = 0;
+	int i;
+
+	for (i = 0; i < MDB_HIST_BUCKETS-1; i++) {
+		n += oh->oh_hist[i];
+		if (n >= p * oh->oh_count)
+			break;
+	}
+	return (double)(2ULL << i);
+}
+
+static void prophist(char *name, MDB_ophist *oh, int verbose)
+{
+	int i;
+
+	if (!oh->oh_count)
+		return;
+	printf("  %s: %llu calls, avg %.1f us, max %.1f us, 50%% < %.1f us, 99%% < %.1f us\n",
+		name, oh->oh_count, oh->oh_nsec / 1000.0 / oh->oh_count,
+		oh->oh_max / 1000.0, histpct(oh, 0.5) / 1000.0, histpct(oh, 0.99) / 1000.0);
+	if (verbose) {
+		for (i = 0; i < MDB_HIST_BUCKETS; i++)
+			if (oh->oh_hist[i])
+				printf("    < %12.3f us: %llu\n", (double)(2ULL << i) / 1000.0,
+					oh->oh_hist[i]);
+	}
+}
+
+/* Read every record of a DB, for the timings of -t */
+static int timescan(MDB_txn *txn, MDB_dbi dbi)
+{
+	MDB_cursor *cursor;
+	MDB_val key, data;
+	int rc;
+
+	rc = mdb_cursor_open(txn, dbi, &cursor);
+	if (rc)
+		return rc;
+	while ((rc = mdb_cursor_get(cursor, &key, &data, MDB_NEXT)) == 0) ;
+	mdb_cursor_close(cursor);
+	return rc == MDB_NOTFOUND ? MDB_SUCCESS : rc;
+}
+
 static void usage(char *prog)
 {
-	fprintf(stderr, "usage: %s [-V] [-n] [-e] [-r[r]] [-f[f[f]]] [-a|-s subdb] dbpath\n", prog);
+	fprintf(stderr, "usage: %s [-V] [-n] [-e] [-r[r]] [-f[f[f]]] [-t[t]] [-a|-s subdb] dbpath\n", prog);
 	exit(EXIT_FAILURE);
 }
 
@@ -53,6 +99,7 @@ int main(int argc, char *argv[])
 	char *envname;
 	char *subname = NULL;
 	int alldbs = 0, envinfo = 0, envflags = 0, freinfo = 0, rdrinfo = 0;
+	int timing = 0;
 
 	if (argc < 2) {
 		usage(prog);
@@ -63,11 +110,12 @@ int main(int argc, char *argv[])
 	 * -e: print env info
 	 * -f: print freelist info
 	 * -r: print reader info
+	 * -t: time a read of all records, print latency histograms
 	 * -n: use NOSUBDIR flag on env_open
 	 * -V: print version and exit
 	 * (default) print stat of only the main DB
 	 */
-	while ((i = getopt(argc, argv, "Vaefnrs:")) != EOF) {
+	while ((i = getopt(argc, argv, "Vaefnrs:t")) != EOF) {
 		switch(i) {
 		case 'V':
 			printf("%s\n", MDB_VERSION_STRING);
@@ -90,6 +138,9 @@ int main(int argc, char *argv[])
 		case 'r':
 			rdrinfo++;
 			break;
+		case 't':
+			timing++;
+			break;
 		case 's':
 			if (alldbs)
 				usage(prog);
@@ -120,6 +171,9 @@ int main(int argc, char *argv[])
 		goto env_close;
 	}
 
+	if (timing)
+		mdb_env_set_flags(env, MDB_OPSTATS, 1);
+
 	if (envinfo) {
 		(void)mdb_env_stat(env, &mst);
 		(void)mdb_env_info(env, &mei);
@@ -143,7 +197,7 @@ int main(int argc, char *argv[])
 			printf("  %d stale readers cleared.\n", dead);
 			rc = mdb_reader_list(env, (MDB_msg_func *)fputs, stdout);
 		}
-		if (!(subname || alldbs || freinfo))
+		if (!(subname || alldbs || freinfo || timing))
 			goto env_close;
 	}
 
@@ -216,6 +270,10 @@ int main(int argc, char *argv[])
 	}
 	printf("Status of %s\n", subname ? subname : "Main DB");
 	prstat(&mst);
+	if (timing && (rc = timescan(txn, dbi))) {
+		fprintf(stderr, "read failed, error %d %s\n", rc, mdb_strerror(rc));
+		goto txn_abort;
+	}
 
 	if (alldbs) {
 		MDB_cursor *cursor;
@@ -245,6 +303,10 @@ int main(int argc, char *argv[])
 				goto txn_abort;
 			}
 			prstat(&mst);
+			if (timing && (rc = timescan(txn, db2))) {
+				fprintf(stderr, "read failed, error %d %s\n", rc, mdb_strerror(rc));
+				goto txn_abort;
+			}
 			mdb_close(env, db2);
 		}
 		mdb_cursor_close(cursor);
@@ -256,6 +318,14 @@ int main(int argc, char *argv[])
 	mdb_close(env, dbi);
 txn_abort:
 	mdb_txn_abort(txn);
+	if (timing && !rc) {
+		/* faults are counted when the txn ends */
+		MDB_opstat mos;
+		mdb_env_opstat(env, &mos, 0);
+		printf("Read Timings\n");
+		prophist("Gets", &mos.os_op[MDB_OPS_GET], timing > 1);
+		printf("  Major page faults: %llu\n", mos.os_faults);
+	}
 env_close:
 	mdb_env_close(env);
 
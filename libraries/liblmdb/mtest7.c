@@ -0,0 +1,241 @@
+/* mtest7.c - memory-mapped database tester/toy */
+/*
+ * Copyright 2011-2018 Howard Chu, Symas Corp.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+/* Tests for MDB_WINDOWMAP with a window much smaller than the DB:
+ * a reader walks the whole DB in one txn while a writer walks and
+ * rewrites it in short txns, so windows are evicted all along.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "lmdb.h"
+
+#define E(expr) CHECK((rc = (expr)) == MDB_SUCCESS, #expr)
+#define RES(err, expr) ((rc = expr) == (err) || (CHECK(!rc, #expr), 0))
+#define CHECK(test, msg) ((test) ? (void)0 : ((void)fprintf(stderr, \
+	"%s:%d: %s: %s\n", __FILE__, __LINE__, msg, mdb_strerror(rc)), abort()))
+
+#define NKEYS	20000
+#define BIGKEY(k)	((k) % 1000 == 500)	/* spans several windows */
+#define VALSIZE(k)	(BIGKEY(k) ? 1500000 + (k) : 300 + (k) * 37 % 400)
+#define NSAMPLES	200
+#define PASSES	4
+#define ROUNDS	1000
+
+typedef struct hdr {
+	int key;
+	int ver;
+} hdr;
+
+static MDB_env *env;
+static MDB_dbi dbi;
+static volatile int writing;
+
+/* the number of a key, which is not terminated */
+static int
+keynum(MDB_val *key)
+{
+	char buf[9];
+
+	memcpy(buf, key->mv_data, 8);
+	buf[8] = '\0';
+	return atoi(buf);
+}
+
+/* fill a value of key k at version ver */
+static void
+mkval(char *buf, int k, int ver)
+{
+	hdr h;
+	size_t i, len = VALSIZE(k);
+
+	h.key = k;
+	h.ver = ver;
+	memcpy(buf, &h, sizeof(h));
+	for (i = sizeof(h); i < len; i++)
+		buf[i] = (char)(k * 31 + ver * 7 + i);
+}
+
+/* check a value is whole, returns its version */
+static int
+chkval(MDB_val *key, MDB_val *data)
+{
+	hdr h;
+	size_t i;
+	char *ptr = data->mv_data;
+	int k, rc = 0;
+
+	CHECK(key->mv_size == 8, "key size");
+	k = keynum(key);
+	CHECK(data->mv_size == (size_t)VALSIZE(k), "value size");
+	memcpy(&h, ptr, sizeof(h));
+	CHECK(h.key == k, "value key");
+	for (i = sizeof(h); i < data->mv_size; i++)
+		CHECK(ptr[i] == (char)(k * 31 + h.ver * 7 + i), "value contents");
+	return h.ver;
+}
+
+/* walk the whole DB in one txn, keeping pointers into pages all over
+ * it, which must stay valid until the txn ends
+ */
+static void
+walk(MDB_txn *txn, int *mapped)
+{
+	MDB_cursor *cursor;
+	MDB_val key, data, skey[NSAMPLES], sdata[NSAMPLES];
+	int i, n = 0, rc;
+
+	E(mdb_cursor_open(txn, dbi, &cursor));
+	while ((rc = mdb_cursor_get(cursor, &key, &data, MDB_NEXT)) == 0) {
+		chkval(&key, &data);
+		CHECK(keynum(&key) == n, "key order");
+		if (n % (NKEYS / NSAMPLES) == 0) {
+			skey[n / (NKEYS / NSAMPLES)] = key;
+			sdata[n / (NKEYS / NSAMPLES)] = data;
+		}
+		n++;
+	}
+	CHECK(rc == MDB_NOTFOUND, "mdb_cursor_get");
+	CHECK(n == NKEYS, "key count");
+	mdb_cursor_close(cursor);
+	for (i = 0; i < NSAMPLES; i++) {
+		chkval(&skey[i], &sdata[i]);
+		CHECK(mdb_env_inmap(env, &sdata[i]), "sample unmapped in txn");
+	}
+	if (mapped) {
+		mdb_txn_abort(txn);
+		for (i = 0, *mapped = 0; i < NSAMPLES; i++)
+			if (mdb_env_inmap(env, &sdata[i]))
+				(*mapped)++;
+	}
+}
+
+static void *
+reader(void *arg)
+{
+	MDB_txn *txn;
+	int i, rc;
+
+	E(mdb_txn_begin(env, NULL, MDB_RDONLY, &txn));
+	for (i = 0; i < PASSES || writing; i++) {
+		walk(txn, NULL);
+		mdb_txn_reset(txn);
+		E(mdb_txn_renew(txn));
+	}
+	mdb_txn_abort(txn);
+	return NULL;
+}
+
+int main(int argc,char * argv[])
+{
+	int i, j, k, ver, mapped, rc;
+	MDB_val key, data;
+	MDB_txn *txn;
+	MDB_cursor *cursor;
+	pthread_t thr;
+	char kval[9], *dval;
+
+	srand(7);
+	dval = malloc(VALSIZE(NKEYS - 500));
+
+	E(mdb_env_create(&env));
+	/* neither bounds the file with MDB_WINDOWMAP */
+	E(mdb_env_set_mapsize(env, 1048576));
+	E(mdb_env_set_mapwindow(env, 1048576));
+	E(mdb_env_open(env, "./testdb", MDB_WINDOWMAP|MDB_NOSYNC, 0664));
+
+	printf("Adding %d values\n", NKEYS);
+	for (i = 0; i < NKEYS; i += 1000) {
+		E(mdb_txn_begin(env, NULL, 0, &txn));
+		E(mdb_dbi_open(txn, NULL, 0, &dbi));
+		for (k = i; k < i + 1000; k++) {
+			sprintf(kval, "%08d", k);
+			key.mv_size = 8;
+			key.mv_data = kval;
+			data.mv_size = VALSIZE(k);
+			data.mv_data = dval;
+			mkval(dval, k, 0);
+			E(mdb_put(txn, dbi, &key, &data, MDB_NOOVERWRITE));
+		}
+		E(mdb_txn_commit(txn));
+	}
+
+	printf("Walking the DB\n");
+	E(mdb_txn_begin(env, NULL, MDB_RDONLY, &txn));
+	walk(txn, &mapped);
+	printf("%d of %d samples still mapped\n", mapped, NSAMPLES);
+	CHECK(mapped <= NSAMPLES / 4, "windows not evicted");
+
+	printf("Rewriting the DB during walks\n");
+	writing = 1;
+	CHECK((rc = pthread_create(&thr, NULL, reader, NULL)) == 0, "pthread_create");
+	for (j = 0; j < ROUNDS; j++) {
+		E(mdb_txn_begin(env, NULL, 0, &txn));
+		E(mdb_cursor_open(txn, dbi, &cursor));
+		sprintf(kval, "%08d", rand() % NKEYS);
+		key.mv_size = 8;
+		key.mv_data = kval;
+		rc = mdb_cursor_get(cursor, &key, &data, MDB_SET_RANGE);
+		for (i = 0; i < 100 && rc == 0; i++) {
+			ver = chkval(&key, &data);
+			k = keynum(&key);
+			/* the key must not point into the page being changed */
+			sprintf(kval, "%08d", k);
+			key.mv_size = 8;
+			key.mv_data = kval;
+			if (i % 10 == 9) {
+				/* delete it, and put it back */
+				E(mdb_cursor_del(cursor, 0));
+				data.mv_size = VALSIZE(k);
+				data.mv_data = dval;
+				mkval(dval, k, ver + 1);
+				E(mdb_put(txn, dbi, &key, &data, MDB_NOOVERWRITE));
+				/* back where we were */
+				E(mdb_cursor_get(cursor, &key, &data, MDB_SET));
+			} else if (i % 3 == 0) {
+				data.mv_size = VALSIZE(k);
+				data.mv_data = dval;
+				mkval(dval, k, ver + 1);
+				E(mdb_cursor_put(cursor, &key, &data, MDB_CURRENT));
+			}
+			rc = mdb_cursor_get(cursor, &key, &data, MDB_NEXT);
+		}
+		CHECK(rc == 0 || rc == MDB_NOTFOUND, "mdb_cursor_get");
+		mdb_cursor_close(cursor);
+		E(mdb_txn_commit(txn));
+	}
+	writing = 0;
+	pthread_join(thr, NULL);
+
+	printf("Walking the DB again\n");
+	E(mdb_txn_begin(env, NULL, MDB_RDONLY, &txn));
+	walk(txn, &mapped);
+	CHECK(mapped <= NSAMPLES / 4, "windows not evicted");
+	mdb_dbi_close(env, dbi);
+	mdb_env_close(env);
+
+	printf("Reopening the DB\n");
+	E(mdb_env_create(&env));
+	E(mdb_env_set_mapwindow(env, 1048576));
+	E(mdb_env_open(env, "./testdb", MDB_WINDOWMAP|MDB_NOSYNC|MDB_RDONLY, 0664));
+	E(mdb_txn_begin(env, NULL, MDB_RDONLY, &txn));
+	E(mdb_dbi_open(txn, NULL, 0, &dbi));
+	walk(txn, NULL);
+	mdb_txn_abort(txn);
+	mdb_env_close(env);
+	free(dval);
+
+	return 0;
+}
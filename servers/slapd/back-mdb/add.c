@@ -77,6 +77,8 @@ mdb_add(Operation *op, SlapReply *rs )
 		goto return_results;
 	}
 	txn = moi->moi_txn;
+	/* earlier ops in the same group commit may have added attrs */
+	numads = mdb->mi_numads;
 
 	/* add opattrs to shadow as well, only missing attrs will actually
 	 * be added; helps compatibility with older OL versions */
@@ -370,16 +372,18 @@ mdb_add(Operation *op, SlapReply *rs )
 		opinfo.moi_oe.oe_key = NULL;
 		if ( op->o_noop ) {
 			mdb->mi_numads = numads;
-			mdb_txn_abort( txn );
+			mdb_group_abort( mdb, txn );
 			rs->sr_err = LDAP_X_NO_OPERATION;
 			txn = NULL;
 			goto return_results;
 		}
 
-		rs->sr_err = mdb_txn_commit( txn );
+		rs->sr_err = mdb_group_commit( mdb, txn );
 		txn = NULL;
 		if ( rs->sr_err != 0 ) {
-			mdb->mi_numads = numads;
+			/* a group commit restores it itself */
+			if ( !mdb->mi_group )
+				mdb->mi_numads = numads;
 			rs->sr_text = "txn_commit failed";
 			Debug( LDAP_DEBUG_ANY,
 				LDAP_XSTRING(mdb_add) ": %s : %s (%d)\n",
@@ -404,7 +408,7 @@ return_results:
 	if( moi == &opinfo ) {
 		if( txn != NULL ) {
 			mdb->mi_numads = numads;
-			mdb_txn_abort( txn );
+			mdb_group_abort( mdb, txn );
 		}
 		if ( opinfo.moi_oe.oe_key ) {
 			LDAP_SLIST_REMOVE( &op->o_extra, &opinfo.moi_oe, OpExtra, oe_next );
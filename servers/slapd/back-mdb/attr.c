@@ -632,3 +632,134 @@ int mdb_ad_get( struct mdb_info *mdb, MDB_txn *txn, AttributeDescription *ad )
 
 	return rc;
 }
+
+/* Progress of the online indexer is kept in the ad2i DB under key 0,
+ * which is never used for an attribute. The record holds the next
+ * entry ID to be indexed, followed by the old and new index masks and
+ * the name of each attribute whose index is being built.
+ */
+typedef struct ixstate_attr {
+	slap_mask_t ix_oldmask;
+	slap_mask_t ix_newmask;
+	unsigned short ix_len;
+} ixstate_attr;
+
+int mdb_ixstate_put( struct mdb_info *mdb, MDB_txn *txn, ID next )
+{
+	int i, rc, zero = 0;
+	MDB_val key, data;
+	ixstate_attr ia;
+	char *ptr;
+
+	key.mv_size = sizeof(int);
+	key.mv_data = &zero;
+
+	if ( next == NOID ) {
+		rc = mdb_del( txn, mdb->mi_ad2id, &key, NULL );
+		if ( rc == MDB_NOTFOUND )
+			rc = 0;
+		return rc;
+	}
+
+	data.mv_size = sizeof(ID);
+	for ( i = 0; i < mdb->mi_nattrs; i++ ) {
+		AttrInfo *ai = mdb->mi_attrs[i];
+		if ( !ai->ai_newmask || ( ai->ai_indexmask & MDB_INDEX_DELETING ))
+			continue;
+		data.mv_size += sizeof(ia) + ai->ai_desc->ad_cname.bv_len;
+	}
+
+	rc = mdb_put( txn, mdb->mi_ad2id, &key, &data, MDB_RESERVE );
+	if ( rc ) {
+		Debug( LDAP_DEBUG_ANY,
+			"mdb_ixstate_put: mdb_put failed %s(%d)\n",
+			mdb_strerror(rc), rc, 0);
+		return rc;
+	}
+
+	ptr = data.mv_data;
+	memcpy( ptr, &next, sizeof(ID) );
+	ptr += sizeof(ID);
+	for ( i = 0; i < mdb->mi_nattrs; i++ ) {
+		AttrInfo *ai = mdb->mi_attrs[i];
+		if ( !ai->ai_newmask || ( ai->ai_indexmask & MDB_INDEX_DELETING ))
+			continue;
+		ia.ix_oldmask = ai->ai_indexmask;
+		ia.ix_newmask = ai->ai_newmask;
+		ia.ix_len = ai->ai_desc->ad_cname.bv_len;
+		memcpy( ptr, &ia, sizeof(ia) );
+		ptr += sizeof(ia);
+		memcpy( ptr, ai->ai_desc->ad_cname.bv_val, ia.ix_len );
+		ptr += ia.ix_len;
+	}
+	return 0;
+}
+
+/* Reload an interrupted online indexing run. Returns 1 if there is
+ * still indexing to do, 0 if not, -1 on error.
+ */
+int mdb_ixstate_get( struct mdb_info *mdb, MDB_txn *txn )
+{
+	int rc, zero = 0, pending = 0;
+	MDB_val key, data;
+	ixstate_attr ia;
+	struct berval bv;
+	AttributeDescription *ad;
+	AttrInfo *ai;
+	const char *text;
+	char *ptr, *end;
+	ID next;
+
+	key.mv_size = sizeof(int);
+	key.mv_data = &zero;
+
+	rc = mdb_get( txn, mdb->mi_ad2id, &key, &data );
+	if ( rc == MDB_NOTFOUND )
+		return 0;
+	if ( rc ) {
+		Debug( LDAP_DEBUG_ANY,
+			"mdb_ixstate_get: mdb_get failed %s(%d)\n",
+			mdb_strerror(rc), rc, 0);
+		return -1;
+	}
+	if ( data.mv_size < sizeof(ID) )
+		return 0;
+
+	ptr = data.mv_data;
+	end = ptr + data.mv_size;
+	memcpy( &next, ptr, sizeof(ID) );
+	ptr += sizeof(ID);
+
+	while ( ptr + sizeof(ia) <= end ) {
+		memcpy( &ia, ptr, sizeof(ia) );
+		ptr += sizeof(ia);
+		if ( ptr + ia.ix_len > end )
+			break;
+		bv.bv_val = ptr;
+		bv.bv_len = ia.ix_len;
+		ptr += ia.ix_len;
+
+		ad = NULL;
+		if ( slap_bv2ad( &bv, &ad, &text ))
+			continue;
+		ai = mdb_attr_mask( mdb, ad );
+		/* index was dropped from the config in the meantime */
+		if ( !ai || !ai->ai_indexmask )
+			continue;
+		/* already pending in this process */
+		if ( ai->ai_newmask ) {
+			pending = 1;
+			continue;
+		}
+		/* index was changed in the meantime, start over */
+		if ( ai->ai_indexmask != ia.ix_newmask )
+			next = 0;
+		ai->ai_newmask = ai->ai_indexmask;
+		ai->ai_indexmask = ia.ix_oldmask;
+		pending = 1;
+	}
+
+	if ( pending )
+		mdb->mi_index_next = next;
+	return pending;
+}
@@ -48,9 +48,21 @@ LDAP_BEGIN_DECL
 /* Default to 10MB max */
 #define DEFAULT_MAPSIZE	(10*1048576)
 
+/* Address space kept mapped by envflags windowmap, 256MB */
+#define DEFAULT_MAPWINDOW	(256*1048576)
+
 /* Most users will never see this */
 #define DEFAULT_RTXN_SIZE	10000
 
+/* Entries reindexed per write txn by the online indexer */
+#define DEFAULT_INDEX_BATCH	100
+
+/* Pages verified per run of the background scrub */
+#define DEFAULT_SCRUB_BATCH	1024
+
+/* Percentage of free pages from which online compaction runs */
+#define DEFAULT_COMPACT_PERCENT	30
+
 #ifdef LDAP_DEVEL
 #define MDB_MONITOR_IDX
 #endif
@@ -63,6 +75,18 @@ typedef struct mdb_monitor_t {
 /* From ldap_rq.h */
 struct re_s;
 
+/* From commit.c */
+typedef struct mdb_group mdb_group;
+
+/* An ordered index of an attribute's least value, see sortidx.c */
+typedef struct mdb_sortinfo {
+	AttributeDescription	*si_ad;
+	MatchingRule	*si_mr;	/* the attribute's ORDERING rule */
+	int		si_flags;
+#define MDB_SORT_INTEGER	0x01	/* integerOrderingMatch keys */
+#define MDB_SORT_BUILT	0x02	/* all entries are indexed */
+} mdb_sortinfo;
+
 struct mdb_info {
 	MDB_env		*mi_dbenv;
 
@@ -72,14 +96,18 @@ struct mdb_info {
 	int			mi_dbenv_mode;
 
 	size_t		mi_mapsize;
+	size_t		mi_mapwindow;	/* windows kept mapped with MDB_WINDOWMAP */
 	ID			mi_nextid;
 	size_t		mi_maxentrysize;
+	uint32_t	mi_compress;	/* compress id2entry values from this size */
+	int			mi_dnprefix;	/* create dn2id with MDB_PREFIXDUP */
 
 	slap_mask_t	mi_defaultmask;
 	int			mi_nattrs;
 	struct mdb_attrinfo		**mi_attrs;
 	void		*mi_search_stack;
 	int			mi_search_stack_depth;
+	uint32_t	mi_prefetch;	/* candidates to prefetch ahead, 0 = off */
 	int			mi_readers;
 
 	uint32_t	mi_rtxn_size;
@@ -89,6 +117,38 @@ struct mdb_info {
 
 	struct re_s		*mi_txn_cp_task;
 	struct re_s		*mi_index_task;
+	struct re_s		*mi_scrub_task;
+	struct re_s		*mi_compact_task;
+
+	/* online indexer state */
+	ID			mi_index_next;	/* next entry to reindex, 0 to restart */
+	unsigned long	mi_index_count;	/* entries reindexed so far */
+	uint32_t	mi_index_batch;	/* entries per write txn */
+	uint32_t	mi_index_rate;	/* max entries per second, 0 = no limit */
+
+	/* background scrub state */
+	uint32_t	mi_scrub_interval;	/* seconds between runs, 0 = off */
+	uint32_t	mi_scrub_batch;	/* pages to verify per run */
+	int			mi_scrub_db;	/* DB being scrubbed, see mdb_scrub_dbi() */
+	struct berval	mi_scrub_key;	/* where to resume in that DB */
+	unsigned long	mi_scrub_passes;	/* complete passes so far */
+	unsigned long	mi_scrub_pages;	/* pages verified so far */
+	unsigned long	mi_scrub_corrupt;	/* corrupt pages found so far */
+
+	/* online compaction */
+	uint32_t	mi_compact_interval;	/* seconds between checks, 0 = off */
+	uint32_t	mi_compact_percent;	/* free pages that trigger a compaction */
+	unsigned long	mi_compactions;	/* compactions done so far */
+	unsigned long	mi_compact_pages;	/* pages released by them */
+
+	/* sort indexes */
+	int			mi_nsorts;
+	mdb_sortinfo	*mi_sorts;
+	MDB_dbi		mi_sortdbi;	/* 0 until a sort index is opened */
+
+	/* group commit */
+	mdb_group	*mi_group;
+	uint32_t	mi_group_max;	/* max ops per group txn, 0 = off */
 
 	mdb_monitor_t	mi_monitor;
 
@@ -123,9 +183,19 @@ struct mdb_info {
 #define mi_ad2id	mi_dbis[MDB_AD2ID]
 #define mi_id2val	mi_dbis[MDB_ID2VAL]
 
+/* The read snapshot of a thread. An operation and the internal
+ * operations it issues on the same thread all read from it, whether
+ * or not they share the operation's o_extra.
+ */
+typedef struct mdb_snapshot {
+	MDB_txn		*ms_txn;
+	int			ms_users;	/* op infos reading the current snapshot */
+} mdb_snapshot;
+
 typedef struct mdb_op_info {
 	OpExtra		moi_oe;
 	MDB_txn*	moi_txn;
+	mdb_snapshot	*moi_snap;	/* the snapshot moi_txn belongs to, if any */
 	int			moi_ref;
 	char		moi_flag;
 } mdb_op_info;
@@ -133,6 +203,15 @@ typedef struct mdb_op_info {
 #define MOI_FREEIT	0x02
 #define MOI_KEEPER	0x04
 
+/* A search returning entries in the order of a sort index */
+typedef struct mdb_sortscan {
+	MDB_cursor	*ss_mc;
+	mdb_sortinfo	*ss_si;
+	ID			*ss_ids;	/* the search candidates */
+	int			ss_reverse;
+	int			ss_pending;	/* see mdb_sort_next() */
+} mdb_sortscan;
+
 LDAP_END_DECL
 
 /* for the cache of attribute information (which are indexed, etc.) */
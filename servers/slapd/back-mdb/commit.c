@@ -0,0 +1,298 @@
+/* commit.c - group commit of write operations */
+/* $OpenLDAP$ */
+/* This work is part of OpenLDAP Software <http://www.openldap.org/>.
+ *
+ * Copyright 2000-2018 The OpenLDAP Foundation.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+#include "portable.h"
+
+#include <stdio.h>
+#include <ac/string.h>
+#include <ac/errno.h>
+
+#include "back-mdb.h"
+
+/* With group commit, write operations don't each commit (and sync)
+ * their own LMDB txn. A committer thread keeps a group txn open, and
+ * every write op runs in a nested txn of it, one op at a time. Once
+ * its nested txn is committed into the group, an op waits until the
+ * group txn itself has been committed. The group is committed as soon
+ * as no other op is waiting to write, or when it holds groupcommit
+ * ops, so that ops arriving meanwhile pile up for the next group.
+ *
+ * The group txn has to be committed by the thread that began it,
+ * since it holds the LMDB writer lock; hence the dedicated thread.
+ */
+
+enum {
+	MG_IDLE = 0,	/* no group txn */
+	MG_BEGIN,		/* group txn requested */
+	MG_OPEN,		/* group txn open */
+	MG_CLOSE		/* group txn to be committed */
+};
+
+/* an op committed into the group txn, waiting for its outcome */
+typedef struct mdb_gwait {
+	struct mdb_gwait *mw_next;
+	int mw_rc;
+	int mw_done;
+} mdb_gwait;
+
+struct mdb_group {
+	ldap_pvt_thread_mutex_t	mg_mutex;
+	ldap_pvt_thread_cond_t	mg_cond;	/* ops wait here */
+	ldap_pvt_thread_cond_t	mg_task;	/* the committer waits here */
+	ldap_pvt_thread_t	mg_tid;
+	MDB_txn		*mg_txn;		/* the group txn */
+	MDB_txn		*mg_child;		/* txn of the op now writing */
+	mdb_gwait	*mg_waiters;	/* ops committed into mg_txn */
+	int			mg_queued;		/* ops waiting to write */
+	int			mg_joined;		/* ops committed into mg_txn */
+	int			mg_state;
+	int			mg_stop;
+	int			mg_rc;			/* why mg_txn could not be begun */
+	int			mg_numads;		/* mi_numads when mg_txn was begun */
+	int			mg_childads;	/* mi_numads when mg_child was begun */
+};
+
+/* Decide what to do after an op is done writing. Mutex held. */
+static void
+mdb_group_next( struct mdb_info *mdb, mdb_group *mg )
+{
+	mg->mg_child = NULL;
+	if ( !mg->mg_queued || mg->mg_joined >= mdb->mi_group_max ) {
+		mg->mg_state = MG_CLOSE;
+		ldap_pvt_thread_cond_signal( &mg->mg_task );
+	} else {
+		ldap_pvt_thread_cond_broadcast( &mg->mg_cond );
+	}
+}
+
+static void *
+mdb_group_task( void *arg )
+{
+	struct mdb_info *mdb = arg;
+	mdb_group *mg = mdb->mi_group;
+	mdb_gwait *mw;
+	MDB_txn *txn;
+	int rc, joined;
+
+	ldap_pvt_thread_mutex_lock( &mg->mg_mutex );
+	for (;;) {
+		while ( mg->mg_state != MG_BEGIN && mg->mg_state != MG_CLOSE &&
+			!mg->mg_stop )
+			ldap_pvt_thread_cond_wait( &mg->mg_task, &mg->mg_mutex );
+
+		if ( mg->mg_state == MG_BEGIN ) {
+			ldap_pvt_thread_mutex_unlock( &mg->mg_mutex );
+			rc = mdb_txn_begin( mdb->mi_dbenv, NULL, 0, &txn );
+			ldap_pvt_thread_mutex_lock( &mg->mg_mutex );
+			if ( rc ) {
+				Debug( LDAP_DEBUG_ANY,
+					LDAP_XSTRING(mdb_group_task) ": txn_begin failed: "
+					"%s (%d)\n", mdb_strerror(rc), rc, 0 );
+				mg->mg_rc = rc;
+				mg->mg_state = MG_IDLE;
+			} else {
+				mg->mg_txn = txn;
+				mg->mg_numads = mdb->mi_numads;
+				mg->mg_state = MG_OPEN;
+			}
+			ldap_pvt_thread_cond_broadcast( &mg->mg_cond );
+
+		} else if ( mg->mg_state == MG_CLOSE ) {
+			txn = mg->mg_txn;
+			mw = mg->mg_waiters;
+			joined = mg->mg_joined;
+			mg->mg_txn = NULL;
+			mg->mg_waiters = NULL;
+			mg->mg_joined = 0;
+			ldap_pvt_thread_mutex_unlock( &mg->mg_mutex );
+			rc = mdb_txn_commit( txn );
+			ldap_pvt_thread_mutex_lock( &mg->mg_mutex );
+			if ( rc ) {
+				Debug( LDAP_DEBUG_ANY,
+					LDAP_XSTRING(mdb_group_task) ": txn_commit of %d ops "
+					"failed: %s (%d)\n", joined, mdb_strerror(rc), rc );
+				mdb->mi_numads = mg->mg_numads;
+			} else {
+				Debug( LDAP_DEBUG_TRACE,
+					LDAP_XSTRING(mdb_group_task) ": committed %d ops\n",
+					joined, 0, 0 );
+			}
+			for ( ; mw; mw = mw->mw_next ) {
+				mw->mw_rc = rc;
+				mw->mw_done = 1;
+			}
+			/* begin the next group right away if ops are waiting */
+			mg->mg_state = mg->mg_queued ? MG_BEGIN : MG_IDLE;
+			ldap_pvt_thread_cond_broadcast( &mg->mg_cond );
+
+		} else {
+			break;
+		}
+	}
+	ldap_pvt_thread_mutex_unlock( &mg->mg_mutex );
+	return NULL;
+}
+
+/* Begin the txn of a write op */
+int
+mdb_group_begin( struct mdb_info *mdb, unsigned flags, MDB_txn **txn )
+{
+	mdb_group *mg = mdb->mi_group;
+	int rc, asked = 0;
+
+	if ( !mg )
+		return mdb_txn_begin( mdb->mi_dbenv, NULL, flags, txn );
+
+	ldap_pvt_thread_mutex_lock( &mg->mg_mutex );
+	mg->mg_queued++;
+	while ( mg->mg_state != MG_OPEN || mg->mg_child ) {
+		if ( mg->mg_state == MG_IDLE ) {
+			/* the group txn we waited for failed to begin */
+			if ( asked && mg->mg_rc ) {
+				rc = mg->mg_rc;
+				mg->mg_queued--;
+				ldap_pvt_thread_mutex_unlock( &mg->mg_mutex );
+				return rc;
+			}
+			mg->mg_rc = 0;
+			mg->mg_state = MG_BEGIN;
+			ldap_pvt_thread_cond_signal( &mg->mg_task );
+		}
+		if ( mg->mg_state == MG_BEGIN )
+			asked = 1;
+		ldap_pvt_thread_cond_wait( &mg->mg_cond, &mg->mg_mutex );
+	}
+	mg->mg_queued--;
+
+	/* lazyCommit is moot, the group txn is synced anyway */
+	rc = mdb_txn_begin( mdb->mi_dbenv, mg->mg_txn, 0, txn );
+	if ( rc == 0 ) {
+		mg->mg_child = *txn;
+		mg->mg_childads = mdb->mi_numads;
+	} else
+		mdb_group_next( mdb, mg );
+	ldap_pvt_thread_mutex_unlock( &mg->mg_mutex );
+	return rc;
+}
+
+/* Commit the txn of a write op, return once it is durable.
+ * If it fails, mi_numads has been restored already.
+ */
+int
+mdb_group_commit( struct mdb_info *mdb, MDB_txn *txn )
+{
+	mdb_group *mg = mdb->mi_group;
+	mdb_gwait mw;
+	int rc;
+
+	if ( !mg || txn != mg->mg_child )
+		return mdb_txn_commit( txn );
+
+	rc = mdb_txn_commit( txn );
+
+	ldap_pvt_thread_mutex_lock( &mg->mg_mutex );
+	if ( rc == 0 ) {
+		mw.mw_rc = 0;
+		mw.mw_done = 0;
+		mw.mw_next = mg->mg_waiters;
+		mg->mg_waiters = &mw;
+		mg->mg_joined++;
+	} else {
+		mdb->mi_numads = mg->mg_childads;
+	}
+	mdb_group_next( mdb, mg );
+	if ( rc == 0 ) {
+		while ( !mw.mw_done )
+			ldap_pvt_thread_cond_wait( &mg->mg_cond, &mg->mg_mutex );
+		rc = mw.mw_rc;
+	}
+	ldap_pvt_thread_mutex_unlock( &mg->mg_mutex );
+	return rc;
+}
+
+void
+mdb_group_abort( struct mdb_info *mdb, MDB_txn *txn )
+{
+	mdb_group *mg = mdb->mi_group;
+
+	mdb_txn_abort( txn );
+	if ( !mg || txn != mg->mg_child )
+		return;
+
+	ldap_pvt_thread_mutex_lock( &mg->mg_mutex );
+	mdb->mi_numads = mg->mg_childads;
+	mdb_group_next( mdb, mg );
+	ldap_pvt_thread_mutex_unlock( &mg->mg_mutex );
+}
+
+int
+mdb_group_start( struct mdb_info *mdb )
+{
+	mdb_group *mg;
+	int rc;
+
+	if ( mdb->mi_group )
+		return 0;
+
+	/* LMDB has no nested txns with a writable map */
+	if ( mdb->mi_dbenv_flags & MDB_WRITEMAP ) {
+		Debug( LDAP_DEBUG_ANY,
+			LDAP_XSTRING(mdb_group_start) ": groupcommit is not "
+			"supported with envflags writemap, ignored.\n", 0, 0, 0 );
+		return 0;
+	}
+
+	mg = ch_calloc( 1, sizeof( mdb_group ));
+	ldap_pvt_thread_mutex_init( &mg->mg_mutex );
+	ldap_pvt_thread_cond_init( &mg->mg_cond );
+	ldap_pvt_thread_cond_init( &mg->mg_task );
+	mdb->mi_group = mg;
+
+	rc = ldap_pvt_thread_create( &mg->mg_tid, 0, mdb_group_task, mdb );
+	if ( rc ) {
+		Debug( LDAP_DEBUG_ANY,
+			LDAP_XSTRING(mdb_group_start) ": thread create failed (%d)\n",
+			rc, 0, 0 );
+		mdb->mi_group = NULL;
+		ldap_pvt_thread_cond_destroy( &mg->mg_task );
+		ldap_pvt_thread_cond_destroy( &mg->mg_cond );
+		ldap_pvt_thread_mutex_destroy( &mg->mg_mutex );
+		ch_free( mg );
+	}
+	return rc;
+}
+
+/* No write ops may be running */
+void
+mdb_group_stop( struct mdb_info *mdb )
+{
+	mdb_group *mg = mdb->mi_group;
+
+	if ( !mg )
+		return;
+
+	ldap_pvt_thread_mutex_lock( &mg->mg_mutex );
+	mg->mg_stop = 1;
+	ldap_pvt_thread_cond_signal( &mg->mg_task );
+	ldap_pvt_thread_mutex_unlock( &mg->mg_mutex );
+	ldap_pvt_thread_join( mg->mg_tid, NULL );
+
+	mdb->mi_group = NULL;
+	ldap_pvt_thread_cond_destroy( &mg->mg_task );
+	ldap_pvt_thread_cond_destroy( &mg->mg_cond );
+	ldap_pvt_thread_mutex_destroy( &mg->mg_mutex );
+	ch_free( mg );
+}
@@ -128,7 +128,7 @@ return_results:
 
 done:
 	if ( moi == &opinfo ) {
-		mdb_txn_reset( moi->moi_txn );
+		mdb_snapshot_release( moi );
 		LDAP_SLIST_REMOVE( &op->o_extra, &moi->moi_oe, OpExtra, oe_next );
 	} else {
 		moi->moi_ref--;
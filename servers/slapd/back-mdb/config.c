@@ -40,6 +40,12 @@ enum {
 	MDB_MAXSIZE,
 	MDB_MODE,
 	MDB_SSTACK,
+	MDB_COMPRESS,
+	MDB_GROUPCOMMIT,
+	MDB_SCRUB,
+	MDB_COMPACT,
+	MDB_MAPWINDOW,
+	MDB_SORTINDEX,
 };
 
 static ConfigTable mdbcfg[] = {
@@ -52,10 +58,27 @@ static ConfigTable mdbcfg[] = {
 		mdb_cf_gen, "( OLcfgDbAt:1.2 NAME 'olcDbCheckpoint' "
 			"DESC 'Database checkpoint interval in kbytes and minutes' "
 			"SYNTAX OMsDirectoryString SINGLE-VALUE )",NULL, NULL },
+	{ "compact", "seconds> <percent", 2, 3, 0, ARG_MAGIC|MDB_COMPACT,
+		mdb_cf_gen, "( OLcfgDbAt:12.14 NAME 'olcDbCompact' "
+		"DESC 'Online compaction check interval in seconds and percentage of free pages' "
+		"SYNTAX OMsDirectoryString SINGLE-VALUE )", NULL, NULL },
+	{ "compress", "size", 2, 2, 0, ARG_UINT|ARG_MAGIC|MDB_COMPRESS,
+		mdb_cf_gen, "( OLcfgDbAt:12.10 NAME 'olcDbCompress' "
+			"DESC 'Size from which entries are stored compressed, 0 to disable' "
+			"SYNTAX OMsInteger SINGLE-VALUE )", NULL, NULL },
 	{ "dbnosync", NULL, 1, 2, 0, ARG_ON_OFF|ARG_MAGIC|MDB_DBNOSYNC,
 		mdb_cf_gen, "( OLcfgDbAt:1.4 NAME 'olcDbNoSync' "
 			"DESC 'Disable synchronous database writes' "
 			"SYNTAX OMsBoolean SINGLE-VALUE )", NULL, NULL },
+	{ "dnprefix", NULL, 1, 2, 0, ARG_ON_OFF|ARG_OFFSET,
+		(void *)offsetof(struct mdb_info, mi_dnprefix),
+		"( OLcfgDbAt:12.17 NAME 'olcDbDnPrefix' "
+		"DESC 'Create the dn2id DB with shared RDN prefixes' "
+		"SYNTAX OMsBoolean SINGLE-VALUE )", NULL, NULL },
+	{ "groupcommit", "ops", 2, 2, 0, ARG_UINT|ARG_MAGIC|MDB_GROUPCOMMIT,
+		mdb_cf_gen, "( OLcfgDbAt:12.11 NAME 'olcDbGroupCommit' "
+			"DESC 'Most write operations to commit in one txn, 0 to disable' "
+			"SYNTAX OMsInteger SINGLE-VALUE )", NULL, NULL },
 	{ "envflags", "flags", 2, 0, 0, ARG_MAGIC|MDB_ENVFLAGS,
 		mdb_cf_gen, "( OLcfgDbAt:12.3 NAME 'olcDbEnvFlags' "
 			"DESC 'Database environment flags' "
@@ -66,6 +89,20 @@ static ConfigTable mdbcfg[] = {
 		"DESC 'Attribute index parameters' "
 		"EQUALITY caseIgnoreMatch "
 		"SYNTAX OMsDirectoryString )", NULL, NULL },
+	{ "indexbatch", "entries", 2, 2, 0, ARG_UINT|ARG_OFFSET,
+		(void *)offsetof(struct mdb_info, mi_index_batch),
+		"( OLcfgDbAt:12.8 NAME 'olcDbIndexBatch' "
+		"DESC 'Number of entries to reindex in one write transaction' "
+		"SYNTAX OMsInteger SINGLE-VALUE )", NULL, NULL },
+	{ "indexrate", "entries", 2, 2, 0, ARG_UINT|ARG_OFFSET,
+		(void *)offsetof(struct mdb_info, mi_index_rate),
+		"( OLcfgDbAt:12.9 NAME 'olcDbIndexRate' "
+		"DESC 'Maximum number of entries to reindex per second' "
+		"SYNTAX OMsInteger SINGLE-VALUE )", NULL, NULL },
+	{ "mapwindow", "size", 2, 2, 0, ARG_ULONG|ARG_MAGIC|MDB_MAPWINDOW,
+		mdb_cf_gen, "( OLcfgDbAt:12.15 NAME 'olcDbMapWindow' "
+		"DESC 'Bytes of the DB file kept mapped with envflags windowmap' "
+		"SYNTAX OMsInteger SINGLE-VALUE )", NULL, NULL },
 	{ "maxentrysize", "size", 2, 2, 0, ARG_ULONG|ARG_OFFSET,
 		(void *)offsetof(struct mdb_info, mi_maxentrysize),
 		"( OLcfgDbAt:12.4 NAME 'olcDbMaxEntrySize' "
@@ -93,11 +130,25 @@ static ConfigTable mdbcfg[] = {
 		"( OLcfgDbAt:12.7 NAME 'olcDbMultivalLo' "
 		"DESC 'Threshold for consolidating multivalued attr back into main blob' "
 		"SYNTAX OMsInteger SINGLE-VALUE )", NULL, NULL },
+	{ "prefetch", "ids", 2, 2, 0, ARG_UINT|ARG_OFFSET,
+		(void *)offsetof(struct mdb_info, mi_prefetch),
+		"( OLcfgDbAt:12.12 NAME 'olcDbPrefetch' "
+		"DESC 'Number of search candidates whose pages are prefetched ahead' "
+		"SYNTAX OMsInteger SINGLE-VALUE )", NULL, NULL },
 	{ "rtxnsize", "entries", 2, 2, 0, ARG_UINT|ARG_OFFSET,
 		(void *)offsetof(struct mdb_info, mi_rtxn_size),
 		"( OLcfgDbAt:12.5 NAME 'olcDbRtxnSize' "
 		"DESC 'Number of entries to process in one read transaction' "
 		"SYNTAX OMsInteger SINGLE-VALUE )", NULL, NULL },
+	{ "scrub", "seconds> <pages", 2, 3, 0, ARG_MAGIC|MDB_SCRUB,
+		mdb_cf_gen, "( OLcfgDbAt:12.13 NAME 'olcDbScrub' "
+		"DESC 'Background page verification interval in seconds and pages per run' "
+		"SYNTAX OMsDirectoryString SINGLE-VALUE )", NULL, NULL },
+	{ "sortindex", "attr", 2, 0, 0, ARG_MAGIC|MDB_SORTINDEX,
+		mdb_cf_gen, "( OLcfgDbAt:12.16 NAME 'olcDbSortIndex' "
+		"DESC 'Attributes kept in sort order for server side sorting' "
+		"EQUALITY caseIgnoreMatch "
+		"SYNTAX OMsDirectoryString )", NULL, NULL },
 	{ "searchstack", "depth", 2, 2, 0, ARG_INT|ARG_MAGIC|MDB_SSTACK,
 		mdb_cf_gen, "( OLcfgDbAt:1.9 NAME 'olcDbSearchStack' "
 		"DESC 'Depth of search stack in IDLs' "
@@ -116,7 +167,9 @@ static ConfigOCs mdbocs[] = {
 		"MAY ( olcDbCheckpoint $ olcDbEnvFlags $ "
 		"olcDbNoSync $ olcDbIndex $ olcDbMaxReaders $ olcDbMaxSize $ "
 		"olcDbMode $ olcDbSearchStack $ olcDbMaxEntrySize $ olcDbRtxnSize $ "
-		"olcDbMultivalHi $ olcDbMultivalLo ) )",
+		"olcDbMultivalHi $ olcDbMultivalLo $ olcDbIndexBatch $ "
+		"olcDbIndexRate $ olcDbCompress $ olcDbGroupCommit $ olcDbPrefetch $ "
+		"olcDbScrub $ olcDbCompact $ olcDbMapWindow $ olcDbSortIndex $ olcDbDnPrefix ) )",
 		 	Cft_Database, mdbcfg },
 	{ NULL, 0, NULL }
 };
@@ -127,6 +180,10 @@ static slap_verbmasks mdb_envflags[] = {
 	{ BER_BVC("writemap"),	MDB_WRITEMAP },
 	{ BER_BVC("mapasync"),	MDB_MAPASYNC },
 	{ BER_BVC("nordahead"),	MDB_NORDAHEAD },
+	{ BER_BVC("trackpages"),	MDB_TRACKPAGES },
+	{ BER_BVC("opstats"),	MDB_OPSTATS },
+	{ BER_BVC("checksum"),	MDB_CHECKSUM },
+	{ BER_BVC("windowmap"),	MDB_WINDOWMAP },
 	{ BER_BVNULL, 0 }
 };
 
@@ -144,6 +201,214 @@ mdb_checkpoint( void *ctx, void *arg )
 	return NULL;
 }
 
+/* Which DB the scrub is at: the free page DB, the main DB,
+ * then our own DBs and the attribute indices. Returns 1 if
+ * *dbi is to be scrubbed, 0 if this slot is to be skipped and
+ * -1 past the last DB.
+ */
+static int
+mdb_scrub_dbi( struct mdb_info *mdb, int i, MDB_dbi *dbi )
+{
+	if ( i < 2 ) {
+		*dbi = i;
+		return 1;
+	}
+	i -= 2;
+	if ( i < MDB_NDB ) {
+		*dbi = mdb->mi_dbis[i];
+		return *dbi != 0;
+	}
+	i -= MDB_NDB;
+	if ( i < mdb->mi_nattrs ) {
+		/* index not opened yet, or going away */
+		if ( mdb->mi_attrs[i]->ai_indexmask & MDB_INDEX_DELETING )
+			return 0;
+		*dbi = mdb->mi_attrs[i]->ai_dbi;
+		return *dbi != 0;
+	}
+	return -1;
+}
+
+/* verify a batch of pages, resuming where the last run stopped */
+static void *
+mdb_scrub_task( void *ctx, void *arg )
+{
+	struct re_s *rtask = arg;
+	BackendDB *be = rtask->arg;
+	struct mdb_info *mdb = be->be_private;
+
+	MDB_txn *txn;
+	MDB_scrub sc;
+	MDB_val key;
+	MDB_dbi dbi;
+	size_t budget;
+	int rc;
+
+	if ( !( mdb->mi_flags & MDB_IS_OPEN ) ||
+		mdb_txn_begin( mdb->mi_dbenv, NULL, MDB_RDONLY, &txn ) != 0 )
+		goto done;
+
+	budget = mdb->mi_scrub_batch ? mdb->mi_scrub_batch : DEFAULT_SCRUB_BATCH;
+	key.mv_size = mdb->mi_scrub_key.bv_len;
+	key.mv_data = mdb->mi_scrub_key.bv_val;
+	while ( budget && !slapd_shutdown ) {
+		rc = mdb_scrub_dbi( mdb, mdb->mi_scrub_db, &dbi );
+		if ( rc < 0 ) {
+			/* next run starts a new pass */
+			mdb->mi_scrub_passes++;
+			mdb->mi_scrub_db = 0;
+			key.mv_size = 0;
+			break;
+		}
+		if ( !rc ) {
+			mdb->mi_scrub_db++;
+			key.mv_size = 0;
+			continue;
+		}
+		sc.ms_pages = budget;
+		rc = mdb_scrub( txn, dbi, &key, &sc );
+		mdb->mi_scrub_pages += sc.ms_pages;
+		budget = budget > sc.ms_pages ? budget - sc.ms_pages : 0;
+		if ( sc.ms_corrupt ) {
+			mdb->mi_scrub_corrupt += sc.ms_corrupt;
+			Debug( LDAP_DEBUG_ANY,
+				LDAP_XSTRING(mdb_scrub_task) ": database %s: "
+				"%lu corrupt pages, the last one is page %lu\n",
+				be->be_suffix[0].bv_val, (unsigned long) sc.ms_corrupt,
+				(unsigned long) sc.ms_badpg );
+		}
+		if ( rc == 0 )
+			break;
+		/* done with this DB */
+		if ( rc != MDB_NOTFOUND ) {
+			Debug( LDAP_DEBUG_ANY,
+				LDAP_XSTRING(mdb_scrub_task) ": database %s: "
+				"scrub of DB %d failed: %s\n",
+				be->be_suffix[0].bv_val, mdb->mi_scrub_db, mdb_strerror(rc) );
+		}
+		mdb->mi_scrub_db++;
+		key.mv_size = 0;
+		/* the txn may be unusable after an error */
+		if ( rc != MDB_NOTFOUND )
+			break;
+	}
+
+	/* the key points into the txn's snapshot */
+	if ( key.mv_size && key.mv_data != mdb->mi_scrub_key.bv_val ) {
+		mdb->mi_scrub_key.bv_val = ch_realloc( mdb->mi_scrub_key.bv_val,
+			key.mv_size );
+		memcpy( mdb->mi_scrub_key.bv_val, key.mv_data, key.mv_size );
+	}
+	mdb->mi_scrub_key.bv_len = key.mv_size;
+	mdb_txn_abort( txn );
+
+done:
+	ldap_pvt_thread_mutex_lock( &slapd_rq.rq_mutex );
+	ldap_pvt_runqueue_stoptask( &slapd_rq, rtask );
+	ldap_pvt_thread_mutex_unlock( &slapd_rq.rq_mutex );
+	return NULL;
+}
+
+/* Replay rounds before the switch; fewer if the journal gets short */
+#define COMPACT_ROUNDS	8
+#define COMPACT_TAIL	1000
+
+/* count the pages on the freelist and the pages in use by the DB */
+static int
+mdb_compact_free_pages( struct mdb_info *mdb, size_t *freepg, size_t *total )
+{
+	MDB_envinfo ei;
+	MDB_txn *txn;
+	MDB_cursor *curs;
+	MDB_val key, data;
+	int rc;
+
+	*freepg = 0;
+	rc = mdb_txn_begin( mdb->mi_dbenv, NULL, MDB_RDONLY, &txn );
+	if ( rc )
+		return rc;
+	rc = mdb_cursor_open( txn, 0, &curs );
+	if ( rc == 0 ) {
+		while (( rc = mdb_cursor_get( curs, &key, &data, MDB_NEXT )) == 0 )
+			*freepg += *(size_t *)data.mv_data;
+		mdb_cursor_close( curs );
+		if ( rc == MDB_NOTFOUND )
+			rc = 0;
+	}
+	mdb_txn_abort( txn );
+	if ( rc == 0 && ( rc = mdb_env_info( mdb->mi_dbenv, &ei )) == 0 )
+		*total = ei.me_last_pgno + 1;
+	return rc;
+}
+
+/* compact the DB online once enough of it is free. Writes go on while
+ * the copy is made and caught up; only the switch to it pauses the
+ * server, for the last writes to be replayed.
+ */
+static void *
+mdb_compact_task( void *ctx, void *arg )
+{
+	struct re_s *rtask = arg;
+	BackendDB *be = rtask->arg;
+	struct mdb_info *mdb = be->be_private;
+
+	MDB_compact *cp;
+	size_t freepg, total, count;
+	int i, rc;
+
+	if ( !( mdb->mi_flags & MDB_IS_OPEN ) ||
+		mdb_compact_free_pages( mdb, &freepg, &total ) != 0 ||
+		freepg * 100 < (size_t)mdb->mi_compact_percent * total )
+		goto done;
+
+	rc = mdb_env_compact_begin( mdb->mi_dbenv, &cp );
+	if ( rc ) {
+		Debug( LDAP_DEBUG_ANY,
+			LDAP_XSTRING(mdb_compact_task) ": database %s: "
+			"cannot start compaction: %s\n",
+			be->be_suffix[0].bv_val, mdb_strerror(rc), 0 );
+		goto done;
+	}
+	for ( i = 0; i < COMPACT_ROUNDS && !slapd_shutdown; i++ ) {
+		rc = mdb_env_compact_replay( cp, &count );
+		if ( rc || count < COMPACT_TAIL )
+			break;
+	}
+	if ( rc || slapd_shutdown ||
+		ldap_pvt_thread_pool_pause( &connection_pool ) < 0 ) {
+		mdb_env_compact_end( cp, 0 );
+	} else {
+		/* no op is running, so no read txn is active */
+		rc = mdb_env_compact_end( cp, 1 );
+		if ( rc == EBUSY )
+			mdb_env_compact_end( cp, 0 );
+		ldap_pvt_thread_pool_resume( &connection_pool );
+	}
+	if ( rc ) {
+		Debug( LDAP_DEBUG_ANY,
+			LDAP_XSTRING(mdb_compact_task) ": database %s: "
+			"compaction failed: %s\n",
+			be->be_suffix[0].bv_val, mdb_strerror(rc), 0 );
+	} else {
+		size_t after = total;
+		mdb_compact_free_pages( mdb, &freepg, &after );
+		mdb->mi_compactions++;
+		if ( after < total )
+			mdb->mi_compact_pages += total - after;
+		Debug( LDAP_DEBUG_ANY,
+			LDAP_XSTRING(mdb_compact_task) ": database %s: "
+			"compacted from %lu to %lu pages\n",
+			be->be_suffix[0].bv_val, (unsigned long) total,
+			(unsigned long) after );
+	}
+
+done:
+	ldap_pvt_thread_mutex_lock( &slapd_rq.rq_mutex );
+	ldap_pvt_runqueue_stoptask( &slapd_rq, rtask );
+	ldap_pvt_thread_mutex_unlock( &slapd_rq.rq_mutex );
+	return NULL;
+}
+
 /* reindex entries on the fly */
 static void *
 mdb_online_index( void *ctx, void *arg )
@@ -161,21 +426,29 @@ mdb_online_index( void *ctx, void *arg )
 	MDB_txn *txn;
 	ID id;
 	Entry *e;
-	int rc, getnext = 1;
-	int i;
+	int rc = 0, done = 0, pausing = 0;
+	int i, n, batch;
+	unsigned long budget;
 
 	connection_fake_init( &conn, &opbuf, ctx );
 	op = &opbuf.ob_op;
 
 	op->o_bd = be;
 
-	id = 1;
+	batch = mdb->mi_index_batch ? mdb->mi_index_batch : DEFAULT_INDEX_BATCH;
+	budget = mdb->mi_index_rate;
 	key.mv_size = sizeof(ID);
 
 	while ( 1 ) {
 		if ( slapd_shutdown )
 			break;
 
+		/* let a server pause (e.g. for cn=config changes) go ahead */
+		if ( ldap_pvt_thread_pool_pausing( &connection_pool ) > 0 ) {
+			pausing = 1;
+			break;
+		}
+
 		rc = mdb_txn_begin( mdb->mi_dbenv, NULL, 0, &txn );
 		if ( rc )
 			break;
@@ -184,39 +457,41 @@ mdb_online_index( void *ctx, void *arg )
 			mdb_txn_abort( txn );
 			break;
 		}
-		if ( getnext ) {
-			getnext = 0;
-			key.mv_data = &id;
-			rc = mdb_cursor_get( curs, &key, &data, MDB_SET_RANGE );
-			if ( rc ) {
-				mdb_txn_abort( txn );
-				if ( rc == MDB_NOTFOUND )
-					rc = 0;
-				break;
-			}
+
+		id = mdb->mi_index_next ? mdb->mi_index_next : 1;
+		key.mv_data = &id;
+		rc = mdb_cursor_get( curs, &key, &data, MDB_SET_RANGE );
+		for ( n = 0; rc == 0 && n < batch; n++ ) {
 			memcpy( &id, key.mv_data, sizeof( id ));
+			rc = mdb_id2entry( op, curs, id, &e );
+			if ( rc == 0 ) {
+				rc = mdb_index_entry( op, txn, MDB_INDEX_UPDATE_OP, e );
+				mdb_entry_return( op, e );
+			} else if ( rc == MDB_NOTFOUND ) {
+				rc = 0;
+			}
+			if ( rc )
+				break;
+			id++;
+			rc = mdb_cursor_get( curs, &key, &data, MDB_NEXT );
 		}
-
-		rc = mdb_id2entry( op, curs, id, &e );
 		mdb_cursor_close( curs );
-		if ( rc ) {
-			mdb_txn_abort( txn );
-			if ( rc == MDB_NOTFOUND ) {
-				id++;
-				getnext = 1;
-				continue;
-			}
-			break;
+		if ( rc == MDB_NOTFOUND ) {
+			done = 1;
+			rc = 0;
 		}
-		rc = mdb_index_entry( op, txn, MDB_INDEX_UPDATE_OP, e );
-		mdb_entry_return( op, e );
+
+		/* save our position along with the index updates */
+		if ( rc == 0 && done )
+			rc = mdb_sort_built( mdb, txn );
+		if ( rc == 0 )
+			rc = mdb_ixstate_put( mdb, txn, done ? NOID : id );
 		if ( rc == 0 ) {
 			rc = mdb_txn_commit( txn );
-			txn = NULL;
 		} else {
 			mdb_txn_abort( txn );
-			txn = NULL;
 		}
+		txn = NULL;
 		if ( rc ) {
 			Debug( LDAP_DEBUG_ANY,
 				LDAP_XSTRING(mdb_online_index) ": database %s: "
@@ -224,29 +499,96 @@ mdb_online_index( void *ctx, void *arg )
 				be->be_suffix[0].bv_val, mdb_strerror(rc), rc );
 			break;
 		}
-		id++;
-		getnext = 1;
+		mdb->mi_index_next = id;
+		mdb->mi_index_count += n;
+
+		if ( done )
+			break;
+
+		/* throttled: wait for the next second */
+		if ( budget ) {
+			if ( budget <= n )
+				break;
+			budget -= n;
+		}
 	}
 
-	for ( i = 0; i < mdb->mi_nattrs; i++ ) {
-		if ( mdb->mi_attrs[ i ]->ai_indexmask & MDB_INDEX_DELETING
-			|| mdb->mi_attrs[ i ]->ai_newmask == 0 )
-		{
-			continue;
+	if ( done ) {
+		for ( i = 0; i < mdb->mi_nattrs; i++ ) {
+			if ( mdb->mi_attrs[ i ]->ai_indexmask & MDB_INDEX_DELETING
+				|| mdb->mi_attrs[ i ]->ai_newmask == 0 )
+			{
+				continue;
+			}
+			mdb->mi_attrs[ i ]->ai_indexmask = mdb->mi_attrs[ i ]->ai_newmask;
+			mdb->mi_attrs[ i ]->ai_newmask = 0;
 		}
-		mdb->mi_attrs[ i ]->ai_indexmask = mdb->mi_attrs[ i ]->ai_newmask;
-		mdb->mi_attrs[ i ]->ai_newmask = 0;
+		mdb_sort_built( mdb, NULL );
+		mdb->mi_index_next = 0;
+		mdb->mi_index_count = 0;
 	}
 
 	ldap_pvt_thread_mutex_lock( &slapd_rq.rq_mutex );
 	ldap_pvt_runqueue_stoptask( &slapd_rq, rtask );
-	mdb->mi_index_task = NULL;
-	ldap_pvt_runqueue_remove( &slapd_rq, rtask );
+	if ( done || rc ) {
+		mdb->mi_index_task = NULL;
+		ldap_pvt_runqueue_remove( &slapd_rq, rtask );
+	} else if ( !slapd_shutdown ) {
+		/* come back right after the pause, or in a second */
+		rtask->interval.tv_sec = pausing ? 0 : 1;
+		ldap_pvt_runqueue_resched( &slapd_rq, rtask, 0 );
+		rtask->interval.tv_sec = 36000;
+	}
 	ldap_pvt_thread_mutex_unlock( &slapd_rq.rq_mutex );
 
 	return NULL;
 }
 
+/* Schedule the online indexer, unless it's already queued */
+int
+mdb_index_task_start( BackendDB *be )
+{
+	struct mdb_info *mdb = be->be_private;
+
+	/* an overlaid database is opened through a copy on the stack,
+	 * the task needs the real one
+	 */
+	if ( SLAP_DBFLAGS( be ) & SLAP_DBFLAG_OVERLAY ) {
+		BackendDB *b;
+		LDAP_STAILQ_FOREACH( b, &backendDB, be_next ) {
+			if ( b->be_private == mdb ) {
+				be = b;
+				break;
+			}
+		}
+	}
+
+	ldap_pvt_thread_mutex_lock( &slapd_rq.rq_mutex );
+	if ( !mdb->mi_index_task ) {
+		/* Start the task as soon as we finish here. Set a long
+		 * interval (10 hours) so that it only gets scheduled once.
+		 */
+		mdb->mi_index_task = ldap_pvt_runqueue_insert( &slapd_rq, 36000,
+			mdb_online_index, be,
+			LDAP_XSTRING(mdb_online_index), be->be_suffix[0].bv_val );
+	}
+	ldap_pvt_thread_mutex_unlock( &slapd_rq.rq_mutex );
+
+	return 0;
+}
+
+/* apply a changed compress setting to the open id2entry DB */
+static void
+mdb_compress_set( struct mdb_info *mdb )
+{
+	MDB_txn *txn;
+
+	if ( mdb_txn_begin( mdb->mi_dbenv, NULL, MDB_RDONLY, &txn ) == 0 ) {
+		mdb_set_compress( txn, mdb->mi_id2entry, mdb->mi_compress );
+		mdb_txn_abort( txn );
+	}
+}
+
 /* Cleanup loose ends after Modify completes */
 static int
 mdb_cf_cleanup( ConfigArgs *c )
@@ -346,6 +688,11 @@ mdb_cf_gen( ConfigArgs *c )
 			if ( !c->rvalue_vals ) rc = 1;
 			break;
 
+		case MDB_SORTINDEX:
+			mdb_sort_unparse( mdb, &c->rvalue_vals );
+			if ( !c->rvalue_vals ) rc = 1;
+			break;
+
 		case MDB_SSTACK:
 			c->value_int = mdb->mi_search_stack_depth;
 			break;
@@ -357,6 +704,44 @@ mdb_cf_gen( ConfigArgs *c )
 		case MDB_MAXSIZE:
 			c->value_ulong = mdb->mi_mapsize;
 			break;
+
+		case MDB_MAPWINDOW:
+			c->value_ulong = mdb->mi_mapwindow;
+			break;
+
+		case MDB_COMPRESS:
+			c->value_uint = mdb->mi_compress;
+			break;
+
+		case MDB_GROUPCOMMIT:
+			c->value_uint = mdb->mi_group_max;
+			break;
+
+		case MDB_SCRUB:
+			if ( mdb->mi_scrub_interval ) {
+				char buf[64];
+				struct berval bv;
+				bv.bv_len = snprintf( buf, sizeof(buf), "%u %u",
+					mdb->mi_scrub_interval, mdb->mi_scrub_batch );
+				bv.bv_val = buf;
+				value_add_one( &c->rvalue_vals, &bv );
+			} else {
+				rc = 1;
+			}
+			break;
+
+		case MDB_COMPACT:
+			if ( mdb->mi_compact_interval ) {
+				char buf[64];
+				struct berval bv;
+				bv.bv_len = snprintf( buf, sizeof(buf), "%u %u",
+					mdb->mi_compact_interval, mdb->mi_compact_percent );
+				bv.bv_val = buf;
+				value_add_one( &c->rvalue_vals, &bv );
+			} else {
+				rc = 1;
+			}
+			break;
 		}
 		return rc;
 	} else if ( c->op == LDAP_MOD_DELETE ) {
@@ -374,6 +759,7 @@ mdb_cf_gen( ConfigArgs *c )
 		case MDB_SSTACK:
 		case MDB_MAXREADERS:
 		case MDB_MAXSIZE:
+		case MDB_MAPWINDOW:
 			break;
 
 		case MDB_CHKPT:
@@ -395,6 +781,41 @@ mdb_cf_gen( ConfigArgs *c )
 			c->cleanup = mdb_cf_cleanup;
 			ldap_pvt_thread_pool_purgekey( mdb->mi_dbenv );
 			break;
+		case MDB_COMPRESS:
+			mdb->mi_compress = 0;
+			if ( mdb->mi_flags & MDB_IS_OPEN )
+				mdb_compress_set( mdb );
+			break;
+		case MDB_GROUPCOMMIT:
+			mdb->mi_group_max = 0;
+			mdb_group_stop( mdb );
+			break;
+		case MDB_SCRUB:
+			if ( mdb->mi_scrub_task ) {
+				struct re_s *re = mdb->mi_scrub_task;
+				mdb->mi_scrub_task = NULL;
+				ldap_pvt_thread_mutex_lock( &slapd_rq.rq_mutex );
+				if ( ldap_pvt_runqueue_isrunning( &slapd_rq, re ) )
+					ldap_pvt_runqueue_stoptask( &slapd_rq, re );
+				ldap_pvt_runqueue_remove( &slapd_rq, re );
+				ldap_pvt_thread_mutex_unlock( &slapd_rq.rq_mutex );
+			}
+			mdb->mi_scrub_interval = 0;
+			mdb->mi_scrub_batch = 0;
+			break;
+		case MDB_COMPACT:
+			if ( mdb->mi_compact_task ) {
+				struct re_s *re = mdb->mi_compact_task;
+				mdb->mi_compact_task = NULL;
+				ldap_pvt_thread_mutex_lock( &slapd_rq.rq_mutex );
+				if ( ldap_pvt_runqueue_isrunning( &slapd_rq, re ) )
+					ldap_pvt_runqueue_stoptask( &slapd_rq, re );
+				ldap_pvt_runqueue_remove( &slapd_rq, re );
+				ldap_pvt_thread_mutex_unlock( &slapd_rq.rq_mutex );
+			}
+			mdb->mi_compact_interval = 0;
+			mdb->mi_compact_percent = 0;
+			break;
 		case MDB_DBNOSYNC:
 			mdb_env_set_flags( mdb->mi_dbenv, MDB_NOSYNC, 0 );
 			mdb->mi_dbenv_flags &= ~MDB_NOSYNC;
@@ -489,6 +910,15 @@ mdb_cf_gen( ConfigArgs *c )
 				}
 			}
 			break;
+
+		case MDB_SORTINDEX:
+			if ( c->valx == -1 ) {
+				while ( mdb->mi_nsorts )
+					mdb_sort_delete( c->be, mdb->mi_nsorts - 1 );
+			} else {
+				mdb_sort_delete( c->be, c->valx );
+			}
+			break;
 		}
 		return rc;
 	}
@@ -649,25 +1079,40 @@ mdb_cf_gen( ConfigArgs *c )
 		mdb->mi_flags |= MDB_OPEN_INDEX;
 		if ( mdb->mi_flags & MDB_IS_OPEN ) {
 			c->cleanup = mdb_cf_cleanup;
-			if ( !mdb->mi_index_task ) {
-				/* Start the task as soon as we finish here. Set a long
-				 * interval (10 hours) so that it only gets scheduled once.
-				 */
-				if ( c->be->be_suffix == NULL || BER_BVISNULL( &c->be->be_suffix[0] ) ) {
-					fprintf( stderr, "%s: "
-						"\"index\" must occur after \"suffix\".\n",
-						c->log );
-					return 1;
-				}
-				ldap_pvt_thread_mutex_lock( &slapd_rq.rq_mutex );
-				mdb->mi_index_task = ldap_pvt_runqueue_insert( &slapd_rq, 36000,
-					mdb_online_index, c->be,
-					LDAP_XSTRING(mdb_online_index), c->be->be_suffix[0].bv_val );
-				ldap_pvt_thread_mutex_unlock( &slapd_rq.rq_mutex );
+			if ( c->be->be_suffix == NULL || BER_BVISNULL( &c->be->be_suffix[0] ) ) {
+				fprintf( stderr, "%s: "
+					"\"index\" must occur after \"suffix\".\n",
+					c->log );
+				return 1;
 			}
+			/* a running indexer has already passed some entries */
+			mdb->mi_index_next = 0;
+			mdb_index_task_start( c->be );
 		}
 		break;
 
+	case MDB_SORTINDEX: {
+		int i;
+
+		for ( i = 1; i < c->argc; i++ ) {
+			rc = mdb_sort_config( mdb, c->argv[i], &c->reply );
+			if ( rc ) {
+				Debug( LDAP_DEBUG_ANY, "%s: %s\n", c->log, c->cr_msg, 0 );
+				return 1;
+			}
+		}
+		if ( mdb->mi_flags & MDB_IS_OPEN ) {
+			rc = mdb_sort_open( c->be, NULL, &c->reply );
+			if ( rc < 0 )
+				return 1;
+			if ( rc > 0 ) {
+				mdb->mi_index_next = 0;
+				mdb_index_task_start( c->be );
+			}
+			rc = 0;
+		}
+		} break;
+
 	case MDB_SSTACK:
 		if ( c->value_int < MINIMUM_SEARCH_STACK_DEPTH ) {
 			fprintf( stderr,
@@ -694,6 +1139,115 @@ mdb_cf_gen( ConfigArgs *c )
 		}
 		break;
 
+	case MDB_MAPWINDOW:
+		mdb->mi_mapwindow = c->value_ulong;
+		if ( mdb->mi_flags & MDB_IS_OPEN )
+			mdb_env_set_mapwindow( mdb->mi_dbenv, mdb->mi_mapwindow );
+		break;
+
+	case MDB_COMPRESS:
+		if ( c->value_uint && c->value_uint < MDB_COMPRESS_MIN ) {
+			snprintf( c->cr_msg, sizeof( c->cr_msg ),
+				"%s: size must be 0 or at least %d",
+				c->log, MDB_COMPRESS_MIN );
+			Debug( LDAP_DEBUG_ANY, "%s\n", c->cr_msg, 0, 0 );
+			return -1;
+		}
+		mdb->mi_compress = c->value_uint;
+		if ( mdb->mi_flags & MDB_IS_OPEN )
+			mdb_compress_set( mdb );
+		break;
+
+	case MDB_GROUPCOMMIT:
+		/* write ops are paused while cn=config is modified */
+		mdb->mi_group_max = c->value_uint;
+		if (( mdb->mi_flags & MDB_IS_OPEN ) && ( slapMode & SLAP_SERVER_MODE )) {
+			if ( mdb->mi_group_max )
+				mdb_group_start( mdb );
+			else
+				mdb_group_stop( mdb );
+		}
+		break;
+
+	case MDB_SCRUB: {
+		unsigned	secs, pages = 0;
+		if ( lutil_atoux( &secs, c->argv[1], 0 ) != 0 || !secs ) {
+			snprintf( c->cr_msg, sizeof( c->cr_msg ),
+				"invalid seconds \"%s\" in \"scrub\"", c->argv[1] );
+			Debug( LDAP_DEBUG_ANY, "%s: %s\n", c->log, c->cr_msg, 0 );
+			return 1;
+		}
+		if ( c->argc > 2 && lutil_atoux( &pages, c->argv[2], 0 ) != 0 ) {
+			snprintf( c->cr_msg, sizeof( c->cr_msg ),
+				"invalid pages \"%s\" in \"scrub\"", c->argv[2] );
+			Debug( LDAP_DEBUG_ANY, "%s: %s\n", c->log, c->cr_msg, 0 );
+			return 1;
+		}
+		mdb->mi_scrub_interval = secs;
+		mdb->mi_scrub_batch = pages ? pages : DEFAULT_SCRUB_BATCH;
+		/* In server mode, submit a task that verifies a batch of
+		 * pages every interval.
+		 */
+		if ( slapMode & SLAP_SERVER_MODE ) {
+			struct re_s *re = mdb->mi_scrub_task;
+			if ( re ) {
+				re->interval.tv_sec = secs;
+			} else {
+				if ( c->be->be_suffix == NULL || BER_BVISNULL( &c->be->be_suffix[0] ) ) {
+					snprintf( c->cr_msg, sizeof( c->cr_msg ),
+						"\"scrub\" must occur after \"suffix\"" );
+					Debug( LDAP_DEBUG_ANY, "%s: %s\n", c->log, c->cr_msg, 0 );
+					return 1;
+				}
+				ldap_pvt_thread_mutex_lock( &slapd_rq.rq_mutex );
+				mdb->mi_scrub_task = ldap_pvt_runqueue_insert( &slapd_rq,
+					secs, mdb_scrub_task, c->be,
+					LDAP_XSTRING(mdb_scrub_task), c->be->be_suffix[0].bv_val );
+				ldap_pvt_thread_mutex_unlock( &slapd_rq.rq_mutex );
+			}
+		}
+		} break;
+
+	case MDB_COMPACT: {
+		unsigned	secs, percent = 0;
+		if ( lutil_atoux( &secs, c->argv[1], 0 ) != 0 || !secs ) {
+			snprintf( c->cr_msg, sizeof( c->cr_msg ),
+				"invalid seconds \"%s\" in \"compact\"", c->argv[1] );
+			Debug( LDAP_DEBUG_ANY, "%s: %s\n", c->log, c->cr_msg, 0 );
+			return 1;
+		}
+		if ( c->argc > 2 && ( lutil_atoux( &percent, c->argv[2], 0 ) != 0 ||
+			!percent || percent > 100 )) {
+			snprintf( c->cr_msg, sizeof( c->cr_msg ),
+				"invalid percent \"%s\" in \"compact\"", c->argv[2] );
+			Debug( LDAP_DEBUG_ANY, "%s: %s\n", c->log, c->cr_msg, 0 );
+			return 1;
+		}
+		mdb->mi_compact_interval = secs;
+		mdb->mi_compact_percent = percent ? percent : DEFAULT_COMPACT_PERCENT;
+		/* In server mode, submit a task that checks every interval
+		 * whether the DB is worth compacting.
+		 */
+		if ( slapMode & SLAP_SERVER_MODE ) {
+			struct re_s *re = mdb->mi_compact_task;
+			if ( re ) {
+				re->interval.tv_sec = secs;
+			} else {
+				if ( c->be->be_suffix == NULL || BER_BVISNULL( &c->be->be_suffix[0] ) ) {
+					snprintf( c->cr_msg, sizeof( c->cr_msg ),
+						"\"compact\" must occur after \"suffix\"" );
+					Debug( LDAP_DEBUG_ANY, "%s: %s\n", c->log, c->cr_msg, 0 );
+					return 1;
+				}
+				ldap_pvt_thread_mutex_lock( &slapd_rq.rq_mutex );
+				mdb->mi_compact_task = ldap_pvt_runqueue_insert( &slapd_rq,
+					secs, mdb_compact_task, c->be,
+					LDAP_XSTRING(mdb_compact_task), c->be->be_suffix[0].bv_val );
+				ldap_pvt_thread_mutex_unlock( &slapd_rq.rq_mutex );
+			}
+		}
+		} break;
+
 	}
 	return 0;
 }
@@ -21,6 +21,7 @@
 
 #include "lutil.h"
 #include "back-mdb.h"
+#include "idl.h"
 
 int
 mdb_delete( Operation *op, SlapReply *rs )
@@ -370,12 +371,12 @@ mdb_delete( Operation *op, SlapReply *rs )
 		LDAP_SLIST_REMOVE( &op->o_extra, &opinfo.moi_oe, OpExtra, oe_next );
 		opinfo.moi_oe.oe_key = NULL;
 		if( op->o_noop ) {
-			mdb_txn_abort( txn );
+			mdb_group_abort( mdb, txn );
 			rs->sr_err = LDAP_X_NO_OPERATION;
 			txn = NULL;
 			goto return_results;
 		} else {
-			rs->sr_err = mdb_txn_commit( txn );
+			rs->sr_err = mdb_group_commit( mdb, txn );
 		}
 		txn = NULL;
 	}
@@ -415,7 +416,7 @@ return_results:
 
 	if( moi == &opinfo ) {
 		if( txn != NULL ) {
-			mdb_txn_abort( txn );
+			mdb_group_abort( mdb, txn );
 		}
 		if ( opinfo.moi_oe.oe_key ) {
 			LDAP_SLIST_REMOVE( &op->o_extra, &opinfo.moi_oe, OpExtra, oe_next );
@@ -440,3 +441,196 @@ return_results:
 #endif
 	return rs->sr_err;
 }
+
+/* Entries looked at per write txn of mdb_purge */
+#define MDB_PURGE_BATCH	1024
+
+/* Delete the leaf entries under base/scope that match f, many per
+ * write txn instead of one txn per entry. Candidates come from the
+ * indices; no ACLs, controls or callbacks apply. Meant for expiring
+ * log entries. If maxcsn is set, its buffer receives the newest
+ * entryCSN of the deleted entries.
+ */
+int
+mdb_purge(
+	Operation	*op,
+	struct berval	*base,
+	int		scope,
+	Filter		*f,
+	struct berval	*maxcsn,
+	int		*count )
+{
+	struct mdb_info	*mdb = (struct mdb_info *) op->o_bd->be_private;
+	mdb_op_info	opinfo, *moi;
+	MDB_txn		*txn;
+	MDB_cursor	*mc, *mci, *mcd;
+	MDB_val		key, data;
+	ID		*ids, id = NOID, last = NOID, i = 1, tmpid;
+	struct berval	name, nname, csn;
+	char		csnbuf[ LDAP_PVT_CSNSTR_BUFSIZE ];
+	Entry		*e;
+	int		rc = LDAP_SUCCESS, n, ndel, first = 1;
+
+	*count = 0;
+	/* maxcsn only gets the CSNs of committed batches */
+	csn.bv_val = csnbuf;
+	csn.bv_len = 0;
+	csnbuf[0] = '\0';
+	if ( maxcsn ) {
+		maxcsn->bv_len = 0;
+		maxcsn->bv_val[0] = '\0';
+	}
+
+	/* the candidates, then the filter scratch space */
+	ids = ch_malloc(( mdb->mi_search_stack_depth + 2 ) * MDB_IDL_UM_SIZEOF );
+
+	do {
+		memset( &opinfo, 0, sizeof( opinfo ));
+		moi = &opinfo;
+		mc = mci = mcd = NULL;
+		ndel = 0;
+
+		rc = mdb_opinfo_get( op, mdb, 0, &moi );
+		if ( rc ) {
+			Debug( LDAP_DEBUG_TRACE,
+				LDAP_XSTRING(mdb_purge) ": txn_begin failed: "
+				"%s (%d)\n", mdb_strerror(rc), rc, 0 );
+			rc = LDAP_OTHER;
+			break;
+		}
+		txn = moi->moi_txn;
+
+		if ( first ) {
+			first = 0;
+			rc = mdb_filter_candidates( op, txn, f, ids,
+				ids + MDB_IDL_UM_SIZE, ids + 2 * MDB_IDL_UM_SIZE );
+			if ( rc ) {
+				rc = LDAP_OTHER;
+				goto txn_done;
+			}
+			if ( MDB_IDL_IS_RANGE( ids ) || ids[0] ) {
+				id = MDB_IDL_FIRST( ids );
+				last = MDB_IDL_LAST( ids );
+			}
+		}
+
+		rc = mdb_cursor_open( txn, mdb->mi_dn2id, &mc );
+		if ( rc == 0 )
+			rc = mdb_cursor_open( txn, mdb->mi_id2entry, &mci );
+		if ( rc ) {
+			rc = LDAP_OTHER;
+			goto txn_done;
+		}
+
+		for ( n = 0; id != NOID && n < MDB_PURGE_BATCH; n++ ) {
+			Attribute *a;
+
+			if ( mdb_id2name( op, txn, &mcd, id, &name, &nname ) != 0 )
+				goto next;
+			if ( !dnIsSuffixScope( &nname, base, scope ) ||
+				mdb_id2entry( op, mci, id, &e ) != 0 ) {
+				op->o_tmpfree( name.bv_val, op->o_tmpmemctx );
+				op->o_tmpfree( nname.bv_val, op->o_tmpmemctx );
+				goto next;
+			}
+			e->e_name = name;
+			e->e_nname = nname;
+
+			/* only leaves are deleted */
+			if ( test_filter( op, e, f ) != LDAP_COMPARE_TRUE ||
+				mdb_dn2id_children( op, txn, e ) != MDB_NOTFOUND ) {
+				mdb_entry_return( op, e );
+				goto next;
+			}
+
+			/* position mc on the entry, then as in mdb_delete */
+			rc = mdb_dn2id( op, txn, mc, &e->e_nname, &tmpid, NULL, NULL, NULL );
+			if ( rc == 0 )
+				rc = mdb_dn2id_delete( op, mc, e->e_id, 1 );
+			if ( rc == 0 )
+				rc = mdb_index_entry_del( op, txn, e );
+			if ( rc == 0 )
+				rc = mdb_id2entry_delete( op->o_bd, txn, e );
+			if ( rc ) {
+				Debug( LDAP_DEBUG_ANY,
+					LDAP_XSTRING(mdb_purge) ": delete of \"%s\" failed: "
+					"%s (%d)\n", e->e_name.bv_val, mdb_strerror(rc), rc );
+				mdb_entry_return( op, e );
+				rc = LDAP_OTHER;
+				goto txn_done;
+			}
+			ndel++;
+
+			if ( maxcsn ) {
+				a = attr_find( e->e_attrs, slap_schema.si_ad_entryCSN );
+				if ( a && a->a_nvals[0].bv_len < LDAP_PVT_CSNSTR_BUFSIZE &&
+					ber_bvcmp( &a->a_nvals[0], &csn ) > 0 ) {
+					AC_MEMCPY( csnbuf, a->a_nvals[0].bv_val,
+						a->a_nvals[0].bv_len + 1 );
+					csn.bv_len = a->a_nvals[0].bv_len;
+				}
+			}
+			mdb_entry_return( op, e );
+
+next:
+			if ( MDB_IDL_IS_RANGE( ids )) {
+				/* skip the gaps in the range */
+				id++;
+				key.mv_data = &id;
+				key.mv_size = sizeof( ID );
+				if ( mdb_cursor_get( mci, &key, &data, MDB_SET_RANGE ) == 0 ) {
+					memcpy( &id, key.mv_data, sizeof( ID ));
+					if ( id > last )
+						id = NOID;
+				} else {
+					id = NOID;
+				}
+			} else {
+				id = ( ++i <= ids[0] ) ? ids[i] : NOID;
+			}
+		}
+
+txn_done:
+		if ( mcd )
+			mdb_cursor_close( mcd );
+		if ( mci )
+			mdb_cursor_close( mci );
+		if ( mc )
+			mdb_cursor_close( mc );
+
+		if ( moi == &opinfo ) {
+			LDAP_SLIST_REMOVE( &op->o_extra, &opinfo.moi_oe, OpExtra, oe_next );
+			if ( rc == LDAP_SUCCESS ) {
+				rc = mdb_group_commit( mdb, txn );
+				if ( rc ) {
+					Debug( LDAP_DEBUG_ANY,
+						LDAP_XSTRING(mdb_purge) ": txn_commit failed: "
+						"%s (%d)\n", mdb_strerror(rc), rc, 0 );
+					rc = LDAP_OTHER;
+				}
+			} else {
+				mdb_group_abort( mdb, txn );
+			}
+		} else {
+			moi->moi_ref--;
+		}
+		if ( rc != LDAP_SUCCESS )
+			break;
+
+		*count += ndel;
+		if ( maxcsn && csn.bv_len ) {
+			AC_MEMCPY( maxcsn->bv_val, csnbuf, csn.bv_len + 1 );
+			maxcsn->bv_len = csn.bv_len;
+		}
+
+		if ( id != NOID && moi == &opinfo )
+			ldap_pvt_thread_pool_pausecheck( &connection_pool );
+	} while ( id != NOID && !slapd_shutdown );
+
+	ch_free( ids );
+
+	Debug( LDAP_DEBUG_TRACE, "<= " LDAP_XSTRING(mdb_purge) ": %s deleted %d (%d)\n",
+		base->bv_val, *count, rc );
+
+	return rc;
+}
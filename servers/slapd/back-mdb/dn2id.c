@@ -695,6 +695,72 @@ leave:
 	return rc;
 }
 
+/* Save a copy of the n-th RDN on the scope's RDN stack. Values
+ * read from the DB may live in a cursor buffer that the next
+ * cursor op overwrites, so the stack never points into them.
+ * The copy keeps the diskNode header so it can still be used
+ * as a search key for mdb_dup_compare.
+ */
+static void
+mdb_rdn_push(
+	Operation *op,
+	IdScopes *isc,
+	int n,
+	diskNode *d,
+	unsigned int nrlen,
+	unsigned int rlen )
+{
+	size_t off, len;
+	char *ptr;
+	int i;
+
+	off = n ? isc->rdns[n-1].bv_val + isc->rdns[n-1].bv_len + 1 - isc->rdnbuf : 0;
+	len = 2 + nrlen + 1 + rlen + 1;
+	if ( off + len > isc->rdnsize ) {
+		size_t size = isc->rdnsize ? isc->rdnsize * 2 : 1024;
+		while ( size < off + len )
+			size *= 2;
+		ptr = op->o_tmpalloc( size, op->o_tmpmemctx );
+		if ( isc->rdnbuf ) {
+			memcpy( ptr, isc->rdnbuf, off );
+			for ( i=0; i<n; i++ ) {
+				isc->nrdns[i].bv_val = ptr + ( isc->nrdns[i].bv_val - isc->rdnbuf );
+				isc->rdns[i].bv_val = ptr + ( isc->rdns[i].bv_val - isc->rdnbuf );
+			}
+			op->o_tmpfree( isc->rdnbuf, op->o_tmpmemctx );
+		}
+		isc->rdnbuf = ptr;
+		isc->rdnsize = size;
+	}
+	ptr = isc->rdnbuf + off;
+	memcpy( ptr, d, len );
+	isc->nrdns[n].bv_len = nrlen;
+	isc->nrdns[n].bv_val = ptr + 2;
+	isc->rdns[n].bv_len = rlen;
+	isc->rdns[n].bv_val = ptr + 2 + nrlen + 1;
+}
+
+/* Remember a parent's dn2id record in a scope entry. Only records
+ * that point into the map stay valid across cursor ops; others, or
+ * a missing record (data is NULL), get an empty placeholder that
+ * is looked up again when needed.
+ */
+void
+mdb_idscope_mval(
+	Operation *op,
+	MDB_val *mval,
+	MDB_val *data )
+{
+	struct mdb_info *mdb = (struct mdb_info *) op->o_bd->be_private;
+
+	if ( data && mdb_env_inmap( mdb->mi_dbenv, data )) {
+		*mval = *data;
+	} else {
+		mval->mv_size = 0;
+		mval->mv_data = "";
+	}
+}
+
 /* See if base is a child of any of the scopes
  */
 int
@@ -742,16 +808,13 @@ mdb_idscopes(
 		d = data.mv_data;
 		nrlen = (d->nrdnlen[0] << 8) | d->nrdnlen[1];
 		rlen = data.mv_size - sizeof(diskNode) - nrlen;
-		isc->nrdns[isc->numrdns].bv_len = nrlen;
-		isc->nrdns[isc->numrdns].bv_val = d->nrdn;
-		isc->rdns[isc->numrdns].bv_len = rlen;
-		isc->rdns[isc->numrdns].bv_val = d->nrdn+nrlen+1;
+		mdb_rdn_push( op, isc, isc->numrdns, d, nrlen, rlen );
 		isc->numrdns++;
 
 		if (!rc && id != isc->id) {
 			/* remember our chain of parents */
 			id2.mid = id;
-			id2.mval = data;
+			mdb_idscope_mval( op, &id2.mval, &data );
 			mdb_id2l_insert( isc->sctmp, &id2 );
 		}
 		ptr = data.mv_data;
@@ -778,8 +841,13 @@ mdb_idscopes(
 				isc->nscope = x;
 				return MDB_SUCCESS;
 			}
-			data = isc->scopes[x].mval;
-			rc = 1;
+			/* reuse the saved record, unless it had to be dropped */
+			if ( isc->scopes[x].mval.mv_size ) {
+				data = isc->scopes[x].mval;
+				rc = 1;
+			} else {
+				rc = 0;
+			}
 		}
 		if ( op->ors_scope == LDAP_SCOPE_ONELEVEL )
 			break;
@@ -844,6 +912,7 @@ mdb_dn2id_walk(
 	diskNode *d;
 	char *ptr;
 	int rc, n;
+	unsigned int nrlen;
 	ID nsubs;
 
 	if ( !isc->numrdns ) {
@@ -880,10 +949,9 @@ mdb_dn2id_walk(
 			n = isc->numrdns;
 			isc->scopes[n].mid = isc->id;
 			n--;
-			isc->nrdns[n].bv_len = ((d->nrdnlen[0] & 0x7f) << 8) | d->nrdnlen[1];
-			isc->nrdns[n].bv_val = d->nrdn;
-			isc->rdns[n].bv_val = d->nrdn+isc->nrdns[n].bv_len+1;
-			isc->rdns[n].bv_len = data.mv_size - sizeof(diskNode) - isc->nrdns[n].bv_len - sizeof(ID);
+			nrlen = ((d->nrdnlen[0] & 0x7f) << 8) | d->nrdnlen[1];
+			mdb_rdn_push( op, isc, n, d, nrlen,
+				data.mv_size - sizeof(diskNode) - nrlen - sizeof(ID));
 			/* return this ID to caller */
 			if ( !isc->nscope )
 				break;
@@ -922,46 +990,3 @@ mdb_dn2id_walk(
 	}
 	return rc;
 }
-
-/* restore the nrdn/rdn pointers after a txn reset */
-void mdb_dn2id_wrestore (
-	Operation *op,
-	IdScopes *isc
-)
-{
-	MDB_val key, data;
-	diskNode *d;
-	int rc, n, nrlen;
-	char *ptr;
-
-	/* We only need to restore up to the n-1th element,
-	 * the nth element will be replaced anyway
-	 */
-	key.mv_size = sizeof(ID);
-	for ( n=0; n<isc->numrdns-1; n++ ) {
-		key.mv_data = &isc->scopes[n+1].mid;
-		rc = mdb_cursor_get( isc->mc, &key, &data, MDB_SET );
-		if ( rc )
-			continue;
-		/* we can't use this data directly since its nrlen
-		 * is missing the high bit setting, so copy it and
-		 * set it properly. we just copy enough to satisfy
-		 * mdb_dup_compare.
-		 */
-		d = data.mv_data;
-		nrlen = ((d->nrdnlen[0] & 0x7f) << 8) | d->nrdnlen[1];
-		ptr = op->o_tmpalloc( nrlen+2, op->o_tmpmemctx );
-		memcpy( ptr, data.mv_data, nrlen+2 );
-		key.mv_data = &isc->scopes[n].mid;
-		data.mv_data = ptr;
-		data.mv_size = 1;
-		*ptr |= 0x80;
-		mdb_cursor_get( isc->mc, &key, &data, MDB_GET_BOTH );
-		op->o_tmpfree( ptr, op->o_tmpmemctx );
-
-		/* now we're back to where we wanted to be */
-		d = data.mv_data;
-		isc->nrdns[n].bv_val = d->nrdn;
-		isc->rdns[n].bv_val = d->nrdn+isc->nrdns[n].bv_len+1;
-	}
-}
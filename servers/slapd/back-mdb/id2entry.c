@@ -35,7 +35,8 @@ static int mdb_entry_partsize(struct mdb_info *mdb, MDB_txn *txn, Entry *e,
 	Ecount *eh);
 static int mdb_entry_encode(Operation *op, Entry *e, MDB_val *data,
 	Ecount *ec);
-static Entry *mdb_entry_alloc( Operation *op, int nattrs, int nvals );
+static Entry *mdb_entry_alloc( Operation *op, int nattrs, int nvals,
+	size_t extra );
 
 #define ID2VKSZ	(sizeof(ID)+2)
 
@@ -271,6 +272,7 @@ static int mdb_id2entry_put(
 	struct mdb_info *mdb = (struct mdb_info *) op->o_bd->be_private;
 	Ecount ec;
 	MDB_val key, data;
+	char *buf = NULL;
 	int rc, adding = flag;
 
 	/* We only store rdns, and they go in the dn2id database. */
@@ -282,24 +284,40 @@ static int mdb_id2entry_put(
 	if (rc)
 		return LDAP_OTHER;
 
-	flag |= MDB_RESERVE;
-
 	if (e->e_id < mdb->mi_nextid)
 		flag &= ~MDB_APPEND;
 
 	if (mdb->mi_maxentrysize && ec.len > mdb->mi_maxentrysize)
 		return LDAP_ADMINLIMIT_EXCEEDED;
 
+	/* Values written with MDB_RESERVE are never compressed, so
+	 * large entries are encoded beforehand when compression is on.
+	 */
+	if (mdb->mi_compress && ec.dlen >= mdb->mi_compress) {
+		buf = op->o_tmpalloc( ec.dlen, op->o_tmpmemctx );
+		data.mv_data = buf;
+		rc = mdb_entry_encode( op, e, &data, &ec );
+		if( rc != LDAP_SUCCESS ) {
+			op->o_tmpfree( buf, op->o_tmpmemctx );
+			return rc;
+		}
+	} else {
+		flag |= MDB_RESERVE;
+	}
+
 again:
 	data.mv_size = ec.dlen;
+	data.mv_data = buf;
 	if ( mc )
 		rc = mdb_cursor_put( mc, &key, &data, flag );
 	else
 		rc = mdb_put( txn, mdb->mi_id2entry, &key, &data, flag );
 	if (rc == MDB_SUCCESS) {
-		rc = mdb_entry_encode( op, e, &data, &ec );
-		if( rc != LDAP_SUCCESS )
-			return rc;
+		if ( !buf ) {
+			rc = mdb_entry_encode( op, e, &data, &ec );
+			if( rc != LDAP_SUCCESS )
+				return rc;
+		}
 		/* Handle adds of large multi-valued attrs here.
 		 * Modifies handle them directly.
 		 */
@@ -339,6 +357,8 @@ again:
 		if ( rc != MDB_KEYEXIST )
 			rc = LDAP_OTHER;
 	}
+	if ( buf )
+		op->o_tmpfree( buf, op->o_tmpmemctx );
 	return rc;
 }
 
@@ -403,7 +423,7 @@ int mdb_id2entry(
 		/* Looking for root entry on an empty-dn suffix? */
 		if ( !id && BER_BVISEMPTY( &op->o_bd->be_nsuffix[0] )) {
 			struct berval gluebv = BER_BVC("glue");
-			Entry *r = mdb_entry_alloc(op, 2, 4);
+			Entry *r = mdb_entry_alloc(op, 2, 4, 0);
 			Attribute *a = r->e_attrs;
 			struct berval *bptr;
 
@@ -488,14 +508,18 @@ int mdb_id2entry_delete(
 	return rc;
 }
 
+/* extra bytes are left after the attributes and values,
+ * for an entry whose encoded data has to be copied.
+ */
 static Entry * mdb_entry_alloc(
 	Operation *op,
 	int nattrs,
-	int nvals )
+	int nvals,
+	size_t extra )
 {
 	Entry *e = op->o_tmpalloc( sizeof(Entry) +
 		nattrs * sizeof(Attribute) +
-		nvals * sizeof(struct berval), op->o_tmpmemctx );
+		nvals * sizeof(struct berval) + extra, op->o_tmpmemctx );
 	BER_BVZERO(&e->e_bv);
 	e->e_private = e;
 	if (nattrs) {
@@ -554,7 +578,7 @@ int mdb_entry_release(
 				if (( moi->moi_flag & (MOI_FREEIT|MOI_KEEPER)) == MOI_FREEIT ) {
 					moi->moi_ref--;
 					if ( moi->moi_ref < 1 ) {
-						mdb_txn_reset( moi->moi_txn );
+						mdb_snapshot_release( moi );
 						moi->moi_ref = 0;
 						LDAP_SLIST_REMOVE( &op->o_extra, &moi->moi_oe, OpExtra, oe_next );
 						op->o_tmpfree( moi, op->o_tmpmemctx );
@@ -654,9 +678,12 @@ return_results:
 static void
 mdb_reader_free( void *key, void *data )
 {
-	MDB_txn *txn = data;
+	mdb_snapshot *ms = data;
 
-	if ( txn ) mdb_txn_abort( txn );
+	if ( ms ) {
+		mdb_txn_abort( ms->ms_txn );
+		ch_free( ms );
+	}
 }
 
 /* free up any keys used by the main thread */
@@ -681,6 +708,7 @@ mdb_opinfo_get( Operation *op, struct mdb_info *mdb, int rdonly, mdb_op_info **m
 	void *data;
 	void *ctx;
 	mdb_op_info *moi = NULL;
+	mdb_snapshot *ms;
 	OpExtra *oex;
 
 	assert( op != NULL );
@@ -717,6 +745,7 @@ mdb_opinfo_get( Operation *op, struct mdb_info *mdb, int rdonly, mdb_op_info **m
 		moi->moi_oe.oe_key = mdb;
 		moi->moi_ref = 0;
 		moi->moi_txn = NULL;
+		moi->moi_snap = NULL;
 	}
 
 	if ( !rdonly ) {
@@ -736,7 +765,7 @@ mdb_opinfo_get( Operation *op, struct mdb_info *mdb, int rdonly, mdb_op_info **m
 				int flag = 0;
 				if ( get_lazyCommit( op ))
 					flag |= MDB_NOMETASYNC;
-				rc = mdb_txn_begin( mdb->mi_dbenv, NULL, flag, &moi->moi_txn );
+				rc = mdb_group_begin( mdb, flag, &moi->moi_txn );
 				if (rc) {
 					Debug( LDAP_DEBUG_ANY, "mdb_opinfo_get: err %s(%d)\n",
 						mdb_strerror(rc), rc, 0 );
@@ -763,25 +792,33 @@ mdb_opinfo_get( Operation *op, struct mdb_info *mdb, int rdonly, mdb_op_info **m
 			return rc;
 		}
 		if ( ldap_pvt_thread_pool_getkey( ctx, mdb->mi_dbenv, &data, NULL ) ) {
-			rc = mdb_txn_begin( mdb->mi_dbenv, NULL, MDB_RDONLY, &moi->moi_txn );
+			ms = ch_malloc( sizeof( mdb_snapshot ));
+			rc = mdb_txn_begin( mdb->mi_dbenv, NULL, MDB_RDONLY, &ms->ms_txn );
 			if (rc) {
+				ch_free( ms );
 				Debug( LDAP_DEBUG_ANY, "mdb_opinfo_get: err %s(%d)\n",
 					mdb_strerror(rc), rc, 0 );
 				return rc;
 			}
-			data = moi->moi_txn;
+			ms->ms_users = 0;
 			if ( ( rc = ldap_pvt_thread_pool_setkey( ctx, mdb->mi_dbenv,
-				data, mdb_reader_free, NULL, NULL ) ) ) {
-				mdb_txn_abort( moi->moi_txn );
-				moi->moi_txn = NULL;
+				ms, mdb_reader_free, NULL, NULL ) ) ) {
+				mdb_reader_free( mdb->mi_dbenv, ms );
 				Debug( LDAP_DEBUG_ANY, "mdb_opinfo_get: thread_pool_setkey failed err (%d)\n",
 					rc, 0, 0 );
 				return rc;
 			}
 		} else {
-			moi->moi_txn = data;
-			renew = 1;
+			ms = data;
+			/* An enclosing operation on this thread is reading it,
+			 * share its view instead of taking a new one.
+			 */
+			if ( !ms->ms_users )
+				renew = 1;
 		}
+		ms->ms_users++;
+		moi->moi_snap = ms;
+		moi->moi_txn = ms->ms_txn;
 		moi->moi_flag |= MOI_READER;
 	}
 ok:
@@ -799,6 +836,32 @@ ok:
 	return 0;
 }
 
+/* Done reading with an op info that took a reader txn. The
+ * snapshot is only reset once no op info on the thread uses it.
+ */
+void
+mdb_snapshot_release( mdb_op_info *moi )
+{
+	mdb_snapshot *ms = moi->moi_snap;
+
+	if ( !ms ) {
+		mdb_txn_reset( moi->moi_txn );
+		return;
+	}
+	moi->moi_snap = NULL;
+	if ( --ms->ms_users < 1 ) {
+		ms->ms_users = 0;
+		mdb_txn_reset( ms->ms_txn );
+	}
+}
+
+/* Whether other op infos on the thread read the same snapshot */
+int
+mdb_snapshot_shared( mdb_op_info *moi )
+{
+	return moi->moi_snap && moi->moi_snap->ms_users > 1;
+}
+
 #ifdef LDAP_X_TXN
 int mdb_txn( Operation *op, int txnop, OpExtra **ptr )
 {
@@ -815,14 +878,14 @@ int mdb_txn( Operation *op, int txnop, OpExtra **ptr )
 		}
 		return rc;
 	case SLAP_TXN_COMMIT:
-		rc = mdb_txn_commit( moi->moi_txn );
+		rc = mdb_group_commit( mdb, moi->moi_txn );
 		if ( rc )
 			mdb->mi_numads = 0;
 		op->o_tmpfree( moi, op->o_tmpmemctx );
 		return rc;
 	case SLAP_TXN_ABORT:
 		mdb->mi_numads = 0;
-		mdb_txn_abort( moi->moi_txn );
+		mdb_group_abort( mdb, moi->moi_txn );
 		op->o_tmpfree( moi, op->o_tmpmemctx );
 		return 0;
 	}
@@ -1017,7 +1080,18 @@ int mdb_entry_decode(Operation *op, MDB_txn *txn, MDB_val *data, ID id, Entry **
 
 	nattrs = *lp++;
 	nvals = *lp++;
-	x = mdb_entry_alloc(op, nattrs, nvals);
+	if ( mdb_env_inmap( mdb->mi_dbenv, data )) {
+		x = mdb_entry_alloc(op, nattrs, nvals, 0);
+	} else {
+		/* A compressed entry was uncompressed into a buffer that
+		 * only lasts until the next cursor op, keep our own copy.
+		 */
+		x = mdb_entry_alloc(op, nattrs, nvals, data->mv_size);
+		lp = (unsigned int *)((char *)(x+1) +
+			nattrs * sizeof(Attribute) + nvals * sizeof(struct berval));
+		memcpy(lp, data->mv_data, data->mv_size);
+		lp += 2;
+	}
 	x->e_ocflags = *lp++;
 	if (!nvals) {
 		goto done;
@@ -1066,6 +1140,12 @@ int mdb_entry_decode(Operation *op, MDB_txn *txn, MDB_val *data, ID id, Entry **
 					goto leave;
 			}
 			mdb_mval_get(op, mvc, id, a, have_nval);
+			/* id2v keeps the values in equality order, so lookups
+			 * in large attributes can binary search.
+			 */
+			if (!(a->a_desc->ad_type->sat_flags & SLAP_AT_ORDERED) &&
+				a->a_desc != slap_schema.si_ad_objectClass)
+				a->a_flags |= SLAP_ATTR_SORTED_VALS;
 			bptr += a->a_numvals + 1;
 			if (have_nval)
 				bptr += a->a_numvals + 1;
@@ -94,6 +94,8 @@ typedef struct IdScopes {
 	int oscope;
 	struct berval rdns[MAXRDNS];
 	struct berval nrdns[MAXRDNS];
+	char *rdnbuf;	/* copies of the RDNs, in stack order */
+	size_t rdnsize;
 } IdScopes;
 
 LDAP_BEGIN_DECL
@@ -161,6 +161,96 @@ done:
 	return LDAP_SUCCESS;
 }
 
+/* Values staying behind when others of the same attribute are
+ * deleted. Index keys they share with the deleted values must not
+ * be removed.
+ */
+typedef struct IndexKeep {
+	AttributeDescription *ik_desc;	/* the attribute losing values */
+	Attribute *ik_attrs;	/* the remaining attributes of the entry */
+} IndexKeep;
+
+#define MDB_KEEP_CHUNK	256
+
+static int
+index_keep_any( IndexKeep *ik, AttributeDescription *ad )
+{
+	Attribute *a;
+
+	for ( a = ik->ik_attrs; a; a = a->a_next ) {
+		if ( a->a_numvals && is_ad_subtype( a->a_desc, ad ))
+			return 1;
+	}
+	return 0;
+}
+
+/* Drop the keys that a remaining value also generates. The values
+ * are run through the indexer a chunk at a time, so memory stays
+ * bounded however large the attribute is.
+ */
+static void
+index_keep_keys(
+	Operation *op,
+	IndexKeep *ik,
+	AttributeDescription *ad,
+	struct berval *atname,
+	MatchingRule *mr,
+	int ftype,
+	slap_mask_t mask,
+	struct berval *keys )
+{
+	Attribute *a;
+	struct berval vals[MDB_KEEP_CHUNK+1], *kkeys;
+	unsigned i, n;
+	int j, k, nkeys, rc;
+
+	for ( nkeys = 0; !BER_BVISNULL( &keys[nkeys] ); nkeys++ );
+
+	/* Like mdb_modify_idxflags(), assume 64 bit equality hashes of
+	 * distinct values don't collide. The values deleted from ik_desc
+	 * are distinct from the ones it keeps, so only other attributes
+	 * feeding the same index need to be checked.
+	 */
+	if ( ftype == LDAP_FILTER_EQUALITY && slap_hash64( -1 )) {
+		for ( a = ik->ik_attrs; a; a = a->a_next ) {
+			if ( a->a_desc != ik->ik_desc && a->a_numvals &&
+				is_ad_subtype( a->a_desc, ad ))
+				break;
+		}
+		if ( !a )
+			return;
+	}
+
+	for ( a = ik->ik_attrs; a && nkeys; a = a->a_next ) {
+		if ( !is_ad_subtype( a->a_desc, ad ))
+			continue;
+		for ( i = 0; i < a->a_numvals && nkeys; i += n ) {
+			n = a->a_numvals - i;
+			if ( n > MDB_KEEP_CHUNK )
+				n = MDB_KEEP_CHUNK;
+			AC_MEMCPY( vals, &a->a_nvals[i], n * sizeof(struct berval) );
+			BER_BVZERO( &vals[n] );
+			kkeys = NULL;
+			rc = mr->smr_indexer( ftype, mask, ad->ad_type->sat_syntax,
+				mr, atname, vals, &kkeys, op->o_tmpmemctx );
+			if ( rc != LDAP_SUCCESS || kkeys == NULL )
+				continue;
+			for ( k = 0; !BER_BVISNULL( &kkeys[k] ) && nkeys; k++ ) {
+				for ( j = 0; j < nkeys; ) {
+					if ( !ber_bvcmp( &kkeys[k], &keys[j] )) {
+						op->o_tmpfree( keys[j].bv_val, op->o_tmpmemctx );
+						keys[j] = keys[--nkeys];
+						BER_BVZERO( &keys[nkeys] );
+					} else {
+						j++;
+					}
+				}
+			}
+			ber_bvarray_free_x( kkeys, op->o_tmpmemctx );
+		}
+	}
+}
+
 static int indexer(
 	Operation *op,
 	MDB_txn *txn,
@@ -170,7 +260,8 @@ static int indexer(
 	BerVarray vals,
 	ID id,
 	int opid,
-	slap_mask_t mask )
+	slap_mask_t mask,
+	IndexKeep *ik )
 {
 	int rc;
 	struct berval *keys;
@@ -201,7 +292,8 @@ static int indexer(
 	} else
 		keyfunc = mdb_idl_delete_keys;
 
-	if( IS_SLAP_INDEX( mask, SLAP_INDEX_PRESENT ) ) {
+	if( IS_SLAP_INDEX( mask, SLAP_INDEX_PRESENT ) &&
+		!( ik && index_keep_any( ik, ad ))) {
 		rc = keyfunc( op->o_bd, mc, presence_key, id );
 		if( rc ) {
 			err = "presence";
@@ -218,7 +310,10 @@ static int indexer(
 			atname, vals, &keys, op->o_tmpmemctx );
 
 		if( rc == LDAP_SUCCESS && keys != NULL ) {
-			rc = keyfunc( op->o_bd, mc, keys, id );
+			if ( ik )
+				index_keep_keys( op, ik, ad, atname,
+					ad->ad_type->sat_equality, LDAP_FILTER_EQUALITY, mask, keys );
+			rc = BER_BVISNULL( keys ) ? 0 : keyfunc( op->o_bd, mc, keys, id );
 			ber_bvarray_free_x( keys, op->o_tmpmemctx );
 			if ( rc ) {
 				err = "equality";
@@ -237,7 +332,10 @@ static int indexer(
 			atname, vals, &keys, op->o_tmpmemctx );
 
 		if( rc == LDAP_SUCCESS && keys != NULL ) {
-			rc = keyfunc( op->o_bd, mc, keys, id );
+			if ( ik )
+				index_keep_keys( op, ik, ad, atname,
+					ad->ad_type->sat_approx, LDAP_FILTER_APPROX, mask, keys );
+			rc = BER_BVISNULL( keys ) ? 0 : keyfunc( op->o_bd, mc, keys, id );
 			ber_bvarray_free_x( keys, op->o_tmpmemctx );
 			if ( rc ) {
 				err = "approx";
@@ -257,7 +355,10 @@ static int indexer(
 			atname, vals, &keys, op->o_tmpmemctx );
 
 		if( rc == LDAP_SUCCESS && keys != NULL ) {
-			rc = keyfunc( op->o_bd, mc, keys, id );
+			if ( ik )
+				index_keep_keys( op, ik, ad, atname,
+					ad->ad_type->sat_substr, LDAP_FILTER_SUBSTRINGS, mask, keys );
+			rc = BER_BVISNULL( keys ) ? 0 : keyfunc( op->o_bd, mc, keys, id );
 			ber_bvarray_free_x( keys, op->o_tmpmemctx );
 			if( rc ) {
 				err = "substr";
@@ -290,7 +391,8 @@ static int index_at_values(
 	struct berval *tags,
 	BerVarray vals,
 	ID id,
-	int opid )
+	int opid,
+	IndexKeep *ik )
 {
 	int rc;
 	slap_mask_t mask = 0;
@@ -304,7 +406,7 @@ static int index_at_values(
 		/* recurse */
 		rc = index_at_values( op, txn, NULL,
 			type->sat_sup, tags,
-			vals, id, opid );
+			vals, id, opid, ik );
 
 		if( rc ) return rc;
 	}
@@ -320,7 +422,7 @@ static int index_at_values(
 				for( cr = ai->ai_cr ; cr ; cr = cr->cr_next ) {
 					rc = indexer( op, txn, ai, cr->cr_ad, &type->sat_cname,
 						cr->cr_nvals, id, ixop,
-						cr->cr_indexmask );
+						cr->cr_indexmask, NULL );
 				}
 			}
 #endif
@@ -337,7 +439,7 @@ static int index_at_values(
 				mask = ai->ai_newmask ? ai->ai_newmask : ai->ai_indexmask;
 			if( mask ) {
 				rc = indexer( op, txn, ai, ad, &type->sat_cname,
-					vals, id, ixop, mask );
+					vals, id, ixop, mask, ik );
 
 				if( rc ) return rc;
 			}
@@ -358,7 +460,7 @@ static int index_at_values(
 					mask = ai->ai_newmask ? ai->ai_newmask : ai->ai_indexmask;
 				if ( mask ) {
 					rc = indexer( op, txn, ai, desc, &desc->ad_cname,
-						vals, id, ixop, mask );
+						vals, id, ixop, mask, ik );
 
 					if( rc ) {
 						return rc;
@@ -387,7 +489,34 @@ int mdb_index_values(
 
 	rc = index_at_values( op, txn, desc,
 		desc->ad_type, &desc->ad_tags,
-		vals, id, opid );
+		vals, id, opid, NULL );
+
+	return rc;
+}
+
+/* Delete the index entries of some values of an attribute, keeping
+ * the keys still generated by the values left in attrs.
+ */
+int mdb_index_values_delta(
+	Operation *op,
+	MDB_txn *txn,
+	AttributeDescription *desc,
+	BerVarray vals,
+	Attribute *attrs,
+	ID id )
+{
+	IndexKeep ik;
+	int rc;
+
+	/* Never index ID 0 */
+	if ( id == 0 )
+		return 0;
+
+	ik.ik_desc = desc;
+	ik.ik_attrs = attrs;
+	rc = index_at_values( op, txn, desc,
+		desc->ad_type, &desc->ad_tags,
+		vals, id, SLAP_INDEX_DELETE_OP, &ik );
 
 	return rc;
 }
@@ -463,7 +592,7 @@ int mdb_index_recrun(
 			rc = indexer( op, txn, ir->ir_ai, ir->ir_ai->ai_desc,
 				&ir->ir_ai->ai_desc->ad_type->sat_cname,
 				al->attr->a_nvals, id, SLAP_INDEX_ADD_OP,
-				ir->ir_ai->ai_indexmask );
+				ir->ir_ai->ai_indexmask, NULL );
 			free( al );
 			if ( rc ) break;
 		}
@@ -569,6 +698,15 @@ mdb_index_entry(
 		}
 	}
 
+	rc = mdb_sort_entry( op, txn, opid, e );
+	if( rc != LDAP_SUCCESS ) {
+		Debug( LDAP_DEBUG_TRACE,
+			"<= index_entry_%s( %ld, \"%s\" ) sort index failure\n",
+			opid == SLAP_INDEX_ADD_OP ? "add" : "del",
+			(long) e->e_id, e->e_dn );
+		return rc;
+	}
+
 	Debug( LDAP_DEBUG_TRACE, "<= index_entry_%s( %ld, \"%s\" ) success\n",
 		opid == SLAP_INDEX_DELETE_OP ? "del" : "add",
 		(long) e->e_id, e->e_dn ? e->e_dn : "" );
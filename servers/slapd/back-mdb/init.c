@@ -63,7 +63,9 @@ mdb_db_init( BackendDB *be, ConfigReply *cr )
 	mdb->mi_search_stack = NULL;
 
 	mdb->mi_mapsize = DEFAULT_MAPSIZE;
+	mdb->mi_mapwindow = DEFAULT_MAPWINDOW;
 	mdb->mi_rtxn_size = DEFAULT_RTXN_SIZE;
+	mdb->mi_index_batch = DEFAULT_INDEX_BATCH;
 	mdb->mi_multi_hi = UINT_MAX;
 	mdb->mi_multi_lo = UINT_MAX;
 
@@ -145,6 +147,15 @@ mdb_db_open( BackendDB *be, ConfigReply *cr )
 		goto fail;
 	}
 
+	rc = mdb_env_set_mapwindow( mdb->mi_dbenv, mdb->mi_mapwindow );
+	if( rc != 0 ) {
+		Debug( LDAP_DEBUG_ANY,
+			LDAP_XSTRING(mdb_db_open) ": database \"%s\": "
+			"mdb_env_set_mapwindow failed: %s (%d).\n",
+			be->be_suffix[0].bv_val, mdb_strerror(rc), rc );
+		goto fail;
+	}
+
 	rc = mdb_env_set_maxdbs( mdb->mi_dbenv, MDB_INDICES );
 	if( rc != 0 ) {
 		Debug( LDAP_DEBUG_ANY,
@@ -202,8 +213,16 @@ mdb_db_open( BackendDB *be, ConfigReply *cr )
 			if ( !(slapMode & (SLAP_TOOL_READMAIN|SLAP_TOOL_READONLY) ))
 				flags |= MDB_CREATE;
 		} else {
-			if ( i == MDB_DN2ID )
+			/* Sibling RDNs often share a long prefix. Only
+			 * applies to newly created DBs, existing ones keep
+			 * the flags they were created with. Older builds
+			 * can't read such a DB, so it is opt-in.
+			 */
+			if ( i == MDB_DN2ID ) {
 				flags |= MDB_DUPSORT;
+				if ( mdb->mi_dnprefix )
+					flags |= MDB_PREFIXDUP;
+			}
 			if ( i == MDB_ID2VAL )
 				flags ^= MDB_INTEGERKEY|MDB_DUPSORT;
 			if ( !(slapMode & SLAP_TOOL_READONLY) )
@@ -227,9 +246,10 @@ mdb_db_open( BackendDB *be, ConfigReply *cr )
 			goto fail;
 		}
 
-		if ( i == MDB_ID2ENTRY )
+		if ( i == MDB_ID2ENTRY ) {
 			mdb_set_compare( txn, mdb->mi_dbis[i], mdb_id_compare );
-		else if ( i == MDB_ID2VAL ) {
+			mdb_set_compress( txn, mdb->mi_dbis[i], mdb->mi_compress );
+		} else if ( i == MDB_ID2VAL ) {
 			mdb_set_compare( txn, mdb->mi_dbis[i], mdb_id2v_compare );
 			mdb_set_dupsort( txn, mdb->mi_dbis[i], mdb_id2v_dupsort );
 		} else if ( i == MDB_DN2ID ) {
@@ -284,6 +304,43 @@ mdb_db_open( BackendDB *be, ConfigReply *cr )
 		}
 	}
 
+	/* pick up an online reindex that was interrupted */
+	if (( slapMode & SLAP_SERVER_MODE ) && !mdb->mi_index_task ) {
+		i = mdb_ixstate_get( mdb, txn );
+		if ( i < 0 ) {
+			mdb_txn_abort( txn );
+			rc = LDAP_OTHER;
+			goto fail;
+		}
+		if ( i > 0 ) {
+			Debug( LDAP_DEBUG_ANY,
+				LDAP_XSTRING(mdb_db_open) ": database \"%s\": "
+				"resuming online index at entry %ld.\n",
+				be->be_suffix[0].bv_val, (long) mdb->mi_index_next, 0 );
+			mdb_index_task_start( be );
+		}
+	}
+
+	/* sort indexes; any that aren't complete yet get (re)built by
+	 * the online indexer, or by slapindex.
+	 */
+	if ( !(slapMode & SLAP_TOOL_READONLY) ) {
+		i = mdb_sort_open( be, txn, cr );
+		if ( i < 0 ) {
+			mdb_txn_abort( txn );
+			rc = LDAP_OTHER;
+			goto fail;
+		}
+		if ( i > 0 && ( slapMode & SLAP_SERVER_MODE )) {
+			Debug( LDAP_DEBUG_ANY,
+				LDAP_XSTRING(mdb_db_open) ": database \"%s\": "
+				"building %d sort indexes online.\n",
+				be->be_suffix[0].bv_val, i, 0 );
+			mdb->mi_index_next = 0;
+			mdb_index_task_start( be );
+		}
+	}
+
 	rc = mdb_txn_commit(txn);
 	if ( rc != 0 ) {
 		Debug( LDAP_DEBUG_ANY,
@@ -299,6 +356,13 @@ mdb_db_open( BackendDB *be, ConfigReply *cr )
 		goto fail;
 	}
 
+	if (( slapMode & SLAP_SERVER_MODE ) && mdb->mi_group_max ) {
+		rc = mdb_group_start( mdb );
+		if ( rc != 0 ) {
+			goto fail;
+		}
+	}
+
 	mdb->mi_flags |= MDB_IS_OPEN;
 
 	return 0;
@@ -319,6 +383,8 @@ mdb_db_close( BackendDB *be, ConfigReply *cr )
 
 	mdb->mi_flags &= ~MDB_IS_OPEN;
 
+	mdb_group_stop( mdb );
+
 	if( mdb->mi_dbenv ) {
 		mdb_reader_flush( mdb->mi_dbenv );
 	}
@@ -328,6 +394,12 @@ mdb_db_close( BackendDB *be, ConfigReply *cr )
 			int i;
 
 			mdb_attr_dbs_close( mdb );
+			if ( mdb->mi_sortdbi ) {
+				mdb_dbi_close( mdb->mi_dbenv, mdb->mi_sortdbi );
+				mdb->mi_sortdbi = 0;
+			}
+			for ( i=0; i<mdb->mi_nsorts; i++ )
+				mdb->mi_sorts[i].si_flags &= ~MDB_SORT_BUILT;
 			for ( i=0; i<MDB_NDB; i++ )
 				mdb_dbi_close( mdb->mi_dbenv, mdb->mi_dbis[i] );
 
@@ -368,12 +440,47 @@ mdb_db_destroy( BackendDB *be, ConfigReply *cr )
 		ldap_pvt_thread_mutex_unlock( &slapd_rq.rq_mutex );
 	}
 
+	/* stop and remove online index task; its progress was saved */
+	if ( mdb->mi_index_task ) {
+		struct re_s *re = mdb->mi_index_task;
+		mdb->mi_index_task = NULL;
+		ldap_pvt_thread_mutex_lock( &slapd_rq.rq_mutex );
+		if ( ldap_pvt_runqueue_isrunning( &slapd_rq, re ) )
+			ldap_pvt_runqueue_stoptask( &slapd_rq, re );
+		ldap_pvt_runqueue_remove( &slapd_rq, re );
+		ldap_pvt_thread_mutex_unlock( &slapd_rq.rq_mutex );
+	}
+
+	/* stop and remove scrub task */
+	if ( mdb->mi_scrub_task ) {
+		struct re_s *re = mdb->mi_scrub_task;
+		mdb->mi_scrub_task = NULL;
+		ldap_pvt_thread_mutex_lock( &slapd_rq.rq_mutex );
+		if ( ldap_pvt_runqueue_isrunning( &slapd_rq, re ) )
+			ldap_pvt_runqueue_stoptask( &slapd_rq, re );
+		ldap_pvt_runqueue_remove( &slapd_rq, re );
+		ldap_pvt_thread_mutex_unlock( &slapd_rq.rq_mutex );
+	}
+	ch_free( mdb->mi_scrub_key.bv_val );
+
+	/* stop and remove compaction task */
+	if ( mdb->mi_compact_task ) {
+		struct re_s *re = mdb->mi_compact_task;
+		mdb->mi_compact_task = NULL;
+		ldap_pvt_thread_mutex_lock( &slapd_rq.rq_mutex );
+		if ( ldap_pvt_runqueue_isrunning( &slapd_rq, re ) )
+			ldap_pvt_runqueue_stoptask( &slapd_rq, re );
+		ldap_pvt_runqueue_remove( &slapd_rq, re );
+		ldap_pvt_thread_mutex_unlock( &slapd_rq.rq_mutex );
+	}
+
 	/* monitor handling */
 	(void)mdb_monitor_db_destroy( be );
 
 	if( mdb->mi_dbenv_home ) ch_free( mdb->mi_dbenv_home );
 
 	mdb_attr_index_destroy( mdb );
+	ch_free( mdb->mi_sorts );
 
 	ch_free( mdb );
 	be->be_private = NULL;
@@ -472,6 +579,8 @@ mdb_back_initialize(
 	bi->bi_operational = mdb_operational;
 
 	bi->bi_has_subordinates = mdb_hasSubordinates;
+	bi->bi_value_count = mdb_value_count;
+	bi->bi_purge = mdb_purge;
 	bi->bi_entry_release_rw = mdb_entry_release;
 	bi->bi_entry_get_rw = mdb_entry_get;
 
@@ -49,6 +49,15 @@ mdb_modify_idxflags(
 			ap = attr_find( oldattrs, desc );
 			if ( ap ) ap->a_flags |= SLAP_ATTR_IXDEL;
 
+			/* Large multi-valued attributes keep their shared keys
+			 * when deleting, see mdb_index_values_delta().
+			 */
+			if ( ap && ( ap->a_flags & SLAP_ATTR_BIG_MULTI )) {
+				ap = attr_find( newattrs, desc );
+				if ( ap ) ap->a_flags |= SLAP_ATTR_IXADD;
+				return;
+			}
+
 			/* ITS#8678 FIXME
 			 * If using 32bit hashes, or substring index, must account for
 			 * possible index collisions. If no substring index, and using
@@ -74,6 +83,76 @@ mdb_modify_idxflags(
 	}
 }
 
+/* For a large multi-valued attribute, find the deleted values from
+ * the modifications instead of looking up every old value in the
+ * new attribute. Both are sorted, so this costs O(k log n) for k
+ * deleted values. Returns NULL if the attribute was replaced or
+ * deleted as a whole.
+ */
+static struct berval *
+mdb_modify_delvals(
+	Operation *op,
+	Modifications *modlist,
+	Attribute *old,
+	Attribute *new )
+{
+	Modifications *ml;
+	struct berval *vals, *cvals;
+	unsigned i, n = 0, slot, flags;
+	int rc;
+
+	for ( ml = modlist; ml != NULL; ml = ml->sml_next ) {
+		if ( ml->sml_desc != old->a_desc )
+			continue;
+		switch ( ml->sml_op ) {
+		case LDAP_MOD_ADD:
+		case SLAP_MOD_SOFTADD:
+		case SLAP_MOD_ADD_IF_NOT_PRESENT:
+			break;
+		case LDAP_MOD_DELETE:
+		case SLAP_MOD_SOFTDEL:
+			if ( ml->sml_numvals ) {
+				n += ml->sml_numvals;
+				break;
+			}
+			/* FALLTHRU */
+		default:
+			return NULL;
+		}
+	}
+
+	vals = op->o_tmpalloc( (n + 1) * sizeof(struct berval), op->o_tmpmemctx );
+	n = 0;
+	for ( ml = modlist; ml != NULL; ml = ml->sml_next ) {
+		if ( ml->sml_desc != old->a_desc ||
+			( ml->sml_op != LDAP_MOD_DELETE && ml->sml_op != SLAP_MOD_SOFTDEL ))
+			continue;
+		if ( old->a_desc == slap_schema.si_ad_objectClass )
+			flags = SLAP_MR_EQUALITY | SLAP_MR_VALUE_OF_ATTRIBUTE_SYNTAX;
+		else
+			flags = SLAP_MR_EQUALITY | SLAP_MR_VALUE_OF_ASSERTION_SYNTAX;
+		if ( ml->sml_nvalues ) {
+			flags |= SLAP_MR_ASSERTED_VALUE_NORMALIZED_MATCH |
+				SLAP_MR_ATTRIBUTE_VALUE_NORMALIZED_MATCH;
+			cvals = ml->sml_nvalues;
+		} else {
+			cvals = ml->sml_values;
+		}
+		for ( i = 0; i < ml->sml_numvals; i++ ) {
+			rc = attr_valfind( old, flags, &cvals[i], &slot, op->o_tmpmemctx );
+			if ( rc != LDAP_SUCCESS )
+				continue;
+			/* deleted, then added back */
+			if ( new && attr_valfind( new, SLAP_MR_ASSERTED_VALUE_NORMALIZED_MATCH,
+				&old->a_nvals[slot], NULL, op->o_tmpmemctx ) == LDAP_SUCCESS )
+				continue;
+			vals[n++] = old->a_nvals[slot];
+		}
+	}
+	BER_BVZERO( &vals[n] );
+	return vals;
+}
+
 int mdb_modify_internal(
 	Operation *op,
 	MDB_txn *tid,
@@ -441,11 +520,17 @@ do_del:
 			Attribute *a2;
 			ap->a_flags &= ~SLAP_ATTR_IXDEL;
 			a2 = attr_find( e->e_attrs, ap->a_desc );
-			if ( a2 ) {
+			vals = NULL;
+			if ( a2 && ( ap->a_flags & SLAP_ATTR_BIG_MULTI ))
+				vals = mdb_modify_delvals( op, modlist, ap, a2 );
+			if ( vals ) {
+				/* only the values named in the modifications */
+			} else if ( a2 ) {
 				/* need to detect which values were deleted */
 				int i, j;
 				/* let add know there were deletes */
-				if ( a2->a_flags & SLAP_ATTR_IXADD )
+				if (( a2->a_flags & SLAP_ATTR_IXADD ) &&
+					!( ap->a_flags & SLAP_ATTR_BIG_MULTI ))
 					a2->a_flags |= SLAP_ATTR_IXDEL;
 				vals = op->o_tmpalloc( (ap->a_numvals + 1) *
 					sizeof(struct berval), op->o_tmpmemctx );
@@ -464,8 +549,15 @@ do_del:
 			}
 			rc = 0;
 			if ( !BER_BVISNULL( vals )) {
-				rc = mdb_index_values( op, tid, ap->a_desc,
-					vals, e->e_id, SLAP_INDEX_DELETE_OP );
+				/* Keys the remaining values still use are kept,
+				 * so nothing needs to be indexed again.
+				 */
+				if ( ap->a_flags & SLAP_ATTR_BIG_MULTI )
+					rc = mdb_index_values_delta( op, tid, ap->a_desc,
+						vals, e->e_attrs, e->e_id );
+				else
+					rc = mdb_index_values( op, tid, ap->a_desc,
+						vals, e->e_id, SLAP_INDEX_DELETE_OP );
 				if ( rc != LDAP_SUCCESS ) {
 					Debug( LDAP_DEBUG_ANY,
 						"%s: attribute \"%s\" index delete failure\n",
@@ -542,6 +634,17 @@ do_del:
 		}
 	}
 
+	rc = mdb_sort_modify( op, tid, e, save_attrs );
+	if ( rc != LDAP_SUCCESS ) {
+		Debug( LDAP_DEBUG_ANY, "%s: sort index update failure: %s (%d)\n",
+			op->o_log_prefix, mdb_strerror( rc ), rc );
+		strncpy( textbuf, mdb_strerror( rc ), textlen );
+		*text = textbuf;
+		rc = LDAP_OTHER;
+		attrs_free( e->e_attrs );
+		e->e_attrs = save_attrs;
+	}
+
 	return rc;
 }
 
@@ -586,6 +689,8 @@ mdb_modify( Operation *op, SlapReply *rs )
 		goto return_results;
 	}
 	txn = moi->moi_txn;
+	/* earlier ops in the same group commit may have added attrs */
+	numads = mdb->mi_numads;
 
 	/* Don't touch the opattrs, if this is a contextCSN update
 	 * initiated from updatedn */
@@ -741,13 +846,14 @@ mdb_modify( Operation *op, SlapReply *rs )
 		opinfo.moi_oe.oe_key = NULL;
 		if( op->o_noop ) {
 			mdb->mi_numads = numads;
-			mdb_txn_abort( txn );
+			mdb_group_abort( mdb, txn );
 			rs->sr_err = LDAP_X_NO_OPERATION;
 			txn = NULL;
 			goto return_results;
 		} else {
-			rs->sr_err = mdb_txn_commit( txn );
-			if ( rs->sr_err )
+			rs->sr_err = mdb_group_commit( mdb, txn );
+			/* a group commit restores it itself */
+			if ( rs->sr_err && !mdb->mi_group )
 				mdb->mi_numads = numads;
 			txn = NULL;
 		}
@@ -792,7 +898,7 @@ done:
 	if( moi == &opinfo ) {
 		if( txn != NULL ) {
 			mdb->mi_numads = numads;
-			mdb_txn_abort( txn );
+			mdb_group_abort( mdb, txn );
 		}
 		if ( opinfo.moi_oe.oe_key ) {
 			LDAP_SLIST_REMOVE( &op->o_extra, &opinfo.moi_oe, OpExtra, oe_next );
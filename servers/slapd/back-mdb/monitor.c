@@ -32,6 +32,18 @@
 static ObjectClass		*oc_olmMDBDatabase;
 
 static AttributeDescription *ad_olmDbDirectory;
+static AttributeDescription *ad_olmDbReindexNext;
+static AttributeDescription *ad_olmDbReindexCount;
+static AttributeDescription *ad_olmDbOpLatency;
+static AttributeDescription *ad_olmDbPagesDirtied;
+static AttributeDescription *ad_olmDbPagesSpilled;
+static AttributeDescription *ad_olmDbPagesReused;
+static AttributeDescription *ad_olmDbPageFaults;
+static AttributeDescription *ad_olmDbScrubPasses;
+static AttributeDescription *ad_olmDbScrubPages;
+static AttributeDescription *ad_olmDbScrubCorrupt;
+static AttributeDescription *ad_olmDbCompactions;
+static AttributeDescription *ad_olmDbCompactPages;
 
 #ifdef MDB_MONITOR_IDX
 static int
@@ -59,7 +71,7 @@ static struct {
 	char			*name;
 	char			*oid;
 }		s_oid[] = {
-	{ "olmMDBAttributes",			"olmDatabaseAttributes:1" },
+	{ "olmMDBAttributes",			"olmDatabaseAttributes:3" },
 	{ "olmMDBObjectClasses",		"olmDatabaseObjectClasses:1" },
 
 	{ NULL }
@@ -78,6 +90,102 @@ static struct {
 		"USAGE dSAOperation )",
 		&ad_olmDbDirectory },
 
+	{ "( olmMDBAttributes:1 "
+		"NAME ( 'olmDbReindexNext' ) "
+		"DESC 'Next entry ID to be processed by the online indexer' "
+		"SUP monitorCounter "
+		"NO-USER-MODIFICATION "
+		"USAGE dSAOperation )",
+		&ad_olmDbReindexNext },
+
+	{ "( olmMDBAttributes:2 "
+		"NAME ( 'olmDbReindexCount' ) "
+		"DESC 'Number of entries processed by the online indexer' "
+		"SUP monitorCounter "
+		"NO-USER-MODIFICATION "
+		"USAGE dSAOperation )",
+		&ad_olmDbReindexCount },
+
+	{ "( olmMDBAttributes:3 "
+		"NAME ( 'olmDbOpLatency' ) "
+		"DESC 'Latency summary of an LMDB operation' "
+		"SUP monitoredInfo "
+		"NO-USER-MODIFICATION "
+		"USAGE dSAOperation )",
+		&ad_olmDbOpLatency },
+
+	{ "( olmMDBAttributes:4 "
+		"NAME ( 'olmDbPagesDirtied' ) "
+		"DESC 'Number of pages dirtied by write transactions' "
+		"SUP monitorCounter "
+		"NO-USER-MODIFICATION "
+		"USAGE dSAOperation )",
+		&ad_olmDbPagesDirtied },
+
+	{ "( olmMDBAttributes:5 "
+		"NAME ( 'olmDbPagesSpilled' ) "
+		"DESC 'Number of dirty pages spilled before commit' "
+		"SUP monitorCounter "
+		"NO-USER-MODIFICATION "
+		"USAGE dSAOperation )",
+		&ad_olmDbPagesSpilled },
+
+	{ "( olmMDBAttributes:6 "
+		"NAME ( 'olmDbPagesReused' ) "
+		"DESC 'Number of pages reused from the freelist' "
+		"SUP monitorCounter "
+		"NO-USER-MODIFICATION "
+		"USAGE dSAOperation )",
+		&ad_olmDbPagesReused },
+
+	{ "( olmMDBAttributes:7 "
+		"NAME ( 'olmDbPageFaults' ) "
+		"DESC 'Number of major page faults taken in transactions' "
+		"SUP monitorCounter "
+		"NO-USER-MODIFICATION "
+		"USAGE dSAOperation )",
+		&ad_olmDbPageFaults },
+
+	{ "( olmMDBAttributes:8 "
+		"NAME ( 'olmDbScrubPasses' ) "
+		"DESC 'Number of complete passes of the background scrub' "
+		"SUP monitorCounter "
+		"NO-USER-MODIFICATION "
+		"USAGE dSAOperation )",
+		&ad_olmDbScrubPasses },
+
+	{ "( olmMDBAttributes:9 "
+		"NAME ( 'olmDbScrubPages' ) "
+		"DESC 'Number of pages checked by the background scrub' "
+		"SUP monitorCounter "
+		"NO-USER-MODIFICATION "
+		"USAGE dSAOperation )",
+		&ad_olmDbScrubPages },
+
+	{ "( olmMDBAttributes:10 "
+		"NAME ( 'olmDbScrubCorrupt' ) "
+		"DESC 'Number of corrupt pages found by the background scrub' "
+		"SUP monitorCounter "
+		"NO-USER-MODIFICATION "
+		"USAGE dSAOperation )",
+		&ad_olmDbScrubCorrupt },
+
+	{ "( olmMDBAttributes:11 "
+		"NAME ( 'olmDbCompactions' ) "
+		"DESC 'Number of online compactions done' "
+		"SUP monitorCounter "
+		"NO-USER-MODIFICATION "
+		"USAGE dSAOperation )",
+		&ad_olmDbCompactions },
+
+	{ "( olmMDBAttributes:12 "
+		"NAME ( 'olmDbCompactPages' ) "
+		"DESC 'Number of pages released by online compaction' "
+		"SUP monitorCounter "
+		"NO-USER-MODIFICATION "
+		"USAGE dSAOperation )",
+		&ad_olmDbCompactPages },
+
 #ifdef MDB_MONITOR_IDX
 	{ "( olmDatabaseAttributes:2 "
 		"NAME ( 'olmDbNotIndexed' ) "
@@ -102,6 +210,18 @@ static struct {
 		"SUP top AUXILIARY "
 		"MAY ( "
 			"olmDbDirectory "
+			"$ olmDbReindexNext "
+			"$ olmDbReindexCount "
+			"$ olmDbOpLatency "
+			"$ olmDbPagesDirtied "
+			"$ olmDbPagesSpilled "
+			"$ olmDbPagesReused "
+			"$ olmDbPageFaults "
+			"$ olmDbScrubPasses "
+			"$ olmDbScrubPages "
+			"$ olmDbScrubCorrupt "
+			"$ olmDbCompactions "
+			"$ olmDbCompactPages "
 #ifdef MDB_MONITOR_IDX
 			"$ olmDbNotIndexed "
 #endif /* MDB_MONITOR_IDX */
@@ -111,6 +231,58 @@ static struct {
 	{ NULL }
 };
 
+static const char *mdb_opnames[] = {
+	"txn_begin", "get", "put", "txn_commit", "flush", "sync"
+};
+
+/* Upper bound in nanoseconds of the bucket holding fraction pct of the calls */
+static unsigned long long
+mdb_hist_pct( MDB_ophist *oh, int pct )
+{
+	unsigned long long n = 0;
+	int i;
+
+	for ( i = 0; i < MDB_HIST_BUCKETS - 1; i++ ) {
+		n += oh->oh_hist[i];
+		if ( n * 100 >= oh->oh_count * pct )
+			break;
+	}
+	return 2ULL << i;
+}
+
+static void
+mdb_monitor_opstat( struct mdb_info *mdb, Entry *e )
+{
+	MDB_opstat	mos;
+	char		buf[ 256 ];
+	struct berval	bv;
+	int		i;
+
+	if ( mdb_env_opstat( mdb->mi_dbenv, &mos, 0 ))
+		return;
+
+	bv.bv_val = buf;
+	for ( i = 0; i < MDB_OPS_NUM; i++ ) {
+		MDB_ophist *oh = &mos.os_op[i];
+		if ( !oh->oh_count )
+			continue;
+		bv.bv_len = snprintf( buf, sizeof( buf ),
+			"%s calls=%llu avg=%lluns max=%lluns p50<%lluns p99<%lluns",
+			mdb_opnames[i], oh->oh_count,
+			oh->oh_nsec / oh->oh_count, oh->oh_max,
+			mdb_hist_pct( oh, 50 ), mdb_hist_pct( oh, 99 ));
+		attr_merge_one( e, ad_olmDbOpLatency, &bv, NULL );
+	}
+	bv.bv_len = snprintf( buf, sizeof( buf ), "%llu", mos.os_dirtied );
+	attr_merge_one( e, ad_olmDbPagesDirtied, &bv, NULL );
+	bv.bv_len = snprintf( buf, sizeof( buf ), "%llu", mos.os_spilled );
+	attr_merge_one( e, ad_olmDbPagesSpilled, &bv, NULL );
+	bv.bv_len = snprintf( buf, sizeof( buf ), "%llu", mos.os_reused );
+	attr_merge_one( e, ad_olmDbPagesReused, &bv, NULL );
+	bv.bv_len = snprintf( buf, sizeof( buf ), "%llu", mos.os_faults );
+	attr_merge_one( e, ad_olmDbPageFaults, &bv, NULL );
+}
+
 static int
 mdb_monitor_update(
 	Operation	*op,
@@ -118,9 +290,66 @@ mdb_monitor_update(
 	Entry		*e,
 	void		*priv )
 {
-#ifdef MDB_MONITOR_IDX
 	struct mdb_info		*mdb = (struct mdb_info *) priv;
 
+	attr_delete( &e->e_attrs, ad_olmDbReindexNext );
+	attr_delete( &e->e_attrs, ad_olmDbReindexCount );
+	if ( mdb->mi_index_task ) {
+		char		buf[ 64 ];
+		struct berval	bv;
+
+		bv.bv_val = buf;
+		bv.bv_len = snprintf( buf, sizeof( buf ), "%lu",
+			(unsigned long)( mdb->mi_index_next ? mdb->mi_index_next : 1 ));
+		attr_merge_one( e, ad_olmDbReindexNext, &bv, NULL );
+		bv.bv_len = snprintf( buf, sizeof( buf ), "%lu",
+			mdb->mi_index_count );
+		attr_merge_one( e, ad_olmDbReindexCount, &bv, NULL );
+	}
+
+	attr_delete( &e->e_attrs, ad_olmDbOpLatency );
+	attr_delete( &e->e_attrs, ad_olmDbPagesDirtied );
+	attr_delete( &e->e_attrs, ad_olmDbPagesSpilled );
+	attr_delete( &e->e_attrs, ad_olmDbPagesReused );
+	attr_delete( &e->e_attrs, ad_olmDbPageFaults );
+	if ( mdb->mi_dbenv_flags & MDB_OPSTATS )
+		mdb_monitor_opstat( mdb, e );
+
+	attr_delete( &e->e_attrs, ad_olmDbScrubPasses );
+	attr_delete( &e->e_attrs, ad_olmDbScrubPages );
+	attr_delete( &e->e_attrs, ad_olmDbScrubCorrupt );
+	if ( mdb->mi_scrub_task ) {
+		char		buf[ 64 ];
+		struct berval	bv;
+
+		bv.bv_val = buf;
+		bv.bv_len = snprintf( buf, sizeof( buf ), "%lu",
+			mdb->mi_scrub_passes );
+		attr_merge_one( e, ad_olmDbScrubPasses, &bv, NULL );
+		bv.bv_len = snprintf( buf, sizeof( buf ), "%lu",
+			mdb->mi_scrub_pages );
+		attr_merge_one( e, ad_olmDbScrubPages, &bv, NULL );
+		bv.bv_len = snprintf( buf, sizeof( buf ), "%lu",
+			mdb->mi_scrub_corrupt );
+		attr_merge_one( e, ad_olmDbScrubCorrupt, &bv, NULL );
+	}
+
+	attr_delete( &e->e_attrs, ad_olmDbCompactions );
+	attr_delete( &e->e_attrs, ad_olmDbCompactPages );
+	if ( mdb->mi_compact_task ) {
+		char		buf[ 64 ];
+		struct berval	bv;
+
+		bv.bv_val = buf;
+		bv.bv_len = snprintf( buf, sizeof( buf ), "%lu",
+			mdb->mi_compactions );
+		attr_merge_one( e, ad_olmDbCompactions, &bv, NULL );
+		bv.bv_len = snprintf( buf, sizeof( buf ), "%lu",
+			mdb->mi_compact_pages );
+		attr_merge_one( e, ad_olmDbCompactPages, &bv, NULL );
+	}
+
+#ifdef MDB_MONITOR_IDX
 	mdb_monitor_idx_entry_add( mdb, e );
 #endif /* MDB_MONITOR_IDX */
 
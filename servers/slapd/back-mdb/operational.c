@@ -74,7 +74,7 @@ mdb_hasSubordinates(
 
 done:;
 	if ( moi == &opinfo ) {
-		mdb_txn_reset( moi->moi_txn );
+		mdb_snapshot_release( moi );
 		LDAP_SLIST_REMOVE( &op->o_extra, &moi->moi_oe, OpExtra, oe_next );
 	} else {
 		moi->moi_ref--;
@@ -49,11 +49,25 @@ void mdb_attr_info_free( AttrInfo *ai );
 int mdb_ad_read( struct mdb_info *mdb, MDB_txn *txn );
 int mdb_ad_get( struct mdb_info *mdb, MDB_txn *txn, AttributeDescription *ad );
 
+int mdb_ixstate_get( struct mdb_info *mdb, MDB_txn *txn );
+int mdb_ixstate_put( struct mdb_info *mdb, MDB_txn *txn, ID next );
+
+/*
+ * commit.c
+ */
+
+int mdb_group_begin( struct mdb_info *mdb, unsigned flags, MDB_txn **txn );
+int mdb_group_commit( struct mdb_info *mdb, MDB_txn *txn );
+void mdb_group_abort( struct mdb_info *mdb, MDB_txn *txn );
+int mdb_group_start( struct mdb_info *mdb );
+void mdb_group_stop( struct mdb_info *mdb );
+
 /*
  * config.c
  */
 
 int mdb_back_init_cf( BackendInfo *bi );
+int mdb_index_task_start( BackendDB *be );
 
 /*
  * dn2entry.c
@@ -146,9 +160,10 @@ int mdb_dn2id_walk(
 	Operation *op,
 	struct IdScopes *isc );
 
-void mdb_dn2id_wrestore(
+void mdb_idscope_mval(
 	Operation *op,
-	struct IdScopes *isc );
+	MDB_val *mval,
+	MDB_val *data );
 
 MDB_cmp_func mdb_dup_compare;
 
@@ -209,6 +224,8 @@ int mdb_entry_decode( Operation *op, MDB_txn *txn, MDB_val *data, ID id, Entry *
 
 void mdb_reader_flush( MDB_env *env );
 int mdb_opinfo_get( Operation *op, struct mdb_info *mdb, int rdonly, mdb_op_info **moi );
+void mdb_snapshot_release( mdb_op_info *moi );
+int mdb_snapshot_shared( mdb_op_info *moi );
 
 int mdb_mval_put(Operation *op, MDB_cursor *mc, ID id, Attribute *a);
 int mdb_mval_del(Operation *op, MDB_cursor *mc, ID id, Attribute *a);
@@ -285,6 +302,15 @@ mdb_index_values LDAP_P((
 	ID id,
 	int opid ));
 
+extern int
+mdb_index_values_delta LDAP_P((
+	Operation *op,
+	MDB_txn *txn,
+	AttributeDescription *desc,
+	BerVarray vals,
+	Attribute *attrs,
+	ID id ));
+
 extern int
 mdb_index_recset LDAP_P((
 	struct mdb_info *mdb,
@@ -359,6 +385,28 @@ mdb_monitor_idx_add(
 	slap_mask_t		type );
 #endif /* MDB_MONITOR_IDX */
 
+/*
+ * sortidx.c
+ */
+
+mdb_sortinfo *mdb_sort_find( struct mdb_info *mdb,
+	AttributeDescription *ad, MatchingRule *mr );
+int mdb_sort_config( struct mdb_info *mdb, const char *attr,
+	struct config_reply_s *cr );
+void mdb_sort_unparse( struct mdb_info *mdb, BerVarray *bva );
+int mdb_sort_delete( BackendDB *be, int i );
+int mdb_sort_open( BackendDB *be, MDB_txn *txn, struct config_reply_s *cr );
+int mdb_sort_built( struct mdb_info *mdb, MDB_txn *txn );
+int mdb_sort_entry( Operation *op, MDB_txn *txn, int opid, Entry *e );
+int mdb_sort_modify( Operation *op, MDB_txn *txn, Entry *e,
+	Attribute *old );
+ID mdb_sort_start( Operation *op, mdb_sortscan *ss, OpExtraSort *os,
+	ID ncand );
+ID mdb_sort_next( mdb_sortscan *ss );
+void mdb_sort_stop( mdb_sortscan *ss, OpExtraSort *os );
+void mdb_sort_tell( mdb_sortscan *ss, struct berval *pos, void *ctx );
+int mdb_sort_seek( mdb_sortscan *ss, struct berval *pos );
+
 /*
  * former external.h
  */
@@ -374,6 +422,8 @@ extern BI_op_delete			mdb_delete;
 extern BI_op_modify			mdb_modify;
 extern BI_op_modrdn			mdb_modrdn;
 extern BI_op_search			mdb_search;
+extern BI_value_count			mdb_value_count;
+extern BI_purge				mdb_purge;
 extern BI_op_extended			mdb_extended;
 
 extern BI_chk_referrals			mdb_referrals;
@@ -321,9 +321,12 @@ static void *search_stack( Operation *op );
 
 typedef struct ww_ctx {
 	MDB_txn *txn;
+	mdb_op_info *moi;
 	MDB_cursor *mcd;	/* if set, save cursor context */
 	ID key;
 	MDB_val data;
+	mdb_sortscan *ss;	/* if set, save sort index position */
+	struct berval spos;
 	int flag;
 	int nentries;
 } ww_ctx;
@@ -341,6 +344,11 @@ typedef struct ww_ctx {
 static void
 mdb_rtxn_snap( Operation *op, ww_ctx *ww )
 {
+	/* Internal operations on this thread read the same snapshot,
+	 * keep it for them.
+	 */
+	if ( mdb_snapshot_shared( ww->moi ))
+		return;
 	/* save cursor position and release read txn */
 	if ( ww->mcd ) {
 		MDB_val key, data;
@@ -350,6 +358,14 @@ mdb_rtxn_snap( Operation *op, ww_ctx *ww )
 		ww->data.mv_data = op->o_tmpalloc( data.mv_size, op->o_tmpmemctx );
 		memcpy(ww->data.mv_data, data.mv_data, data.mv_size);
 	}
+	if ( ww->ss )
+		mdb_sort_tell( ww->ss, &ww->spos, op->o_tmpmemctx );
+	if ( ww->moi->moi_snap ) {
+		/* Park it, an internal operation issued meanwhile takes
+		 * a fresh snapshot of its own.
+		 */
+		ww->moi->moi_snap->ms_users--;
+	}
 	mdb_txn_reset( ww->txn );
 	ww->flag = 1;
 }
@@ -369,17 +385,26 @@ mdb_waitfixup( Operation *op, ww_ctx *ww, MDB_cursor *mci, MDB_cursor *mcd, IdSc
 	MDB_val key;
 	int rc = 0;
 	ww->flag = 0;
-	mdb_txn_renew( ww->txn );
+	if ( !ww->moi->moi_snap || !ww->moi->moi_snap->ms_users++ )
+		mdb_txn_renew( ww->txn );
 	mdb_cursor_renew( ww->txn, mci );
 	mdb_cursor_renew( ww->txn, mcd );
+	if ( ww->ss ) {
+		mdb_cursor_renew( ww->txn, ww->ss->ss_mc );
+		if ( BER_BVISNULL( &ww->spos )) {
+			/* the scan was over */
+			ww->ss->ss_pending = 2;
+		} else {
+			rc = mdb_sort_seek( ww->ss, &ww->spos );
+			op->o_tmpfree( ww->spos.bv_val, op->o_tmpmemctx );
+			BER_BVZERO( &ww->spos );
+		}
+	}
 
 	key.mv_size = sizeof(ID);
 	if ( ww->mcd ) {	/* scope-based search using dn2id_walk */
 		MDB_val data;
 
-		if ( isc->numrdns )
-			mdb_dn2id_wrestore( op, isc );
-
 		key.mv_data = &ww->key;
 		data = ww->data;
 		rc = mdb_cursor_get( mcd, &key, &data, MDB_GET_BOTH );
@@ -401,21 +426,71 @@ mdb_waitfixup( Operation *op, ww_ctx *ww, MDB_cursor *mci, MDB_cursor *mcd, IdSc
 	} else if ( isc->scopes[0].mid > 1 ) {	/* candidate-based search */
 		int i;
 		for ( i=1; i<isc->scopes[0].mid; i++ ) {
+			MDB_val data;
 			if ( !isc->scopes[i].mval.mv_data )
 				continue;
 			key.mv_data = &isc->scopes[i].mid;
-			mdb_cursor_get( mcd, &key, &isc->scopes[i].mval, MDB_SET );
+			mdb_idscope_mval( op, &isc->scopes[i].mval,
+				mdb_cursor_get( mcd, &key, &data, MDB_SET ) ? NULL : &data );
 		}
 	}
 	return rc;
 }
 
+/* Prefetch the id2entry pages of upcoming candidates, so that on
+ * a cold cache their I/O overlaps with processing the current one.
+ * The first stage advises the leaf pages of the candidates mi_prefetch
+ * ahead. The second stage, half as far ahead, reads those leaf pages,
+ * by then hopefully in memory, and advises the overflow pages of
+ * large entries.
+ */
+typedef struct pf_ctx {
+	ID id[2];		/* next candidate for each stage */
+	ID cursor[2];
+	ID ahead[2];	/* candidates each stage is ahead */
+	int started;
+} pf_ctx;
+
+static void
+mdb_search_prefetch( struct mdb_info *mdb, MDB_txn *txn, ID *ids,
+	ID cursor, pf_ctx *pf )
+{
+	MDB_val key;
+	ID dist;
+	int i;
+
+	if ( !pf->started ) {
+		for ( i=0; i<2; i++ ) {
+			pf->cursor[i] = cursor;
+			pf->id[i] = mdb_idl_next( ids, &pf->cursor[i] );
+			pf->ahead[i] = 0;
+		}
+		pf->started = 1;
+	}
+
+	key.mv_size = sizeof(ID);
+	for ( i=0; i<2; i++ ) {
+		dist = i ? ( mdb->mi_prefetch + 1 ) / 2 : mdb->mi_prefetch;
+		/* the candidate being processed is no longer ahead */
+		if ( pf->ahead[i] )
+			pf->ahead[i]--;
+		while ( pf->ahead[i] < dist && pf->id[i] != NOID ) {
+			key.mv_data = &pf->id[i];
+			mdb_prefetch( txn, mdb->mi_id2entry, &key,
+				i ? MDB_PREFETCH_DATA : 0 );
+			pf->id[i] = mdb_idl_next( ids, &pf->cursor[i] );
+			pf->ahead[i]++;
+		}
+	}
+}
+
 int
 mdb_search( Operation *op, SlapReply *rs )
 {
 	struct mdb_info *mdb = (struct mdb_info *) op->o_bd->be_private;
 	ID		id, cursor, nsubs, ncand, cscope;
 	ID		lastid = NOID;
+	pf_ctx	pfctx = { { 0 } };
 	ID		candidates[MDB_IDL_UM_SIZE];
 	ID		iscopes[MDB_IDL_DB_SIZE];
 	ID2		*scopes;
@@ -431,12 +506,17 @@ mdb_search( Operation *op, SlapReply *rs )
 	MDB_cursor	*mci, *mcd;
 	ww_ctx wwctx;
 	slap_callback cb = { 0 };
+	OpExtra		*oex;
+	OpExtraSort	*sort = NULL;
+	mdb_sortscan	ss = { 0 };
 
 	mdb_op_info	opinfo = {{{0}}}, *moi = &opinfo;
 	MDB_txn			*ltid = NULL;
 
 	Debug( LDAP_DEBUG_TRACE, "=> " LDAP_XSTRING(mdb_search) "\n", 0, 0, 0);
 	attrs = op->oq_search.rs_attrs;
+	wwctx.ss = NULL;
+	BER_BVZERO( &wwctx.spos );
 
 	manageDSAit = get_manageDSAit( op );
 
@@ -464,6 +544,25 @@ mdb_search( Operation *op, SlapReply *rs )
 		return rs->sr_err;
 	}
 
+	/* a server side sort we can serve from a sort index */
+	LDAP_SLIST_FOREACH( oex, &op->o_extra, oe_next ) {
+		if ( oex->oe_key == &slap_sorthint_key &&
+			((OpExtraSort *)oex)->os_op == op )
+			break;
+	}
+	if ( oex ) {
+		sort = (OpExtraSort *)oex;
+		ss.ss_si = mdb_sort_find( mdb, sort->os_ad, sort->os_mr );
+		if ( ss.ss_si && ( ss.ss_si->si_flags & MDB_SORT_BUILT ) &&
+			mdb_cursor_open( ltid, mdb->mi_sortdbi, &ss.ss_mc ) == 0 ) {
+			sort->os_flags |= SLAP_SORT_SERVED;
+			sort->os_target = 0;
+			sort->os_total = 0;
+		} else {
+			sort = NULL;
+		}
+	}
+
 	scopes = scope_chunk_get( op );
 	stack = search_stack( op );
 	isc.mt = ltid;
@@ -471,6 +570,8 @@ mdb_search( Operation *op, SlapReply *rs )
 	isc.scopes = scopes;
 	isc.oscope = op->ors_scope;
 	isc.sctmp = stack;
+	isc.rdnbuf = NULL;
+	isc.rdnsize = 0;
 
 	if ( op->ors_deref & LDAP_DEREF_FINDING ) {
 		MDB_IDL_ZERO(candidates);
@@ -714,7 +815,10 @@ dn2entry_retry:
 		cb.sc_writewait = mdb_writewait;
 		cb.sc_private = &wwctx;
 		wwctx.txn = ltid;
+		wwctx.moi = moi;
 		wwctx.mcd = NULL;
+		if ( sort )
+			wwctx.ss = &ss;
 		cb.sc_next = op->o_callback;
 		op->o_callback = &cb;
 	}
@@ -751,7 +855,12 @@ dn2entry_retry:
 		nsubs = ncand;	/* always bypass scope'd search */
 		goto loop_begin;
 	}
-	if ( nsubs < ncand ) {
+	if ( sort ) {
+		/* walk the sort index, checking scope per entry */
+		ss.ss_ids = candidates;
+		nsubs = ncand;
+		id = mdb_sort_start( op, &ss, sort, ncand );
+	} else if ( nsubs < ncand ) {
 		int rc;
 		/* Do scope-based search */
 
@@ -816,6 +925,8 @@ loop_begin:
 			goto done;
 		}
 
+		if ( mdb->mi_prefetch && nsubs >= ncand && !sort )
+			mdb_search_prefetch( mdb, ltid, candidates, cursor, &pfctx );
 
 		if ( nsubs < ncand ) {
 			unsigned i;
@@ -890,7 +1001,7 @@ scopeok:
 			rs->sr_err = mdb_id2edata( op, mci, id, &edata );
 			if ( rs->sr_err == MDB_NOTFOUND ) {
 notfound:
-				if( nsubs < ncand )
+				if( nsubs < ncand || sort )
 					goto loop_continue;
 
 				if( !MDB_IDL_IS_RANGE(candidates) ) {
@@ -1146,7 +1257,13 @@ loop_continue:
 			rs->sr_entry = NULL;
 		}
 
-		if ( nsubs < ncand ) {
+		if ( sort ) {
+			if ( sort->os_limit && rs->sr_nentries >= sort->os_limit ) {
+				mdb_sort_stop( &ss, sort );
+				break;
+			}
+			id = mdb_sort_next( &ss );
+		} else if ( nsubs < ncand ) {
 			int rc = mdb_dn2id_walk( op, &isc );
 			if (rc) {
 				id = NOID;
@@ -1202,11 +1319,20 @@ done:
 				break;
 			}
 		}
+		/* still parked by mdb_rtxn_snap() */
+		if ( wwctx.flag && moi->moi_snap )
+			moi->moi_snap->ms_users++;
 	}
+	if ( !BER_BVISNULL( &wwctx.spos ))
+		op->o_tmpfree( wwctx.spos.bv_val, op->o_tmpmemctx );
+	if ( ss.ss_mc )
+		mdb_cursor_close( ss.ss_mc );
 	mdb_cursor_close( mcd );
 	mdb_cursor_close( mci );
+	if ( isc.rdnbuf )
+		op->o_tmpfree( isc.rdnbuf, op->o_tmpmemctx );
 	if ( moi == &opinfo ) {
-		mdb_txn_reset( moi->moi_txn );
+		mdb_snapshot_release( moi );
 		LDAP_SLIST_REMOVE( &op->o_extra, &moi->moi_oe, OpExtra, oe_next );
 	} else {
 		moi->moi_ref--;
@@ -1499,3 +1625,101 @@ send_paged_response(
 done:
 	(void) ber_free_buf( ber );
 }
+
+/* Count the entries holding a given value, for uniqueness checks:
+ * only the equality index is read, plus the few candidates it
+ * yields to weed out hash collisions and out of scope entries.
+ */
+int
+mdb_value_count(
+	Operation	*op,
+	struct berval	*base,
+	int		scope,
+	AttributeDescription *ad,
+	struct berval	*nval,
+	struct berval	*skip,
+	int		*count )
+{
+	struct mdb_info	*mdb = (struct mdb_info *) op->o_bd->be_private;
+	mdb_op_info	opinfo = {{{0}}}, *moi = &opinfo;
+	MDB_cursor	*mci = NULL, *mcd = NULL;
+	MDB_dbi		dbi;
+	slap_mask_t	mask;
+	struct berval	prefix;
+	AttributeAssertion ava = ATTRIBUTEASSERTION_INIT;
+	Filter		f = { 0 };
+	ID		*stack, *ids, i;
+	Entry		*e;
+	int		rc;
+
+	*count = 0;
+
+	/* the value must be usable as an assertion as is */
+	if ( !ad->ad_type->sat_equality ||
+		ad->ad_type->sat_equality->smr_syntax != ad->ad_type->sat_syntax )
+		return LDAP_UNWILLING_TO_PERFORM;
+
+	if ( mdb_index_param( op->o_bd, ad, LDAP_FILTER_EQUALITY,
+		&dbi, &mask, &prefix ) != LDAP_SUCCESS )
+		return LDAP_UNWILLING_TO_PERFORM;
+
+	rc = mdb_opinfo_get( op, mdb, 1, &moi );
+	if ( rc )
+		return LDAP_OTHER;
+
+	ava.aa_desc = ad;
+	ava.aa_value = *nval;
+	f.f_choice = LDAP_FILTER_EQUALITY;
+	f.f_ava = &ava;
+
+	stack = search_stack( op );
+	ids = stack;
+	rc = mdb_filter_candidates( op, moi->moi_txn, &f, ids,
+		stack + MDB_IDL_UM_SIZE, stack + 2 * MDB_IDL_UM_SIZE );
+	if ( rc ) {
+		rc = LDAP_OTHER;
+		goto done;
+	}
+	if ( MDB_IDL_IS_RANGE( ids )) {
+		rc = LDAP_UNWILLING_TO_PERFORM;
+		goto done;
+	}
+	if ( !ids[0] )
+		goto done;
+
+	rc = mdb_cursor_open( moi->moi_txn, mdb->mi_id2entry, &mci );
+	if ( rc ) {
+		rc = LDAP_OTHER;
+		goto done;
+	}
+	for ( i = 1; i <= ids[0]; i++ ) {
+		struct berval name, nname;
+		int match;
+
+		if ( mdb_id2name( op, moi->moi_txn, &mcd, ids[i], &name, &nname ) != 0 )
+			continue;
+		match = ( !skip || !dn_match( &nname, skip )) &&
+			dnIsSuffixScope( &nname, base, scope );
+		op->o_tmpfree( name.bv_val, op->o_tmpmemctx );
+		op->o_tmpfree( nname.bv_val, op->o_tmpmemctx );
+		if ( !match || mdb_id2entry( op, mci, ids[i], &e ) != 0 )
+			continue;
+		if ( test_filter( op, e, &f ) == LDAP_COMPARE_TRUE )
+			(*count)++;
+		mdb_entry_return( op, e );
+	}
+	mdb_cursor_close( mci );
+	if ( mcd )
+		mdb_cursor_close( mcd );
+
+done:
+	Debug( LDAP_DEBUG_TRACE, "<= mdb_value_count: %s %d (%d)\n",
+		ad->ad_cname.bv_val, *count, rc );
+	if ( moi == &opinfo ) {
+		mdb_snapshot_release( moi );
+		LDAP_SLIST_REMOVE( &op->o_extra, &moi->moi_oe, OpExtra, oe_next );
+	} else {
+		moi->moi_ref--;
+	}
+	return rc;
+}
@@ -0,0 +1,798 @@
+/* sortidx.c - ordered indexes for server side sorting */
+/* $OpenLDAP$ */
+/* This work is part of OpenLDAP Software <http://www.openldap.org/>.
+ *
+ * Copyright 2000-2018 The OpenLDAP Foundation.
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted only as authorized by the OpenLDAP
+ * Public License.
+ *
+ * A copy of this license is available in the file LICENSE in the
+ * top-level directory of the distribution or, alternatively, at
+ * <http://www.OpenLDAP.org/license.html>.
+ */
+
+#include "portable.h"
+
+#include <stdio.h>
+#include <ac/string.h>
+
+#include "back-mdb.h"
+#include "idl.h"
+#include "config.h"
+
+/* All sort indexes share the "sort" DB. A key is the OID of the
+ * attribute type and a NUL, a tag, and the least value of the
+ * attribute in the entry, encoded so that memcmp() order is the
+ * ORDERING rule's order. The data are the IDs of the entries with
+ * that value. Entries without the attribute get the SORT_NONE tag
+ * and sort after all values, as RFC 2891 has it. The SORT_BUILT key
+ * holds ID 0 once every entry of the DB is in the index.
+ *
+ * Values too long for a key are truncated, entries with values that
+ * only differ past that point come in ID order.
+ */
+#define SORT_BUILT	0x00
+#define SORT_VALUE	0x01
+#define SORT_NONE	0x02
+
+static struct berval mdb_sort_dbname = BER_BVC("sort");
+
+/* Ordering rules whose order the keys can keep */
+static slap_mr_match_func *mdb_sort_octets, *mdb_sort_integer;
+
+/* For attributes without an ORDERING rule, the one that goes with
+ * their EQUALITY rule, as clients name it in the sort control.
+ */
+static const struct {
+	char *eq, *ord;
+} mdb_sort_orderings[] = {
+	{ "caseIgnoreMatch", "caseIgnoreOrderingMatch" },
+	{ "caseExactMatch", "caseExactOrderingMatch" },
+	{ "numericStringMatch", "numericStringOrderingMatch" },
+	{ "octetStringMatch", "octetStringOrderingMatch" },
+	{ "integerMatch", "integerOrderingMatch" },
+	{ NULL, NULL }
+};
+
+static int
+mdb_sort_prefix( mdb_sortinfo *si, unsigned char *buf, int tag )
+{
+	AttributeType *at = si->si_ad->ad_type;
+	int len = strlen( at->sat_oid ) + 1;
+
+	memcpy( buf, at->sat_oid, len );
+	buf[len++] = tag;
+	return len;
+}
+
+/* Append val to the key in buf, len bytes so far, at most max.
+ * integerOrderingMatch compares the sign, the number of digits and
+ * the digits; the digits of negative numbers are complemented.
+ */
+static int
+mdb_sort_encode( mdb_sortinfo *si, struct berval *val,
+	unsigned char *buf, int len, int max )
+{
+	ber_len_t i, n = val->bv_len;
+	char *p = val->bv_val;
+	int neg = 0;
+
+	if ( !( si->si_flags & MDB_SORT_INTEGER )) {
+		if ( n > max - len )
+			n = max - len;
+		memcpy( buf + len, p, n );
+		return len + n;
+	}
+
+	if ( len + 3 > max )
+		return len;
+	if ( n && *p == '-' ) {
+		neg = 1;
+		p++;
+		n--;
+	}
+	i = n > 0xffff ? 0xffff : n;
+	if ( neg )
+		i = 0xffff - i;
+	buf[len++] = neg ? 0x01 : 0x02;
+	buf[len++] = i >> 8;
+	buf[len++] = i & 0xff;
+	for ( i = 0; i < n && len < max; i++ )
+		buf[len++] = neg ? 0xff - (unsigned char)p[i] : (unsigned char)p[i];
+	return len;
+}
+
+/* The key of an entry with these attributes, in buf */
+static void
+mdb_sort_key( struct mdb_info *mdb, mdb_sortinfo *si, Attribute *attrs,
+	unsigned char *buf, MDB_val *key )
+{
+	Attribute *a = attr_find( attrs, si->si_ad );
+	struct berval *bv;
+	unsigned i;
+	int cmp;
+
+	if ( !a || !a->a_numvals ) {
+		key->mv_size = mdb_sort_prefix( si, buf, SORT_NONE );
+		key->mv_data = buf;
+		return;
+	}
+
+	/* RFC 2891: sort multi-valued attributes by their least value */
+	bv = a->a_nvals;
+	for ( i = 1; i < a->a_numvals; i++ ) {
+		si->si_mr->smr_match( &cmp, 0, si->si_mr->smr_syntax, si->si_mr,
+			bv, &a->a_nvals[i] );
+		if ( cmp > 0 )
+			bv = &a->a_nvals[i];
+	}
+	key->mv_size = mdb_sort_encode( si, bv, buf,
+		mdb_sort_prefix( si, buf, SORT_VALUE ),
+		mdb_env_get_maxkeysize( mdb->mi_dbenv ));
+	key->mv_data = buf;
+}
+
+/* Is this key in the sort index of si? */
+static int
+mdb_sort_inrange( mdb_sortinfo *si, MDB_val *key )
+{
+	const char *oid = si->si_ad->ad_type->sat_oid;
+	size_t len = strlen( oid ) + 1;
+	unsigned char tag;
+
+	if ( key->mv_size <= len || memcmp( key->mv_data, oid, len ))
+		return 0;
+	tag = ((unsigned char *)key->mv_data)[len];
+	return tag == SORT_VALUE || tag == SORT_NONE;
+}
+
+mdb_sortinfo *
+mdb_sort_find( struct mdb_info *mdb, AttributeDescription *ad,
+	MatchingRule *mr )
+{
+	int i;
+
+	for ( i = 0; i < mdb->mi_nsorts; i++ ) {
+		mdb_sortinfo *si = &mdb->mi_sorts[i];
+		if ( si->si_ad == ad && ( !mr ||
+			mr->smr_match == si->si_mr->smr_match ))
+			return si;
+	}
+	return NULL;
+}
+
+int
+mdb_sort_config( struct mdb_info *mdb, const char *attr,
+	ConfigReply *cr )
+{
+	AttributeDescription *ad = NULL;
+	MatchingRule *mr;
+	const char *text;
+	int flags;
+
+	if ( !mdb_sort_octets ) {
+		mdb_sort_octets = mr_find( "octetStringOrderingMatch" )->smr_match;
+		mdb_sort_integer = mr_find( "integerOrderingMatch" )->smr_match;
+	}
+
+	if ( slap_str2ad( attr, &ad, &text ) != LDAP_SUCCESS ) {
+		snprintf( cr->msg, sizeof( cr->msg ),
+			"sortindex attribute \"%s\" undefined", attr );
+		return LDAP_PARAM_ERROR;
+	}
+	if ( ad->ad_tags.bv_len ) {
+		snprintf( cr->msg, sizeof( cr->msg ),
+			"sortindex attribute \"%s\" must not have options", attr );
+		return LDAP_PARAM_ERROR;
+	}
+	mr = ad->ad_type->sat_ordering;
+	if ( !mr && ad->ad_type->sat_equality ) {
+		int i;
+		for ( i = 0; mdb_sort_orderings[i].eq; i++ ) {
+			if ( ad->ad_type->sat_equality ==
+				mr_find( mdb_sort_orderings[i].eq )) {
+				mr = mr_find( mdb_sort_orderings[i].ord );
+				break;
+			}
+		}
+	}
+	if ( mr && mr->smr_match == mdb_sort_octets ) {
+		flags = 0;
+	} else if ( mr && mr->smr_match == mdb_sort_integer ) {
+		flags = MDB_SORT_INTEGER;
+	} else {
+		snprintf( cr->msg, sizeof( cr->msg ),
+			"sortindex attribute \"%s\" has no suitable ORDERING rule",
+			attr );
+		return LDAP_INAPPROPRIATE_MATCHING;
+	}
+	if ( mdb_sort_find( mdb, ad, NULL )) {
+		snprintf( cr->msg, sizeof( cr->msg ),
+			"sortindex attribute \"%s\" already configured", attr );
+		return LDAP_TYPE_OR_VALUE_EXISTS;
+	}
+
+	mdb->mi_sorts = ch_realloc( mdb->mi_sorts,
+		( mdb->mi_nsorts + 1 ) * sizeof( mdb_sortinfo ));
+	mdb->mi_sorts[mdb->mi_nsorts].si_ad = ad;
+	mdb->mi_sorts[mdb->mi_nsorts].si_mr = mr;
+	mdb->mi_sorts[mdb->mi_nsorts].si_flags = flags;
+	mdb->mi_nsorts++;
+	return LDAP_SUCCESS;
+}
+
+void
+mdb_sort_unparse( struct mdb_info *mdb, BerVarray *bva )
+{
+	int i;
+
+	for ( i = 0; i < mdb->mi_nsorts; i++ )
+		value_add_one( bva, &mdb->mi_sorts[i].si_ad->ad_cname );
+}
+
+/* Drop all keys of si */
+static int
+mdb_sort_purge( struct mdb_info *mdb, MDB_txn *txn, mdb_sortinfo *si )
+{
+	unsigned char buf[SLAP_TEXT_BUFLEN];
+	MDB_cursor *mc;
+	MDB_val key, data, prefix;
+	int rc;
+
+	prefix.mv_size = mdb_sort_prefix( si, buf, SORT_BUILT );
+	prefix.mv_data = buf;
+	rc = mdb_cursor_open( txn, mdb->mi_sortdbi, &mc );
+	if ( rc )
+		return rc;
+	while ( 1 ) {
+		key = prefix;
+		rc = mdb_cursor_get( mc, &key, &data, MDB_SET_RANGE );
+		if ( rc || key.mv_size < prefix.mv_size ||
+			memcmp( key.mv_data, prefix.mv_data, prefix.mv_size - 1 ))
+			break;
+		rc = mdb_cursor_del( mc, MDB_NODUPDATA );
+		if ( rc )
+			break;
+	}
+	mdb_cursor_close( mc );
+	return rc == MDB_NOTFOUND ? 0 : rc;
+}
+
+/* Drop sort index i, its keys too if the DB is open */
+int
+mdb_sort_delete( BackendDB *be, int i )
+{
+	struct mdb_info *mdb = (struct mdb_info *) be->be_private;
+	MDB_txn *txn;
+	int rc = 0;
+
+	if (( mdb->mi_flags & MDB_IS_OPEN ) && mdb->mi_sortdbi ) {
+		rc = mdb_txn_begin( mdb->mi_dbenv, NULL, 0, &txn );
+		if ( rc == 0 ) {
+			rc = mdb_sort_purge( mdb, txn, &mdb->mi_sorts[i] );
+			if ( rc == 0 )
+				rc = mdb_txn_commit( txn );
+			else
+				mdb_txn_abort( txn );
+		}
+		if ( rc ) {
+			Debug( LDAP_DEBUG_ANY,
+				LDAP_XSTRING(mdb_sort_delete) ": database \"%s\": "
+				"cannot drop sort index %s: %s\n",
+				be->be_suffix[0].bv_val,
+				mdb->mi_sorts[i].si_ad->ad_cname.bv_val, mdb_strerror(rc) );
+		}
+	}
+	mdb->mi_nsorts--;
+	memmove( &mdb->mi_sorts[i], &mdb->mi_sorts[i+1],
+		( mdb->mi_nsorts - i ) * sizeof( mdb_sortinfo ));
+	if ( !mdb->mi_nsorts ) {
+		ch_free( mdb->mi_sorts );
+		mdb->mi_sorts = NULL;
+	}
+	return rc;
+}
+
+/* Open the sort DB and find out which sort indexes are complete.
+ * Incomplete ones are emptied for the online indexer to build, or
+ * just marked complete if the DB has no entries. Returns the number
+ * of sort indexes to build, or -1.
+ */
+int
+mdb_sort_open( BackendDB *be, MDB_txn *tx0, ConfigReply *cr )
+{
+	struct mdb_info *mdb = (struct mdb_info *) be->be_private;
+	unsigned char buf[SLAP_TEXT_BUFLEN];
+	MDB_txn *txn = tx0;
+	MDB_val key, data;
+	MDB_stat ms;
+	ID id = 0;
+	int i, rc, flags, build = 0;
+
+	if ( !mdb->mi_nsorts )
+		return 0;
+
+	if ( !txn ) {
+		rc = mdb_txn_begin( mdb->mi_dbenv, NULL, 0, &txn );
+		if ( rc )
+			goto fail;
+	}
+
+	if ( !mdb->mi_sortdbi ) {
+		flags = MDB_DUPSORT|MDB_DUPFIXED|MDB_INTEGERDUP;
+		if ( !(slapMode & SLAP_TOOL_READONLY) )
+			flags |= MDB_CREATE;
+		rc = mdb_dbi_open( txn, mdb_sort_dbname.bv_val, flags,
+			&mdb->mi_sortdbi );
+		if ( rc )
+			goto fail;
+	}
+
+	rc = mdb_stat( txn, mdb->mi_id2entry, &ms );
+	if ( rc )
+		goto fail;
+
+	data.mv_size = sizeof(ID);
+	data.mv_data = &id;
+	for ( i = 0; i < mdb->mi_nsorts; i++ ) {
+		mdb_sortinfo *si = &mdb->mi_sorts[i];
+
+		if ( si->si_flags & MDB_SORT_BUILT )
+			continue;
+		key.mv_size = mdb_sort_prefix( si, buf, SORT_BUILT );
+		key.mv_data = buf;
+		rc = mdb_get( txn, mdb->mi_sortdbi, &key, &data );
+		if ( rc == 0 ) {
+			si->si_flags |= MDB_SORT_BUILT;
+			continue;
+		}
+		if ( rc != MDB_NOTFOUND )
+			goto fail;
+		rc = 0;
+		if ( slapMode & SLAP_TOOL_READONLY )
+			continue;
+		rc = mdb_sort_purge( mdb, txn, si );
+		if ( rc )
+			goto fail;
+		if ( ms.ms_entries ) {
+			build++;
+			continue;
+		}
+		data.mv_data = &id;
+		rc = mdb_put( txn, mdb->mi_sortdbi, &key, &data, 0 );
+		if ( rc )
+			goto fail;
+		si->si_flags |= MDB_SORT_BUILT;
+	}
+
+	if ( !tx0 ) {
+		rc = mdb_txn_commit( txn );
+		txn = NULL;
+		if ( rc )
+			goto fail;
+	}
+	return build;
+
+fail:
+	if ( txn && !tx0 )
+		mdb_txn_abort( txn );
+	snprintf( cr->msg, sizeof(cr->msg), "database \"%s\": "
+		"cannot open sort indexes: %s (%d).",
+		be->be_suffix[0].bv_val, mdb_strerror(rc), rc );
+	Debug( LDAP_DEBUG_ANY, LDAP_XSTRING(mdb_sort_open) ": %s\n",
+		cr->msg, 0, 0 );
+	return -1;
+}
+
+/* Every entry has been indexed. Call with the txn that did the
+ * last of them, and again without a txn once it has committed.
+ */
+int
+mdb_sort_built( struct mdb_info *mdb, MDB_txn *txn )
+{
+	unsigned char buf[SLAP_TEXT_BUFLEN];
+	MDB_val key, data;
+	ID id = 0;
+	int i, rc = 0;
+
+	data.mv_size = sizeof(ID);
+	for ( i = 0; i < mdb->mi_nsorts; i++ ) {
+		mdb_sortinfo *si = &mdb->mi_sorts[i];
+
+		if ( si->si_flags & MDB_SORT_BUILT )
+			continue;
+		if ( !txn ) {
+			si->si_flags |= MDB_SORT_BUILT;
+			continue;
+		}
+		key.mv_size = mdb_sort_prefix( si, buf, SORT_BUILT );
+		key.mv_data = buf;
+		data.mv_data = &id;
+		rc = mdb_put( txn, mdb->mi_sortdbi, &key, &data, 0 );
+		if ( rc )
+			break;
+	}
+	return rc;
+}
+
+/* Add or delete the sort keys of an entry */
+int
+mdb_sort_entry( Operation *op, MDB_txn *txn, int opid, Entry *e )
+{
+	struct mdb_info *mdb = (struct mdb_info *) op->o_bd->be_private;
+	unsigned char *buf;
+	MDB_val key, data;
+	int i, rc = 0;
+
+	if ( !mdb->mi_sortdbi || e->e_id == 0 )
+		return 0;
+
+	buf = op->o_tmpalloc( mdb_env_get_maxkeysize( mdb->mi_dbenv ),
+		op->o_tmpmemctx );
+	data.mv_size = sizeof(ID);
+	for ( i = 0; i < mdb->mi_nsorts; i++ ) {
+		mdb_sort_key( mdb, &mdb->mi_sorts[i], e->e_attrs, buf, &key );
+		data.mv_data = &e->e_id;
+		if ( opid == SLAP_INDEX_DELETE_OP ) {
+			rc = mdb_del( txn, mdb->mi_sortdbi, &key, &data );
+			if ( rc == MDB_NOTFOUND )
+				rc = 0;
+		} else {
+			rc = mdb_put( txn, mdb->mi_sortdbi, &key, &data, 0 );
+			if ( rc == MDB_KEYEXIST )
+				rc = 0;
+		}
+		if ( rc )
+			break;
+	}
+	op->o_tmpfree( buf, op->o_tmpmemctx );
+	return rc;
+}
+
+/* Move the sort keys of a modified entry. old are its attributes
+ * from before the modification.
+ */
+int
+mdb_sort_modify( Operation *op, MDB_txn *txn, Entry *e, Attribute *old )
+{
+	struct mdb_info *mdb = (struct mdb_info *) op->o_bd->be_private;
+	unsigned char *buf, *obuf;
+	MDB_val key, okey, data;
+	int i, max, rc = 0;
+
+	if ( !mdb->mi_sortdbi || e->e_id == 0 )
+		return 0;
+
+	max = mdb_env_get_maxkeysize( mdb->mi_dbenv );
+	buf = op->o_tmpalloc( 2 * max, op->o_tmpmemctx );
+	obuf = buf + max;
+	data.mv_size = sizeof(ID);
+	for ( i = 0; i < mdb->mi_nsorts; i++ ) {
+		mdb_sort_key( mdb, &mdb->mi_sorts[i], old, obuf, &okey );
+		mdb_sort_key( mdb, &mdb->mi_sorts[i], e->e_attrs, buf, &key );
+		if ( key.mv_size == okey.mv_size &&
+			!memcmp( key.mv_data, okey.mv_data, key.mv_size ))
+			continue;
+		data.mv_data = &e->e_id;
+		rc = mdb_del( txn, mdb->mi_sortdbi, &okey, &data );
+		if ( rc && rc != MDB_NOTFOUND )
+			break;
+		data.mv_data = &e->e_id;
+		rc = mdb_put( txn, mdb->mi_sortdbi, &key, &data, 0 );
+		if ( rc == MDB_KEYEXIST )
+			rc = 0;
+		if ( rc )
+			break;
+	}
+	op->o_tmpfree( buf, op->o_tmpmemctx );
+	return rc;
+}
+
+/* Searches in sort order.
+ *
+ * The scan walks the keys of one attribute, backwards for a reverse
+ * sort, skipping the IDs that aren't search candidates. Positions
+ * in a VLV are counted over candidates rather than over entries
+ * matching the filter, so they are estimates as far as the filter
+ * is not resolved by the candidates; the VLV drafts allow for that.
+ */
+
+static int
+mdb_sort_iscand( ID *ids, ID id )
+{
+	unsigned i;
+
+	if ( MDB_IDL_IS_RANGE( ids ))
+		return id >= MDB_IDL_RANGE_FIRST( ids ) &&
+			id <= MDB_IDL_RANGE_LAST( ids );
+	i = mdb_idl_search( ids, id );
+	return i <= ids[0] && ids[i] == id;
+}
+
+/* The next candidate of the scan, NOID at the end. Unless
+ * ss_pending is set, the cursor is on the previous one.
+ */
+ID
+mdb_sort_next( mdb_sortscan *ss )
+{
+	MDB_cursor_op next = ss->ss_reverse ? MDB_PREV : MDB_NEXT;
+	MDB_val key, data;
+	ID id;
+	int rc;
+
+	switch ( ss->ss_pending ) {
+	case 0:
+		rc = mdb_cursor_get( ss->ss_mc, &key, &data, next );
+		break;
+	case 1:
+		ss->ss_pending = 0;
+		rc = mdb_cursor_get( ss->ss_mc, &key, &data, MDB_GET_CURRENT );
+		break;
+	default:
+		return NOID;
+	}
+	for ( ; rc == 0; rc = mdb_cursor_get( ss->ss_mc, &key, &data, next )) {
+		if ( !mdb_sort_inrange( ss->ss_si, &key ))
+			break;
+		memcpy( &id, data.mv_data, sizeof(ID) );
+		if ( mdb_sort_iscand( ss->ss_ids, id ))
+			return id;
+	}
+	ss->ss_pending = 2;
+	return NOID;
+}
+
+/* Put the cursor before the first candidate */
+static void
+mdb_sort_first( mdb_sortscan *ss, unsigned char *buf )
+{
+	MDB_val key, data;
+	int rc;
+
+	key.mv_data = buf;
+	if ( !ss->ss_reverse ) {
+		key.mv_size = mdb_sort_prefix( ss->ss_si, buf, SORT_VALUE );
+		rc = mdb_cursor_get( ss->ss_mc, &key, &data, MDB_SET_RANGE );
+	} else {
+		key.mv_size = mdb_sort_prefix( ss->ss_si, buf, SORT_NONE + 1 );
+		rc = mdb_cursor_get( ss->ss_mc, &key, &data, MDB_SET_RANGE );
+		if ( rc == 0 )
+			rc = mdb_cursor_get( ss->ss_mc, &key, &data, MDB_PREV );
+		else if ( rc == MDB_NOTFOUND )
+			rc = mdb_cursor_get( ss->ss_mc, &key, &data, MDB_LAST );
+	}
+	ss->ss_pending = rc ? 2 : 1;
+}
+
+/* Save the cursor position in pos */
+void
+mdb_sort_tell( mdb_sortscan *ss, struct berval *pos, void *ctx )
+{
+	MDB_val key, data;
+
+	BER_BVZERO( pos );
+	if ( ss->ss_pending ||
+		mdb_cursor_get( ss->ss_mc, &key, &data, MDB_GET_CURRENT ))
+		return;
+	pos->bv_len = key.mv_size + sizeof(ID);
+	pos->bv_val = ber_memalloc_x( pos->bv_len, ctx );
+	memcpy( pos->bv_val, key.mv_data, key.mv_size );
+	memcpy( pos->bv_val + key.mv_size, data.mv_data, sizeof(ID) );
+}
+
+/* Return the cursor to a saved position. If that key is gone,
+ * stop before the one that followed it.
+ */
+int
+mdb_sort_seek( mdb_sortscan *ss, struct berval *pos )
+{
+	MDB_cursor *mc = ss->ss_mc;
+	MDB_val key, data, k0;
+	ID id;
+	int rc;
+
+	if ( pos->bv_len <= sizeof(ID) )
+		return LDAP_OTHER;
+	k0.mv_size = pos->bv_len - sizeof(ID);
+	k0.mv_data = pos->bv_val;
+	memcpy( &id, pos->bv_val + k0.mv_size, sizeof(ID) );
+
+	key = k0;
+	data.mv_size = sizeof(ID);
+	data.mv_data = &id;
+	rc = mdb_cursor_get( mc, &key, &data, MDB_GET_BOTH );
+	if ( rc == 0 ) {
+		ss->ss_pending = 0;
+		return 0;
+	}
+
+	rc = mdb_cursor_get( mc, &key, &data, MDB_GET_BOTH_RANGE );
+	if ( rc == 0 ) {
+		if ( ss->ss_reverse )
+			rc = mdb_cursor_get( mc, &key, &data, MDB_PREV );
+	} else {
+		key = k0;
+		rc = mdb_cursor_get( mc, &key, &data, MDB_SET_RANGE );
+		if ( rc == 0 && key.mv_size == k0.mv_size &&
+			!memcmp( key.mv_data, k0.mv_data, k0.mv_size )) {
+			rc = mdb_cursor_get( mc, &key, &data,
+				ss->ss_reverse ? MDB_LAST_DUP : MDB_NEXT_NODUP );
+		} else if ( ss->ss_reverse ) {
+			rc = mdb_cursor_get( mc, &key, &data,
+				rc == 0 ? MDB_PREV : MDB_LAST );
+		}
+	}
+	ss->ss_pending = rc ? 2 : 1;
+	return 0;
+}
+
+/* Step back over up to n candidates, and over all of them until
+ * the start if total is set. The n-th one is left to be returned
+ * next, or the first one if there were fewer. Returns the number of
+ * candidates stepped over.
+ */
+static int
+mdb_sort_back( Operation *op, mdb_sortscan *ss, int n, int total )
+{
+	unsigned char buf[SLAP_TEXT_BUFLEN];
+	struct berval pos = BER_BVNULL;
+	int i;
+
+	ss->ss_reverse ^= 1;
+	for ( i = 0; ; i++ ) {
+		if ( i == n ) {
+			mdb_sort_tell( ss, &pos, op->o_tmpmemctx );
+			if ( !total )
+				break;
+		}
+		if ( mdb_sort_next( ss ) == NOID )
+			break;
+	}
+	ss->ss_reverse ^= 1;
+
+	if ( BER_BVISNULL( &pos )) {
+		mdb_sort_first( ss, buf );
+	} else {
+		mdb_sort_seek( ss, &pos );
+		op->o_tmpfree( pos.bv_val, op->o_tmpmemctx );
+		if ( !ss->ss_pending )
+			ss->ss_pending = 1;
+	}
+	return i;
+}
+
+/* Leave the cursor on the last candidate */
+static ID
+mdb_sort_last( mdb_sortscan *ss )
+{
+	unsigned char buf[SLAP_TEXT_BUFLEN];
+	ID id;
+
+	ss->ss_reverse ^= 1;
+	mdb_sort_first( ss, buf );
+	id = mdb_sort_next( ss );
+	ss->ss_reverse ^= 1;
+	return id;
+}
+
+/* Position the scan as os asks and return the first ID to send,
+ * NOID if there is none. For a VLV, sets os_limit to the number of
+ * entries to send and os_target to the target's position.
+ */
+ID
+mdb_sort_start( Operation *op, mdb_sortscan *ss, OpExtraSort *os, ID ncand )
+{
+	struct mdb_info *mdb = (struct mdb_info *) op->o_bd->be_private;
+	unsigned char buf[SLAP_TEXT_BUFLEN], *kbuf;
+	MDB_val key, data;
+	int n, target, rc;
+
+	ss->ss_reverse = ( os->os_flags & SLAP_SORT_REVERSE ) != 0;
+	os->os_total = ncand > INT_MAX ? INT_MAX : ncand;
+
+	/* the next page */
+	if ( !BER_BVISNULL( &os->os_resume )) {
+		if ( mdb_sort_seek( ss, &os->os_resume ))
+			return NOID;
+		return mdb_sort_next( ss );
+	}
+
+	/* all of them */
+	if ( !os->os_offset && BER_BVISNULL( &os->os_value )) {
+		mdb_sort_first( ss, buf );
+		return mdb_sort_next( ss );
+	}
+
+	/* VLV by position */
+	if ( os->os_offset ) {
+		if ( os->os_count && os->os_count != os->os_total ) {
+			if ( os->os_offset > os->os_count ) {
+				os->os_flags |= SLAP_SORT_RANGE;
+				return NOID;
+			}
+			target = (double)os->os_total * os->os_offset / os->os_count;
+			if ( target < 1 )
+				target = 1;
+		} else {
+			if ( os->os_offset > os->os_total ) {
+				os->os_flags |= SLAP_SORT_RANGE;
+				return NOID;
+			}
+			target = os->os_offset;
+		}
+		mdb_sort_first( ss, buf );
+		for ( n = 0; n < target; n++ ) {
+			if ( mdb_sort_next( ss ) == NOID )
+				break;
+		}
+		if ( n < target ) {
+			/* fewer candidates than estimated, take the last */
+			if ( !n || mdb_sort_last( ss ) == NOID ) {
+				os->os_total = 0;
+				return NOID;
+			}
+			os->os_total = target = n;
+		}
+		os->os_target = target;
+		n = mdb_sort_back( op, ss, os->os_before, 0 );
+		os->os_limit = n + 1 + os->os_after;
+		return mdb_sort_next( ss );
+	}
+
+	/* VLV by value: the first entry whose value is not below it,
+	 * or not above it if reversed.
+	 */
+	kbuf = op->o_tmpalloc( mdb_env_get_maxkeysize( mdb->mi_dbenv ),
+		op->o_tmpmemctx );
+	key.mv_data = kbuf;
+	key.mv_size = mdb_sort_encode( ss->ss_si, &os->os_value, kbuf,
+		mdb_sort_prefix( ss->ss_si, kbuf, SORT_VALUE ),
+		mdb_env_get_maxkeysize( mdb->mi_dbenv ));
+	n = key.mv_size;
+	rc = mdb_cursor_get( ss->ss_mc, &key, &data, MDB_SET_RANGE );
+	if ( ss->ss_reverse ) {
+		if ( rc == 0 && key.mv_size == n && !memcmp( key.mv_data, kbuf, n ))
+			rc = mdb_cursor_get( ss->ss_mc, &key, &data, MDB_LAST_DUP );
+		else if ( rc == 0 )
+			rc = mdb_cursor_get( ss->ss_mc, &key, &data, MDB_PREV );
+		else if ( rc == MDB_NOTFOUND )
+			rc = mdb_cursor_get( ss->ss_mc, &key, &data, MDB_LAST );
+	}
+	op->o_tmpfree( kbuf, op->o_tmpmemctx );
+	ss->ss_pending = rc ? 2 : 1;
+
+	if ( mdb_sort_next( ss ) == NOID ) {
+		/* past the end, the last entry counts as one before it */
+		if ( mdb_sort_last( ss ) == NOID ) {
+			os->os_total = 0;
+			os->os_target = 1;
+			return NOID;
+		}
+		os->os_target = os->os_total + 1;
+		n = mdb_sort_back( op, ss, os->os_before ? os->os_before - 1 : 0, 0 );
+		os->os_limit = n + 1 + os->os_after;
+	} else {
+		n = mdb_sort_back( op, ss, os->os_before, 1 );
+		os->os_target = n + 1;
+		if ( os->os_target > os->os_total )
+			os->os_total = os->os_target;
+		os->os_limit = ( n < os->os_before ? n : os->os_before ) +
+			1 + os->os_after;
+	}
+	return mdb_sort_next( ss );
+}
+
+/* The window was sent. Remember where it ended for the next page
+ * and whether there are more entries.
+ */
+void
+mdb_sort_stop( mdb_sortscan *ss, OpExtraSort *os )
+{
+	if ( !os->os_offset && BER_BVISNULL( &os->os_value ))
+		mdb_sort_tell( ss, &os->os_resume, NULL );
+	if ( mdb_sort_next( ss ) != NOID )
+		os->os_flags |= SLAP_SORT_MORE;
+}
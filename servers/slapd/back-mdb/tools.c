@@ -87,6 +87,9 @@ static void * mdb_tool_index_task( void *ctx, void *ptr );
 
 static int	mdb_writes, mdb_writes_per_commit;
 
+/* 1 once slapindex has rebuilt the sort indexes, -1 if that failed */
+static int	mdb_tool_sorted;
+
 /* Number of ops per commit in Quick mode.
  * Batching speeds writes overall, but too large a
  * batch will fail with MDB_TXN_FULL.
@@ -218,6 +221,36 @@ int mdb_tool_entry_close(
 		mdb_tool_txn = NULL;
 	}
 
+	/* Every entry went through slapindex, record the sort indexes
+	 * as complete.
+	 */
+	if ( mdb_tool_sorted > 0 ) {
+		struct mdb_info *mdb = be->be_private;
+		MDB_txn *txn = txi;
+		int rc = 0;
+
+		txi = NULL;
+		if ( !txn )
+			rc = mdb_txn_begin( mdb->mi_dbenv, NULL, 0, &txn );
+		if ( rc == 0 ) {
+			rc = mdb_sort_built( mdb, txn );
+			if ( rc == 0 )
+				rc = mdb_txn_commit( txn );
+			else
+				mdb_txn_abort( txn );
+		}
+		if ( rc ) {
+			Debug( LDAP_DEBUG_ANY,
+				LDAP_XSTRING(mdb_tool_entry_close) ": database %s: "
+				"cannot complete sort indexes: %s (%d)\n",
+				be->be_suffix[0].bv_val, mdb_strerror(rc), rc );
+			mdb_tool_sorted = 0;
+			return -1;
+		}
+		mdb_sort_built( mdb, NULL );
+	}
+	mdb_tool_sorted = 0;
+
 	if( nholes ) {
 		unsigned i;
 		fprintf( stderr, "Error, entries missing!\n");
@@ -563,13 +596,18 @@ mdb_tool_index_add(
 	struct mdb_info *mdb = (struct mdb_info *) op->o_bd->be_private;
 
 	if ( !mdb->mi_nattrs )
-		return 0;
+		return mdb_sort_entry( op, txn, SLAP_INDEX_ADD_OP, e );
 
 	if ( mdb_tool_threads > 1 ) {
 		IndexRec *ir;
 		int i, rc;
 		Attribute *a;
 
+		/* the workers are idle, the sort keys go in first */
+		rc = mdb_sort_entry( op, txn, SLAP_INDEX_ADD_OP, e );
+		if ( rc )
+			return rc;
+
 		ir = mdb_tool_index_rec;
 		for (i=0; i<mdb->mi_nattrs; i++)
 			ir[i].ir_attrs = NULL;
@@ -813,12 +851,12 @@ int mdb_tool_entry_reindex(
 	/* No indexes configured, nothing to do. Could return an
 	 * error here to shortcut things.
 	 */
-	if (!mi->mi_attrs) {
+	if (!mi->mi_attrs && !mi->mi_nsorts) {
 		return 0;
 	}
 
 	/* Check for explicit list of attrs to index */
-	if ( adv ) {
+	if ( adv && mi->mi_attrs ) {
 		int i, j, n;
 
 		if ( mi->mi_attrs[0]->ai_desc != adv[0] ) {
@@ -892,6 +930,18 @@ int mdb_tool_entry_reindex(
 				return -1;
 			}
 		}
+		if ( mi->mi_sortdbi ) {
+			rc = mdb_drop( txi, mi->mi_sortdbi, 0 );
+			if ( rc ) {
+				Debug( LDAP_DEBUG_ANY,
+					LDAP_XSTRING(mdb_tool_entry_reindex)
+					": (Truncate) mdb_drop(sort) failed: %s (%d)\n",
+					mdb_strerror(rc), rc, 0 );
+				return -1;
+			}
+			for ( i=0; i < mi->mi_nsorts; i++ )
+				mi->mi_sorts[i].si_flags &= ~MDB_SORT_BUILT;
+		}
 		slapMode ^= SLAP_TRUNCATE_MODE;
 	}
 
@@ -912,6 +962,8 @@ int mdb_tool_entry_reindex(
 	rc = mdb_tool_index_add( &op, txi, e );
 
 done:
+	if ( mdb_tool_sorted >= 0 && mi->mi_nsorts )
+		mdb_tool_sorted = rc ? -1 : 1;
 	if( rc == 0 ) {
 		mdb_writes++;
 		if ( mdb_writes >= mdb_writes_per_commit ) {
@@ -52,6 +52,9 @@ slap_bi_head backendInfo = LDAP_STAILQ_HEAD_INITIALIZER(backendInfo);
 int			nBackendDB = 0; 
 slap_be_head backendDB = LDAP_STAILQ_HEAD_INITIALIZER(backendDB);
 
+/* only its address is used, as the oe_key of OpExtraSort */
+int			slap_sorthint_key;
+
 static int
 backend_init_controls( BackendInfo *bi )
 {
@@ -374,13 +374,13 @@ fail:
 #define GRABSIZE	BUFSIZ
 
 #define MAKE_SPACE( n )	{ \
-		while ( ecur + (n) > ebuf + emaxsize ) { \
+		while ( cur + (n) > *bufp + *sizep ) { \
 			ptrdiff_t	offset; \
-			offset = (int) (ecur - ebuf); \
-			ebuf = ch_realloc( ebuf, \
-				emaxsize + GRABSIZE ); \
-			emaxsize += GRABSIZE; \
-			ecur = ebuf + offset; \
+			offset = (int) (cur - *bufp); \
+			*bufp = ch_realloc( *bufp, \
+				*sizep + GRABSIZE ); \
+			*sizep += GRABSIZE; \
+			cur = *bufp + offset; \
 		} \
 	}
 
@@ -398,13 +398,36 @@ entry2str_wrap(
 	Entry		*e,
 	int			*len,
 	ber_len_t	wrap )
+{
+	char *buf = entry2str_wrap_r( e, len, wrap, &ebuf, &emaxsize );
+
+	ecur = ebuf + *len;
+	return buf;
+}
+
+/*
+ * Like entry2str_wrap(), but formats into a caller-owned buffer
+ * so that several threads can convert entries at the same time.
+ * *bufp and *sizep are updated if the buffer needs to grow; the
+ * caller must free *bufp when done.
+ */
+char *
+entry2str_wrap_r(
+	Entry		*e,
+	int			*len,
+	ber_len_t	wrap,
+	char		**bufp,
+	int			*sizep )
 {
 	Attribute	*a;
 	struct berval	*bv;
 	int		i;
 	ber_len_t tmplen;
+	char	*cur;
 
 	assert( e != NULL );
+	assert( bufp != NULL );
+	assert( sizep != NULL );
 
 	/*
 	 * In string format, an entry looks like this:
@@ -412,14 +435,14 @@ entry2str_wrap(
 	 *	[<attr>: <value>\n]*
 	 */
 
-	ecur = ebuf;
+	cur = *bufp;
 
 	/* put the dn */
 	if ( e->e_dn != NULL ) {
 		/* put "dn: <dn>" */
 		tmplen = e->e_name.bv_len;
 		MAKE_SPACE( LDIF_SIZE_NEEDED( 2, tmplen ));
-		ldif_sput_wrap( &ecur, LDIF_PUT_VALUE, "dn", e->e_dn, tmplen, wrap );
+		ldif_sput_wrap( &cur, LDIF_PUT_VALUE, "dn", e->e_dn, tmplen, wrap );
 	}
 
 	/* put the attributes */
@@ -429,16 +452,16 @@ entry2str_wrap(
 			bv = &a->a_vals[i];
 			tmplen = a->a_desc->ad_cname.bv_len;
 			MAKE_SPACE( LDIF_SIZE_NEEDED( tmplen, bv->bv_len ));
-			ldif_sput_wrap( &ecur, LDIF_PUT_VALUE,
+			ldif_sput_wrap( &cur, LDIF_PUT_VALUE,
 				a->a_desc->ad_cname.bv_val,
 				bv->bv_val, bv->bv_len, wrap );
 		}
 	}
 	MAKE_SPACE( 1 );
-	*ecur = '\0';
-	*len = ecur - ebuf;
+	*cur = '\0';
+	*len = cur - *bufp;
 
-	return( ebuf );
+	return( *bufp );
 }
 
 void
@@ -644,6 +644,7 @@ accesslog_purge( void *ctx, void *arg )
 	char timebuf[LDAP_LUTIL_GENTIME_BUFSIZE];
 	char csnbuf[LDAP_PVT_CSNSTR_BUFSIZE];
 	time_t old = slap_get_time();
+	int rc, purged = 0;
 
 	connection_fake_init( &conn, &opbuf, ctx );
 	op = &opbuf.ob_op;
@@ -680,7 +681,24 @@ accesslog_purge( void *ctx, void *arg )
 	csnbuf[0] = '\0';
 	cb.sc_private = &pd;
 
-	op->o_bd->be_search( op, &rs );
+	/* drop the whole range in bulk if the backend can */
+	rc = LDAP_UNWILLING_TO_PERFORM;
+	if ( op->o_bd->be_purge ) {
+		rc = op->o_bd->be_purge( op, &op->o_req_ndn,
+			op->ors_scope, &f, &pd.csn, &purged );
+		if ( rc == LDAP_SUCCESS ) {
+			if ( purged )
+				Debug( LDAP_DEBUG_STATS, "accesslog_purge: %s deleted %d\n",
+					op->o_req_ndn.bv_val, purged, 0 );
+		} else {
+			/* what was deleted is committed, do the rest one by one */
+			Debug( LDAP_DEBUG_ANY, "accesslog_purge: %s range delete "
+				"failed (%d)\n", op->o_req_ndn.bv_val, rc, 0 );
+		}
+	}
+	if ( rc != LDAP_SUCCESS ) {
+		op->o_bd->be_search( op, &rs );
+	}
 	op->o_tmpfree( op->ors_filterstr.bv_val, op->o_tmpmemctx );
 
 	if ( pd.used ) {
@@ -705,33 +723,33 @@ accesslog_purge( void *ctx, void *arg )
 		}
 		ch_free( pd.ndn );
 		ch_free( pd.dn );
+	}
 
-		{
-			Modifications mod;
-			struct berval bv[2];
-			rs_reinit( &rs, REP_RESULT );
-			/* update context's entryCSN to reflect oldest CSN */
-			mod.sml_numvals = 1;
-			mod.sml_values = bv;
-			bv[0] = pd.csn;
-			BER_BVZERO(&bv[1]);
-			mod.sml_nvalues = NULL;
-			mod.sml_desc = slap_schema.si_ad_entryCSN;
-			mod.sml_op = LDAP_MOD_REPLACE;
-			mod.sml_flags = SLAP_MOD_INTERNAL;
-			mod.sml_next = NULL;
-
-			op->o_tag = LDAP_REQ_MODIFY;
-			op->orm_modlist = &mod;
-			op->orm_no_opattrs = 1;
-			op->o_req_dn = li->li_db->be_suffix[0];
-			op->o_req_ndn = li->li_db->be_nsuffix[0];
-			op->o_no_schema_check = 1;
-			op->o_managedsait = SLAP_CONTROL_NONCRITICAL;
-			op->o_bd->be_modify( op, &rs );
-			if ( mod.sml_next ) {
-				slap_mods_free( mod.sml_next, 1 );
-			}
+	if ( pd.used || purged ) {
+		Modifications mod;
+		struct berval bv[2];
+		rs_reinit( &rs, REP_RESULT );
+		/* update context's entryCSN to reflect oldest CSN */
+		mod.sml_numvals = 1;
+		mod.sml_values = bv;
+		bv[0] = pd.csn;
+		BER_BVZERO(&bv[1]);
+		mod.sml_nvalues = NULL;
+		mod.sml_desc = slap_schema.si_ad_entryCSN;
+		mod.sml_op = LDAP_MOD_REPLACE;
+		mod.sml_flags = SLAP_MOD_INTERNAL;
+		mod.sml_next = NULL;
+
+		op->o_tag = LDAP_REQ_MODIFY;
+		op->orm_modlist = &mod;
+		op->orm_no_opattrs = 1;
+		op->o_req_dn = li->li_db->be_suffix[0];
+		op->o_req_ndn = li->li_db->be_nsuffix[0];
+		op->o_no_schema_check = 1;
+		op->o_managedsait = SLAP_CONTROL_NONCRITICAL;
+		op->o_bd->be_modify( op, &rs );
+		if ( mod.sml_next ) {
+			slap_mods_free( mod.sml_next, 1 );
 		}
 	}
 
@@ -36,6 +36,7 @@
 #define	DDS_RF2589_MAX_TTL		(31557600)	/* 1 year + 6 hours */
 #define	DDS_RF2589_DEFAULT_TTL		(86400)		/* 1 day */
 #define	DDS_DEFAULT_INTERVAL		(3600)		/* 1 hour */
+#define	DDS_EXPIRE_BATCH		(256)		/* deletions per run */
 
 typedef struct dds_info_t {
 	unsigned		di_flags;
@@ -63,6 +64,11 @@ typedef struct dds_info_t {
 	int			di_num_dynamicObjects;
 	int			di_max_dynamicObjects;
 
+	/* expiry index, protected by di_mutex: all dynamic objects
+	 * by DN, and those with an entryExpireTimestamp by time */
+	TAvlnode		*di_byndn;
+	TAvlnode		*di_byexp;
+
 	/* used to advertize the dynamicSubtrees in the root DSE,
 	 * and to select the database in the expiration task */
 	BerVarray		di_suffix;
@@ -72,150 +78,373 @@ typedef struct dds_info_t {
 static struct berval slap_EXOP_REFRESH = BER_BVC( LDAP_EXOP_REFRESH );
 static AttributeDescription	*ad_entryExpireTimestamp;
 
-/* list of expired DNs */
-typedef struct dds_expire_t {
-	struct berval		de_ndn;
-	struct dds_expire_t	*de_next;
-} dds_expire_t;
+/* expiry index node; dn_expire is 0 when the object
+ * has no entryExpireTimestamp, and is not scheduled */
+typedef struct dds_node_t {
+	time_t			dn_expire;
+	struct berval		dn_ndn;
+} dds_node_t;
 
-typedef struct dds_cb_t {
-	dds_expire_t	*dc_ndnlist;
-} dds_cb_t;
+/* DNs are compared from their last character, so that the
+ * subordinates of a DN, which all end in ",<DN>", are adjacent */
+static int
+dds_node_ndn_cmp( const void *c1, const void *c2 )
+{
+	const dds_node_t	*n1 = c1, *n2 = c2;
+	const unsigned char	*p1, *p2;
+	ber_len_t		i;
+
+	p1 = (const unsigned char *)&n1->dn_ndn.bv_val[ n1->dn_ndn.bv_len ];
+	p2 = (const unsigned char *)&n2->dn_ndn.bv_val[ n2->dn_ndn.bv_len ];
+	for ( i = 0; i < n1->dn_ndn.bv_len && i < n2->dn_ndn.bv_len; i++ ) {
+		if ( *--p1 != *--p2 ) {
+			return *p1 < *p2 ? -1 : 1;
+		}
+	}
+
+	if ( n1->dn_ndn.bv_len != n2->dn_ndn.bv_len ) {
+		return n1->dn_ndn.bv_len < n2->dn_ndn.bv_len ? -1 : 1;
+	}
+
+	return 0;
+}
 
 static int
-dds_expire_cb( Operation *op, SlapReply *rs )
+dds_node_exp_cmp( const void *c1, const void *c2 )
 {
-	dds_cb_t	*dc = (dds_cb_t *)op->o_callback->sc_private;
-	dds_expire_t	*de;
-	int		rc;
+	const dds_node_t	*n1 = c1, *n2 = c2;
 
-	switch ( rs->sr_type ) {
-	case REP_SEARCH:
-		/* alloc list and buffer for berval all in one */
-		de = op->o_tmpalloc( sizeof( dds_expire_t ) + rs->sr_entry->e_nname.bv_len + 1,
-			op->o_tmpmemctx );
+	if ( n1->dn_expire != n2->dn_expire ) {
+		return n1->dn_expire < n2->dn_expire ? -1 : 1;
+	}
 
-		de->de_next = dc->dc_ndnlist;
-		dc->dc_ndnlist = de;
+	return ber_bvcmp( &n1->dn_ndn, &n2->dn_ndn );
+}
 
-		de->de_ndn.bv_len = rs->sr_entry->e_nname.bv_len;
-		de->de_ndn.bv_val = (char *)&de[ 1 ];
-		AC_MEMCPY( de->de_ndn.bv_val, rs->sr_entry->e_nname.bv_val,
-			rs->sr_entry->e_nname.bv_len + 1 );
-		rc = 0;
-		break;
+/* whether the node's DN ends in sfx, i.e. ",<DN of the superior>" */
+static int
+dds_node_is_sub( dds_node_t *dn, struct berval *sfx )
+{
+	return dn->dn_ndn.bv_len > sfx->bv_len
+		&& !memcmp( &dn->dn_ndn.bv_val[ dn->dn_ndn.bv_len - sfx->bv_len ],
+			sfx->bv_val, sfx->bv_len );
+}
 
-	case REP_SEARCHREF:
-	case REP_RESULT:
-		rc = rs->sr_err;
-		break;
+static dds_node_t *
+dds_node_alloc( struct berval *ndn, time_t expire )
+{
+	dds_node_t	*dn;
 
-	default:
-		assert( 0 );
+	dn = ch_malloc( sizeof( dds_node_t ) + ndn->bv_len + 1 );
+	dn->dn_expire = expire;
+	dn->dn_ndn.bv_len = ndn->bv_len;
+	dn->dn_ndn.bv_val = (char *)&dn[ 1 ];
+	AC_MEMCPY( dn->dn_ndn.bv_val, ndn->bv_val, ndn->bv_len + 1 );
+
+	return dn;
+}
+
+static dds_node_t *
+dds_index_find( dds_info_t *di, struct berval *ndn )
+{
+	dds_node_t	tmp;
+
+	tmp.dn_ndn = *ndn;
+
+	return tavl_find( di->di_byndn, &tmp, dds_node_ndn_cmp );
+}
+
+/* returns the first dynamic subordinate of ndn in the DN index,
+ * or NULL; the others follow it; di_mutex must be held */
+static TAvlnode *
+dds_index_first_sub( dds_info_t *di, struct berval *ndn, void *ctx )
+{
+	dds_node_t	tmp;
+	TAvlnode	*node;
+	int		c;
+
+	/* the smallest key ending in ",<ndn>" */
+	tmp.dn_ndn.bv_len = ndn->bv_len + 1;
+	tmp.dn_ndn.bv_val = slap_sl_malloc( tmp.dn_ndn.bv_len + 1, ctx );
+	tmp.dn_ndn.bv_val[ 0 ] = ',';
+	AC_MEMCPY( &tmp.dn_ndn.bv_val[ 1 ], ndn->bv_val, ndn->bv_len + 1 );
+
+	node = tavl_find3( di->di_byndn, &tmp, dds_node_ndn_cmp, &c );
+	if ( node != NULL && c > 0 ) {
+		node = tavl_next( node, TAVL_DIR_RIGHT );
+	}
+	if ( node != NULL && !dds_node_is_sub( node->avl_data, &tmp.dn_ndn ) ) {
+		node = NULL;
 	}
+	slap_sl_free( tmp.dn_ndn.bv_val, ctx );
 
-	return rc;
+	return node;
+}
+
+/* add or reschedule a dynamic object; di_mutex must be held */
+static void
+dds_index_set( dds_info_t *di, struct berval *ndn, time_t expire )
+{
+	dds_node_t	*dn;
+
+	dn = dds_index_find( di, ndn );
+	if ( dn == NULL ) {
+		dn = dds_node_alloc( ndn, expire );
+		tavl_insert( &di->di_byndn, dn, dds_node_ndn_cmp, avl_dup_error );
+		di->di_num_dynamicObjects++;
+
+	} else if ( dn->dn_expire == expire ) {
+		return;
+
+	} else {
+		if ( dn->dn_expire ) {
+			tavl_delete( &di->di_byexp, dn, dds_node_exp_cmp );
+		}
+		dn->dn_expire = expire;
+	}
+
+	if ( dn->dn_expire ) {
+		tavl_insert( &di->di_byexp, dn, dds_node_exp_cmp, avl_dup_error );
+	}
 }
 
+/* remove a dynamic object; di_mutex must be held */
+static void
+dds_index_del( dds_info_t *di, struct berval *ndn )
+{
+	dds_node_t	*dn;
+
+	dn = dds_index_find( di, ndn );
+	if ( dn == NULL ) {
+		return;
+	}
+
+	if ( dn->dn_expire ) {
+		tavl_delete( &di->di_byexp, dn, dds_node_exp_cmp );
+	}
+	tavl_delete( &di->di_byndn, dn, dds_node_ndn_cmp );
+	assert( di->di_num_dynamicObjects > 0 );
+	di->di_num_dynamicObjects--;
+	ch_free( dn );
+}
+
+/* whether ndn or any of its subordinates is a dynamic object;
+ * di_mutex must be held */
+static int
+dds_index_has_subtree( dds_info_t *di, struct berval *ndn, void *ctx )
+{
+	return dds_index_find( di, ndn ) != NULL
+		|| dds_index_first_sub( di, ndn, ctx ) != NULL;
+}
+
+/* move a renamed object and its dynamic subordinates;
+ * di_mutex must be held */
+static void
+dds_index_rename( dds_info_t *di, struct berval *ndn, struct berval *newndn,
+	void *ctx )
+{
+	dds_node_t	**nodes = NULL, *dn;
+	TAvlnode	*node;
+	struct berval	sfx;
+	int		i, num = 0, max = 0;
+
+	/* collect the object and its subordinates, which are
+	 * adjacent in the DN index, before moving them */
+	sfx.bv_len = ndn->bv_len + 1;
+	sfx.bv_val = slap_sl_malloc( sfx.bv_len + 1, ctx );
+	sfx.bv_val[ 0 ] = ',';
+	AC_MEMCPY( &sfx.bv_val[ 1 ], ndn->bv_val, ndn->bv_len + 1 );
+
+	dn = dds_index_find( di, ndn );
+	node = dds_index_first_sub( di, ndn, ctx );
+	for ( ;; ) {
+		if ( dn == NULL ) {
+			if ( node == NULL || !dds_node_is_sub( node->avl_data, &sfx ) ) {
+				break;
+			}
+			dn = node->avl_data;
+			node = tavl_next( node, TAVL_DIR_RIGHT );
+		}
+
+		if ( num == max ) {
+			max = max ? 2 * max : 8;
+			nodes = ch_realloc( nodes, max * sizeof( dds_node_t * ) );
+		}
+		nodes[ num++ ] = dn;
+		dn = NULL;
+	}
+	slap_sl_free( sfx.bv_val, ctx );
+
+	for ( i = 0; i < num; i++ ) {
+		dds_node_t	*newdn;
+		struct berval	bv;
+		ber_len_t	len;
+
+		dn = nodes[ i ];
+		len = dn->dn_ndn.bv_len - ndn->bv_len;
+
+		if ( dn->dn_expire ) {
+			tavl_delete( &di->di_byexp, dn, dds_node_exp_cmp );
+		}
+		tavl_delete( &di->di_byndn, dn, dds_node_ndn_cmp );
+
+		bv.bv_len = len + newndn->bv_len;
+		bv.bv_val = ch_malloc( bv.bv_len + 1 );
+		AC_MEMCPY( bv.bv_val, dn->dn_ndn.bv_val, len );
+		AC_MEMCPY( &bv.bv_val[ len ], newndn->bv_val, newndn->bv_len + 1 );
+
+		newdn = dds_node_alloc( &bv, dn->dn_expire );
+		ch_free( bv.bv_val );
+		ch_free( dn );
+
+		tavl_insert( &di->di_byndn, newdn, dds_node_ndn_cmp, avl_dup_error );
+		if ( newdn->dn_expire ) {
+			tavl_insert( &di->di_byexp, newdn, dds_node_exp_cmp, avl_dup_error );
+		}
+	}
+
+	ch_free( nodes );
+}
+
+static void
+dds_index_free( dds_info_t *di )
+{
+	ldap_pvt_thread_mutex_lock( &di->di_mutex );
+	tavl_free( di->di_byexp, NULL );
+	di->di_byexp = NULL;
+	tavl_free( di->di_byndn, ch_free );
+	di->di_byndn = NULL;
+	di->di_num_dynamicObjects = 0;
+	ldap_pvt_thread_mutex_unlock( &di->di_mutex );
+}
+
+/* parses an entryExpireTimestamp value; returns 0 if invalid */
+static time_t
+dds_expire_time( Attribute *a )
+{
+	struct lutil_tm		tm;
+	struct lutil_timet	tt;
+
+	if ( a == NULL || a->a_numvals == 0
+		|| lutil_parsetime( a->a_nvals[ 0 ].bv_val, &tm ) )
+	{
+		return 0;
+	}
+
+	lutil_tm2time( &tm, &tt );
+
+	return (time_t)tt.tt_sec;
+}
+
+/* moves a due object that could not be deleted down the expiry
+ * index by one interval, so that it does not hold up the objects
+ * behind it; di_mutex must be held */
+static void
+dds_expire_defer( dds_info_t *di, struct berval *ndn, time_t now )
+{
+	if ( dds_index_find( di, ndn ) != NULL ) {
+		dds_index_set( di, ndn, now + DDS_INTERVAL( di ) );
+	}
+}
+
+/* list of expired DNs */
+typedef struct dds_expire_t {
+	struct berval		de_ndn;
+	struct dds_expire_t	*de_next;
+} dds_expire_t;
+
+/* deletes the objects that are due according to the expiry index,
+ * at most DDS_EXPIRE_BATCH per run; sets *morep if more are due */
 static int
-dds_expire( void *ctx, dds_info_t *di )
+dds_expire( void *ctx, dds_info_t *di, int *morep )
 {
 	Connection	conn = { 0 };
 	OperationBuffer opbuf;
 	Operation	*op;
 	slap_callback	sc = { 0 };
-	dds_cb_t	dc = { 0 };
-	dds_expire_t	*de = NULL, **dep;
+	dds_expire_t	*de = NULL, **dep, *delist = NULL;
 	SlapReply	rs = { REP_RESULT };
+	TAvlnode	*node;
 
 	time_t		expire;
-	char		tsbuf[ LDAP_LUTIL_GENTIME_BUFSIZE ];
-	struct berval	ts;
 
-	int		ndeletes, ntotdeletes;
-
-	int		rc;
-	char		*extra = "";
+	int		ndue, ndeletes, ntotdeletes;
 
 	connection_fake_init2( &conn, &opbuf, ctx, 0 );
 	op = &opbuf.ob_op;
 
-	op->o_tag = LDAP_REQ_SEARCH;
-	memset( &op->oq_search, 0, sizeof( op->oq_search ) );
-
-	op->o_bd = select_backend( &di->di_nsuffix[ 0 ], 0 );
-
-	op->o_req_dn = op->o_bd->be_suffix[ 0 ];
-	op->o_req_ndn = op->o_bd->be_nsuffix[ 0 ];
+	*morep = 0;
+	expire = slap_get_time() - di->di_tolerance;
 
-	op->o_dn = op->o_bd->be_rootdn;
-	op->o_ndn = op->o_bd->be_rootndn;
+	/* collect the due objects, earliest first */
+	dep = &delist;
+	ndue = 0;
+	ldap_pvt_thread_mutex_lock( &di->di_mutex );
+	for ( node = tavl_end( di->di_byexp, TAVL_DIR_LEFT ); node != NULL;
+		node = tavl_next( node, TAVL_DIR_RIGHT ) )
+	{
+		dds_node_t	*dn = node->avl_data;
 
-	op->ors_scope = LDAP_SCOPE_SUBTREE;
-	op->ors_tlimit = DDS_INTERVAL( di )/2 + 1;
-	op->ors_slimit = SLAP_NO_LIMIT;
-	op->ors_attrs = slap_anlist_no_attrs;
+		if ( dn->dn_expire > expire ) {
+			break;
+		}
 
-	expire = slap_get_time() - di->di_tolerance;
-	ts.bv_val = tsbuf;
-	ts.bv_len = sizeof( tsbuf );
-	slap_timestamp( &expire, &ts );
-
-	op->ors_filterstr.bv_len = STRLENOF( "(&(objectClass=" ")(" "<=" "))" )
-		+ slap_schema.si_oc_dynamicObject->soc_cname.bv_len
-		+ ad_entryExpireTimestamp->ad_cname.bv_len
-		+ ts.bv_len;
-	op->ors_filterstr.bv_val = op->o_tmpalloc( op->ors_filterstr.bv_len + 1, op->o_tmpmemctx );
-	snprintf( op->ors_filterstr.bv_val, op->ors_filterstr.bv_len + 1,
-		"(&(objectClass=%s)(%s<=%s))",
-		slap_schema.si_oc_dynamicObject->soc_cname.bv_val,
-		ad_entryExpireTimestamp->ad_cname.bv_val, ts.bv_val );
+		if ( ndue == DDS_EXPIRE_BATCH ) {
+			*morep = 1;
+			break;
+		}
 
-	op->ors_filter = str2filter_x( op, op->ors_filterstr.bv_val );
-	if ( op->ors_filter == NULL ) {
-		rs.sr_err = LDAP_OTHER;
-		goto done_search;
+		/* alloc list and buffer for berval all in one */
+		de = op->o_tmpalloc( sizeof( dds_expire_t ) + dn->dn_ndn.bv_len + 1,
+			op->o_tmpmemctx );
+		de->de_next = NULL;
+		de->de_ndn.bv_len = dn->dn_ndn.bv_len;
+		de->de_ndn.bv_val = (char *)&de[ 1 ];
+		AC_MEMCPY( de->de_ndn.bv_val, dn->dn_ndn.bv_val,
+			dn->dn_ndn.bv_len + 1 );
+		*dep = de;
+		dep = &de->de_next;
+		ndue++;
 	}
-	
-	op->o_callback = &sc;
-	sc.sc_response = dds_expire_cb;
-	sc.sc_private = &dc;
+	ldap_pvt_thread_mutex_unlock( &di->di_mutex );
 
-	(void)op->o_bd->bd_info->bi_op_search( op, &rs );
-
-done_search:;
-	op->o_tmpfree( op->ors_filterstr.bv_val, op->o_tmpmemctx );
-	filter_free_x( op, op->ors_filter, 1 );
+	if ( delist == NULL ) {
+		return LDAP_SUCCESS;
+	}
 
-	rc = rs.sr_err;
-	switch ( rs.sr_err ) {
-	case LDAP_SUCCESS:
-		break;
+	op->o_tag = LDAP_REQ_DELETE;
 
-	case LDAP_NO_SUCH_OBJECT:
-		/* (ITS#5267) database not created yet? */
-		rs.sr_err = LDAP_SUCCESS;
-		extra = " (ignored)";
-		/* fallthru */
+	op->o_bd = select_backend( &di->di_nsuffix[ 0 ], 0 );
 
-	default:
-		Log2( LDAP_DEBUG_ANY, LDAP_LEVEL_ERR,
-			"DDS expired objects lookup failed err=%d%s\n",
-			rc, extra );
-		goto done;
-	}
+	op->o_dn = op->o_bd->be_rootdn;
+	op->o_ndn = op->o_bd->be_rootndn;
 
-	op->o_tag = LDAP_REQ_DELETE;
 	op->o_callback = &sc;
 	sc.sc_response = slap_null_cb;
 	sc.sc_private = NULL;
 
-	for ( ntotdeletes = 0, ndeletes = 1; dc.dc_ndnlist != NULL  && ndeletes > 0; ) {
+	/* subordinates are deleted first; superiors
+	 * that are still non-leaf are retried */
+	for ( ntotdeletes = 0, ndeletes = 1; delist != NULL && ndeletes > 0; ) {
 		ndeletes = 0;
 
-		for ( dep = &dc.dc_ndnlist; *dep != NULL; ) {
+		for ( dep = &delist; *dep != NULL; ) {
+			dds_node_t	*dn;
+			int		due;
+
 			de = *dep;
 
+			/* skip objects refreshed or deleted meanwhile */
+			ldap_pvt_thread_mutex_lock( &di->di_mutex );
+			dn = dds_index_find( di, &de->de_ndn );
+			due = ( dn != NULL && dn->dn_expire && dn->dn_expire <= expire );
+			ldap_pvt_thread_mutex_unlock( &di->di_mutex );
+			if ( !due ) {
+				*dep = de->de_next;
+				op->o_tmpfree( de, op->o_tmpmemctx );
+				continue;
+			}
+
 			op->o_req_dn = de->de_ndn;
 			op->o_req_ndn = de->de_ndn;
 			(void)op->o_bd->bd_info->bi_op_delete( op, &rs );
@@ -227,6 +456,13 @@ done_search:;
 				ndeletes++;
 				break;
 
+			case LDAP_NO_SUCH_OBJECT:
+				/* stale index entry */
+				ldap_pvt_thread_mutex_lock( &di->di_mutex );
+				dds_index_del( di, &de->de_ndn );
+				ldap_pvt_thread_mutex_unlock( &di->di_mutex );
+				break;
+
 			case LDAP_NOT_ALLOWED_ON_NONLEAF:
 				Log1( LDAP_DEBUG_ANY, LDAP_LEVEL_NOTICE,
 					"DDS dn=\"%s\" is non-leaf; "
@@ -241,6 +477,9 @@ done_search:;
 					"DDS dn=\"%s\" err=%d; "
 					"deferring.\n",
 					de->de_ndn.bv_val, rs.sr_err );
+				ldap_pvt_thread_mutex_lock( &di->di_mutex );
+				dds_expire_defer( di, &de->de_ndn, slap_get_time() );
+				ldap_pvt_thread_mutex_unlock( &di->di_mutex );
 				break;
 			}
 
@@ -253,13 +492,23 @@ done_search:;
 		ntotdeletes += ndeletes;
 	}
 
-	rs.sr_err = LDAP_SUCCESS;
+	/* objects still in the list have subordinates left; they are
+	 * retried once those are gone */
+	ldap_pvt_thread_mutex_lock( &di->di_mutex );
+	for ( de = delist; de != NULL; de = de->de_next ) {
+		dds_expire_defer( di, &de->de_ndn, slap_get_time() );
+	}
+	ldap_pvt_thread_mutex_unlock( &di->di_mutex );
+	while ( delist != NULL ) {
+		de = delist;
+		delist = de->de_next;
+		op->o_tmpfree( de, op->o_tmpmemctx );
+	}
 
-	Log1( LDAP_DEBUG_STATS, LDAP_LEVEL_INFO,
-		"DDS expired=%d\n", ntotdeletes );
+	Log2( LDAP_DEBUG_STATS, LDAP_LEVEL_INFO,
+		"DDS expired=%d due=%d\n", ntotdeletes, ndue );
 
-done:;
-	return rs.sr_err;
+	return LDAP_SUCCESS;
 }
 
 static void *
@@ -268,15 +517,25 @@ dds_expire_fn( void *ctx, void *arg )
 	struct re_s     *rtask = arg;
 	dds_info_t	*di = rtask->arg;
 
+	int		more;
+
 	assert( di->di_expire_task == rtask );
 
-	(void)dds_expire( ctx, di );
+	(void)dds_expire( ctx, di, &more );
 	
 	ldap_pvt_thread_mutex_lock( &slapd_rq.rq_mutex );
 	if ( ldap_pvt_runqueue_isrunning( &slapd_rq, rtask )) {
 		ldap_pvt_runqueue_stoptask( &slapd_rq, rtask );
 	}
-	ldap_pvt_runqueue_resched( &slapd_rq, rtask, 0 );
+	if ( more && !slapd_shutdown ) {
+		/* more objects are due: run the next batch right away */
+		rtask->interval.tv_sec = 0;
+		ldap_pvt_runqueue_resched( &slapd_rq, rtask, 0 );
+		rtask->interval.tv_sec = DDS_INTERVAL( di );
+
+	} else {
+		ldap_pvt_runqueue_resched( &slapd_rq, rtask, 0 );
+	}
 	ldap_pvt_thread_mutex_unlock( &slapd_rq.rq_mutex );
 
 	return NULL;
@@ -292,27 +551,47 @@ dds_freeit_cb( Operation *op, SlapReply *rs )
 	return SLAP_CB_CONTINUE;
 }
 
-/* updates counter - installed on add/delete only if required */
+/* updates the expiry index and the counter */
+typedef struct dds_index_cb_t {
+	slap_callback		dic_cb;
+	dds_info_t		*dic_di;
+	time_t			dic_expire;
+} dds_index_cb_t;
+
 static int
-dds_counter_cb( Operation *op, SlapReply *rs )
+dds_index_cb( Operation *op, SlapReply *rs )
 {
 	assert( rs->sr_type == REP_RESULT );
 
 	if ( rs->sr_err == LDAP_SUCCESS ) {
-		dds_info_t	*di = op->o_callback->sc_private;
+		dds_index_cb_t	*dic = (dds_index_cb_t *)op->o_callback;
+		dds_info_t	*di = dic->dic_di;
 
 		ldap_pvt_thread_mutex_lock( &di->di_mutex );
 		switch ( op->o_tag ) {
 		case LDAP_REQ_DELETE:
-			assert( di->di_num_dynamicObjects > 0 );
-			di->di_num_dynamicObjects--;
+			dds_index_del( di, &op->o_req_ndn );
 			break;
 
 		case LDAP_REQ_ADD:
-			assert( di->di_num_dynamicObjects < di->di_max_dynamicObjects );
-			di->di_num_dynamicObjects++;
+		case LDAP_REQ_MODIFY:
+			dds_index_set( di, &op->o_req_ndn, dic->dic_expire );
 			break;
 
+		case LDAP_REQ_MODRDN: {
+			struct berval	pndn, newndn;
+
+			if ( op->orr_nnewSup != NULL ) {
+				pndn = *op->orr_nnewSup;
+
+			} else {
+				dnParent( &op->o_req_ndn, &pndn );
+			}
+			build_new_dn( &newndn, &pndn, &op->orr_nnewrdn, op->o_tmpmemctx );
+			dds_index_rename( di, &op->o_req_ndn, &newndn, op->o_tmpmemctx );
+			op->o_tmpfree( newndn.bv_val, op->o_tmpmemctx );
+			} break;
+
 		default:
 			assert( 0 );
 		}
@@ -322,6 +601,23 @@ dds_counter_cb( Operation *op, SlapReply *rs )
 	return dds_freeit_cb( op, rs );
 }
 
+static void
+dds_index_cb_install( Operation *op, dds_info_t *di, time_t expire )
+{
+	dds_index_cb_t	*dic;
+
+	dic = op->o_tmpalloc( sizeof( dds_index_cb_t ), op->o_tmpmemctx );
+	dic->dic_cb.sc_cleanup = dds_freeit_cb;
+	dic->dic_cb.sc_response = dds_index_cb;
+	dic->dic_cb.sc_private = NULL;
+	dic->dic_cb.sc_writewait = 0;
+	dic->dic_cb.sc_next = op->o_callback;
+	dic->dic_di = di;
+	dic->dic_expire = expire;
+
+	op->o_callback = &dic->dic_cb;
+}
+
 static int
 dds_op_add( Operation *op, SlapReply *rs )
 {
@@ -433,19 +729,7 @@ dds_op_add( Operation *op, SlapReply *rs )
 		assert( attr_find( op->ora_e->e_attrs, ad_entryExpireTimestamp ) == NULL );
 		attr_merge_one( op->ora_e, ad_entryExpireTimestamp, &bv, &bv );
 
-		/* if required, install counter callback */
-		if ( di->di_max_dynamicObjects > 0) {
-			slap_callback	*sc;
-
-			sc = op->o_tmpalloc( sizeof( slap_callback ), op->o_tmpmemctx );
-			sc->sc_cleanup = dds_freeit_cb;
-			sc->sc_response = dds_counter_cb;
-			sc->sc_private = di;
-			sc->sc_next = op->o_callback;
-			sc->sc_writewait = 0;
-
-			op->o_callback = sc;
-		}
+		dds_index_cb_install( op, di, expire );
 	}
 
 	return SLAP_CB_CONTINUE;
@@ -456,33 +740,19 @@ dds_op_delete( Operation *op, SlapReply *rs )
 {
 	slap_overinst	*on = (slap_overinst *)op->o_bd->bd_info;
 	dds_info_t	*di = on->on_bi.bi_private;
+	int		is_dynamicObject;
 
-	/* if required, install counter callback */
-	if ( !DDS_OFF( di ) && di->di_max_dynamicObjects > 0 ) {
-		Entry		*e = NULL;
-		BackendInfo	*bi = op->o_bd->bd_info;
+	if ( DDS_OFF( di ) ) {
+		return SLAP_CB_CONTINUE;
+	}
 
-		op->o_bd->bd_info = (BackendInfo *)on->on_info;
-		rs->sr_err = be_entry_get_rw( op, &op->o_req_ndn,
-			slap_schema.si_oc_dynamicObject, NULL, 0, &e );
+	/* all dynamic objects are in the index */
+	ldap_pvt_thread_mutex_lock( &di->di_mutex );
+	is_dynamicObject = ( dds_index_find( di, &op->o_req_ndn ) != NULL );
+	ldap_pvt_thread_mutex_unlock( &di->di_mutex );
 
-		/* FIXME: couldn't the entry be added before deletion? */
-		if ( rs->sr_err == LDAP_SUCCESS && e != NULL ) {
-			slap_callback	*sc;
-	
-			be_entry_release_r( op, e );
-			e = NULL;
-	
-			sc = op->o_tmpalloc( sizeof( slap_callback ), op->o_tmpmemctx );
-			sc->sc_cleanup = dds_freeit_cb;
-			sc->sc_response = dds_counter_cb;
-			sc->sc_private = di;
-			sc->sc_writewait = 0;
-			sc->sc_next = op->o_callback;
-	
-			op->o_callback = sc;
-		}
-		op->o_bd->bd_info = bi;
+	if ( is_dynamicObject ) {
+		dds_index_cb_install( op, di, 0 );
 	}
 
 	return SLAP_CB_CONTINUE;
@@ -779,6 +1049,7 @@ done:;
 
 	if ( rs->sr_err == LDAP_SUCCESS && entryTtl != 0 ) {
 		Modifications	*tmpmod = NULL, **modp;
+		time_t		expire = 0;
 
 		for ( modp = &op->orm_modlist; *modp; modp = &(*modp)->sml_next )
 			;
@@ -795,7 +1066,6 @@ done:;
 			tmpmod->sml_op = LDAP_MOD_DELETE;
 
 		} else {
-			time_t		expire;
 			char		tsbuf[ LDAP_LUTIL_GENTIME_BUFSIZE ];
 			struct berval	bv;
 
@@ -811,6 +1081,11 @@ done:;
 			value_add_one( &tmpmod->sml_nvalues, &bv );
 			tmpmod->sml_numvals = 1;
 		}
+
+		/* reschedule, or unschedule if entryTtl was deleted */
+		if ( is_dynamicObject ) {
+			dds_index_cb_install( op, di, expire );
+		}
 	}
 
 	if ( rs->sr_err ) {
@@ -827,6 +1102,7 @@ dds_op_rename( Operation *op, SlapReply *rs )
 {
 	slap_overinst	*on = (slap_overinst *)op->o_bd->bd_info;
 	dds_info_t	*di = on->on_bi.bi_private;
+	int		is_indexed;
 
 	if ( DDS_OFF( di ) ) {
 		return SLAP_CB_CONTINUE;
@@ -876,6 +1152,15 @@ dds_op_rename( Operation *op, SlapReply *rs )
 		}
 	}
 
+	/* only if the object or some of its subordinates is dynamic */
+	ldap_pvt_thread_mutex_lock( &di->di_mutex );
+	is_indexed = dds_index_has_subtree( di, &op->o_req_ndn, op->o_tmpmemctx );
+	ldap_pvt_thread_mutex_unlock( &di->di_mutex );
+
+	if ( is_indexed ) {
+		dds_index_cb_install( op, di, 0 );
+	}
+
 	return SLAP_CB_CONTINUE;
 }
 
@@ -1657,17 +1942,21 @@ dds_entry_info( void *arg, Entry *e )
 	return 0;
 }
 
-/* callback that counts the returned entries, since the search
+/* callback that indexes the returned entries, since the search
  * does not get to the point in slap_send_search_entries where
  * the actual count occurs */
 static int
-dds_count_cb( Operation *op, SlapReply *rs )
+dds_load_cb( Operation *op, SlapReply *rs )
 {
-	int	*nump = (int *)op->o_callback->sc_private;
+	dds_info_t	*di = (dds_info_t *)op->o_callback->sc_private;
 
 	switch ( rs->sr_type ) {
 	case REP_SEARCH:
-		(*nump)++;
+		ldap_pvt_thread_mutex_lock( &di->di_mutex );
+		dds_index_set( di, &rs->sr_entry->e_nname,
+			dds_expire_time( attr_find( rs->sr_entry->e_attrs,
+				ad_entryExpireTimestamp ) ) );
+		ldap_pvt_thread_mutex_unlock( &di->di_mutex );
 		break;
 
 	case REP_SEARCHREF:
@@ -1681,9 +1970,11 @@ dds_count_cb( Operation *op, SlapReply *rs )
 	return 0;
 }
 
-/* count dynamic objects existing in the database at startup */
+/* build the expiry index from the dynamic objects existing
+ * in the database at startup; with an equality index on
+ * objectClass, only the dynamic objects are read */
 static int
-dds_count( void *ctx, BackendDB *be )
+dds_load( void *ctx, BackendDB *be )
 {
 	slap_overinst	*on = (slap_overinst *)be->bd_info;
 	dds_info_t	*di = (dds_info_t *)on->on_bi.bi_private;
@@ -1693,6 +1984,7 @@ dds_count( void *ctx, BackendDB *be )
 	Operation	*op;
 	slap_callback	sc = { 0 };
 	SlapReply	rs = { REP_RESULT };
+	AttributeName	an[ 2 ];
 
 	int		rc;
 	char		*extra = "";
@@ -1711,10 +2003,14 @@ dds_count( void *ctx, BackendDB *be )
 	op->o_dn = op->o_bd->be_rootdn;
 	op->o_ndn = op->o_bd->be_rootndn;
 
+	memset( an, 0, sizeof( an ) );
+	an[ 0 ].an_desc = ad_entryExpireTimestamp;
+	an[ 0 ].an_name = ad_entryExpireTimestamp->ad_cname;
+
 	op->ors_scope = LDAP_SCOPE_SUBTREE;
 	op->ors_tlimit = SLAP_NO_LIMIT;
 	op->ors_slimit = SLAP_NO_LIMIT;
-	op->ors_attrs = slap_anlist_no_attrs;
+	op->ors_attrs = an;
 
 	op->ors_filterstr.bv_len = STRLENOF( "(objectClass=" ")" )
 		+ slap_schema.si_oc_dynamicObject->soc_cname.bv_len;
@@ -1730,9 +2026,9 @@ dds_count( void *ctx, BackendDB *be )
 	}
 	
 	op->o_callback = &sc;
-	sc.sc_response = dds_count_cb;
-	sc.sc_private = &di->di_num_dynamicObjects;
-	di->di_num_dynamicObjects = 0;
+	sc.sc_response = dds_load_cb;
+	sc.sc_private = di;
+	dds_index_free( di );
 
 	op->o_bd->bd_info = (BackendInfo *)on->on_info;
 	(void)op->o_bd->bd_info->bi_op_search( op, &rs );
@@ -1801,8 +2097,8 @@ dds_db_open(
 	di->di_suffix = be->be_suffix;
 	di->di_nsuffix = be->be_nsuffix;
 
-	/* count the dynamic objects first */
-	rc = dds_count( thrctx, be );
+	/* index the dynamic objects first */
+	rc = dds_load( thrctx, be );
 	if ( rc != LDAP_SUCCESS ) {
 		rc = 1;
 		goto done;
@@ -1845,6 +2141,10 @@ dds_db_close(
 
 	(void)entry_info_unregister( dds_entry_info, (void *)di );
 
+	if ( di ) {
+		dds_index_free( di );
+	}
+
 	return 0;
 }
 
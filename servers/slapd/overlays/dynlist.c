@@ -56,6 +56,48 @@ typedef struct dynlist_info_t {
 	struct dynlist_info_t	*dli_next;
 } dynlist_info_t;
 
+/* A URL of a materialized group, parsed once */
+typedef struct dynlist_murl_t {
+	struct berval		dmu_nbase;
+	int			dmu_scope;
+	Filter			*dmu_filter;
+	struct berval		dmu_filterstr;
+	struct dynlist_murl_t	*dmu_next;
+} dynlist_murl_t;
+
+/* The expanded member list of a dynamic group, kept up to date
+ * by the writes going through the overlay.
+ */
+typedef struct dynlist_mat_t {
+	struct berval		dm_ndn;
+	dynlist_info_t		*dm_dli;
+	BerVarray		dm_urls;	/* the URLs it was built from */
+	dynlist_murl_t		*dm_murls;
+	Avlnode			*dm_members;	/* of dynlist_mdn_t */
+	int			dm_nmembers;
+	struct dynlist_mat_t	*dm_lrunext;	/* towards the least used */
+	struct dynlist_mat_t	*dm_lruprev;
+} dynlist_mat_t;
+
+typedef struct dynlist_mdn_t {
+	struct berval		dd_name;
+	struct berval		dd_nname;
+} dynlist_mdn_t;
+
+typedef struct dynlist_gen_t {
+	dynlist_info_t		*dlg_dli;
+	int			dlg_materialize;
+	ldap_pvt_thread_mutex_t	dlg_mutex;
+	Avlnode			*dlg_groups;	/* of dynlist_mat_t */
+	dynlist_mat_t		*dlg_lruhead;	/* most recently used */
+	dynlist_mat_t		*dlg_lrutail;
+	int			dlg_ngroups;
+	int			dlg_maxgroups;	/* 0 for no limit */
+	unsigned long		dlg_gen;	/* bumped by every write */
+} dynlist_gen_t;
+
+#define DYNLIST_MAT_MAXGROUPS	1000
+
 #define DYNLIST_USAGE \
 	"\"dynlist-attrset <oc> [uri] <URL-ad> [[<mapped-ad>:]<member-ad> ...]\": "
 
@@ -68,7 +110,7 @@ dynlist_is_dynlist_next( Operation *op, SlapReply *rs, dynlist_info_t *old_dli )
 	Attribute	*a;
 
 	if ( old_dli == NULL ) {
-		dli = (dynlist_info_t *)on->on_bi.bi_private;
+		dli = ((dynlist_gen_t *)on->on_bi.bi_private)->dlg_dli;
 
 	} else {
 		dli = old_dli->dli_next;
@@ -116,7 +158,7 @@ static int
 dynlist_make_filter( Operation *op, Entry *e, const char *url, struct berval *oldf, struct berval *newf )
 {
 	slap_overinst	*on = (slap_overinst *)op->o_bd->bd_info;
-	dynlist_info_t	*dli = (dynlist_info_t *)on->on_bi.bi_private;
+	dynlist_info_t	*dli = ((dynlist_gen_t *)on->on_bi.bi_private)->dlg_dli;
 
 	char		*ptr;
 	int		needBrackets = 0;
@@ -342,6 +384,582 @@ done:;
 	return 0;
 }
 	
+static int
+dynlist_mdn_cmp( const void *c1, const void *c2 )
+{
+	const dynlist_mdn_t	*d1 = c1, *d2 = c2;
+
+	return ber_bvcmp( &d1->dd_nname, &d2->dd_nname );
+}
+
+static int
+dynlist_mat_cmp( const void *c1, const void *c2 )
+{
+	const dynlist_mat_t	*m1 = c1, *m2 = c2;
+
+	return ber_bvcmp( &m1->dm_ndn, &m2->dm_ndn );
+}
+
+static dynlist_mdn_t *
+dynlist_mdn_new( struct berval *name, struct berval *nname )
+{
+	dynlist_mdn_t	*dd;
+
+	dd = ch_malloc( sizeof( dynlist_mdn_t ) + name->bv_len + nname->bv_len + 2 );
+	dd->dd_name.bv_val = (char *)(dd + 1);
+	dd->dd_name.bv_len = name->bv_len;
+	AC_MEMCPY( dd->dd_name.bv_val, name->bv_val, name->bv_len + 1 );
+	dd->dd_nname.bv_val = dd->dd_name.bv_val + name->bv_len + 1;
+	dd->dd_nname.bv_len = nname->bv_len;
+	AC_MEMCPY( dd->dd_nname.bv_val, nname->bv_val, nname->bv_len + 1 );
+
+	return dd;
+}
+
+static void
+dynlist_mdn_add( dynlist_mat_t *dm, struct berval *name, struct berval *nname )
+{
+	dynlist_mdn_t	*dd = dynlist_mdn_new( name, nname );
+
+	if ( avl_insert( &dm->dm_members, dd, dynlist_mdn_cmp, avl_dup_error ) ) {
+		ch_free( dd );
+	} else {
+		dm->dm_nmembers++;
+	}
+}
+
+static void
+dynlist_mdn_del( dynlist_mat_t *dm, struct berval *nname )
+{
+	dynlist_mdn_t	key, *dd;
+
+	key.dd_nname = *nname;
+	dd = avl_delete( &dm->dm_members, &key, dynlist_mdn_cmp );
+	if ( dd ) {
+		ch_free( dd );
+		dm->dm_nmembers--;
+	}
+}
+
+static void
+dynlist_mat_free( void *ptr )
+{
+	dynlist_mat_t	*dm = ptr;
+	dynlist_murl_t	*dmu;
+
+	while (( dmu = dm->dm_murls )) {
+		dm->dm_murls = dmu->dmu_next;
+		ch_free( dmu->dmu_nbase.bv_val );
+		if ( dmu->dmu_filter )
+			filter_free( dmu->dmu_filter );
+		ch_free( dmu->dmu_filterstr.bv_val );
+		ch_free( dmu );
+	}
+	avl_free( dm->dm_members, ch_free );
+	ber_bvarray_free( dm->dm_urls );
+	ch_free( dm->dm_ndn.bv_val );
+	ch_free( dm );
+}
+
+static void
+dynlist_mat_flush( dynlist_gen_t *dlg )
+{
+	ldap_pvt_thread_mutex_lock( &dlg->dlg_mutex );
+	avl_free( dlg->dlg_groups, dynlist_mat_free );
+	dlg->dlg_groups = NULL;
+	dlg->dlg_lruhead = dlg->dlg_lrutail = NULL;
+	dlg->dlg_ngroups = 0;
+	dlg->dlg_gen++;
+	ldap_pvt_thread_mutex_unlock( &dlg->dlg_mutex );
+}
+
+/* The cached groups are kept on an LRU list, so that the least
+ * recently used can be evicted once there are dlg_maxgroups of them.
+ * Call these with dlg_mutex locked.
+ */
+static void
+dynlist_mat_unlink( dynlist_gen_t *dlg, dynlist_mat_t *dm )
+{
+	if ( dm->dm_lruprev )
+		dm->dm_lruprev->dm_lrunext = dm->dm_lrunext;
+	else
+		dlg->dlg_lruhead = dm->dm_lrunext;
+	if ( dm->dm_lrunext )
+		dm->dm_lrunext->dm_lruprev = dm->dm_lruprev;
+	else
+		dlg->dlg_lrutail = dm->dm_lruprev;
+	dm->dm_lrunext = dm->dm_lruprev = NULL;
+}
+
+static void
+dynlist_mat_link( dynlist_gen_t *dlg, dynlist_mat_t *dm )
+{
+	dm->dm_lruprev = NULL;
+	dm->dm_lrunext = dlg->dlg_lruhead;
+	if ( dlg->dlg_lruhead )
+		dlg->dlg_lruhead->dm_lruprev = dm;
+	else
+		dlg->dlg_lrutail = dm;
+	dlg->dlg_lruhead = dm;
+}
+
+static void
+dynlist_mat_touch( dynlist_gen_t *dlg, dynlist_mat_t *dm )
+{
+	if ( dlg->dlg_lruhead != dm ) {
+		dynlist_mat_unlink( dlg, dm );
+		dynlist_mat_link( dlg, dm );
+	}
+}
+
+static void
+dynlist_mat_remove( dynlist_gen_t *dlg, dynlist_mat_t *dm )
+{
+	avl_delete( &dlg->dlg_groups, dm, dynlist_mat_cmp );
+	dynlist_mat_unlink( dlg, dm );
+	dlg->dlg_ngroups--;
+	dynlist_mat_free( dm );
+}
+
+static void
+dynlist_mat_trim( dynlist_gen_t *dlg )
+{
+	while ( dlg->dlg_maxgroups && dlg->dlg_ngroups > dlg->dlg_maxgroups ) {
+		Debug( LDAP_DEBUG_TRACE, "dynlist_mat_trim: evicting \"%s\"\n",
+			dlg->dlg_lrutail->dm_ndn.bv_val, 0, 0 );
+		dynlist_mat_remove( dlg, dlg->dlg_lrutail );
+	}
+}
+
+static int
+dynlist_mat_insert( dynlist_gen_t *dlg, dynlist_mat_t *dm )
+{
+	if ( avl_insert( &dlg->dlg_groups, dm, dynlist_mat_cmp, avl_dup_error ))
+		return -1;
+	dynlist_mat_link( dlg, dm );
+	dlg->dlg_ngroups++;
+	dynlist_mat_trim( dlg );
+	return 0;
+}
+
+/* Does the entry fall within one of the group's URLs? */
+static int
+dynlist_mat_match( Operation *op, dynlist_mat_t *dm, Entry *e )
+{
+	dynlist_murl_t	*dmu;
+
+	for ( dmu = dm->dm_murls; dmu; dmu = dmu->dmu_next ) {
+		if ( dnIsSuffixScope( &e->e_nname, &dmu->dmu_nbase, dmu->dmu_scope ) &&
+			test_filter( op, e, dmu->dmu_filter ) == LDAP_COMPARE_TRUE )
+			return 1;
+	}
+	return 0;
+}
+
+/* Run an operation as the database's rootdn, so the member list
+ * doesn't depend on who asked for it first.
+ */
+static void
+dynlist_mat_op( Operation *op, Operation *o )
+{
+	*o = *op;
+	o->o_dn = op->o_bd->be_rootdn;
+	o->o_ndn = op->o_bd->be_rootndn;
+	o->o_groups = NULL;
+	memset( o->o_ctrlflag, 0, sizeof( o->o_ctrlflag ) );
+	o->o_controls = NULL;
+}
+
+static int
+dynlist_sc_collect( Operation *op, SlapReply *rs )
+{
+	if ( rs->sr_type == REP_SEARCH ) {
+		dynlist_mat_t	*dm = op->o_callback->sc_private;
+
+		dynlist_mdn_add( dm, &rs->sr_entry->e_name, &rs->sr_entry->e_nname );
+	}
+	return 0;
+}
+
+/* Expand a group into a new dynlist_mat_t. Returns NULL if one of
+ * its URLs can't be followed from within this database, so that
+ * writes elsewhere could change the result.
+ */
+static dynlist_mat_t *
+dynlist_mat_build( Operation *op, Entry *ge, dynlist_info_t *dli, Attribute *a )
+{
+	dynlist_mat_t	*dm;
+	dynlist_murl_t	**dmup, *dmu;
+	struct berval	*url;
+	Operation	o;
+	slap_callback	cb = { 0 };
+	int		rc = LDAP_SUCCESS;
+
+	Debug( LDAP_DEBUG_TRACE, "dynlist_mat_build: expanding \"%s\"\n",
+		ge->e_nname.bv_val, 0, 0 );
+
+	dm = ch_calloc( 1, sizeof( dynlist_mat_t ) );
+	dm->dm_dli = dli;
+	dmup = &dm->dm_murls;
+
+	for ( url = a->a_nvals; !BER_BVISNULL( url ); url++ ) {
+		LDAPURLDesc	*lud = NULL;
+		struct berval	dn, flt, filterstr;
+		BackendDB	*be;
+		int		i;
+
+		if ( ldap_url_parse( url->bv_val, &lud ) != LDAP_URL_SUCCESS ) {
+			rc = LDAP_OTHER;
+			break;
+		}
+		if ( lud->lud_host != NULL || lud->lud_attrs != NULL ) {
+			ldap_free_urldesc( lud );
+			rc = LDAP_OTHER;
+			break;
+		}
+
+		dmu = ch_calloc( 1, sizeof( dynlist_murl_t ) );
+		*dmup = dmu;
+		dmup = &dmu->dmu_next;
+
+		if ( lud->lud_dn == NULL ) {
+			BER_BVSTR( &dn, "" );
+		} else {
+			ber_str2bv( lud->lud_dn, 0, 0, &dn );
+		}
+		rc = dnNormalize( 0, NULL, NULL, &dn, &dmu->dmu_nbase, NULL );
+		dmu->dmu_scope = lud->lud_scope;
+		if ( rc == LDAP_SUCCESS ) {
+			if ( lud->lud_filter == NULL ) {
+				ber_dupbv( &dmu->dmu_filterstr, &dli->dli_default_filter );
+			} else {
+				ber_str2bv( lud->lud_filter, 0, 0, &flt );
+				if ( dynlist_make_filter( op, ge, url->bv_val, &flt, &filterstr ) ) {
+					rc = LDAP_OTHER;
+				} else {
+					ber_dupbv( &dmu->dmu_filterstr, &filterstr );
+					op->o_tmpfree( filterstr.bv_val, op->o_tmpmemctx );
+				}
+			}
+		}
+		ldap_free_urldesc( lud );
+		if ( rc != LDAP_SUCCESS )
+			break;
+		dmu->dmu_filter = str2filter( dmu->dmu_filterstr.bv_val );
+		if ( dmu->dmu_filter == NULL ) {
+			rc = LDAP_OTHER;
+			break;
+		}
+
+		/* Only writes to this database are seen */
+		be = select_backend( &dmu->dmu_nbase, 1 );
+		if ( be == NULL || be->be_nsuffix != op->o_bd->be_nsuffix ) {
+			rc = LDAP_OTHER;
+			break;
+		}
+		for ( i = 0; !BER_BVISNULL( &be->be_nsuffix[i] ); i++ ) {
+			if ( dnIsSuffix( &dmu->dmu_nbase, &be->be_nsuffix[i] ))
+				break;
+		}
+		if ( BER_BVISNULL( &be->be_nsuffix[i] )) {
+			rc = LDAP_OTHER;
+			break;
+		}
+	}
+
+	if ( rc != LDAP_SUCCESS ) {
+		dynlist_mat_free( dm );
+		return NULL;
+	}
+
+	ber_dupbv( &dm->dm_ndn, &ge->e_nname );
+	ber_bvarray_dup_x( &dm->dm_urls, a->a_nvals, NULL );
+
+	dynlist_mat_op( op, &o );
+	cb.sc_private = dm;
+	cb.sc_response = dynlist_sc_collect;
+	o.o_callback = &cb;
+	o.o_tag = LDAP_REQ_SEARCH;
+	o.ors_deref = LDAP_DEREF_NEVER;
+	o.ors_limit = NULL;
+	o.ors_tlimit = SLAP_NO_LIMIT;
+	o.ors_slimit = SLAP_NO_LIMIT;
+	o.ors_attrs = slap_anlist_no_attrs;
+	o.ors_attrsonly = 1;
+
+	for ( dmu = dm->dm_murls; dmu; dmu = dmu->dmu_next ) {
+		SlapReply	r = { REP_SEARCH };
+
+		o.o_req_dn = dmu->dmu_nbase;
+		o.o_req_ndn = dmu->dmu_nbase;
+		o.ors_scope = dmu->dmu_scope;
+		o.ors_filter = dmu->dmu_filter;
+		o.ors_filterstr = dmu->dmu_filterstr;
+		o.o_bd = select_backend( &dmu->dmu_nbase, 1 );
+		r.sr_attr_flags = slap_attr_flags( o.ors_attrs );
+		rc = o.o_bd->be_search( &o, &r );
+		if ( rc != LDAP_SUCCESS && rc != LDAP_NO_SUCH_OBJECT ) {
+			dynlist_mat_free( dm );
+			return NULL;
+		}
+	}
+
+	return dm;
+}
+
+typedef struct dynlist_mvals_t {
+	BerVarray	dv_vals;
+	BerVarray	dv_nvals;
+	int		dv_n;
+} dynlist_mvals_t;
+
+static int
+dynlist_mdn_collect( void *data, void *arg )
+{
+	dynlist_mdn_t	*dd = data;
+	dynlist_mvals_t	*dv = arg;
+
+	dv->dv_vals[dv->dv_n] = dd->dd_name;
+	dv->dv_nvals[dv->dv_n] = dd->dd_nname;
+	dv->dv_n++;
+	return 0;
+}
+
+/* Copy the cached members out, so they can be used without holding
+ * the mutex. Call with dlg_mutex locked.
+ */
+static void
+dynlist_mat_copy( Operation *op, dynlist_mat_t *dm, dynlist_mvals_t *dv )
+{
+	dynlist_mvals_t	dt;
+	char		*ptr;
+	int		i;
+	ber_len_t	len = 0;
+
+	dt.dv_vals = op->o_tmpalloc( 2 * ( dm->dm_nmembers + 1 ) * sizeof( struct berval ),
+		op->o_tmpmemctx );
+	dt.dv_nvals = dt.dv_vals + dm->dm_nmembers + 1;
+	dt.dv_n = 0;
+	avl_apply( dm->dm_members, dynlist_mdn_collect, &dt, -1, AVL_INORDER );
+
+	for ( i = 0; i < dt.dv_n; i++ )
+		len += dt.dv_vals[i].bv_len + dt.dv_nvals[i].bv_len + 2;
+
+	dv->dv_vals = op->o_tmpalloc( 2 * ( dt.dv_n + 1 ) * sizeof( struct berval ) + len,
+		op->o_tmpmemctx );
+	dv->dv_nvals = dv->dv_vals + dt.dv_n + 1;
+	dv->dv_n = dt.dv_n;
+	ptr = (char *)( dv->dv_nvals + dt.dv_n + 1 );
+	for ( i = 0; i < dt.dv_n; i++ ) {
+		dv->dv_vals[i].bv_val = ptr;
+		dv->dv_vals[i].bv_len = dt.dv_vals[i].bv_len;
+		ptr = lutil_strncopy( ptr, dt.dv_vals[i].bv_val, dt.dv_vals[i].bv_len ) + 1;
+		dv->dv_nvals[i].bv_val = ptr;
+		dv->dv_nvals[i].bv_len = dt.dv_nvals[i].bv_len;
+		ptr = lutil_strncopy( ptr, dt.dv_nvals[i].bv_val, dt.dv_nvals[i].bv_len ) + 1;
+	}
+	BER_BVZERO( &dv->dv_vals[i] );
+	BER_BVZERO( &dv->dv_nvals[i] );
+	op->o_tmpfree( dt.dv_vals, op->o_tmpmemctx );
+}
+
+/* Add the members to the entry being returned. Members the user
+ * can't read are left out, as the live expansion would.
+ */
+static void
+dynlist_mat_send( Operation *op, SlapReply *rs, dynlist_info_t *dli, dynlist_mvals_t *dv )
+{
+	slap_overinst	*on = (slap_overinst *)op->o_bd->bd_info;
+	dynlist_map_t	*dlm = dli->dli_dlm;
+	Modification	mod;
+	const char	*text = NULL;
+	char		textbuf[1024];
+	Entry		*e;
+	int		i, j;
+
+	if ( !be_isroot( op ) ) {
+		for ( i = 0, j = 0; i < dv->dv_n; i++ ) {
+			Entry	*me = NULL;
+			int	ok = 0;
+
+			if ( overlay_entry_get_ov( op, &dv->dv_nvals[i], NULL, NULL, 0,
+				&me, on ) == LDAP_SUCCESS && me != NULL )
+			{
+				ok = access_allowed( op, me, slap_schema.si_ad_entry,
+					NULL, ACL_READ, NULL );
+				overlay_entry_release_ov( op, me, 0, on );
+			}
+			if ( ok ) {
+				dv->dv_vals[j] = dv->dv_vals[i];
+				dv->dv_nvals[j] = dv->dv_nvals[i];
+				j++;
+			}
+		}
+		dv->dv_n = j;
+		BER_BVZERO( &dv->dv_vals[j] );
+		BER_BVZERO( &dv->dv_nvals[j] );
+	}
+
+	if ( !dv->dv_n )
+		return;
+
+	e = rs->sr_entry;
+	if ( !( rs->sr_flags & REP_ENTRY_MODIFIABLE ) ) {
+		e = entry_dup( rs->sr_entry );
+	}
+
+	mod.sm_op = LDAP_MOD_ADD;
+	mod.sm_desc = dlm->dlm_member_ad;
+	mod.sm_type = dlm->dlm_member_ad->ad_cname;
+	mod.sm_values = dv->dv_vals;
+	mod.sm_nvalues = dv->dv_nvals;
+	mod.sm_numvals = dv->dv_n;
+
+	(void)modify_add_values( e, &mod, /* permissive */ 1,
+			&text, textbuf, sizeof( textbuf ) );
+
+	if ( e != rs->sr_entry ) {
+		rs_replace_entry( op, rs, on, e );
+		rs->sr_flags |= REP_ENTRY_MODIFIABLE | REP_ENTRY_MUSTBEFREED;
+	}
+}
+
+/* Can this group be served from the materialized member lists? Only
+ * plain member listings qualify, and not those expanded on behalf of
+ * a dgIdentity.
+ */
+static int
+dynlist_mat_ok( Operation *op, Entry *e, dynlist_info_t *dli )
+{
+	slap_overinst	*on = (slap_overinst *)op->o_bd->bd_info;
+	dynlist_gen_t	*dlg = (dynlist_gen_t *)on->on_bi.bi_private;
+	dynlist_map_t	*dlm = dli->dli_dlm;
+
+	if ( !dlg->dlg_materialize || !dlm || dlm->dlm_mapped_ad || dlm->dlm_next )
+		return 0;
+	if ( BER_BVISEMPTY( &op->o_bd->be_rootndn ))
+		return 0;
+	if ( ad_dgIdentity && attrs_find( e->e_attrs, ad_dgIdentity ))
+		return 0;
+	return 1;
+}
+
+static int
+dynlist_mat_expand( Operation *op, SlapReply *rs, dynlist_info_t *dli, Attribute *a )
+{
+	slap_overinst	*on = (slap_overinst *)op->o_bd->bd_info;
+	dynlist_gen_t	*dlg = (dynlist_gen_t *)on->on_bi.bi_private;
+	dynlist_mat_t	key, *dm;
+	dynlist_mvals_t	dv = { NULL };
+	unsigned long	gen;
+	int		i;
+
+	key.dm_ndn = rs->sr_entry->e_nname;
+
+	ldap_pvt_thread_mutex_lock( &dlg->dlg_mutex );
+	dm = avl_find( dlg->dlg_groups, &key, dynlist_mat_cmp );
+	if ( dm ) {
+		for ( i = 0; !BER_BVISNULL( &dm->dm_urls[i] ); i++ ) {
+			if ( i >= a->a_numvals || !bvmatch( &dm->dm_urls[i], &a->a_nvals[i] ))
+				break;
+		}
+		if ( dm->dm_dli == dli && i == a->a_numvals && BER_BVISNULL( &dm->dm_urls[i] )) {
+			dynlist_mat_copy( op, dm, &dv );
+			dynlist_mat_touch( dlg, dm );
+		} else {
+			/* changed behind our back */
+			dynlist_mat_remove( dlg, dm );
+		}
+	}
+	gen = dlg->dlg_gen;
+	ldap_pvt_thread_mutex_unlock( &dlg->dlg_mutex );
+
+	if ( dv.dv_vals == NULL ) {
+		dm = dynlist_mat_build( op, rs->sr_entry, dli, a );
+		if ( dm == NULL )
+			return LDAP_OTHER;
+		dynlist_mat_copy( op, dm, &dv );
+
+		/* Keep it only if no write could have slipped past the searches */
+		ldap_pvt_thread_mutex_lock( &dlg->dlg_mutex );
+		if ( gen == dlg->dlg_gen && dynlist_mat_insert( dlg, dm ) == 0 )
+			dm = NULL;
+		ldap_pvt_thread_mutex_unlock( &dlg->dlg_mutex );
+		if ( dm )
+			dynlist_mat_free( dm );
+	}
+
+	dynlist_mat_send( op, rs, dli, &dv );
+	op->o_tmpfree( dv.dv_vals, op->o_tmpmemctx );
+	return LDAP_SUCCESS;
+}
+
+typedef struct dynlist_mupd_t {
+	Operation	*du_op;
+	Entry		*du_e;
+	struct berval	*du_ndn;
+} dynlist_mupd_t;
+
+static int
+dynlist_mat_update_one( void *data, void *arg )
+{
+	dynlist_mat_t	*dm = data;
+	dynlist_mupd_t	*du = arg;
+
+	if ( du->du_e && dynlist_mat_match( du->du_op, dm, du->du_e ))
+		dynlist_mdn_add( dm, &du->du_e->e_name, &du->du_e->e_nname );
+	else
+		dynlist_mdn_del( dm, du->du_ndn );
+	return 0;
+}
+
+/* Apply a successful write to the materialized groups: the changed
+ * entry joins or leaves each group according to its URLs. A changed
+ * group is dropped and expanded again when next needed; renames,
+ * which may move whole subtrees, drop everything.
+ */
+static void
+dynlist_mat_update( Operation *op, SlapReply *rs )
+{
+	slap_overinst	*on = (slap_overinst *)op->o_bd->bd_info;
+	dynlist_gen_t	*dlg = (dynlist_gen_t *)on->on_bi.bi_private;
+	dynlist_mupd_t	du;
+	dynlist_mat_t	key, *dm;
+	Operation	o;
+	Entry		*e = NULL;
+
+	if ( op->o_tag == LDAP_REQ_MODRDN ) {
+		dynlist_mat_flush( dlg );
+		return;
+	}
+
+	dynlist_mat_op( op, &o );
+	if ( op->o_tag == LDAP_REQ_ADD ) {
+		e = op->ora_e;
+	} else if ( op->o_tag == LDAP_REQ_MODIFY ) {
+		if ( overlay_entry_get_ov( &o, &op->o_req_ndn, NULL, NULL, 0, &e, on ) !=
+			LDAP_SUCCESS )
+			e = NULL;
+	}
+
+	ldap_pvt_thread_mutex_lock( &dlg->dlg_mutex );
+	dlg->dlg_gen++;
+	key.dm_ndn = op->o_req_ndn;
+	dm = avl_find( dlg->dlg_groups, &key, dynlist_mat_cmp );
+	if ( dm )
+		dynlist_mat_remove( dlg, dm );
+	if ( dlg->dlg_groups ) {
+		du.du_op = &o;
+		du.du_e = e;
+		du.du_ndn = &op->o_req_ndn;
+		avl_apply( dlg->dlg_groups, dynlist_mat_update_one, &du, -1, AVL_INORDER );
+	}
+	ldap_pvt_thread_mutex_unlock( &dlg->dlg_mutex );
+
+	if ( e && e != op->ora_e )
+		overlay_entry_release_ov( &o, e, 0, on );
+}
+
 static int
 dynlist_prepare_entry( Operation *op, SlapReply *rs, dynlist_info_t *dli )
 {
@@ -373,6 +991,10 @@ dynlist_prepare_entry( Operation *op, SlapReply *rs, dynlist_info_t *dli )
 	if ( dli->dli_dlm && !dlm )
 		return SLAP_CB_CONTINUE;
 
+	if ( dynlist_mat_ok( op, rs->sr_entry, dli ) &&
+		dynlist_mat_expand( op, rs, dli, a ) == LDAP_SUCCESS )
+		return SLAP_CB_CONTINUE;
+
 	if ( ad_dgIdentity && ( id = attrs_find( rs->sr_entry->e_attrs, ad_dgIdentity ))) {
 		Attribute *authz = NULL;
 
@@ -631,7 +1253,8 @@ static int
 dynlist_compare( Operation *op, SlapReply *rs )
 {
 	slap_overinst	*on = (slap_overinst *)op->o_bd->bd_info;
-	dynlist_info_t	*dli = (dynlist_info_t *)on->on_bi.bi_private;
+	dynlist_gen_t	*dlg = (dynlist_gen_t *)on->on_bi.bi_private;
+	dynlist_info_t	*dli = dlg->dlg_dli;
 	Operation o = *op;
 	Entry *e = NULL;
 	dynlist_map_t *dlm;
@@ -649,6 +1272,31 @@ dynlist_compare( Operation *op, SlapReply *rs )
 			 */
 			BerVarray id = NULL, authz = NULL;
 
+			if ( dlg->dlg_materialize ) {
+				dynlist_mat_t	key, *dm;
+				dynlist_mdn_t	dkey;
+				int		found = 0;
+
+				/* answer from the materialized members if we have them */
+				ldap_pvt_thread_mutex_lock( &dlg->dlg_mutex );
+				key.dm_ndn = op->o_req_ndn;
+				dm = avl_find( dlg->dlg_groups, &key, dynlist_mat_cmp );
+				if ( dm && dm->dm_dli == dli ) {
+					dkey.dd_nname = op->oq_compare.rs_ava->aa_value;
+					rs->sr_err = avl_find( dm->dm_members, &dkey, dynlist_mdn_cmp ) ?
+						LDAP_COMPARE_TRUE : LDAP_COMPARE_FALSE;
+					dynlist_mat_touch( dlg, dm );
+					found = 1;
+				}
+				ldap_pvt_thread_mutex_unlock( &dlg->dlg_mutex );
+				if ( found ) {
+					Debug( LDAP_DEBUG_TRACE, "dynlist_compare: \"%s\" "
+						"answered from the expanded members\n",
+						op->o_req_ndn.bv_val, 0, 0 );
+					return SLAP_CB_CONTINUE;
+				}
+			}
+
 			o.o_do_not_cache = 1;
 
 			if ( ad_dgIdentity && backend_attribute( &o, NULL, &o.o_req_ndn,
@@ -712,7 +1360,7 @@ done:;
 	}
 
 	/* check for dynlist objectClass; done if not found */
-	dli = (dynlist_info_t *)on->on_bi.bi_private;
+	dli = dlg->dlg_dli;
 	while ( dli != NULL && !is_entry_objectclass_or_sub( e, dli->dli_oc ) ) {
 		dli = dli->dli_next;
 	}
@@ -820,6 +1468,19 @@ dynlist_response( Operation *op, SlapReply *rs )
 			return dynlist_compare( op, rs );
 		}
 		break;
+
+	case LDAP_REQ_ADD:
+	case LDAP_REQ_DELETE:
+	case LDAP_REQ_MODIFY:
+	case LDAP_REQ_MODRDN:
+		if ( rs->sr_err == LDAP_SUCCESS ) {
+			slap_overinst	*on = (slap_overinst *)op->o_bd->bd_info;
+			dynlist_gen_t	*dlg = (dynlist_gen_t *)on->on_bi.bi_private;
+
+			if ( dlg->dlg_materialize )
+				dynlist_mat_update( op, rs );
+		}
+		break;
 	}
 
 	return SLAP_CB_CONTINUE;
@@ -852,6 +1513,8 @@ enum {
 	DL_ATTRSET = 1,
 	DL_ATTRPAIR,
 	DL_ATTRPAIR_COMPAT,
+	DL_MATERIALIZE,
+	DL_MATERIALIZE_MAX,
 	DL_LAST
 };
 
@@ -870,6 +1533,18 @@ static ConfigTable dlcfg[] = {
 	{ "dynlist-attrpair", "member-ad> <URL-ad",
 		3, 3, 0, ARG_MAGIC|DL_ATTRPAIR, dl_cfgen,
 			NULL, NULL, NULL },
+	{ "dynlist-materialize", "on|off",
+		2, 2, 0, ARG_MAGIC|ARG_ON_OFF|DL_MATERIALIZE, dl_cfgen,
+		"( OLcfgOvAt:8.2 NAME 'olcDlMaterialize' "
+			"DESC 'Dynamic list: keep member lists expanded and up to date' "
+			"SYNTAX OMsBoolean SINGLE-VALUE )",
+			NULL, NULL },
+	{ "dynlist-materialize-max", "groups",
+		2, 2, 0, ARG_MAGIC|ARG_INT|DL_MATERIALIZE_MAX, dl_cfgen,
+		"( OLcfgOvAt:8.3 NAME 'olcDlMaterializeMax' "
+			"DESC 'Dynamic list: maximum number of expanded member lists kept' "
+			"SYNTAX OMsInteger SINGLE-VALUE )",
+			NULL, NULL },
 #ifdef TAKEOVER_DYNGROUP
 	{ "attrpair", "member-ad> <URL-ad",
 		3, 3, 0, ARG_MAGIC|DL_ATTRPAIR_COMPAT, dl_cfgen,
@@ -883,7 +1558,7 @@ static ConfigOCs dlocs[] = {
 		"NAME 'olcDynamicList' "
 		"DESC 'Dynamic list configuration' "
 		"SUP olcOverlayConfig "
-		"MAY olcDLattrSet )",
+		"MAY ( olcDLattrSet $ olcDlMaterialize $ olcDlMaterializeMax ) )",
 		Cft_Overlay, dlcfg, NULL, NULL },
 	{ NULL, 0, NULL }
 };
@@ -892,7 +1567,8 @@ static int
 dl_cfgen( ConfigArgs *c )
 {
 	slap_overinst	*on = (slap_overinst *)c->bi;
-	dynlist_info_t	*dli = (dynlist_info_t *)on->on_bi.bi_private;
+	dynlist_gen_t	*dlg = (dynlist_gen_t *)on->on_bi.bi_private;
+	dynlist_info_t	*dli = dlg->dlg_dli;
 
 	int		rc = 0, i;
 
@@ -942,6 +1618,17 @@ dl_cfgen( ConfigArgs *c )
 			}
 			break;
 
+		case DL_MATERIALIZE:
+			c->value_int = dlg->dlg_materialize;
+			break;
+
+		case DL_MATERIALIZE_MAX:
+			if ( dlg->dlg_maxgroups != DYNLIST_MAT_MAXGROUPS )
+				c->value_int = dlg->dlg_maxgroups;
+			else
+				rc = 1;
+			break;
+
 		case DL_ATTRPAIR_COMPAT:
 		case DL_ATTRPAIR:
 			rc = 1;
@@ -956,7 +1643,21 @@ dl_cfgen( ConfigArgs *c )
 
 	} else if ( c->op == LDAP_MOD_DELETE ) {
 		switch( c->type ) {
+		case DL_MATERIALIZE:
+			dlg->dlg_materialize = 0;
+			dynlist_mat_flush( dlg );
+			break;
+
+		case DL_MATERIALIZE_MAX:
+			ldap_pvt_thread_mutex_lock( &dlg->dlg_mutex );
+			dlg->dlg_maxgroups = DYNLIST_MAT_MAXGROUPS;
+			dynlist_mat_trim( dlg );
+			ldap_pvt_thread_mutex_unlock( &dlg->dlg_mutex );
+			break;
+
 		case DL_ATTRSET:
+			/* cached groups point to the attrsets */
+			dynlist_mat_flush( dlg );
 			if ( c->valx < 0 ) {
 				dynlist_info_t	*dli_next;
 
@@ -992,14 +1693,14 @@ dl_cfgen( ConfigArgs *c )
 					ch_free( dli );
 				}
 
-				on->on_bi.bi_private = NULL;
+				dlg->dlg_dli = NULL;
 
 			} else {
 				dynlist_info_t	**dlip;
 				dynlist_map_t *dlm;
 				dynlist_map_t *dlm_next;
 
-				for ( i = 0, dlip = (dynlist_info_t **)&on->on_bi.bi_private;
+				for ( i = 0, dlip = &dlg->dlg_dli;
 					i < c->valx; i++ )
 				{
 					if ( *dlip == NULL ) {
@@ -1037,7 +1738,7 @@ dl_cfgen( ConfigArgs *c )
 				}
 				ch_free( dli );
 
-				dli = (dynlist_info_t *)on->on_bi.bi_private;
+				dli = dlg->dlg_dli;
 			}
 			break;
 
@@ -1253,7 +1954,7 @@ done_uri:;
 		if ( c->valx > 0 ) {
 			int	i;
 
-			for ( i = 0, dlip = (dynlist_info_t **)&on->on_bi.bi_private;
+			for ( i = 0, dlip = &dlg->dlg_dli;
 				i < c->valx; i++ )
 			{
 				if ( *dlip == NULL ) {
@@ -1271,7 +1972,7 @@ done_uri:;
 			dli_next = *dlip;
 
 		} else {
-			for ( dlip = (dynlist_info_t **)&on->on_bi.bi_private;
+			for ( dlip = &dlg->dlg_dli;
 				*dlip; dlip = &(*dlip)->dli_next )
 				/* goto last */;
 		}
@@ -1292,6 +1993,26 @@ done_uri:;
 
 		} break;
 
+	case DL_MATERIALIZE:
+		dlg->dlg_materialize = c->value_int;
+		if ( !c->value_int )
+			dynlist_mat_flush( dlg );
+		break;
+
+	case DL_MATERIALIZE_MAX:
+		if ( c->value_int < 0 ) {
+			snprintf( c->cr_msg, sizeof( c->cr_msg ),
+				"invalid number of groups \"%s\"", c->argv[1] );
+			Debug( LDAP_DEBUG_ANY, "%s: %s.\n", c->log, c->cr_msg, 0 );
+			rc = 1;
+			break;
+		}
+		ldap_pvt_thread_mutex_lock( &dlg->dlg_mutex );
+		dlg->dlg_maxgroups = c->value_int;
+		dynlist_mat_trim( dlg );
+		ldap_pvt_thread_mutex_unlock( &dlg->dlg_mutex );
+		break;
+
 	case DL_ATTRPAIR_COMPAT:
 		snprintf( c->cr_msg, sizeof( c->cr_msg ),
 			"warning: \"attrpair\" only supported for limited "
@@ -1349,7 +2070,7 @@ done_uri:;
 			return 1;
 		}
 
-		for ( dlip = (dynlist_info_t **)&on->on_bi.bi_private;
+		for ( dlip = &dlg->dlg_dli;
 			*dlip; dlip = &(*dlip)->dli_next )
 		{
 			/* 
@@ -1402,7 +2123,8 @@ dynlist_db_open(
 	ConfigReply	*cr )
 {
 	slap_overinst		*on = (slap_overinst *) be->bd_info;
-	dynlist_info_t		*dli = (dynlist_info_t *)on->on_bi.bi_private;
+	dynlist_gen_t		*dlg = (dynlist_gen_t *)on->on_bi.bi_private;
+	dynlist_info_t		*dli = dlg->dlg_dli;
 	ObjectClass		*oc = NULL;
 	AttributeDescription	*ad = NULL;
 	const char	*text;
@@ -1410,7 +2132,7 @@ dynlist_db_open(
 
 	if ( dli == NULL ) {
 		dli = ch_calloc( 1, sizeof( dynlist_info_t ) );
-		on->on_bi.bi_private = (void *)dli;
+		dlg->dlg_dli = dli;
 	}
 
 	for ( ; dli; dli = dli->dli_next ) {
@@ -1476,15 +2198,32 @@ dynlist_db_open(
 	return 0;
 }
 
+static int
+dynlist_db_init(
+	BackendDB	*be,
+	ConfigReply	*cr )
+{
+	slap_overinst	*on = (slap_overinst *) be->bd_info;
+	dynlist_gen_t	*dlg;
+
+	dlg = (dynlist_gen_t *)ch_calloc( 1, sizeof( dynlist_gen_t ) );
+	ldap_pvt_thread_mutex_init( &dlg->dlg_mutex );
+	dlg->dlg_maxgroups = DYNLIST_MAT_MAXGROUPS;
+	on->on_bi.bi_private = (void *)dlg;
+
+	return 0;
+}
+
 static int
 dynlist_db_destroy(
 	BackendDB	*be,
 	ConfigReply	*cr )
 {
 	slap_overinst	*on = (slap_overinst *) be->bd_info;
+	dynlist_gen_t	*dlg = (dynlist_gen_t *)on->on_bi.bi_private;
 
-	if ( on->on_bi.bi_private ) {
-		dynlist_info_t	*dli = (dynlist_info_t *)on->on_bi.bi_private,
+	if ( dlg ) {
+		dynlist_info_t	*dli = dlg->dlg_dli,
 				*dli_next;
 
 		for ( dli_next = dli; dli_next; dli = dli_next ) {
@@ -1519,6 +2258,11 @@ dynlist_db_destroy(
 			}
 			ch_free( dli );
 		}
+
+		dynlist_mat_flush( dlg );
+		ldap_pvt_thread_mutex_destroy( &dlg->dlg_mutex );
+		ch_free( dlg );
+		on->on_bi.bi_private = NULL;
 	}
 
 	return 0;
@@ -1547,6 +2291,7 @@ dynlist_initialize(void)
 	dynlist.on_bi.bi_obsolete_names = obsolete_names;
 #endif
 
+	dynlist.on_bi.bi_db_init = dynlist_db_init;
 	dynlist.on_bi.bi_db_config = config_generic_wrapper;
 	dynlist.on_bi.bi_db_open = dynlist_db_open;
 	dynlist.on_bi.bi_db_destroy = dynlist_db_destroy;
@@ -261,12 +261,17 @@ memberof_isGroupOrMember( Operation *op, memberof_cbinfo_t *mci )
 
 	assert( mci->what != MEMBEROF_IS_NONE );
 
+	BER_BVZERO( &an[ 1 ].an_name );
 	cb.sc_private = &mc;
 	if ( op->o_tag == LDAP_REQ_DELETE ) {
 		cb.sc_response = memberof_saveMember_cb;
+		op2.ors_attrs = an;
 
 	} else {
+		/* only existence matters, don't have a large group's
+		 * members returned */
 		cb.sc_response = memberof_isGroupOrMember_cb;
+		op2.ors_attrs = slap_anlist_no_attrs;
 	}
 
 	op2.o_tag = LDAP_REQ_SEARCH;
@@ -276,8 +281,6 @@ memberof_isGroupOrMember( Operation *op, memberof_cbinfo_t *mci )
 
 	op2.ors_scope = LDAP_SCOPE_BASE;
 	op2.ors_deref = LDAP_DEREF_NEVER;
-	BER_BVZERO( &an[ 1 ].an_name );
-	op2.ors_attrs = an;
 	op2.ors_attrsonly = 0;
 	op2.ors_limit = NULL;
 	op2.ors_slimit = 1;
@@ -336,6 +339,7 @@ memberof_isGroupOrMember( Operation *op, memberof_cbinfo_t *mci )
 
 /*
  * response callback that adds memberof values when a group is modified.
+ * A rename of the value is done as a single modification.
  */
 static void
 memberof_value_modify(
@@ -355,9 +359,11 @@ memberof_value_modify(
 	unsigned long opid = op->o_opid;
 	SlapReply	rs2 = { REP_RESULT };
 	slap_callback	cb = { NULL, slap_null_cb, NULL, NULL };
-	Modifications	mod[ 2 ] = { { { 0 } } }, *ml;
-	struct berval	values[ 4 ], nvalues[ 4 ];
-	int		mcnt = 0;
+	Modifications	mod[ 3 ] = { { { 0 } } }, *ml;
+	struct berval	values[ 6 ], nvalues[ 6 ];
+	int		i, mcnt = 0;
+	BackendInfo	*bi;
+	OpExtra		oex;
 
 	op2.o_tag = LDAP_REQ_MODIFY;
 
@@ -367,7 +373,6 @@ memberof_value_modify(
 	op2.o_callback = &cb;
 	op2.o_dn = op->o_bd->be_rootdn;
 	op2.o_ndn = op->o_bd->be_rootndn;
-	op2.orm_modlist = NULL;
 
 	/* Internal ops, never replicate these */
 	op2.o_opid = 0;		/* shared with op, saved above */
@@ -377,121 +382,179 @@ memberof_value_modify(
 	if ( !BER_BVISNULL( &mo->mo_ndn ) ) {
 		ml = &mod[ mcnt ];
 		ml->sml_numvals = 1;
-		ml->sml_values = &values[ 0 ];
+		ml->sml_values = &values[ 2 * mcnt ];
 		ml->sml_values[ 0 ] = mo->mo_dn;
 		BER_BVZERO( &ml->sml_values[ 1 ] );
-		ml->sml_nvalues = &nvalues[ 0 ];
+		ml->sml_nvalues = &nvalues[ 2 * mcnt ];
 		ml->sml_nvalues[ 0 ] = mo->mo_ndn;
 		BER_BVZERO( &ml->sml_nvalues[ 1 ] );
 		ml->sml_desc = slap_schema.si_ad_modifiersName;
 		ml->sml_type = ml->sml_desc->ad_cname;
 		ml->sml_op = LDAP_MOD_REPLACE;
 		ml->sml_flags = SLAP_MOD_INTERNAL;
-		ml->sml_next = op2.orm_modlist;
-		op2.orm_modlist = ml;
 
 		mcnt++;
 	}
 
-	ml = &mod[ mcnt ];
-	ml->sml_numvals = 1;
-	ml->sml_values = &values[ 2 ];
-	BER_BVZERO( &ml->sml_values[ 1 ] );
-	ml->sml_nvalues = &nvalues[ 2 ];
-	BER_BVZERO( &ml->sml_nvalues[ 1 ] );
-	ml->sml_desc = ad;
-	ml->sml_type = ml->sml_desc->ad_cname;
-	ml->sml_flags = SLAP_MOD_INTERNAL;
-	ml->sml_next = op2.orm_modlist;
-	op2.orm_modlist = ml;
-
+	/* add before delete, so that the attribute keeps its place
+	 * in the entry when its only value is renamed */
 	if ( new_ndn != NULL ) {
-		BackendInfo *bi = op2.o_bd->bd_info;
-		OpExtra	oex;
-
 		assert( !BER_BVISNULL( new_dn ) );
 		assert( !BER_BVISNULL( new_ndn ) );
 
 		ml = &mod[ mcnt ];
-		ml->sml_op = LDAP_MOD_ADD;
-
+		ml->sml_numvals = 1;
+		ml->sml_values = &values[ 2 * mcnt ];
 		ml->sml_values[ 0 ] = *new_dn;
+		BER_BVZERO( &ml->sml_values[ 1 ] );
+		ml->sml_nvalues = &nvalues[ 2 * mcnt ];
 		ml->sml_nvalues[ 0 ] = *new_ndn;
+		BER_BVZERO( &ml->sml_nvalues[ 1 ] );
+		ml->sml_desc = ad;
+		ml->sml_type = ml->sml_desc->ad_cname;
+		ml->sml_op = old_ndn ? SLAP_MOD_SOFTADD : LDAP_MOD_ADD;
+		ml->sml_flags = SLAP_MOD_INTERNAL;
 
-		oex.oe_key = (void *)&memberof;
-		LDAP_SLIST_INSERT_HEAD(&op2.o_extra, &oex, oe_next);
-		memberof_set_backend( &op2, op, on );
-		(void)op->o_bd->be_modify( &op2, &rs2 );
-		op2.o_bd->bd_info = bi;
-		LDAP_SLIST_REMOVE(&op2.o_extra, &oex, OpExtra, oe_next);
-		if ( rs2.sr_err != LDAP_SUCCESS ) {
-			char buf[ SLAP_TEXT_BUFLEN ];
-			snprintf( buf, sizeof( buf ),
-				"memberof_value_modify DN=\"%s\" add %s=\"%s\" failed err=%d",
-				op2.o_req_dn.bv_val, ad->ad_cname.bv_val, new_dn->bv_val, rs2.sr_err );
-			Debug( LDAP_DEBUG_ANY, "%s: %s\n",
-				op->o_log_prefix, buf, 0 );
-		}
-
-		assert( op2.orm_modlist == &mod[ mcnt ] );
-		assert( mcnt == 0 || op2.orm_modlist->sml_next == &mod[ 0 ] );
-		ml = op2.orm_modlist->sml_next;
-		if ( mcnt == 1 ) {
-			assert( ml == &mod[ 0 ] );
-			ml = ml->sml_next;
-		}
-		if ( ml != NULL ) {
-			slap_mods_free( ml, 1 );
-		}
-
-		mod[ 0 ].sml_next = NULL;
+		mcnt++;
 	}
 
 	if ( old_ndn != NULL ) {
-		BackendInfo *bi = op2.o_bd->bd_info;
-		OpExtra	oex;
-
 		assert( !BER_BVISNULL( old_dn ) );
 		assert( !BER_BVISNULL( old_ndn ) );
 
 		ml = &mod[ mcnt ];
-		ml->sml_op = LDAP_MOD_DELETE;
-
+		ml->sml_numvals = 1;
+		ml->sml_values = &values[ 2 * mcnt ];
 		ml->sml_values[ 0 ] = *old_dn;
+		BER_BVZERO( &ml->sml_values[ 1 ] );
+		ml->sml_nvalues = &nvalues[ 2 * mcnt ];
 		ml->sml_nvalues[ 0 ] = *old_ndn;
+		BER_BVZERO( &ml->sml_nvalues[ 1 ] );
+		ml->sml_desc = ad;
+		ml->sml_type = ml->sml_desc->ad_cname;
+		/* when renaming, neither a missing old value nor an
+		 * existing new one may fail the other half */
+		ml->sml_op = new_ndn ? SLAP_MOD_SOFTDEL : LDAP_MOD_DELETE;
+		ml->sml_flags = SLAP_MOD_INTERNAL;
 
-		oex.oe_key = (void *)&memberof;
-		LDAP_SLIST_INSERT_HEAD(&op2.o_extra, &oex, oe_next);
-		memberof_set_backend( &op2, op, on );
-		(void)op->o_bd->be_modify( &op2, &rs2 );
-		op2.o_bd->bd_info = bi;
-		LDAP_SLIST_REMOVE(&op2.o_extra, &oex, OpExtra, oe_next);
-		if ( rs2.sr_err != LDAP_SUCCESS ) {
-			char buf[ SLAP_TEXT_BUFLEN ];
+		mcnt++;
+	}
+
+	for ( i = 0; i < mcnt - 1; i++ ) {
+		mod[ i ].sml_next = &mod[ i + 1 ];
+	}
+	op2.orm_modlist = &mod[ 0 ];
+
+	bi = op2.o_bd->bd_info;
+	oex.oe_key = (void *)&memberof;
+	LDAP_SLIST_INSERT_HEAD(&op2.o_extra, &oex, oe_next);
+	memberof_set_backend( &op2, op, on );
+	(void)op->o_bd->be_modify( &op2, &rs2 );
+	op2.o_bd->bd_info = bi;
+	LDAP_SLIST_REMOVE(&op2.o_extra, &oex, OpExtra, oe_next);
+	if ( rs2.sr_err != LDAP_SUCCESS ) {
+		char buf[ SLAP_TEXT_BUFLEN ];
+		if ( old_ndn == NULL ) {
+			snprintf( buf, sizeof( buf ),
+				"memberof_value_modify DN=\"%s\" add %s=\"%s\" failed err=%d",
+				op2.o_req_dn.bv_val, ad->ad_cname.bv_val, new_dn->bv_val, rs2.sr_err );
+		} else if ( new_ndn == NULL ) {
 			snprintf( buf, sizeof( buf ),
 				"memberof_value_modify DN=\"%s\" delete %s=\"%s\" failed err=%d",
 				op2.o_req_dn.bv_val, ad->ad_cname.bv_val, old_dn->bv_val, rs2.sr_err );
-			Debug( LDAP_DEBUG_ANY, "%s: %s\n",
-				op->o_log_prefix, buf, 0 );
+		} else {
+			snprintf( buf, sizeof( buf ),
+				"memberof_value_modify DN=\"%s\" rename %s=\"%s\" to \"%s\" failed err=%d",
+				op2.o_req_dn.bv_val, ad->ad_cname.bv_val, old_dn->bv_val,
+				new_dn->bv_val, rs2.sr_err );
 		}
+		Debug( LDAP_DEBUG_ANY, "%s: %s\n",
+			op->o_log_prefix, buf, 0 );
+	}
 
-		assert( op2.orm_modlist == &mod[ mcnt ] );
-		ml = op2.orm_modlist->sml_next;
-		if ( mcnt == 1 ) {
-			assert( ml == &mod[ 0 ] );
-			ml = ml->sml_next;
-		}
-		if ( ml != NULL ) {
-			slap_mods_free( ml, 1 );
-		}
+	/* free whatever the backend appended to our modifications */
+	assert( op2.orm_modlist == &mod[ 0 ] );
+	ml = mod[ mcnt - 1 ].sml_next;
+	if ( ml != NULL ) {
+		slap_mods_free( ml, 1 );
 	}
+
 	/* restore original opid */
 	op->o_opid = opid;
+}
+
+static int
+memberof_bvp_cmp( const void *v1, const void *v2 )
+{
+	struct berval *bv1 = *(struct berval **)v1;
+	struct berval *bv2 = *(struct berval **)v2;
 
-	/* FIXME: if old_group_ndn doesn't exist, both delete __and__
-	 * add will fail; better split in two operations, although
-	 * not optimal in terms of performance.  At least it would
-	 * move towards self-repairing capabilities. */
+	return ber_bvcmp( bv1, bv2 );
+}
+
+/*
+ * the members of a group were replaced: only those that left or
+ * joined the group get their memberof changed.
+ */
+static void
+memberof_replace_members(
+	Operation		*op,
+	BerVarray		old,
+	BerVarray		new )
+{
+	memberof_cbinfo_t *mci = op->o_callback->sc_private;
+	memberof_t	*mo = (memberof_t *)mci->on->on_bi.bi_private;
+
+	struct berval	**po, **pn;
+	int		i, j, nold = 0, nnew = 0, cmp;
+
+	if ( old != NULL ) {
+		for ( ; !BER_BVISNULL( &old[ nold ] ); nold++ );
+	}
+	for ( ; !BER_BVISNULL( &new[ nnew ] ); nnew++ );
+
+	po = op->o_tmpalloc( ( nold + nnew + 1 ) * sizeof( struct berval * ),
+		op->o_tmpmemctx );
+	pn = po + nold;
+	for ( i = 0; i < nold; i++ ) {
+		po[ i ] = &old[ i ];
+	}
+	for ( j = 0; j < nnew; j++ ) {
+		pn[ j ] = &new[ j ];
+	}
+	qsort( po, nold, sizeof( struct berval * ), memberof_bvp_cmp );
+	qsort( pn, nnew, sizeof( struct berval * ), memberof_bvp_cmp );
+
+	for ( i = 0, j = 0; i < nold || j < nnew; ) {
+		if ( i == nold ) {
+			cmp = 1;
+		} else if ( j == nnew ) {
+			cmp = -1;
+		} else {
+			cmp = ber_bvcmp( po[ i ], pn[ j ] );
+		}
+
+		if ( cmp < 0 ) {
+			memberof_value_modify( op,
+					po[ i ], mo->mo_ad_memberof,
+					&op->o_req_dn, &op->o_req_ndn,
+					NULL, NULL );
+			i++;
+
+		} else if ( cmp > 0 ) {
+			memberof_value_modify( op,
+					pn[ j ], mo->mo_ad_memberof,
+					NULL, NULL,
+					&op->o_req_dn, &op->o_req_ndn );
+			j++;
+
+		} else {
+			i++;
+			j++;
+		}
+	}
+
+	op->o_tmpfree( po, op->o_tmpmemctx );
 }
 
 static int
@@ -833,8 +896,14 @@ memberof_op_modify( Operation *op, SlapReply *rs )
 			if ( ml->sml_desc == mo->mo_ad_member ) {
 				switch ( ml->sml_op ) {
 				case LDAP_MOD_DELETE:
-				case LDAP_MOD_REPLACE:
 				case SLAP_MOD_SOFTDEL: /* ITS#7487: can be used by syncrepl (in mirror mode?) */
+					/* the deleted values are in the request */
+					if ( ml->sml_values == NULL ) {
+						save_member = 1;
+					}
+					break;
+
+				case LDAP_MOD_REPLACE:
 					save_member = 1;
 					break;
 				}
@@ -1465,6 +1534,12 @@ memberof_res_modify( Operation *op, SlapReply *rs )
 			case LDAP_MOD_REPLACE:
 				vals = mci->member;
 
+				if ( ml->sml_op == LDAP_MOD_REPLACE && ml->sml_values ) {
+					memberof_replace_members( op, vals,
+							ml->sml_nvalues );
+					break;
+				}
+
 				/* delete all ... */
 				if ( vals != NULL ) {
 					for ( i = 0; !BER_BVISNULL( &vals[ i ] ); i++ ) {
@@ -1474,11 +1549,7 @@ memberof_res_modify( Operation *op, SlapReply *rs )
 								NULL, NULL );
 					}
 				}
-	
-				if ( ml->sml_op == LDAP_MOD_DELETE || ml->sml_op == SLAP_MOD_SOFTDEL || !ml->sml_values ) {
-					break;
-				}
-				/* fall thru */
+				break;
 	
 			case LDAP_MOD_ADD:
 			case SLAP_MOD_SOFTADD: /* ITS#7487 */
@@ -28,6 +28,11 @@
  *
  * Updates are performed using the database rootdn in a separate task
  * to allow the original operation to complete immediately.
+ *
+ * Pending repairs are recorded in the refintPending attribute of the
+ * database suffix entry, so that they are resumed after a restart.
+ * The task takes them in batches; the changes a batch makes to the
+ * same dependent entry are written with a single Modify.
  */
 
 #ifdef SLAPD_OVER_REFINT
@@ -40,9 +45,18 @@
 #include "slap.h"
 #include "config.h"
 #include "ldap_rq.h"
+#include "lutil.h"
+
+#include "../back-monitor/back-monitor.h"
 
 static slap_overinst refint;
 
+static AttributeDescription *ad_refintPending;
+static AttributeDescription *ad_refintQueueDepth;
+static AttributeDescription *ad_refintQueueLag;
+static AttributeDescription *ad_refintRepairs;
+static ObjectClass *oc_olmRefint;
+
 /* The DN to use in the ModifiersName for all refint updates */
 static BerValue refint_dn = BER_BVC("cn=Referential Integrity Overlay");
 static BerValue refint_ndn = BER_BVC("cn=referential integrity overlay");
@@ -55,6 +69,7 @@ typedef struct refint_attrs_s {
 	BerVarray		new_vals;
 	BerVarray		new_nvals;
 	int				ra_numvals;
+	int				ra_total;	/* values in the dependent entry */
 	int				dont_empty;
 } refint_attrs;
 
@@ -63,6 +78,8 @@ typedef struct dependents_s {
 	BerValue dn;				/* target dn */
 	BerValue ndn;
 	refint_attrs *attrs;
+	struct refint_q *rq;		/* the repair that found it */
+	struct dependents_s *merged;	/* same entry, other repairs in the batch */
 } dependent_data;
 
 typedef struct refint_q {
@@ -75,6 +92,8 @@ typedef struct refint_q {
 	BerValue newdn;
 	BerValue newndn;
 	int do_sub;
+	time_t qtime;				/* when the repair was queued */
+	BerVarray pending;			/* its refintPending values */
 } refint_q;
 
 typedef struct refint_data_s {
@@ -87,8 +106,18 @@ typedef struct refint_data_s {
 	struct re_s *qtask;
 	refint_q *qhead;
 	refint_q *qtail;
+	Avlnode *qtree;				/* queued repairs, for dedup */
+	int qlen;				/* repairs waiting */
+	int qrun;				/* repairs in the running batch */
+	time_t qbusy;				/* oldest repair in the batch */
+	unsigned long nrepairs;			/* dependent modifies done */
+	int batch;				/* max repairs per batch */
+	int rate;				/* max dependent modifies per sec */
+	slap_overinst *on;
 	BackendDB *db;
 	ldap_pvt_thread_mutex_t qmutex;
+	void *monitor_cb;
+	struct berval monitor_ndn;
 } refint_data;
 
 typedef struct refint_pre_s {
@@ -98,15 +127,20 @@ typedef struct refint_pre_s {
 
 #define	RUNQ_INTERVAL	36000	/* a long time */
 
+#define	REFINT_BATCH	32	/* default repairs per batch */
+
 static MatchingRule	*mr_dnSubtreeMatch;
 
 enum {
 	REFINT_ATTRS = 1,
 	REFINT_NOTHING,
-	REFINT_MODIFIERSNAME
+	REFINT_MODIFIERSNAME,
+	REFINT_BATCHSIZE,
+	REFINT_RATE
 };
 
 static ConfigDriver refint_cf_gen;
+static void *refint_qtask( void *ctx, void *arg );
 
 static ConfigTable refintcfg[] = {
 	{ "refint_attributes", "attribute...", 2, 0, 0,
@@ -125,6 +159,16 @@ static ConfigTable refintcfg[] = {
 	  "( OLcfgOvAt:11.3 NAME 'olcRefintModifiersName' "
 	  "DESC 'The DN to use as modifiersName' "
 	  "SYNTAX OMsDN SINGLE-VALUE )", NULL, NULL },
+	{ "refint_batch", "repairs", 2, 2, 0,
+	  ARG_INT|ARG_MAGIC|REFINT_BATCHSIZE, refint_cf_gen,
+	  "( OLcfgOvAt:11.4 NAME 'olcRefintBatch' "
+	  "DESC 'Max number of queued repairs to apply together' "
+	  "SYNTAX OMsInteger SINGLE-VALUE )", NULL, NULL },
+	{ "refint_rate", "modifies", 2, 2, 0,
+	  ARG_INT|ARG_MAGIC|REFINT_RATE, refint_cf_gen,
+	  "( OLcfgOvAt:11.5 NAME 'olcRefintRate' "
+	  "DESC 'Max number of dependent entries to modify per second' "
+	  "SYNTAX OMsInteger SINGLE-VALUE )", NULL, NULL },
 	{ NULL, NULL, 0, 0, 0, ARG_IGNORED }
 };
 
@@ -136,6 +180,8 @@ static ConfigOCs refintocs[] = {
 	  "MAY ( olcRefintAttribute "
 		"$ olcRefintNothing "
 		"$ olcRefintModifiersName "
+		"$ olcRefintBatch "
+		"$ olcRefintRate "
 	  ") )",
 	  Cft_Overlay, refintcfg },
 	{ NULL, 0, NULL }
@@ -186,6 +232,14 @@ refint_cf_gen(ConfigArgs *c)
 			}
 			rc = 0;
 			break;
+		case REFINT_BATCHSIZE:
+			c->value_int = dd->batch;
+			rc = 0;
+			break;
+		case REFINT_RATE:
+			c->value_int = dd->rate;
+			rc = 0;
+			break;
 		default:
 			abort ();
 		}
@@ -230,6 +284,14 @@ refint_cf_gen(ConfigArgs *c)
 			BER_BVZERO( &dd->refint_ndn );
 			rc = 0;
 			break;
+		case REFINT_BATCHSIZE:
+			dd->batch = REFINT_BATCH;
+			rc = 0;
+			break;
+		case REFINT_RATE:
+			dd->rate = 0;
+			rc = 0;
+			break;
 		default:
 			abort ();
 		}
@@ -280,6 +342,30 @@ refint_cf_gen(ConfigArgs *c)
 				rc = ARG_BAD_CONF;
 			}
 			break;
+		case REFINT_BATCHSIZE:
+			if ( c->value_int < 1 ) {
+				snprintf( c->cr_msg, sizeof( c->cr_msg ),
+					"%s: batch size must be positive", c->argv[0] );
+				Debug( LDAP_DEBUG_CONFIG|LDAP_DEBUG_NONE,
+					"%s: %s\n", c->log, c->cr_msg, 0 );
+				rc = ARG_BAD_CONF;
+				break;
+			}
+			dd->batch = c->value_int;
+			rc = 0;
+			break;
+		case REFINT_RATE:
+			if ( c->value_int < 0 ) {
+				snprintf( c->cr_msg, sizeof( c->cr_msg ),
+					"%s: rate must not be negative", c->argv[0] );
+				Debug( LDAP_DEBUG_CONFIG|LDAP_DEBUG_NONE,
+					"%s: %s\n", c->log, c->cr_msg, 0 );
+				rc = ARG_BAD_CONF;
+				break;
+			}
+			dd->rate = c->value_int;
+			rc = 0;
+			break;
 		default:
 			abort ();
 		}
@@ -291,6 +377,548 @@ refint_cf_gen(ConfigArgs *c)
 	return rc;
 }
 
+static int
+refint_qcmp( const void *v1, const void *v2 )
+{
+	const refint_q *q1 = v1, *q2 = v2;
+	int rc;
+
+	rc = q1->do_sub - q2->do_sub;
+	if ( rc == 0 )
+		rc = ber_bvcmp( &q1->oldndn, &q2->oldndn );
+	if ( rc == 0 )
+		rc = ber_bvcmp( &q1->newndn, &q2->newndn );
+	return rc;
+}
+
+static void
+refint_qfree( refint_q *rq )
+{
+	ber_bvarray_free( rq->pending );
+	ch_free( rq->newndn.bv_val );
+	ch_free( rq->newdn.bv_val );
+	ch_free( rq->oldndn.bv_val );
+	ch_free( rq->olddn.bv_val );
+	ch_free( rq );
+}
+
+static int
+refint_dn_related( struct berval *dn1, struct berval *dn2 )
+{
+	if ( BER_BVISEMPTY( dn1 ) || BER_BVISEMPTY( dn2 ))
+		return 0;
+	return dnIsSuffix( dn1, dn2 ) || dnIsSuffix( dn2, dn1 );
+}
+
+/* See if rq touches the subtree of any repair from the one at q up
+ * to the one at stop. Such repairs must be done in the order they
+ * were queued: a batch computes all its changes before writing any
+ * of them, and a merged repair takes the place of the one it is
+ * merged with.
+ */
+static int
+refint_conflict( refint_q *q, refint_q *stop, refint_q *rq )
+{
+	for ( ; q != stop; q = q->next ) {
+		if ( refint_dn_related( &rq->oldndn, &q->oldndn ) ||
+			refint_dn_related( &rq->oldndn, &q->newndn ) ||
+			refint_dn_related( &rq->newndn, &q->oldndn ) ||
+			refint_dn_related( &rq->newndn, &q->newndn ))
+			return 1;
+	}
+	return 0;
+}
+
+/* Find a waiting repair identical to rq that rq may be merged with,
+ * one with no conflicting repair between them in the queue. The
+ * tree holds the last one queued of identical repairs.
+ * The caller must hold qmutex.
+ */
+static refint_q *
+refint_qdup( refint_data *id, refint_q *rq, int head )
+{
+	refint_q *dup;
+
+	dup = avl_find( id->qtree, rq, refint_qcmp );
+	if ( dup && refint_conflict( head ? id->qhead : dup->next,
+		head ? dup : NULL, rq ))
+		dup = NULL;
+	return dup;
+}
+
+/* Queue a repair, unless the same repair is already waiting.
+ * The caller must hold qmutex. Returns the waiting repair, if any.
+ */
+static refint_q *
+refint_qput( refint_data *id, refint_q *rq, int head )
+{
+	refint_q *dup;
+
+	dup = refint_qdup( id, rq, head );
+	if ( dup )
+		return dup;
+
+	/* keep the last one queued in the tree */
+	if ( avl_insert( &id->qtree, rq, refint_qcmp, avl_dup_error ) && !head ) {
+		avl_delete( &id->qtree, rq, refint_qcmp );
+		avl_insert( &id->qtree, rq, refint_qcmp, avl_dup_error );
+	}
+
+	if ( head ) {
+		rq->next = id->qhead;
+		id->qhead = rq;
+		if ( !id->qtail )
+			id->qtail = rq;
+	} else {
+		rq->next = NULL;
+		if ( id->qtail ) {
+			id->qtail->next = rq;
+		} else {
+			id->qhead = rq;
+		}
+		id->qtail = rq;
+	}
+	id->qlen++;
+	return NULL;
+}
+
+/* Let a waiting repair take over the refintPending values of its
+ * duplicate. The caller must hold qmutex.
+ */
+static void
+refint_qmerge( refint_q *rq, refint_q *dup )
+{
+	int i;
+
+	if ( dup->pending ) {
+		for ( i = 0; !BER_BVISNULL( &dup->pending[i] ); i++ )
+			ber_bvarray_add( &rq->pending, &dup->pending[i] );
+		ch_free( dup->pending );
+		dup->pending = NULL;
+	}
+	if ( dup->qtime < rq->qtime )
+		rq->qtime = dup->qtime;
+}
+
+/* refintPending values are
+ *	<queue time> <do_sub> <length of old DN> <old DN><new DN>
+ * the new DN being empty for a Delete.
+ */
+static void
+refint_qvalue( refint_q *rq, struct berval *bv )
+{
+	char buf[ 64 ], *ptr;
+	int len;
+
+	len = snprintf( buf, sizeof( buf ), "%ld %d %lu ",
+		(long)rq->qtime, rq->do_sub, rq->olddn.bv_len );
+	bv->bv_len = len + rq->olddn.bv_len + rq->newdn.bv_len;
+	bv->bv_val = ch_malloc( bv->bv_len + 1 );
+	ptr = lutil_strcopy( bv->bv_val, buf );
+	ptr = lutil_strncopy( ptr, rq->olddn.bv_val, rq->olddn.bv_len );
+	if ( !BER_BVISEMPTY( &rq->newdn ))
+		ptr = lutil_strncopy( ptr, rq->newdn.bv_val, rq->newdn.bv_len );
+	*ptr = '\0';
+}
+
+static refint_q *
+refint_qparse( struct berval *bv )
+{
+	refint_q *rq;
+	struct berval dn;
+	char *ptr, *end = bv->bv_val + bv->bv_len;
+	long qtime;
+	int do_sub, rc;
+	unsigned long len;
+
+	qtime = strtol( bv->bv_val, &ptr, 10 );
+	if ( *ptr++ != ' ' )
+		return NULL;
+	do_sub = strtol( ptr, &ptr, 10 );
+	if ( *ptr++ != ' ' )
+		return NULL;
+	len = strtoul( ptr, &ptr, 10 );
+	if ( *ptr++ != ' ' || len == 0 || len > (unsigned long)( end - ptr ))
+		return NULL;
+
+	rq = ch_calloc( 1, sizeof( refint_q ));
+	rq->qtime = qtime;
+	rq->do_sub = do_sub;
+	/* the new DN follows, the old one needs a terminator of its own */
+	ber_str2bv( ptr, len, 1, &dn );
+	rc = dnPrettyNormal( NULL, &dn, &rq->olddn, &rq->oldndn, NULL );
+	ch_free( dn.bv_val );
+	if ( rc )
+		goto fail;
+	dn.bv_val = ptr + len;
+	dn.bv_len = end - dn.bv_val;
+	if ( dn.bv_len &&
+		dnPrettyNormal( NULL, &dn, &rq->newdn, &rq->newndn, NULL ))
+		goto fail;
+	return rq;
+
+fail:
+	refint_qfree( rq );
+	return NULL;
+}
+
+/* Add or remove refintPending values in the suffix entry */
+static int
+refint_pending_mod(
+	Operation *op,
+	refint_data *id,
+	BerVarray vals,
+	int nvals,
+	int mop )
+{
+	slap_overinst *on = id->on;
+	Modifications mod;
+	Operation op2;
+	SlapReply rs2 = {REP_RESULT};
+	slap_callback cb = { NULL, slap_null_cb, NULL, NULL };
+	BackendDB be;
+
+	/* nowhere to keep them */
+	if ( on->on_info->oi_origdb == frontendDB ||
+		!on->on_info->oi_orig->bi_op_modify )
+		return LDAP_UNWILLING_TO_PERFORM;
+
+	mod.sml_numvals = nvals;
+	mod.sml_values = vals;
+	mod.sml_nvalues = NULL;
+	mod.sml_desc = ad_refintPending;
+	mod.sml_op = mop;
+	mod.sml_flags = SLAP_MOD_INTERNAL;
+	mod.sml_next = NULL;
+
+	be = *on->on_info->oi_origdb;
+	be.bd_info = on->on_info->oi_orig;
+
+	op2 = *op;
+	memset( op2.o_ctrlflag, 0, sizeof( op2.o_ctrlflag ));
+	op2.o_ctrls = NULL;
+	op2.o_tag = LDAP_REQ_MODIFY;
+	op2.o_callback = &cb;
+	op2.o_bd = &be;
+	op2.o_req_dn = be.be_suffix[0];
+	op2.o_req_ndn = be.be_nsuffix[0];
+	op2.o_dn = be.be_rootdn;
+	op2.o_ndn = be.be_rootndn;
+	op2.orm_modlist = &mod;
+	op2.orm_no_opattrs = 1;
+	op2.o_managedsait = SLAP_CONTROL_NONCRITICAL;
+	op2.o_no_schema_check = 1;
+	op2.o_dont_replicate = 1;
+	op2.o_opid = -1;
+	be.be_modify( &op2, &rs2 );
+
+	if ( mod.sml_next != NULL ) {
+		slap_mods_free( mod.sml_next, 1 );
+	}
+	if ( rs2.sr_err != LDAP_SUCCESS ) {
+		Debug( LDAP_DEBUG_TRACE,
+			"refint_pending_mod: %s of %d values failed: %d\n",
+			mop == SLAP_MOD_SOFTADD ? "add" : "delete", nvals, rs2.sr_err );
+	}
+	return rs2.sr_err;
+}
+
+/* Have the task run as soon as possible, unless it is already
+ * running or scheduled. Returns nonzero if the listener needs
+ * to be woken up.
+ */
+static int
+refint_qschedule( refint_data *id, BackendDB *be )
+{
+	int ac = 0;
+
+	ldap_pvt_thread_mutex_lock( &slapd_rq.rq_mutex );
+	if ( !id->qtask ) {
+		id->qtask = ldap_pvt_runqueue_insert( &slapd_rq, RUNQ_INTERVAL,
+			refint_qtask, id, "refint_qtask",
+			be->be_suffix[0].bv_val );
+		ac = 1;
+	} else {
+		if ( !ldap_pvt_runqueue_isrunning( &slapd_rq, id->qtask ) &&
+			!id->qtask->next_sched.tv_sec ) {
+			id->qtask->interval.tv_sec = 0;
+			ldap_pvt_runqueue_resched( &slapd_rq, id->qtask, 0 );
+			id->qtask->interval.tv_sec = RUNQ_INTERVAL;
+			ac = 1;
+		}
+	}
+	ldap_pvt_thread_mutex_unlock( &slapd_rq.rq_mutex );
+
+	return ac;
+}
+
+/* Queue again the repairs that were pending when the server stopped */
+static void
+refint_qload( BackendDB *be, refint_data *id )
+{
+	slap_overinst *on = id->on;
+	Connection conn = { 0 };
+	OperationBuffer opbuf;
+	Operation *op;
+	Entry *e = NULL;
+	Attribute *a;
+	refint_q *rq, *dup;
+	int i, n = 0;
+
+	if ( on->on_info->oi_origdb == frontendDB ||
+		( slapMode & SLAP_TOOL_MODE ))
+		return;
+
+	connection_fake_init2( &conn, &opbuf, ldap_pvt_thread_pool_context(), 0 );
+	op = &opbuf.ob_op;
+	op->o_bd = be;
+	op->o_dn = be->be_rootdn;
+	op->o_ndn = be->be_rootndn;
+
+	if ( overlay_entry_get_ov( op, &be->be_nsuffix[0], NULL,
+		ad_refintPending, 0, &e, on ) != LDAP_SUCCESS || e == NULL )
+		return;
+
+	a = attr_find( e->e_attrs, ad_refintPending );
+	if ( a ) {
+		ldap_pvt_thread_mutex_lock( &id->qmutex );
+		for ( i = 0; i < a->a_numvals; i++ ) {
+			rq = refint_qparse( &a->a_vals[i] );
+			if ( !rq ) {
+				Debug( LDAP_DEBUG_ANY, "refint_qload: "
+					"ignoring invalid refintPending value \"%s\"\n",
+					a->a_vals[i].bv_val, 0, 0 );
+				continue;
+			}
+			rq->rdata = id;
+			rq->db = id->db;
+			value_add_one( &rq->pending, &a->a_vals[i] );
+			dup = refint_qput( id, rq, 0 );
+			if ( dup ) {
+				refint_qmerge( dup, rq );
+				refint_qfree( rq );
+			} else {
+				n++;
+			}
+		}
+		ldap_pvt_thread_mutex_unlock( &id->qmutex );
+	}
+	overlay_entry_release_ov( op, e, 0, on );
+
+	if ( n ) {
+		Debug( LDAP_DEBUG_STATS, "refint_qload: %s: "
+			"resuming %d pending repairs\n",
+			be->be_suffix[0].bv_val, n, 0 );
+		refint_qschedule( id, be );
+	}
+}
+
+static void
+refint_monitor_set( Entry *e, AttributeDescription *ad, unsigned long n )
+{
+	Attribute *a;
+	char buf[ SLAP_TEXT_BUFLEN ];
+	struct berval bv;
+
+	a = attr_find( e->e_attrs, ad );
+	assert( a != NULL );
+
+	bv.bv_val = buf;
+	bv.bv_len = snprintf( buf, sizeof( buf ), "%lu", n );
+
+	if ( a->a_nvals != a->a_vals ) {
+		ber_bvreplace( &a->a_nvals[ 0 ], &bv );
+	}
+	ber_bvreplace( &a->a_vals[ 0 ], &bv );
+}
+
+static int
+refint_monitor_update(
+	Operation	*op,
+	SlapReply	*rs,
+	Entry		*e,
+	void		*priv )
+{
+	refint_data	*id = (refint_data *) priv;
+	unsigned long	depth, repairs, lag = 0;
+	time_t		oldest;
+
+	ldap_pvt_thread_mutex_lock( &id->qmutex );
+	depth = id->qlen + id->qrun;
+	if ( id->qrun )
+		oldest = id->qbusy;
+	else if ( id->qhead )
+		oldest = id->qhead->qtime;
+	else
+		oldest = 0;
+	repairs = id->nrepairs;
+	ldap_pvt_thread_mutex_unlock( &id->qmutex );
+
+	if ( oldest && slap_get_time() > oldest )
+		lag = slap_get_time() - oldest;
+
+	refint_monitor_set( e, ad_refintQueueDepth, depth );
+	refint_monitor_set( e, ad_refintQueueLag, lag );
+	refint_monitor_set( e, ad_refintRepairs, repairs );
+
+	return SLAP_CB_CONTINUE;
+}
+
+static int
+refint_monitor_free(
+	Entry		*e,
+	void		**priv )
+{
+	struct berval	values[ 2 ];
+	Modification	mod = { 0 };
+	AttributeDescription *ads[ 4 ];
+
+	const char	*text;
+	char		textbuf[ SLAP_TEXT_BUFLEN ];
+
+	int		i;
+
+	/* NOTE: if slap_shutdown != 0, priv might have already been freed */
+	*priv = NULL;
+
+	/* Remove objectClass */
+	mod.sm_op = LDAP_MOD_DELETE;
+	mod.sm_desc = slap_schema.si_ad_objectClass;
+	mod.sm_values = values;
+	mod.sm_numvals = 1;
+	values[ 0 ] = oc_olmRefint->soc_cname;
+	BER_BVZERO( &values[ 1 ] );
+
+	(void)modify_delete_values( e, &mod, 1, &text,
+		textbuf, sizeof( textbuf ) );
+	/* don't care too much about return code... */
+
+	/* remove attrs */
+	ads[ 0 ] = ad_refintQueueDepth;
+	ads[ 1 ] = ad_refintQueueLag;
+	ads[ 2 ] = ad_refintRepairs;
+	ads[ 3 ] = NULL;
+	for ( i = 0; ads[ i ]; i++ ) {
+		mod.sm_values = NULL;
+		mod.sm_desc = ads[ i ];
+		mod.sm_numvals = 0;
+		(void)modify_delete_values( e, &mod, 1, &text,
+			textbuf, sizeof( textbuf ) );
+		/* don't care too much about return code... */
+	}
+
+	return SLAP_CB_CONTINUE;
+}
+
+static int
+refint_monitor_db_open( BackendDB *be )
+{
+	slap_overinst		*on = (slap_overinst *)be->bd_info;
+	refint_data		*id = on->on_bi.bi_private;
+	Attribute		*a, *next;
+	monitor_callback_t	*cb = NULL;
+	int			rc = 0;
+	BackendInfo		*mi;
+	monitor_extra_t		*mbe;
+
+	if ( !SLAP_DBMONITORING( be ) || id->monitor_cb != NULL ) {
+		return 0;
+	}
+
+	mi = backend_info( "monitor" );
+	if ( !mi || !mi->bi_extra ) {
+		SLAP_DBFLAGS( be ) ^= SLAP_DBFLAG_MONITORING;
+		return 0;
+	}
+	mbe = mi->bi_extra;
+
+	/* don't bother if monitor is not configured */
+	if ( !mbe->is_configured() ) {
+		return 0;
+	}
+
+	/* alloc as many as required (plus 1 for objectClass) */
+	a = attrs_alloc( 1 + 3 );
+	if ( a == NULL ) {
+		rc = 1;
+		goto cleanup;
+	}
+
+	a->a_desc = slap_schema.si_ad_objectClass;
+	attr_valadd( a, &oc_olmRefint->soc_cname, NULL, 1 );
+	next = a->a_next;
+
+	{
+		struct berval	bv = BER_BVC( "0" );
+
+		next->a_desc = ad_refintQueueDepth;
+		attr_valadd( next, &bv, NULL, 1 );
+		next = next->a_next;
+
+		next->a_desc = ad_refintQueueLag;
+		attr_valadd( next, &bv, NULL, 1 );
+		next = next->a_next;
+
+		next->a_desc = ad_refintRepairs;
+		attr_valadd( next, &bv, NULL, 1 );
+		next = next->a_next;
+	}
+
+	cb = ch_calloc( sizeof( monitor_callback_t ), 1 );
+	cb->mc_update = refint_monitor_update;
+	cb->mc_free = refint_monitor_free;
+	cb->mc_private = (void *)id;
+
+	/* make sure the database is registered; then add monitor attributes */
+	BER_BVZERO( &id->monitor_ndn );
+	rc = mbe->register_overlay( be, on, &id->monitor_ndn );
+	if ( rc == 0 ) {
+		rc = mbe->register_entry_attrs( &id->monitor_ndn, a, cb,
+			NULL, -1, NULL );
+	}
+
+cleanup:;
+	if ( rc != 0 ) {
+		if ( cb != NULL ) {
+			ch_free( cb );
+			cb = NULL;
+		}
+	}
+
+	/* store for cleanup */
+	id->monitor_cb = (void *)cb;
+
+	/* the monitor entry keeps its own copy of the attributes */
+	if ( a != NULL ) {
+		attrs_free( a );
+	}
+
+	return rc;
+}
+
+static int
+refint_monitor_db_close( BackendDB *be )
+{
+	slap_overinst *on = (slap_overinst *)be->bd_info;
+	refint_data *id = on->on_bi.bi_private;
+
+	if ( !BER_BVISNULL( &id->monitor_ndn ) ) {
+		BackendInfo		*mi = backend_info( "monitor" );
+		monitor_extra_t		*mbe;
+
+		if ( mi && mi->bi_extra ) {
+			mbe = mi->bi_extra;
+			mbe->unregister_entry_callback( &id->monitor_ndn,
+				(monitor_callback_t *)id->monitor_cb,
+				NULL, 0, NULL );
+		}
+		id->monitor_cb = NULL;
+		BER_BVZERO( &id->monitor_ndn );
+	}
+
+	return 0;
+}
+
 /*
 ** allocate new refint_data;
 ** store in on_bi.bi_private;
@@ -307,7 +935,13 @@ refint_db_init(
 	refint_data *id = ch_calloc(1,sizeof(refint_data));
 
 	on->on_bi.bi_private = id;
+	id->on = on;
+	id->batch = REFINT_BATCH;
 	ldap_pvt_thread_mutex_init( &id->qmutex );
+
+	if ( backend_info( "monitor" ) != NULL ) {
+		SLAP_DBFLAGS( be ) |= SLAP_DBFLAG_MONITORING;
+	}
 	return(0);
 }
 
@@ -322,10 +956,18 @@ refint_db_destroy(
 	if ( on->on_bi.bi_private ) {
 		refint_data *id = on->on_bi.bi_private;
 		refint_attrs *ii, *ij;
+		refint_q *rq;
 
 		on->on_bi.bi_private = NULL;
 		ldap_pvt_thread_mutex_destroy( &id->qmutex );
 
+		/* whatever is left is still in refintPending */
+		avl_free( id->qtree, NULL );
+		while ( ( rq = id->qhead ) ) {
+			id->qhead = rq->next;
+			refint_qfree( rq );
+		}
+
 		for(ii = id->attrs; ii; ii = ij) {
 			ij = ii->next;
 			ch_free(ii);
@@ -394,6 +1036,15 @@ refint_open(
 			return -1;
 		}
 	}
+
+	refint_qload( be, id );
+
+	/* not worth failing over */
+	if ( refint_monitor_db_open( be ) != 0 ) {
+		Debug( LDAP_DEBUG_ANY,
+			"refint_open: %s: queue not visible in cn=monitor\n",
+			be->be_suffix[0].bv_val, 0, 0 );
+	}
 	return(0);
 }
 
@@ -413,6 +1064,8 @@ refint_close(
 	slap_overinst *on	= (slap_overinst *) be->bd_info;
 	refint_data *id	= on->on_bi.bi_private;
 
+	refint_monitor_db_close( be );
+
 	ch_free( id->dn.bv_val );
 	BER_BVZERO( &id->dn );
 	ch_free( id->refint_dn.bv_val );
@@ -464,6 +1117,8 @@ refint_search_cb(
 	ip->next = rq->attrs;
 	rq->attrs = ip;
 	ip->attrs = NULL;
+	ip->rq = rq;
+	ip->merged = NULL;
 	for(ia = da; ia; ia = ia->next) {
 		if ( (a = attr_find(rs->sr_entry->e_attrs, ia->attr) ) ) {
 			int exact = -1, is_exact;
@@ -559,9 +1214,10 @@ refint_search_cb(
 				}
 			}
 
-			/* Deleting/replacing all values and a nothing DN is configured? */
-			if ( na && na->ra_numvals == a->a_numvals && !BER_BVISNULL(&dd->nothing) )
-				na->dont_empty = 1;
+			/* refint_nothing() decides about the nothing DN, once
+			 * it knows all the changes made to this attribute */
+			if ( na )
+				na->ra_total = a->a_numvals;
 
 			Debug( LDAP_DEBUG_TRACE, "refint_search_cb: %s: %s (#%d)\n",
 				a->a_desc->ad_cname.bv_val, rq->olddn.bv_val, i );
@@ -572,15 +1228,12 @@ refint_search_cb(
 }
 
 static int
-refint_repair(
+refint_search(
 	Operation	*op,
 	refint_data	*id,
 	refint_q	*rq )
 {
-	dependent_data	*dp;
 	SlapReply		rs = {REP_RESULT};
-	Operation		op2;
-	unsigned long	opid;
 	int		rc;
 	int	cache;
 
@@ -598,157 +1251,343 @@ refint_repair(
 
 	if ( rc != LDAP_SUCCESS ) {
 		Debug( LDAP_DEBUG_TRACE,
-			"refint_repair: search failed: %d\n",
+			"refint_search: search failed: %d\n",
 			rc, 0, 0 );
-		return rc;
 	}
+	return rc;
+}
+
+/* Of all the changes made to an attribute of a dependent entry,
+ * let one Delete put in the nothing DN if they would leave the
+ * attribute empty.
+ */
+static void
+refint_nothing(
+	refint_data	*id,
+	dependent_data	*dp )
+{
+	dependent_data	*dq, *dr;
+	refint_attrs	*ra, *rb, *first;
+	int		dels, adds;
+
+	for ( dq = dp; dq; dq = dq->merged ) {
+		for ( ra = dq->attrs; ra; ra = ra->next ) {
+			/* already seen along with an earlier change? */
+			for ( dr = dp; dr != dq; dr = dr->merged ) {
+				for ( rb = dr->attrs; rb && rb->attr != ra->attr; rb = rb->next )
+					;
+				if ( rb ) break;
+			}
+			if ( dr != dq ) continue;
+
+			dels = adds = 0;
+			first = NULL;
+			for ( ; dr; dr = dr->merged ) {
+				for ( rb = dr->attrs; rb && rb->attr != ra->attr; rb = rb->next )
+					;
+				if ( !rb ) continue;
+				rb->dont_empty = 0;
+				dels += rb->ra_numvals;
+				if ( !BER_BVISEMPTY( &dr->rq->newdn ) )
+					adds = 1;
+				else if ( !first )
+					first = rb;
+			}
+			if ( first && !adds && dels == ra->ra_total &&
+				!BER_BVISNULL( &id->nothing ) )
+				first->dont_empty = 1;
+		}
+	}
+}
+
+/* Build the Modifications that repair one dependent entry */
+static void
+refint_mods(
+	Operation	*op2,
+	refint_data	*id,
+	dependent_data	*dp )
+{
+	refint_q	*rq = dp->rq;
+	refint_attrs	*ra;
+	Modifications	*m;
+
+	for ( ra = dp->attrs; ra; ra = ra->next ) {
+		size_t	len;
+
+		/* Add values */
+		if ( ra->dont_empty || !BER_BVISEMPTY( &rq->newdn ) ) {
+			len = sizeof(Modifications);
+
+			if ( ra->new_vals == NULL ) {
+				len += 4*sizeof(BerValue);
+			}
+
+			m = op2->o_tmpalloc( len, op2->o_tmpmemctx );
+			m->sml_next = op2->orm_modlist;
+			op2->orm_modlist = m;
+			m->sml_op = LDAP_MOD_ADD;
+			m->sml_flags = 0;
+			m->sml_desc = ra->attr;
+			m->sml_type = ra->attr->ad_cname;
+			if ( ra->new_vals == NULL ) {
+				m->sml_values = (BerVarray)(m+1);
+				m->sml_nvalues = m->sml_values+2;
+				BER_BVZERO( &m->sml_values[1] );
+				BER_BVZERO( &m->sml_nvalues[1] );
+				m->sml_numvals = 1;
+				if ( BER_BVISEMPTY( &rq->newdn ) ) {
+					m->sml_values[0] = id->nothing;
+					m->sml_nvalues[0] = id->nnothing;
+				} else {
+					m->sml_values[0] = rq->newdn;
+					m->sml_nvalues[0] = rq->newndn;
+				}
+			} else {
+				m->sml_values = ra->new_vals;
+				m->sml_nvalues = ra->new_nvals;
+				m->sml_numvals = ra->ra_numvals;
+			}
+		}
+
+		/* Delete values */
+		len = sizeof(Modifications);
+		if ( ra->old_vals == NULL ) {
+			len += 4*sizeof(BerValue);
+		}
+		m = op2->o_tmpalloc( len, op2->o_tmpmemctx );
+		m->sml_next = op2->orm_modlist;
+		op2->orm_modlist = m;
+		m->sml_op = LDAP_MOD_DELETE;
+		m->sml_flags = 0;
+		m->sml_desc = ra->attr;
+		m->sml_type = ra->attr->ad_cname;
+		if ( ra->old_vals == NULL ) {
+			m->sml_numvals = 1;
+			m->sml_values = (BerVarray)(m+1);
+			m->sml_nvalues = m->sml_values+2;
+			m->sml_values[0] = rq->olddn;
+			m->sml_nvalues[0] = rq->oldndn;
+			BER_BVZERO( &m->sml_values[1] );
+			BER_BVZERO( &m->sml_nvalues[1] );
+		} else {
+			m->sml_values = ra->old_vals;
+			m->sml_nvalues = ra->old_nvals;
+			m->sml_numvals = ra->ra_numvals;
+		}
+	}
+}
 
-	/* safety? paranoid just in case */
-	if ( op->o_callback->sc_private == NULL ) {
+/* Apply the changes of dp and of everything merged with it
+ * in one Modify of the dependent entry
+ */
+static int
+refint_modify(
+	Operation	*op,
+	refint_data	*id,
+	dependent_data	*dp )
+{
+	dependent_data	*dq;
+	SlapReply	rs2 = {REP_RESULT};
+	Operation	op2 = *op;
+	Modifications	*m;
+	int		rc;
+
+	op2.o_bd = select_backend( &dp->ndn, 1 );
+	if ( !op2.o_bd ) {
 		Debug( LDAP_DEBUG_TRACE,
-			"refint_repair: callback wiped out sc_private?!\n",
-			0, 0, 0 );
-		return 0;
+			"refint_modify: no backend for DN %s!\n",
+			dp->dn.bv_val, 0, 0 );
+		return LDAP_NO_SUCH_OBJECT;
+	}
+	op2.o_tag = LDAP_REQ_MODIFY;
+	op2.orm_modlist = NULL;
+	op2.o_req_dn	= dp->dn;
+	op2.o_req_ndn	= dp->ndn;
+	/* Internal ops, never replicate these */
+	op2.orm_no_opattrs = 1;
+	op2.o_dont_replicate = 1;
+	op2.o_opid = 0;
+
+	/* Set our ModifiersName */
+	if ( SLAP_LASTMOD( op->o_bd ) ) {
+			m = op2.o_tmpalloc( sizeof(Modifications) +
+				4*sizeof(BerValue), op2.o_tmpmemctx );
+			m->sml_next = op2.orm_modlist;
+			op2.orm_modlist = m;
+			m->sml_op = LDAP_MOD_REPLACE;
+			m->sml_flags = SLAP_MOD_INTERNAL;
+			m->sml_desc = slap_schema.si_ad_modifiersName;
+			m->sml_type = m->sml_desc->ad_cname;
+			m->sml_numvals = 1;
+			m->sml_values = (BerVarray)(m+1);
+			m->sml_nvalues = m->sml_values+2;
+			BER_BVZERO( &m->sml_values[1] );
+			BER_BVZERO( &m->sml_nvalues[1] );
+			m->sml_values[0] = id->refint_dn;
+			m->sml_nvalues[0] = id->refint_ndn;
 	}
 
+	refint_nothing( id, dp );
+	for ( dq = dp; dq; dq = dq->merged ) {
+		refint_mods( &op2, id, dq );
+	}
+
+	op2.o_dn = op2.o_bd->be_rootdn;
+	op2.o_ndn = op2.o_bd->be_rootndn;
+	rc = op2.o_bd->be_modify( &op2, &rs2 );
+	if ( rc != LDAP_SUCCESS ) {
+		Debug( LDAP_DEBUG_TRACE,
+			"refint_modify: dependent modify failed: %d\n",
+			rs2.sr_err, 0, 0 );
+	}
+
+	while ( ( m = op2.orm_modlist ) ) {
+		op2.orm_modlist = m->sml_next;
+		op2.o_tmpfree( m, op2.o_tmpmemctx );
+	}
+
+	return rc;
+}
+
+static int
+refint_dep_cmp( const void *v1, const void *v2 )
+{
+	const dependent_data *d1 = v1, *d2 = v2;
+
+	return ber_bvcmp( &d1->ndn, &d2->ndn );
+}
+
+/* Write the repairs found by the searches of a batch. Returns
+ * the number of dependent entries modified.
+ */
+static int
+refint_repair(
+	Operation	*op,
+	refint_data	*id,
+	refint_q	*batch )
+{
+	Avlnode		*deps = NULL;
+	dependent_data	*dp, *dq, *dr;
+	refint_q	*rq;
+	int		rc, n = 0;
+
 	/* Set up the Modify requests */
 	op->o_callback->sc_response = &slap_null_cb;
 
 	/*
 	 * [our search callback builds a list of attrs]
-	 * foreach attr:
+	 * gather the changes each batch member makes to
+	 * the same dependent entry;
+	 * foreach dependent entry:
 	 *	make sure its dn has a backend;
 	 *	build Modification* chain;
 	 *	call the backend modify function;
 	 *
 	 */
 
-	opid = op->o_opid;
-	op2 = *op;
-	for ( dp = rq->attrs; dp; dp = dp->next ) {
-		SlapReply	rs2 = {REP_RESULT};
-		refint_attrs	*ra;
-		Modifications	*m;
-
-		if ( dp->attrs == NULL ) continue; /* TODO: Is this needed? */
-
-		op2.o_bd = select_backend( &dp->ndn, 1 );
-		if ( !op2.o_bd ) {
-			Debug( LDAP_DEBUG_TRACE,
-				"refint_repair: no backend for DN %s!\n",
-				dp->dn.bv_val, 0, 0 );
-			continue;
-		}
-		op2.o_tag = LDAP_REQ_MODIFY;
-		op2.orm_modlist = NULL;
-		op2.o_req_dn	= dp->dn;
-		op2.o_req_ndn	= dp->ndn;
-		/* Internal ops, never replicate these */
-		op2.orm_no_opattrs = 1;
-		op2.o_dont_replicate = 1;
-		op2.o_opid = 0;
-
-		/* Set our ModifiersName */
-		if ( SLAP_LASTMOD( op->o_bd ) ) {
-				m = op2.o_tmpalloc( sizeof(Modifications) +
-					4*sizeof(BerValue), op2.o_tmpmemctx );
-				m->sml_next = op2.orm_modlist;
-				op2.orm_modlist = m;
-				m->sml_op = LDAP_MOD_REPLACE;
-				m->sml_flags = SLAP_MOD_INTERNAL;
-				m->sml_desc = slap_schema.si_ad_modifiersName;
-				m->sml_type = m->sml_desc->ad_cname;
-				m->sml_numvals = 1;
-				m->sml_values = (BerVarray)(m+1);
-				m->sml_nvalues = m->sml_values+2;
-				BER_BVZERO( &m->sml_values[1] );
-				BER_BVZERO( &m->sml_nvalues[1] );
-				m->sml_values[0] = id->refint_dn;
-				m->sml_nvalues[0] = id->refint_ndn;
+	for ( rq = batch; rq; rq = rq->next ) {
+		for ( dp = rq->attrs; dp; dp = dp->next ) {
+			if ( dp->attrs == NULL ) continue; /* TODO: Is this needed? */
+			if ( avl_insert( &deps, dp, refint_dep_cmp, avl_dup_error )) {
+				dq = avl_find( deps, dp, refint_dep_cmp );
+				while ( dq->merged )
+					dq = dq->merged;
+				dq->merged = dp;
+			}
 		}
+	}
 
-		for ( ra = dp->attrs; ra; ra = ra->next ) {
-			size_t	len;
-
-			/* Add values */
-			if ( ra->dont_empty || !BER_BVISEMPTY( &rq->newdn ) ) {
-				len = sizeof(Modifications);
-
-				if ( ra->new_vals == NULL ) {
-					len += 4*sizeof(BerValue);
-				}
-
-				m = op2.o_tmpalloc( len, op2.o_tmpmemctx );
-				m->sml_next = op2.orm_modlist;
-				op2.orm_modlist = m;
-				m->sml_op = LDAP_MOD_ADD;
-				m->sml_flags = 0;
-				m->sml_desc = ra->attr;
-				m->sml_type = ra->attr->ad_cname;
-				if ( ra->new_vals == NULL ) {
-					m->sml_values = (BerVarray)(m+1);
-					m->sml_nvalues = m->sml_values+2;
-					BER_BVZERO( &m->sml_values[1] );
-					BER_BVZERO( &m->sml_nvalues[1] );
-					m->sml_numvals = 1;
-					if ( BER_BVISEMPTY( &rq->newdn ) ) {
-						m->sml_values[0] = id->nothing;
-						m->sml_nvalues[0] = id->nnothing;
-					} else {
-						m->sml_values[0] = rq->newdn;
-						m->sml_nvalues[0] = rq->newndn;
-					}
-				} else {
-					m->sml_values = ra->new_vals;
-					m->sml_nvalues = ra->new_nvals;
-					m->sml_numvals = ra->ra_numvals;
+	for ( rq = batch; rq; rq = rq->next ) {
+		for ( dp = rq->attrs; dp; dp = dp->next ) {
+			if ( dp->attrs == NULL ||
+				avl_find( deps, dp, refint_dep_cmp ) != dp )
+				continue;
+
+			rc = refint_modify( op, id, dp );
+			n++;
+			if ( rc != LDAP_SUCCESS && dp->merged ) {
+				/* retry the changes one at a time,
+				 * so that the others still get done */
+				for ( dq = dp; dq; dq = dr ) {
+					dr = dq->merged;
+					dq->merged = NULL;
+					refint_modify( op, id, dq );
+					n++;
 				}
 			}
-
-			/* Delete values */
-			len = sizeof(Modifications);
-			if ( ra->old_vals == NULL ) {
-				len += 4*sizeof(BerValue);
-			}
-			m = op2.o_tmpalloc( len, op2.o_tmpmemctx );
-			m->sml_next = op2.orm_modlist;
-			op2.orm_modlist = m;
-			m->sml_op = LDAP_MOD_DELETE;
-			m->sml_flags = 0;
-			m->sml_desc = ra->attr;
-			m->sml_type = ra->attr->ad_cname;
-			if ( ra->old_vals == NULL ) {
-				m->sml_numvals = 1;
-				m->sml_values = (BerVarray)(m+1);
-				m->sml_nvalues = m->sml_values+2;
-				m->sml_values[0] = rq->olddn;
-				m->sml_nvalues[0] = rq->oldndn;
-				BER_BVZERO( &m->sml_values[1] );
-				BER_BVZERO( &m->sml_nvalues[1] );
-			} else {
-				m->sml_values = ra->old_vals;
-				m->sml_nvalues = ra->old_nvals;
-				m->sml_numvals = ra->ra_numvals;
-			}
 		}
+	}
+	avl_free( deps, NULL );
 
-		op2.o_dn = op2.o_bd->be_rootdn;
-		op2.o_ndn = op2.o_bd->be_rootndn;
-		rc = op2.o_bd->be_modify( &op2, &rs2 );
-		if ( rc != LDAP_SUCCESS ) {
-			Debug( LDAP_DEBUG_TRACE,
-				"refint_repair: dependent modify failed: %d\n",
-				rs2.sr_err, 0, 0 );
+	return n;
+}
+
+static void
+refint_qclean(
+	Operation	*op,
+	refint_q	*rq )
+{
+	dependent_data	*dp, *dp_next;
+	refint_attrs *ra, *ra_next;
+
+	for ( dp = rq->attrs; dp; dp = dp_next ) {
+		dp_next = dp->next;
+		for ( ra = dp->attrs; ra; ra = ra_next ) {
+			ra_next = ra->next;
+			ber_bvarray_free_x( ra->new_nvals, op->o_tmpmemctx );
+			ber_bvarray_free_x( ra->new_vals, op->o_tmpmemctx );
+			ber_bvarray_free_x( ra->old_nvals, op->o_tmpmemctx );
+			ber_bvarray_free_x( ra->old_vals, op->o_tmpmemctx );
+			op->o_tmpfree( ra, op->o_tmpmemctx );
 		}
+		op->o_tmpfree( dp->ndn.bv_val, op->o_tmpmemctx );
+		op->o_tmpfree( dp->dn.bv_val, op->o_tmpmemctx );
+		op->o_tmpfree( dp, op->o_tmpmemctx );
+	}
+	rq->attrs = NULL;
+}
 
-		while ( ( m = op2.orm_modlist ) ) {
-			op2.orm_modlist = m->sml_next;
-			op2.o_tmpfree( m, op2.o_tmpmemctx );
+/* The batch is done: forget about it, here and in refintPending */
+static void
+refint_qdone(
+	Operation	*op,
+	refint_data	*id,
+	refint_q	*batch,
+	int		nrun,
+	int		nmods )
+{
+	refint_q	*rq;
+	BerVarray	vals;
+	int		i, n = 0;
+
+	for ( rq = batch; rq; rq = rq->next ) {
+		for ( i = 0; rq->pending && !BER_BVISNULL( &rq->pending[i] ); i++ )
+			n++;
+	}
+	if ( n ) {
+		vals = op->o_tmpalloc( ( n + 1 ) * sizeof( struct berval ),
+			op->o_tmpmemctx );
+		n = 0;
+		for ( rq = batch; rq; rq = rq->next ) {
+			for ( i = 0; rq->pending && !BER_BVISNULL( &rq->pending[i] ); i++ )
+				vals[n++] = rq->pending[i];
 		}
+		BER_BVZERO( &vals[n] );
+		refint_pending_mod( op, id, vals, n, SLAP_MOD_SOFTDEL );
+		op->o_tmpfree( vals, op->o_tmpmemctx );
 	}
-	op2.o_opid = opid;
 
-	return 0;
+	while ( ( rq = batch ) ) {
+		batch = rq->next;
+		refint_qclean( op, rq );
+		refint_qfree( rq );
+	}
+
+	ldap_pvt_thread_mutex_lock( &id->qmutex );
+	id->qrun -= nrun;
+	id->qbusy = 0;
+	id->nrepairs += nmods;
+	ldap_pvt_thread_mutex_unlock( &id->qmutex );
 }
 
 static void *
@@ -761,9 +1600,11 @@ refint_qtask( void *ctx, void *arg )
 	Operation *op;
 	slap_callback cb = { NULL, NULL, NULL, NULL };
 	Filter ftop, *fptr;
-	refint_q *rq;
+	refint_q *rq, *dup;
 	refint_attrs *ip;
 	int pausing = 0, rc = 0;
+	int nmods = 0, delay = -1;
+	time_t start = slap_get_time();
 
 	connection_fake_init( &conn, &opbuf, ctx );
 	op = &opbuf.ob_op;
@@ -796,108 +1637,130 @@ refint_qtask( void *ctx, void *arg )
 	}
 
 	for (;;) {
-		dependent_data	*dp, *dp_next;
-		refint_attrs *ra, *ra_next;
+		refint_q *batch = NULL, *last = NULL;
+		int nrun = 0, nmax = id->batch;
 
 		if ( ldap_pvt_thread_pool_pausing( &connection_pool ) > 0 ) {
 			pausing = 1;
 			break;
 		}
 
-		/* Dequeue an op */
-		ldap_pvt_thread_mutex_lock( &id->qmutex );
-		rq = id->qhead;
-		if ( rq ) {
-			id->qhead = rq->next;
-			if ( !id->qhead )
-				id->qtail = NULL;
-		}
-		ldap_pvt_thread_mutex_unlock( &id->qmutex );
-		if ( !rq )
-			break;
+		/* each repair modifies at least one entry, most likely */
+		if ( id->rate && id->rate - nmods < nmax )
+			nmax = id->rate - nmods;
 
-		for (fptr = ftop.f_or; fptr; fptr = fptr->f_next ) {
-			fptr->f_mr_value = rq->oldndn;
-			/* Use (attr:dnSubtreeMatch:=value) to catch subtree rename
-			 * and subtree delete where supported */
-			if (rq->do_sub)
-				fptr->f_choice = LDAP_FILTER_EXT;
-			else
-				fptr->f_choice = LDAP_FILTER_EQUALITY;
-		}
+		/* Search for the dependents of a batch of queued ops */
+		while ( nrun < nmax ) {
+			/* Dequeue an op */
+			ldap_pvt_thread_mutex_lock( &id->qmutex );
+			rq = id->qhead;
+			if ( rq && refint_conflict( batch, NULL, rq ))
+				rq = NULL;
+			if ( rq ) {
+				id->qhead = rq->next;
+				if ( !id->qhead )
+					id->qtail = NULL;
+				if ( avl_find( id->qtree, rq, refint_qcmp ) == rq )
+					avl_delete( &id->qtree, rq, refint_qcmp );
+				id->qlen--;
+				if ( !id->qrun++ )
+					id->qbusy = rq->qtime;
+				rq->next = NULL;
+			}
+			ldap_pvt_thread_mutex_unlock( &id->qmutex );
+			if ( !rq )
+				break;
+
+			for (fptr = ftop.f_or; fptr; fptr = fptr->f_next ) {
+				fptr->f_mr_value = rq->oldndn;
+				/* Use (attr:dnSubtreeMatch:=value) to catch subtree rename
+				 * and subtree delete where supported */
+				if (rq->do_sub)
+					fptr->f_choice = LDAP_FILTER_EXT;
+				else
+					fptr->f_choice = LDAP_FILTER_EQUALITY;
+			}
 
-		filter2bv_x( op, op->ors_filter, &op->ors_filterstr );
+			filter2bv_x( op, op->ors_filter, &op->ors_filterstr );
 
-		/* callback gets the searched dn instead */
-		cb.sc_private	= rq;
-		cb.sc_response	= refint_search_cb;
-		op->o_callback	= &cb;
-		op->o_tag	= LDAP_REQ_SEARCH;
-		op->ors_scope	= LDAP_SCOPE_SUBTREE;
-		op->ors_deref	= LDAP_DEREF_NEVER;
-		op->ors_limit   = NULL;
-		op->ors_slimit	= SLAP_NO_LIMIT;
-		op->ors_tlimit	= SLAP_NO_LIMIT;
+			/* callback gets the searched dn instead */
+			cb.sc_private	= rq;
+			cb.sc_response	= refint_search_cb;
+			op->o_callback	= &cb;
+			op->o_tag	= LDAP_REQ_SEARCH;
+			op->ors_scope	= LDAP_SCOPE_SUBTREE;
+			op->ors_deref	= LDAP_DEREF_NEVER;
+			op->ors_limit   = NULL;
+			op->ors_slimit	= SLAP_NO_LIMIT;
+			op->ors_tlimit	= SLAP_NO_LIMIT;
 
-		/* no attrs! */
-		op->ors_attrs = slap_anlist_no_attrs;
+			/* no attrs! */
+			op->ors_attrs = slap_anlist_no_attrs;
 
-		slap_op_time( &op->o_time, &op->o_tincr );
+			slap_op_time( &op->o_time, &op->o_tincr );
 
-		if ( rq->db != NULL ) {
-			op->o_bd = rq->db;
-			rc = refint_repair( op, id, rq );
+			if ( rq->db != NULL ) {
+				op->o_bd = rq->db;
+				rc = refint_search( op, id, rq );
 
-		} else {
-			BackendDB	*be;
+			} else {
+				BackendDB	*be;
 
-			LDAP_STAILQ_FOREACH( be, &backendDB, be_next ) {
-				/* we may want to skip cn=config */
-				if ( be == LDAP_STAILQ_FIRST(&backendDB) ) {
-					continue;
-				}
+				LDAP_STAILQ_FOREACH( be, &backendDB, be_next ) {
+					/* we may want to skip cn=config */
+					if ( be == LDAP_STAILQ_FIRST(&backendDB) ) {
+						continue;
+					}
 
-				if ( be->be_search && be->be_modify ) {
-					op->o_bd = be;
-					rc = refint_repair( op, id, rq );
+					if ( be->be_search && be->be_modify ) {
+						op->o_bd = be;
+						rc = refint_search( op, id, rq );
+					}
 				}
 			}
-		}
 
-		for ( dp = rq->attrs; dp; dp = dp_next ) {
-			dp_next = dp->next;
-			for ( ra = dp->attrs; ra; ra = ra_next ) {
-				ra_next = ra->next;
-				ber_bvarray_free_x( ra->new_nvals, op->o_tmpmemctx );
-				ber_bvarray_free_x( ra->new_vals, op->o_tmpmemctx );
-				ber_bvarray_free_x( ra->old_nvals, op->o_tmpmemctx );
-				ber_bvarray_free_x( ra->old_vals, op->o_tmpmemctx );
-				op->o_tmpfree( ra, op->o_tmpmemctx );
+			op->o_tmpfree( op->ors_filterstr.bv_val, op->o_tmpmemctx );
+			if ( rc == LDAP_BUSY ) {
+				pausing = 1;
+				/* re-queue this op */
+				refint_qclean( op, rq );
+				ldap_pvt_thread_mutex_lock( &id->qmutex );
+				id->qrun--;
+				dup = refint_qput( id, rq, 1 );
+				if ( dup ) {
+					refint_qmerge( dup, rq );
+					refint_qfree( rq );
+				}
+				ldap_pvt_thread_mutex_unlock( &id->qmutex );
+				break;
 			}
-			op->o_tmpfree( dp->ndn.bv_val, op->o_tmpmemctx );
-			op->o_tmpfree( dp->dn.bv_val, op->o_tmpmemctx );
-			op->o_tmpfree( dp, op->o_tmpmemctx );
+
+			if ( last )
+				last->next = rq;
+			else
+				batch = rq;
+			last = rq;
+			nrun++;
 		}
-		op->o_tmpfree( op->ors_filterstr.bv_val, op->o_tmpmemctx );
-		if ( rc == LDAP_BUSY ) {
-			pausing = 1;
-			/* re-queue this op */
-			ldap_pvt_thread_mutex_lock( &id->qmutex );
-			rq->next = id->qhead;
-			id->qhead = rq;
-			if ( !id->qtail )
-				id->qtail = rq;
-			ldap_pvt_thread_mutex_unlock( &id->qmutex );
+
+		if ( !batch )
 			break;
-		}
 
-		if ( !BER_BVISNULL( &rq->newndn )) {
-			ch_free( rq->newndn.bv_val );
-			ch_free( rq->newdn.bv_val );
+		/* Write the repairs */
+		rc = refint_repair( op, id, batch );
+		nmods += rc;
+		refint_qdone( op, id, batch, nrun, rc );
+
+		if ( pausing )
+			break;
+
+		/* Used up this second's worth of modifies? */
+		if ( id->rate && nmods >= id->rate ) {
+			delay = nmods / id->rate - ( slap_get_time() - start );
+			if ( delay < 0 )
+				delay = 0;
+			break;
 		}
-		ch_free( rq->oldndn.bv_val );
-		ch_free( rq->olddn.bv_val );
-		ch_free( rq );
 	}
 
 	/* free filter */
@@ -910,9 +1773,10 @@ refint_qtask( void *ctx, void *arg )
 	/* wait until we get explicitly scheduled again */
 	ldap_pvt_thread_mutex_lock( &slapd_rq.rq_mutex );
 	ldap_pvt_runqueue_stoptask( &slapd_rq, id->qtask );
-	if ( pausing ) {
-		/* try to run again as soon as the pause is done */
-		id->qtask->interval.tv_sec = 0;
+	if ( pausing || delay >= 0 ) {
+		/* try to run again as soon as the pause is done,
+		 * or when the rate allows */
+		id->qtask->interval.tv_sec = pausing ? 0 : delay;
 		ldap_pvt_runqueue_resched( &slapd_rq, id->qtask, 0 );
 		id->qtask->interval.tv_sec = RUNQ_INTERVAL;
 	} else {
@@ -937,9 +1801,8 @@ refint_response(
 	refint_pre *rp;
 	slap_overinst *on;
 	refint_data *id;
-	BerValue pdn;
-	refint_q *rq;
-	refint_attrs *ip;
+	BerValue pdn, vals[2];
+	refint_q *rq, *dup;
 	int ac;
 
 	/* If the main op failed or is not a Delete or ModRdn, ignore it */
@@ -957,6 +1820,7 @@ refint_response(
 	rq->db = id->db;
 	rq->rdata = id;
 	rq->do_sub = rp->do_sub;
+	rq->qtime = slap_get_time();
 
 	if ( op->o_tag == LDAP_REQ_MODRDN ) {
 		if ( op->oq_modrdn.rs_newSup ) {
@@ -973,32 +1837,45 @@ refint_response(
 		build_new_dn( &rq->newndn, &pdn, &op->orr_nnewrdn, NULL );
 	}
 
+	/* Already waiting to be done? */
 	ldap_pvt_thread_mutex_lock( &id->qmutex );
-	if ( id->qtail ) {
-		id->qtail->next = rq;
-	} else {
-		id->qhead = rq;
+	dup = refint_qdup( id, rq, 0 );
+	if ( !dup ) {
+		/* an identical repair it can't be merged with must not
+		 * share its refintPending value
+		 */
+		refint_q *same = avl_find( id->qtree, rq, refint_qcmp );
+		if ( same && rq->qtime <= same->qtime )
+			rq->qtime = same->qtime + 1;
 	}
-	id->qtail = rq;
 	ldap_pvt_thread_mutex_unlock( &id->qmutex );
+	if ( dup ) {
+		refint_qfree( rq );
+		return SLAP_CB_CONTINUE;
+	}
 
-	ac = 0;
-	ldap_pvt_thread_mutex_lock( &slapd_rq.rq_mutex );
-	if ( !id->qtask ) {
-		id->qtask = ldap_pvt_runqueue_insert( &slapd_rq, RUNQ_INTERVAL,
-			refint_qtask, id, "refint_qtask",
-			op->o_bd->be_suffix[0].bv_val );
-		ac = 1;
+	/* Record it before queueing it, the task may run at once */
+	refint_qvalue( rq, &vals[0] );
+	BER_BVZERO( &vals[1] );
+	if ( refint_pending_mod( op, id, vals, 1, SLAP_MOD_SOFTADD )
+		== LDAP_SUCCESS ) {
+		ber_bvarray_add( &rq->pending, &vals[0] );
 	} else {
-		if ( !ldap_pvt_runqueue_isrunning( &slapd_rq, id->qtask ) &&
-			!id->qtask->next_sched.tv_sec ) {
-			id->qtask->interval.tv_sec = 0;
-			ldap_pvt_runqueue_resched( &slapd_rq, id->qtask, 0 );
-			id->qtask->interval.tv_sec = RUNQ_INTERVAL;
-			ac = 1;
-		}
+		ch_free( vals[0].bv_val );
 	}
-	ldap_pvt_thread_mutex_unlock( &slapd_rq.rq_mutex );
+
+	ldap_pvt_thread_mutex_lock( &id->qmutex );
+	dup = refint_qput( id, rq, 0 );
+	if ( dup ) {
+		refint_qmerge( dup, rq );
+	}
+	ldap_pvt_thread_mutex_unlock( &id->qmutex );
+	if ( dup ) {
+		refint_qfree( rq );
+		return SLAP_CB_CONTINUE;
+	}
+
+	ac = refint_qschedule( id, op->o_bd );
 	if ( ac )
 		slap_wake_listener();
 
@@ -1052,7 +1929,50 @@ refint_preop(
 */
 
 int refint_initialize() {
-	int rc;
+	static struct {
+		char			*desc;
+		slap_mask_t		flags;
+		AttributeDescription	**ad;
+	}		s_at[] = {
+		{ "( 1.3.6.1.4.1.4203.666.11.12.1.1 "
+			"NAME ( 'refintPending' ) "
+			"DESC 'Referential integrity repairs still to be done' "
+			"EQUALITY octetStringMatch "
+			"SYNTAX 1.3.6.1.4.1.1466.115.121.1.40 "
+			"NO-USER-MODIFICATION "
+			"USAGE dSAOperation )",
+			SLAP_AT_HIDE,
+			&ad_refintPending },
+		{ "( 1.3.6.1.4.1.4203.666.11.12.1.2 "
+			"NAME ( 'refintQueueDepth' ) "
+			"DESC 'Number of queued referential integrity repairs' "
+			"EQUALITY integerMatch "
+			"SYNTAX 1.3.6.1.4.1.1466.115.121.1.27 "
+			"NO-USER-MODIFICATION "
+			"USAGE directoryOperation )",
+			0,
+			&ad_refintQueueDepth },
+		{ "( 1.3.6.1.4.1.4203.666.11.12.1.3 "
+			"NAME ( 'refintQueueLag' ) "
+			"DESC 'Age in seconds of the oldest queued repair' "
+			"EQUALITY integerMatch "
+			"SYNTAX 1.3.6.1.4.1.1466.115.121.1.27 "
+			"NO-USER-MODIFICATION "
+			"USAGE directoryOperation )",
+			0,
+			&ad_refintQueueLag },
+		{ "( 1.3.6.1.4.1.4203.666.11.12.1.4 "
+			"NAME ( 'refintRepairs' ) "
+			"DESC 'Number of dependent entries modified' "
+			"EQUALITY integerMatch "
+			"SYNTAX 1.3.6.1.4.1.1466.115.121.1.27 "
+			"NO-USER-MODIFICATION "
+			"USAGE directoryOperation )",
+			0,
+			&ad_refintRepairs },
+		{ NULL }
+	};
+	int i, rc;
 
 	mr_dnSubtreeMatch = mr_find( "dnSubtreeMatch" );
 	if ( mr_dnSubtreeMatch == NULL ) {
@@ -1062,6 +1982,31 @@ int refint_initialize() {
 		return 1;
 	}
 
+	for ( i = 0; s_at[ i ].desc != NULL; i++ ) {
+		rc = register_at( s_at[ i ].desc, s_at[ i ].ad, 0 );
+		if ( rc ) {
+			Debug( LDAP_DEBUG_ANY,
+				"refint_initialize: register_at #%d failed\n", i, 0, 0 );
+			return rc;
+		}
+		(*s_at[ i ].ad)->ad_type->sat_flags |= s_at[ i ].flags;
+	}
+
+	/* augments the monitor entry of the database, so it must be AUXILIARY */
+	rc = register_oc( "( 1.3.6.1.4.1.4203.666.11.12.2.1 "
+		"NAME ( 'olmRefint' ) "
+		"SUP top AUXILIARY "
+		"MAY ( "
+			"refintQueueDepth "
+			"$ refintQueueLag "
+			"$ refintRepairs "
+			") )", &oc_olmRefint, 0 );
+	if ( rc ) {
+		Debug( LDAP_DEBUG_ANY,
+			"refint_initialize: register_oc failed\n", 0, 0, 0 );
+		return rc;
+	}
+
 	/* statically declared just after the #includes at top */
 	refint.on_bi.bi_type = "refint";
 	refint.on_bi.bi_db_init = refint_db_init;
@@ -28,6 +28,8 @@
 
 #include <ac/string.h>
 #include <ac/ctype.h>
+#include <ac/unistd.h>
+#include <ac/errno.h>
 
 #include <avl.h>
 
@@ -62,6 +64,11 @@
 #define SSSVLV_DEFAULT_MAX_KEYS	5
 #define SSSVLV_DEFAULT_MAX_REQUEST_PER_CONN 5
 
+/* Every so many nodes of a spilled list, remember where the node is */
+#define SSSVLV_SPILL_STRIDE	64
+#define SSSVLV_SPILL_BUFSIZE	8192
+#define SSSVLV_SPILL_NOVAL	((ber_uint_t)-1)
+
 #define NO_PS_COOKIE (PagedResultsCookie) -1
 #define NO_VC_CONTEXT (unsigned long) -1
 
@@ -101,8 +108,41 @@ typedef struct sssvlv_info
 	int svi_num;	/* current # sorts */
 	int svi_max_keys;	/* max sort keys per request */
 	int svi_max_percon; /* max concurrent sorts per con */
+	unsigned long svi_max_mem;	/* bytes of sort keys held per sort */
+	char *svi_tmpdir;	/* where sorted runs are spilled */
 } sssvlv_info;
 
+/* Reads the nodes of a sorted run back from a spill file */
+typedef struct spill_reader
+{
+	int rd_fd;
+	off_t rd_next;		/* file offset of the next unread byte */
+	off_t rd_end;		/* end of the run */
+	char *rd_buf;
+	size_t rd_size;
+	size_t rd_len;
+	size_t rd_off;
+	sort_node rd_node;	/* the node last read, points into rd_buf */
+} spill_reader;
+
+/* A sort that outgrew svi_max_mem. While the entries are collected,
+ * each time the tree reaches the limit it is written out as a sorted
+ * run. At the end the runs are merged into a single list, which is
+ * sent from the file.
+ */
+typedef struct sort_spill
+{
+	FILE *sp_fp;
+	int sp_err;
+	int sp_nkeys;		/* keys of the request that wrote it */
+	off_t sp_end;		/* bytes written */
+	off_t *sp_runs;		/* where each run starts, and the end */
+	int sp_nruns;
+	off_t *sp_marks;	/* every SSSVLV_SPILL_STRIDE'th node of the list */
+	int sp_nmarks;
+	spill_reader sp_rd;	/* the next node to send */
+} sort_spill;
+
 typedef struct sort_op
 {
 	TAvlnode *so_tree;
@@ -117,6 +157,13 @@ typedef struct sort_op
 	int so_session;
 	unsigned long so_vcontext;
 	int so_running;
+	int so_index;	/* paged from the backend's sort index */
+	struct berval so_resume;	/* where the last page ended */
+	OpExtraSort *so_hint;
+	int so_limit;	/* only the first so_limit entries are wanted */
+	int so_dropped;	/* entries beyond so_limit were seen */
+	unsigned long so_mem;	/* bytes held in so_tree */
+	sort_spill *so_spill;
 } sort_op;
 
 /* There is only one conn table for all overlay instances */
@@ -198,6 +245,408 @@ static int node_insert( const void *val1, const void *val2 )
 	return node_cmp( val1, val2 ) < 0 ? -1 : 1;
 }
 
+/* Leads tavl_delete() to the rightmost node */
+static int node_last( const void *val1, const void *val2 )
+{
+	return val1 != val2;
+}
+
+static FILE *spill_file( sssvlv_info *si )
+{
+	char path[MAXPATHLEN];
+	FILE *fp;
+	int fd;
+
+	if ( !si->svi_tmpdir )
+		return tmpfile();
+
+	snprintf( path, sizeof(path), "%s/sssvlvXXXXXX", si->svi_tmpdir );
+	fd = mkstemp( path );
+	if ( fd < 0 )
+		return NULL;
+	unlink( path );
+	fp = fdopen( fd, "w+b" );
+	if ( !fp )
+		close( fd );
+	return fp;
+}
+
+/* Append a node, return the number of bytes written or -1 */
+static int spill_write( FILE *fp, sort_node *sn, int nkeys )
+{
+	ber_uint_t len, reclen;
+	int i;
+
+	reclen = sizeof(len) + sn->sn_dn.bv_len + 1;
+	for ( i=0; i<nkeys; i++ ) {
+		reclen += sizeof(len);
+		if ( !BER_BVISNULL( &sn->sn_vals[i] ))
+			reclen += sn->sn_vals[i].bv_len + 1;
+	}
+
+	len = sn->sn_dn.bv_len;
+	if ( fwrite( &reclen, sizeof(reclen), 1, fp ) != 1 ||
+		fwrite( &len, sizeof(len), 1, fp ) != 1 ||
+		fwrite( sn->sn_dn.bv_val, 1, len + 1, fp ) != len + 1 )
+		return -1;
+	for ( i=0; i<nkeys; i++ ) {
+		if ( BER_BVISNULL( &sn->sn_vals[i] )) {
+			len = SSSVLV_SPILL_NOVAL;
+			if ( fwrite( &len, sizeof(len), 1, fp ) != 1 )
+				return -1;
+		} else {
+			len = sn->sn_vals[i].bv_len;
+			if ( fwrite( &len, sizeof(len), 1, fp ) != 1 ||
+				fwrite( sn->sn_vals[i].bv_val, 1, len + 1, fp ) != len + 1 )
+				return -1;
+		}
+	}
+	return sizeof(reclen) + reclen;
+}
+
+static void spill_reader_init(
+	Operation *op,
+	sort_op *so,
+	spill_reader *rd,
+	int fd,
+	off_t start,
+	off_t end )
+{
+	rd->rd_fd = fd;
+	rd->rd_next = start;
+	rd->rd_end = end;
+	rd->rd_size = SSSVLV_SPILL_BUFSIZE;
+	rd->rd_buf = ch_malloc( rd->rd_size );
+	rd->rd_len = 0;
+	rd->rd_off = 0;
+	rd->rd_node.sn_conn = op->o_conn->c_conn_idx;
+	rd->rd_node.sn_session = so->so_session;
+	rd->rd_node.sn_vals = ch_malloc( so->so_spill->sp_nkeys *
+		sizeof(struct berval));
+}
+
+static void spill_reader_free( spill_reader *rd )
+{
+	ch_free( rd->rd_buf );
+	ch_free( rd->rd_node.sn_vals );
+	rd->rd_buf = NULL;
+	rd->rd_node.sn_vals = NULL;
+}
+
+static void spill_seek( spill_reader *rd, off_t pos )
+{
+	rd->rd_next = pos;
+	rd->rd_len = 0;
+	rd->rd_off = 0;
+}
+
+/* Make sure the buffer holds the next need bytes */
+static int spill_fill( spill_reader *rd, size_t need )
+{
+	size_t avail = rd->rd_len - rd->rd_off;
+	ssize_t n;
+
+	if ( avail >= need )
+		return 0;
+
+	AC_MEMCPY( rd->rd_buf, rd->rd_buf + rd->rd_off, avail );
+	rd->rd_len = avail;
+	rd->rd_off = 0;
+	if ( need > rd->rd_size ) {
+		rd->rd_size = need > rd->rd_size * 2 ? need : rd->rd_size * 2;
+		rd->rd_buf = ch_realloc( rd->rd_buf, rd->rd_size );
+	}
+	if ( lseek( rd->rd_fd, rd->rd_next, SEEK_SET ) < 0 )
+		return -1;
+	while ( rd->rd_len < need ) {
+		size_t want = rd->rd_size - rd->rd_len;
+		if ( want > rd->rd_end - rd->rd_next )
+			want = rd->rd_end - rd->rd_next;
+		if ( !want )
+			return -1;
+		n = read( rd->rd_fd, rd->rd_buf + rd->rd_len, want );
+		if ( n < 0 && errno == EINTR )
+			continue;
+		if ( n <= 0 )
+			return -1;
+		rd->rd_len += n;
+		rd->rd_next += n;
+	}
+	return 0;
+}
+
+/* Read the next node of the run into rd_node.
+ * Return 1 if there was one, 0 at the end of the run, -1 on error.
+ */
+static int spill_read( spill_reader *rd, int nkeys )
+{
+	ber_uint_t len, reclen;
+	char *ptr, *end;
+	int i;
+
+	if ( rd->rd_next - (off_t)( rd->rd_len - rd->rd_off ) >= rd->rd_end )
+		return 0;
+
+	if ( spill_fill( rd, sizeof(reclen) ))
+		return -1;
+	AC_MEMCPY( &reclen, rd->rd_buf + rd->rd_off, sizeof(reclen) );
+	rd->rd_off += sizeof(reclen);
+	if ( spill_fill( rd, reclen ))
+		return -1;
+	ptr = rd->rd_buf + rd->rd_off;
+	end = ptr + reclen;
+	rd->rd_off += reclen;
+
+	AC_MEMCPY( &len, ptr, sizeof(len) );
+	ptr += sizeof(len);
+	rd->rd_node.sn_dn.bv_len = len;
+	rd->rd_node.sn_dn.bv_val = ptr;
+	ptr += len + 1;
+	for ( i=0; i<nkeys; i++ ) {
+		if ( ptr + sizeof(len) > end )
+			return -1;
+		AC_MEMCPY( &len, ptr, sizeof(len) );
+		ptr += sizeof(len);
+		if ( len == SSSVLV_SPILL_NOVAL ) {
+			BER_BVZERO( &rd->rd_node.sn_vals[i] );
+		} else {
+			rd->rd_node.sn_vals[i].bv_len = len;
+			rd->rd_node.sn_vals[i].bv_val = ptr;
+			ptr += len + 1;
+		}
+	}
+	return ptr <= end ? 1 : -1;
+}
+
+/* Write out the tree as a sorted run and let go of it */
+static int spill_run( Operation *op, sort_op *so )
+{
+	sort_spill *sp = so->so_spill;
+	TAvlnode *cur_node;
+	int n;
+
+	if ( !sp ) {
+		sp = ch_calloc( 1, sizeof(sort_spill) );
+		sp->sp_nkeys = so->so_ctrl->sc_nkeys;
+		so->so_spill = sp;
+		sp->sp_fp = spill_file( so->so_info );
+		if ( !sp->sp_fp ) {
+			Debug( LDAP_DEBUG_ANY, "%s: cannot create spill file: %s (%d)\n",
+				debug_header, strerror( errno ), errno );
+			sp->sp_err = 1;
+			return -1;
+		}
+	}
+	if ( sp->sp_err )
+		return -1;
+
+	sp->sp_runs = ch_realloc( sp->sp_runs,
+		( sp->sp_nruns + 2 ) * sizeof(off_t) );
+	sp->sp_runs[sp->sp_nruns++] = sp->sp_end;
+	for ( cur_node = tavl_end( so->so_tree, TAVL_DIR_LEFT ); cur_node;
+		cur_node = tavl_next( cur_node, TAVL_DIR_RIGHT )) {
+		n = spill_write( sp->sp_fp, cur_node->avl_data, sp->sp_nkeys );
+		if ( n < 0 ) {
+			Debug( LDAP_DEBUG_ANY, "%s: write to spill file failed: %s (%d)\n",
+				debug_header, strerror( errno ), errno );
+			sp->sp_err = 1;
+			return -1;
+		}
+		sp->sp_end += n;
+	}
+	sp->sp_runs[sp->sp_nruns] = sp->sp_end;
+
+	tavl_free( so->so_tree, ch_free );
+	so->so_tree = NULL;
+	so->so_mem = 0;
+	return 0;
+}
+
+/* Order of two runs' current nodes; on equal keys the earlier run
+ * goes first, as the tree does with the order of insertion.
+ */
+static int spill_before( spill_reader *rds, int a, int b )
+{
+	int cmp = node_cmp( &rds[a].rd_node, &rds[b].rd_node );
+	return cmp < 0 || ( cmp == 0 && a < b );
+}
+
+static void spill_heapify( spill_reader *rds, int *heap, int nheap, int i )
+{
+	for (;;) {
+		int l = 2*i + 1, r = l + 1, m = i, tmp;
+		if ( l < nheap && spill_before( rds, heap[l], heap[m] ))
+			m = l;
+		if ( r < nheap && spill_before( rds, heap[r], heap[m] ))
+			m = r;
+		if ( m == i )
+			break;
+		tmp = heap[i];
+		heap[i] = heap[m];
+		heap[m] = tmp;
+		i = m;
+	}
+}
+
+/* Merge the runs, and the tree as the last one, into the list */
+static int spill_merge( Operation *op, sort_op *so )
+{
+	sort_spill *sp = so->so_spill;
+	int nkeys = sp->sp_nkeys;
+	spill_reader *rds;
+	int *heap, nheap = 0, count, i, n, rc = -1;
+	off_t pos = 0;
+	FILE *out;
+
+	if ( so->so_tree && spill_run( op, so ))
+		return -1;
+	if ( sp->sp_err )
+		return -1;
+	if ( fflush( sp->sp_fp ))
+		return -1;
+
+	out = spill_file( so->so_info );
+	if ( !out )
+		return -1;
+
+	rds = ch_calloc( sp->sp_nruns, sizeof(spill_reader) );
+	heap = ch_malloc( sp->sp_nruns * sizeof(int) );
+	for ( i=0; i<sp->sp_nruns; i++ ) {
+		spill_reader_init( op, so, &rds[i], fileno( sp->sp_fp ),
+			sp->sp_runs[i], sp->sp_runs[i+1] );
+		n = spill_read( &rds[i], nkeys );
+		if ( n < 0 )
+			goto done;
+		if ( n )
+			heap[nheap++] = i;
+	}
+	for ( i = nheap/2 - 1; i >= 0; i-- )
+		spill_heapify( rds, heap, nheap, i );
+
+	sp->sp_nmarks = 0;
+	sp->sp_marks = ch_malloc(( so->so_nentries / SSSVLV_SPILL_STRIDE + 1 ) *
+		sizeof(off_t) );
+	for ( count=0; nheap; count++ ) {
+		spill_reader *rd = &rds[heap[0]];
+
+		if ( !( count % SSSVLV_SPILL_STRIDE )) {
+			if ( sp->sp_nmarks > so->so_nentries / SSSVLV_SPILL_STRIDE )
+				goto done;
+			sp->sp_marks[sp->sp_nmarks++] = pos;
+		}
+		n = spill_write( out, &rd->rd_node, nkeys );
+		if ( n < 0 )
+			goto done;
+		pos += n;
+
+		n = spill_read( rd, nkeys );
+		if ( n < 0 )
+			goto done;
+		if ( !n )
+			heap[0] = heap[--nheap];
+		spill_heapify( rds, heap, nheap, 0 );
+	}
+	if ( fflush( out ))
+		goto done;
+	rc = 0;
+
+done:
+	for ( i=0; i<sp->sp_nruns; i++ ) {
+		if ( rds[i].rd_buf )
+			spill_reader_free( &rds[i] );
+	}
+	ch_free( rds );
+	ch_free( heap );
+
+	fclose( sp->sp_fp );
+	sp->sp_fp = out;
+	ch_free( sp->sp_runs );
+	sp->sp_runs = NULL;
+	sp->sp_nruns = 0;
+	if ( rc ) {
+		Debug( LDAP_DEBUG_ANY, "%s: merging sorted runs failed: %s (%d)\n",
+			debug_header, strerror( errno ), errno );
+		sp->sp_err = 1;
+		return rc;
+	}
+	so->so_nentries = count;
+	spill_reader_init( op, so, &sp->sp_rd, fileno( out ), 0, pos );
+	return 0;
+}
+
+static void spill_free( sort_spill *sp )
+{
+	if ( sp->sp_fp )
+		fclose( sp->sp_fp );
+	if ( sp->sp_rd.rd_buf )
+		spill_reader_free( &sp->sp_rd );
+	ch_free( sp->sp_runs );
+	ch_free( sp->sp_marks );
+	ch_free( sp );
+}
+
+/* Position the reader at the given node (counting from 0) of the list */
+static int spill_seek_node( sort_op *so, int idx )
+{
+	sort_spill *sp = so->so_spill;
+	int i;
+
+	spill_seek( &sp->sp_rd, sp->sp_marks[idx / SSSVLV_SPILL_STRIDE] );
+	for ( i = idx % SSSVLV_SPILL_STRIDE; i > 0; i-- ) {
+		if ( spill_read( &sp->sp_rd, sp->sp_nkeys ) <= 0 )
+			return -1;
+	}
+	return 0;
+}
+
+/* Compare a node's first key to a VLV target value */
+static int spill_key_cmp( sort_op *so, sort_node *sn, struct berval *bv )
+{
+	sort_key *sk = &so->so_ctrl->sc_keys[0];
+	MatchingRule *mr = sk->sk_ordering;
+	int cmp;
+
+	if ( BER_BVISNULL( &sn->sn_vals[0] ))
+		return sk->sk_direction;
+	mr->smr_match( &cmp, 0, mr->smr_syntax, mr, &sn->sn_vals[0], bv );
+	return cmp * sk->sk_direction;
+}
+
+/* Return the position (counting from 1) of the first node of the list
+ * that sorts at or after the value, so_nentries+1 if there is none,
+ * or 0 on error.
+ */
+static int spill_find( sort_op *so, struct berval *bv )
+{
+	sort_spill *sp = so->so_spill;
+	int nkeys = sp->sp_nkeys;
+	int lo = 0, hi = sp->sp_nmarks, mid, idx, rc;
+
+	/* find the first mark that isn't before the value */
+	while ( lo < hi ) {
+		mid = ( lo + hi ) / 2;
+		spill_seek( &sp->sp_rd, sp->sp_marks[mid] );
+		if ( spill_read( &sp->sp_rd, nkeys ) <= 0 )
+			return 0;
+		if ( spill_key_cmp( so, &sp->sp_rd.rd_node, bv ) < 0 )
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if ( !lo )
+		return 1;
+
+	/* it is within the stride before that mark */
+	idx = ( lo - 1 ) * SSSVLV_SPILL_STRIDE;
+	spill_seek( &sp->sp_rd, sp->sp_marks[lo - 1] );
+	while (( rc = spill_read( &sp->sp_rd, nkeys )) > 0 ) {
+		if ( spill_key_cmp( so, &sp->sp_rd.rd_node, bv ) >= 0 )
+			break;
+		idx++;
+	}
+	return rc < 0 ? 0 : idx + 1;
+}
+
 static int pack_vlv_response_control(
 	Operation		*op,
 	SlapReply		*rs,
@@ -249,6 +698,15 @@ static int pack_vlv_response_control(
 	return rs->sr_err;
 }
 
+/* A paged session is known by its next node, or by itself when the
+ * backend does the sorting or the list is spilled.
+ */
+static PagedResultsCookie sort_op_cookie( sort_op *so )
+{
+	return ( so->so_index || so->so_spill ) ? (PagedResultsCookie)so :
+		(PagedResultsCookie)so->so_tree;
+}
+
 static int pack_pagedresult_response_control(
 	Operation		*op,
 	SlapReply		*rs,
@@ -266,7 +724,7 @@ static int pack_pagedresult_response_control(
 	ber_set_option( ber, LBER_OPT_BER_MEMCTX, &op->o_tmpmemctx );
 
 	if ( so->so_nentries > 0 ) {
-		resp_cookie		= ( PagedResultsCookie )so->so_tree;
+		resp_cookie		= sort_op_cookie( so );
 		cookie.bv_len	= sizeof( PagedResultsCookie );
 		cookie.bv_val	= (char *)&resp_cookie;
 	} else {
@@ -370,7 +828,7 @@ static int find_session_by_context(
 	for(sess_id = 0; sess_id < svi_max_percon; sess_id++) {
 		if( sort_conns[conn_id] && sort_conns[conn_id][sess_id] &&
 		    ( sort_conns[conn_id][sess_id]->so_vcontext == vc_context || 
-                      (PagedResultsCookie) sort_conns[conn_id][sess_id]->so_tree == ps_cookie ) )
+                      sort_op_cookie( sort_conns[conn_id][sess_id] ) == ps_cookie ) )
 			return sess_id;
 	}
 	return -1;
@@ -423,6 +881,10 @@ static void free_sort_op( Connection *conn, sort_op *so )
 		    }
 		    so->so_tree = NULL;
 	    }
+	    if ( so->so_resume.bv_val )
+		    ch_free( so->so_resume.bv_val );
+	    if ( so->so_spill )
+		    spill_free( so->so_spill );
 
 	    ch_free( so );
 	}
@@ -442,6 +904,125 @@ static void free_sort_ops( Connection *conn, sort_op **sos, int svi_max_percon )
 	}
 }
 	
+/* Send the entry of a node, return -1 if the client went away */
+static int send_node(
+	Operation		*op,
+	SlapReply		*rs,
+	sort_node		*sn )
+{
+	Entry *e = NULL;
+	int rc;
+
+	op->o_bd = select_backend( &sn->sn_dn, 0 );
+	rc = be_entry_get_rw( op, &sn->sn_dn, NULL, NULL, 0, &e );
+
+	if ( e && rc == LDAP_SUCCESS ) {
+		rs->sr_entry = e;
+		rs->sr_flags = REP_ENTRY_MUSTRELEASE;
+		rs->sr_err = send_search_entry( op, rs );
+		if ( rs->sr_err == LDAP_UNAVAILABLE )
+			return -1;
+	}
+	return 0;
+}
+
+static void send_spill_list(
+	Operation		*op,
+	SlapReply		*rs,
+	sort_op			*so)
+{
+	sort_spill *sp = so->so_spill;
+	vlv_ctrl *vc = op->o_controls[vlv_cid];
+	int n = so->so_nentries, target, first, last, i, rc;
+	BackendDB *be = op->o_bd;
+	LDAPControl *ctrls[2];
+
+	rs->sr_attrs = op->ors_attrs;
+
+	if ( BER_BVISNULL( &vc->vc_value )) {
+		if ( vc->vc_offset == vc->vc_count ) {
+			target = n;
+		} else if ( vc->vc_offset == 1 ) {
+			target = 1;
+		} else if ( vc->vc_count && vc->vc_count != n ) {
+			if ( vc->vc_offset > vc->vc_count )
+				goto range_err;
+			target = n * vc->vc_offset / vc->vc_count;
+		} else {
+			if ( vc->vc_offset > n ) {
+range_err:
+				so->so_vlv_rc = LDAP_VLV_RANGE_ERROR;
+				pack_vlv_response_control( op, rs, so, ctrls );
+				ctrls[1] = NULL;
+				slap_add_ctrls( op, rs, ctrls );
+				rs->sr_err = LDAP_VLV_ERROR;
+				return;
+			}
+			target = vc->vc_offset;
+		}
+		so->so_vlv_target = target;
+		if ( target < 1 )
+			target = 1;
+	} else {
+		MatchingRule *mr = so->so_ctrl->sc_keys[0].sk_ordering;
+		struct berval bv;
+
+		if ( mr->smr_normalize ) {
+			rc = mr->smr_normalize( SLAP_MR_VALUE_OF_SYNTAX,
+				mr->smr_syntax, mr, &vc->vc_value, &bv, op->o_tmpmemctx );
+			if ( rc ) {
+				so->so_vlv_rc = LDAP_INAPPROPRIATE_MATCHING;
+				pack_vlv_response_control( op, rs, so, ctrls );
+				ctrls[1] = NULL;
+				slap_add_ctrls( op, rs, ctrls );
+				rs->sr_err = LDAP_VLV_ERROR;
+				return;
+			}
+		} else {
+			bv = vc->vc_value;
+		}
+		target = spill_find( so, &bv );
+		if ( bv.bv_val != vc->vc_value.bv_val )
+			op->o_tmpfree( bv.bv_val, op->o_tmpmemctx );
+		if ( !target )
+			goto spill_err;
+		so->so_vlv_target = target;
+	}
+
+	/* Past the end, the window ends with the last entry */
+	if ( target > n ) {
+		first = n - ( vc->vc_before ? vc->vc_before - 1 : 0 );
+		last = n;
+	} else {
+		first = target - vc->vc_before;
+		last = target + vc->vc_after;
+	}
+	if ( first < 1 )
+		first = 1;
+	if ( last > n )
+		last = n;
+
+	if ( spill_seek_node( so, first - 1 ))
+		goto spill_err;
+	for ( i = first; i <= last; i++ ) {
+		if ( slapd_shutdown ) break;
+
+		rc = spill_read( &sp->sp_rd, sp->sp_nkeys );
+		if ( rc <= 0 )
+			goto spill_err;
+		if ( send_node( op, rs, &sp->sp_rd.rd_node ))
+			break;
+	}
+	so->so_vlv_rc = LDAP_SUCCESS;
+	op->o_bd = be;
+	return;
+
+spill_err:
+	op->o_bd = be;
+	rs->sr_err = LDAP_OTHER;
+	rs->sr_text = "cannot read sorted entries";
+}
+
 static void send_list(
 	Operation		*op,
 	SlapReply		*rs,
@@ -451,9 +1032,13 @@ static void send_list(
 	vlv_ctrl *vc = op->o_controls[vlv_cid];
 	int i, j, dir, rc;
 	BackendDB *be;
-	Entry *e;
 	LDAPControl *ctrls[2];
 
+	if ( so->so_spill ) {
+		send_spill_list( op, rs, so );
+		return;
+	}
+
 	rs->sr_attrs = op->ors_attrs;
 
 	/* FIXME: it may be better to just flatten the tree into
@@ -575,21 +1160,10 @@ range_err:
 	j = i + vc->vc_after + 1;
 	be = op->o_bd;
 	for ( i=0; i<j; i++ ) {
-		sort_node *sn = cur_node->avl_data;
-
 		if ( slapd_shutdown ) break;
 
-		op->o_bd = select_backend( &sn->sn_dn, 0 );
-		e = NULL;
-		rc = be_entry_get_rw( op, &sn->sn_dn, NULL, NULL, 0, &e );
-
-		if ( e && rc == LDAP_SUCCESS ) {
-			rs->sr_entry = e;
-			rs->sr_flags = REP_ENTRY_MUSTRELEASE;
-			rs->sr_err = send_search_entry( op, rs );
-			if ( rs->sr_err == LDAP_UNAVAILABLE )
-				break;
-		}
+		if ( send_node( op, rs, cur_node->avl_data ))
+			break;
 		cur_node = tavl_next( cur_node, TAVL_DIR_RIGHT );
 		if ( !cur_node ) break;
 	}
@@ -598,26 +1172,53 @@ range_err:
 	op->o_bd = be;
 }
 
+static void send_spill_page( Operation *op, SlapReply *rs, sort_op *so )
+{
+	sort_spill *sp = so->so_spill;
+	BackendDB *be = op->o_bd;
+	int rc;
+
+	rs->sr_attrs = op->ors_attrs;
+
+	while ( so->so_nentries > 0 && rs->sr_nentries < so->so_page_size ) {
+		if ( slapd_shutdown ) break;
+
+		rc = spill_read( &sp->sp_rd, sp->sp_nkeys );
+		if ( rc <= 0 ) {
+			so->so_nentries = 0;
+			rs->sr_err = LDAP_OTHER;
+			rs->sr_text = "cannot read sorted entries";
+			break;
+		}
+		so->so_nentries--;
+
+		if ( send_node( op, rs, &sp->sp_rd.rd_node ))
+			break;
+	}
+
+	op->o_bd = be;
+}
+
 static void send_page( Operation *op, SlapReply *rs, sort_op *so )
 {
 	TAvlnode *cur_node = so->so_tree;
 	TAvlnode *next_node = NULL;
 	BackendDB *be = op->o_bd;
-	Entry *e;
 	int rc;
 
+	if ( so->so_spill ) {
+		send_spill_page( op, rs, so );
+		return;
+	}
+
 	rs->sr_attrs = op->ors_attrs;
 
 	while ( cur_node && rs->sr_nentries < so->so_page_size ) {
-		sort_node *sn = cur_node->avl_data;
-
 		if ( slapd_shutdown ) break;
 
 		next_node = tavl_next( cur_node, TAVL_DIR_RIGHT );
 
-		op->o_bd = select_backend( &sn->sn_dn, 0 );
-		e = NULL;
-		rc = be_entry_get_rw( op, &sn->sn_dn, NULL, NULL, 0, &e );
+		rc = send_node( op, rs, cur_node->avl_data );
 
 		ch_free( cur_node->avl_data );
 		ber_memfree( cur_node );
@@ -625,13 +1226,8 @@ static void send_page( Operation *op, SlapReply *rs, sort_op *so )
 		cur_node = next_node;
 		so->so_nentries--;
 
-		if ( e && rc == LDAP_SUCCESS ) {
-			rs->sr_entry = e;
-			rs->sr_flags = REP_ENTRY_MUSTRELEASE;
-			rs->sr_err = send_search_entry( op, rs );
-			if ( rs->sr_err == LDAP_UNAVAILABLE )
-				break;
-		}
+		if ( rc )
+			break;
 	}
 
 	/* Set the first entry to send for the next page */
@@ -651,7 +1247,14 @@ static void send_entry(
 		"%s: response control: status=%d, text=%s\n",
 		debug_header, rs->sr_err, SAFESTR(rs->sr_text, "<None>"));
 
-	if ( !so->so_tree )
+	if ( so->so_spill && spill_merge( op, so )) {
+		so->so_nentries = 0;
+		rs->sr_err = LDAP_OTHER;
+		rs->sr_text = "cannot sort entries";
+		return;
+	}
+
+	if ( !so->so_tree && !so->so_spill )
 		return;
 
 	/* RFC 2891: If critical then send the entries iff they were
@@ -677,6 +1280,8 @@ static void send_entry(
 			}
 
 			send_page( op, rs, so );
+			if ( so->so_dropped && rs->sr_err == LDAP_SUCCESS )
+				rs->sr_err = LDAP_SIZELIMIT_EXCEEDED;
 		}
 	}
 }
@@ -705,14 +1310,113 @@ static void send_result(
 
 	if ( ctrls[0] != NULL )
 		slap_add_ctrls( op, rs, ctrls );
-	send_ldap_result( op, rs );
 
-	if ( so->so_tree == NULL ) {
+	/* Let go of the session before the client sees the result and
+	 * sends its next request.
+	 */
+	if (( so->so_index || so->so_spill ) ? !so->so_nentries :
+		so->so_tree == NULL ) {
 		/* Search finished, so clean up */
 		free_sort_op( op->o_conn, so );
 	} else {
 	    so->so_running = 0;
 	}
+	send_ldap_result( op, rs );
+}
+
+/* Offer the search to the backend, which may return the entries in
+ * order from a sort index (see OpExtraSort) instead of having them
+ * sorted here. Only single key sorts qualify, and not on a glued
+ * database where each part would come back sorted by itself.
+ */
+static void sort_hint(
+	Operation		*op,
+	sort_op			*so,
+	vlv_ctrl		*vc,
+	PagedResultsState	*ps )
+{
+	sort_key *sk = &so->so_ctrl->sc_keys[0];
+	MatchingRule *mr = sk->sk_ordering;
+	OpExtraSort *os;
+	struct berval bv = BER_BVNULL;
+
+	if ( so->so_ctrl->sc_nkeys != 1 || SLAP_GLUE_INSTANCE( op->o_bd ) ||
+		( ps && !ps->ps_size ))
+		return;
+
+	if ( vc ) {
+		if ( BER_BVISNULL( &vc->vc_value )) {
+			if ( vc->vc_offset < 1 )
+				return;
+		} else if ( mr->smr_normalize ) {
+			if ( mr->smr_normalize( SLAP_MR_VALUE_OF_SYNTAX,
+				mr->smr_syntax, mr, &vc->vc_value, &bv, op->o_tmpmemctx ))
+				return;
+		} else {
+			ber_dupbv_x( &bv, &vc->vc_value, op->o_tmpmemctx );
+		}
+	}
+
+	os = op->o_tmpcalloc( 1, sizeof(OpExtraSort), op->o_tmpmemctx );
+	os->oe.oe_key = &slap_sorthint_key;
+	os->os_op = op;
+	os->os_ad = sk->sk_ad;
+	os->os_mr = mr;
+	if ( sk->sk_direction < 0 )
+		os->os_flags = SLAP_SORT_REVERSE;
+	if ( vc ) {
+		os->os_offset = BER_BVISNULL( &bv ) ? vc->vc_offset : 0;
+		os->os_count = vc->vc_count;
+		os->os_value = bv;
+		os->os_before = vc->vc_before;
+		os->os_after = vc->vc_after;
+	} else if ( ps ) {
+		os->os_limit = ps->ps_size;
+		os->os_resume = so->so_resume;
+	}
+	LDAP_SLIST_INSERT_HEAD( &op->o_extra, &os->oe, oe_next );
+	so->so_hint = os;
+}
+
+/* The backend sent the entries in order, finish up the controls */
+static void sort_hint_result(
+	Operation		*op,
+	SlapReply		*rs,
+	sort_op			*so,
+	OpExtraSort		*os )
+{
+	LDAPControl *ctrls[2];
+
+	if ( os->os_resume.bv_val != so->so_resume.bv_val ) {
+		if ( so->so_resume.bv_val )
+			ch_free( so->so_resume.bv_val );
+		so->so_resume = os->os_resume;
+	}
+
+	if ( so->so_paged > SLAP_CONTROL_IGNORED ) {
+		so->so_nentries = 0;
+		if ( os->os_flags & SLAP_SORT_MORE ) {
+			/* an estimate, but never claim there are none */
+			so->so_nentries = os->os_total - rs->sr_nentries -
+				((PagedResultsState *)op->o_pagedresults_state)->ps_count;
+			if ( so->so_nentries < 1 )
+				so->so_nentries = 1;
+			so->so_index = 1;
+		}
+	} else if ( so->so_vlv > SLAP_CONTROL_IGNORED ) {
+		/* nothing is kept, a later request starts over */
+		so->so_vcontext = 0;
+		so->so_vlv_target = os->os_target;
+		so->so_nentries = os->os_total;
+		so->so_vlv_rc = LDAP_SUCCESS;
+		if (( os->os_flags & SLAP_SORT_RANGE ) && rs->sr_err == LDAP_SUCCESS ) {
+			so->so_vlv_rc = LDAP_VLV_RANGE_ERROR;
+			pack_vlv_response_control( op, rs, so, ctrls );
+			ctrls[1] = NULL;
+			slap_add_ctrls( op, rs, ctrls );
+			rs->sr_err = LDAP_VLV_ERROR;
+		}
+	}
 }
 
 static int sssvlv_op_response(
@@ -721,8 +1425,19 @@ static int sssvlv_op_response(
 {
 	sort_ctrl *sc = op->o_controls[sss_cid];
 	sort_op *so = op->o_callback->sc_private;
+	OpExtraSort *os = so->so_hint;
 
-	if ( rs->sr_type == REP_SEARCH ) {
+	if ( rs->sr_type == REP_SEARCH && os &&
+		( os->os_flags & SLAP_SORT_SERVED )) {
+		/* already in order */
+		return SLAP_CB_CONTINUE;
+	}
+
+	if ( rs->sr_type == REP_SEARCH && so->so_index ) {
+		/* a later page that the sort index didn't serve */
+		rs->sr_err = LDAP_SUCCESS;
+
+	} else if ( rs->sr_type == REP_SEARCH ) {
 		int i;
 		size_t len;
 		sort_node *sn, *sn2;
@@ -777,10 +1492,37 @@ static int sssvlv_op_response(
 		sn->sn_conn = op->o_conn->c_conn_idx;
 		sn->sn_session = find_session_by_so( so->so_info->svi_max_percon, op->o_conn->c_conn_idx, so );
 
-		/* Insert into the AVL tree */
-		tavl_insert(&(so->so_tree), sn, node_insert, avl_dup_error);
+		if ( so->so_limit >= 0 && so->so_nentries >= so->so_limit ) {
+			/* Only the first so_limit entries will be sent, so
+			 * keep those and forget the rest.
+			 */
+			TAvlnode *last = tavl_end( so->so_tree, TAVL_DIR_RIGHT );
 
-		so->so_nentries++;
+			so->so_dropped = 1;
+			if ( !last || node_cmp( sn, last->avl_data ) >= 0 ) {
+				ch_free( sn );
+				sn = NULL;
+			} else {
+				ch_free( tavl_delete( &so->so_tree, last->avl_data,
+					node_last ));
+				so->so_nentries--;
+			}
+		} else if ( so->so_spill && so->so_spill->sp_err ) {
+			/* the search will fail anyway */
+			ch_free( sn );
+			sn = NULL;
+		}
+
+		if ( sn ) {
+			/* Insert into the AVL tree */
+			tavl_insert(&(so->so_tree), sn, node_insert, avl_dup_error);
+
+			so->so_nentries++;
+			so->so_mem += len + sizeof(TAvlnode);
+			if ( so->so_info->svi_max_mem && so->so_limit < 0 &&
+				so->so_mem > so->so_info->svi_max_mem )
+				spill_run( op, so );
+		}
 
 		/* Collected the keys so that they can be sorted.  Thus, stop
 		 * the entry from propagating.
@@ -796,7 +1538,23 @@ static int sssvlv_op_response(
 			op->o_callback = op->o_callback->sc_next;
 		}
 
-		send_entry( op, rs, so );
+		if ( os ) {
+			so->so_hint = NULL;
+			LDAP_SLIST_REMOVE( &op->o_extra, &os->oe, OpExtra, oe_next );
+			if ( !BER_BVISNULL( &os->os_value ))
+				op->o_tmpfree( os->os_value.bv_val, op->o_tmpmemctx );
+		}
+		if ( os && ( os->os_flags & SLAP_SORT_SERVED )) {
+			sort_hint_result( op, rs, so, os );
+		} else if ( so->so_index ) {
+			so->so_nentries = 0;
+			rs->sr_err = LDAP_UNWILLING_TO_PERFORM;
+			rs->sr_text = "sort index no longer available";
+		} else {
+			send_entry( op, rs, so );
+		}
+		if ( os )
+			op->o_tmpfree( os, op->o_tmpmemctx );
 		send_result( op, rs, so );
 	}
 
@@ -925,11 +1683,27 @@ static int sssvlv_op_search(
 			send_result( op, rs, so );
 			rc = LDAP_SUCCESS;
 		/* are we continuing a paged search? */
-		} else if ( so && ps && ps->ps_cookie ) {
+		} else if ( so && ps && ps->ps_cookie && !so->so_index ) {
 			so->so_ctrl = sc;
 			send_page( op, rs, so );
 			send_result( op, rs, so );
 			rc = LDAP_SUCCESS;
+		/* the next page from the sort index */
+		} else if ( so && ps && ps->ps_cookie ) {
+			slap_callback *cb = op->o_tmpalloc( sizeof(slap_callback),
+				op->o_tmpmemctx );
+
+			cb->sc_cleanup		= NULL;
+			cb->sc_response		= sssvlv_op_response;
+			cb->sc_next			= op->o_callback;
+			cb->sc_private		= so;
+			cb->sc_writewait	= NULL;
+
+			so->so_ctrl = sc;
+			op->o_pagedresults = SLAP_CONTROL_IGNORED;
+			sort_hint( op, so, NULL, ps );
+
+			op->o_callback		= cb;
 		} else {
 			slap_callback *cb = op->o_tmpalloc( sizeof(slap_callback),
 				op->o_tmpmemctx );
@@ -950,6 +1724,7 @@ static int sssvlv_op_search(
 			so->so_tree = NULL;
 			so->so_ctrl = sc;
 			so->so_info = si;
+			so->so_limit = ( ps || vc ) ? -1 : op->ors_slimit;
 			if ( ps ) {
 				so->so_paged = op->o_pagedresults;
 				so->so_page_size = ps->ps_size;
@@ -970,6 +1745,7 @@ static int sssvlv_op_search(
 			so->so_vcontext = (unsigned long)so;
 			so->so_nentries = 0;
 			so->so_running = 1;
+			sort_hint( op, so, vc, ps );
 
 			op->o_callback		= cb;
 		}
@@ -1298,6 +2074,18 @@ static ConfigTable sssvlv_cfg[] = {
 		"( OLcfgOvAt:21.3 NAME 'olcSssVlvMaxPerConn' "
 			"DESC 'Maximum number of concurrent paged search requests per connection' "
 			"SYNTAX OMsInteger SINGLE-VALUE )", NULL, NULL },
+	{ "sssvlv-maxmem", "bytes",
+		2, 2, 0, ARG_ULONG|ARG_OFFSET,
+			(void *)offsetof(sssvlv_info, svi_max_mem),
+		"( OLcfgOvAt:21.4 NAME 'olcSssVlvMaxMem' "
+			"DESC 'Bytes of sort keys held in memory per Sort request' "
+			"SYNTAX OMsInteger SINGLE-VALUE )", NULL, NULL },
+	{ "sssvlv-tmpdir", "dir",
+		2, 2, 0, ARG_STRING|ARG_OFFSET,
+			(void *)offsetof(sssvlv_info, svi_tmpdir),
+		"( OLcfgOvAt:21.5 NAME 'olcSssVlvTmpDir' "
+			"DESC 'Directory for sorted runs of large Sort requests' "
+			"SYNTAX OMsDirectoryString SINGLE-VALUE )", NULL, NULL },
 	{ NULL, NULL, 0, 0, 0, ARG_IGNORED }
 };
 
@@ -1306,7 +2094,8 @@ static ConfigOCs sssvlv_ocs[] = {
 		"NAME 'olcSssVlvConfig' "
 		"DESC 'SSS VLV configuration' "
 		"SUP olcOverlayConfig "
-		"MAY ( olcSssVlvMax $ olcSssVlvMaxKeys $ olcSssVlvMaxPerConn ) )",
+		"MAY ( olcSssVlvMax $ olcSssVlvMaxKeys $ olcSssVlvMaxPerConn $ "
+			"olcSssVlvMaxMem $ olcSssVlvTmpDir ) )",
 		Cft_Overlay, sssvlv_cfg, NULL, NULL },
 	{ NULL, 0, NULL }
 };
@@ -1357,6 +2146,8 @@ static int sssvlv_db_init(
 	si->svi_num = 0;
 	si->svi_max_keys = SSSVLV_DEFAULT_MAX_KEYS;
 	si->svi_max_percon = SSSVLV_DEFAULT_MAX_REQUEST_PER_CONN;
+	si->svi_max_mem = 0;
+	si->svi_tmpdir = NULL;
 
 	ov_count++;
 
@@ -1391,6 +2182,7 @@ static int sssvlv_db_destroy(
 #endif /* SLAP_CONFIG_DELETE */
 
 	if ( si ) {
+		ch_free( si->svi_tmpdir );
 		ch_free( si );
 		on->on_bi.bi_private = NULL;
 	}
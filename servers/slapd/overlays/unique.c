@@ -64,6 +64,8 @@ typedef struct unique_data_s {
 	struct unique_domain_s *domains;
 	struct unique_domain_s *legacy;
 	char legacy_strict_set;
+	Avlnode *reserved;		      /* values of ops in flight */
+	ldap_pvt_thread_mutex_t reserved_mutex;
 } unique_data;
 
 typedef struct unique_counter_s {
@@ -794,6 +796,7 @@ unique_db_init(
 	Debug(LDAP_DEBUG_TRACE, "==> unique_db_init\n", 0, 0, 0);
 
 	*privatep = ch_calloc ( 1, sizeof ( unique_data ) );
+	ldap_pvt_thread_mutex_init( &(*privatep)->reserved_mutex );
 
 	return 0;
 }
@@ -816,6 +819,7 @@ unique_db_destroy(
 
 		unique_free_domain ( domains );
 		unique_free_domain ( legacy );
+		ldap_pvt_thread_mutex_destroy( &private->reserved_mutex );
 		ch_free ( private );
 		*privatep = NULL;
 	}
@@ -1018,6 +1022,229 @@ unique_search(
 	return(SLAP_CB_CONTINUE);
 }
 
+/*
+** values being written by operations still in flight; another
+** operation may not claim them in the same domain until they
+** have completed, since neither would see the other's entry.
+*/
+
+typedef struct unique_reserved_s {
+	struct unique_reserved_s *next;		/* claimed by the same op */
+	unique_domain_uri *uri;
+	AttributeDescription *ad;
+	struct berval val;
+	Operation *op;
+} unique_reserved;
+
+typedef struct unique_cbinfo_s {
+	slap_overinst *on;
+	unique_reserved *reserved;
+} unique_cbinfo;
+
+/* outcome of checking one domain-uri without a search */
+typedef struct unique_probe_s {
+	int count;	/* conflicting entries found */
+	int missed;	/* values that need the search */
+	int busy;	/* values claimed by another operation */
+} unique_probe;
+
+static int
+unique_reserved_cmp( const void *c1, const void *c2 )
+{
+	const unique_reserved *r1 = c1, *r2 = c2;
+
+	if ( r1->uri != r2->uri )
+		return r1->uri < r2->uri ? -1 : 1;
+	if ( r1->ad != r2->ad )
+		return r1->ad < r2->ad ? -1 : 1;
+	return ber_bvcmp( &r1->val, &r2->val );
+}
+
+static int
+unique_cleanup(
+	Operation *op,
+	SlapReply *rs
+)
+{
+	slap_callback *sc = op->o_callback;
+	unique_cbinfo *uci = sc->sc_private;
+	unique_data *private = (unique_data *) uci->on->on_bi.bi_private;
+	unique_reserved *r;
+
+	op->o_callback = sc->sc_next;
+
+	ldap_pvt_thread_mutex_lock( &private->reserved_mutex );
+	while (( r = uci->reserved )) {
+		uci->reserved = r->next;
+		avl_delete( &private->reserved, r, unique_reserved_cmp );
+		ch_free( r );
+	}
+	ldap_pvt_thread_mutex_unlock( &private->reserved_mutex );
+
+	op->o_tmpfree( sc, op->o_tmpmemctx );
+	return 0;
+}
+
+/* claim a value for this operation; returns nonzero if another
+ * operation holds it
+ */
+static int
+unique_reserve(
+	Operation *op,
+	slap_overinst *on,
+	unique_domain_uri *uri,
+	AttributeDescription *ad,
+	struct berval *val
+)
+{
+	unique_data *private = (unique_data *) on->on_bi.bi_private;
+	slap_callback *sc;
+	unique_cbinfo *uci = NULL;
+	unique_reserved *r, *dup;
+	int rc = 0;
+
+	for ( sc = op->o_callback; sc; sc = sc->sc_next ) {
+		if ( sc->sc_cleanup == unique_cleanup ) {
+			uci = sc->sc_private;
+			break;
+		}
+	}
+	if ( !uci ) {
+		sc = op->o_tmpcalloc( 1, sizeof(slap_callback)+sizeof(unique_cbinfo),
+			op->o_tmpmemctx );
+		sc->sc_private = sc+1;
+		sc->sc_cleanup = unique_cleanup;
+		uci = sc->sc_private;
+		uci->on = on;
+		sc->sc_next = op->o_callback;
+		op->o_callback = sc;
+	}
+
+	r = ch_malloc( sizeof( unique_reserved ) + val->bv_len + 1 );
+	r->uri = uri;
+	r->ad = ad;
+	r->val.bv_val = (char *)(r+1);
+	r->val.bv_len = val->bv_len;
+	AC_MEMCPY( r->val.bv_val, val->bv_val, val->bv_len );
+	r->val.bv_val[val->bv_len] = '\0';
+	r->op = op;
+
+	ldap_pvt_thread_mutex_lock( &private->reserved_mutex );
+	if ( avl_insert( &private->reserved, r, unique_reserved_cmp, avl_dup_error )) {
+		dup = avl_find( private->reserved, r, unique_reserved_cmp );
+		if ( dup->op != op )
+			rc = 1;
+		ch_free( r );
+	} else {
+		r->next = uci->reserved;
+		uci->reserved = r;
+	}
+	ldap_pvt_thread_mutex_unlock( &private->reserved_mutex );
+
+	return rc;
+}
+
+/* reserve the values of one attribute, and look them up directly
+ * in the backend's equality index when it can tell us
+ */
+static void
+unique_probe_values(
+	Operation *op,
+	unique_domain *domain,
+	unique_domain_uri *uri,
+	AttributeDescription *ad,
+	BerVarray vals,
+	BerVarray nvals,
+	unique_probe *up
+)
+{
+	slap_overinst *on = (slap_overinst *) op->o_bd->bd_info;
+	BackendInfo *bi = (BackendInfo *) on->on_info->oi_orig;
+	struct berval *base;
+	unique_attrs *attr;
+	Operation nop;
+	int i, n;
+
+	if ( is_at_operational( ad->ad_type ))
+		return;
+	if ( uri->attrs ) {
+		for ( attr = uri->attrs; attr; attr = attr->next ) {
+			if ( ad == attr->attr ) {
+				break;
+			}
+		}
+		if ( ( domain->ignore && attr )
+		     || (!domain->ignore && !attr )) {
+			return;
+		}
+	}
+
+	if ( !vals || !vals[0].bv_val ) {
+		/* (attr=*) is left to the search */
+		if ( domain->strict )
+			up->missed++;
+		return;
+	}
+	if ( !nvals )
+		nvals = vals;
+
+	base = uri->ndn.bv_val ? &uri->ndn : &op->o_bd->be_nsuffix[0];
+	nop = *op;
+	nop.o_dn = op->o_bd->be_rootdn;
+	nop.o_ndn = op->o_bd->be_rootndn;
+	nop.o_bd = on->on_info->oi_origdb;
+
+	for ( i = 0; nvals[i].bv_val; i++ ) {
+		if ( unique_reserve( op, on, uri, ad, &nvals[i] )) {
+			up->busy++;
+			return;
+		}
+		if ( up->missed || up->count )
+			continue;
+		if ( !bi->bi_value_count || SLAP_GLUE_INSTANCE( op->o_bd )
+		     || ( uri->filter.bv_val && uri->filter.bv_len )
+		     || !dnIsSuffix( base, &op->o_bd->be_nsuffix[0] )) {
+			up->missed++;
+			continue;
+		}
+		if ( bi->bi_value_count( &nop, base, uri->scope, ad, &nvals[i],
+			&op->o_req_ndn, &n ) != LDAP_SUCCESS ) {
+			up->missed++;
+			continue;
+		}
+		up->count += n;
+	}
+}
+
+/* act on the probe: returns SLAP_CB_CONTINUE if the search is
+ * still needed, or the result already sent.
+ */
+static int
+unique_probe_result(
+	Operation *op,
+	SlapReply *rs,
+	unique_probe *up
+)
+{
+	slap_overinst *on = (slap_overinst *) op->o_bd->bd_info;
+
+	if ( up->busy ) {
+		op->o_bd->bd_info = (BackendInfo *) on->on_info;
+		send_ldap_error(op, rs, LDAP_BUSY,
+			"some attributes are being written by another operation");
+		return(rs->sr_err);
+	}
+	if ( up->count ) {
+		Debug(LDAP_DEBUG_TRACE, "=> unique_probe found %d records\n",
+			up->count, 0, 0);
+		op->o_bd->bd_info = (BackendInfo *) on->on_info;
+		send_ldap_error(op, rs, LDAP_CONSTRAINT_VIOLATION,
+			"some attributes not unique");
+		return(rs->sr_err);
+	}
+	return up->missed ? SLAP_CB_CONTINUE : LDAP_SUCCESS;
+}
+
 static int
 unique_add(
 	Operation *op,
@@ -1060,6 +1287,7 @@ unique_add(
 		{
 			int len;
 			int ks = 0;
+			unique_probe up = { 0 };
 
 			if ( uri->ndn.bv_val
 			     && !dnIsSuffix( &op->o_req_ndn, &uri->ndn ))
@@ -1089,12 +1317,25 @@ unique_add(
 								 uri,
 								 a->a_desc,
 								 a->a_vals);
+					unique_probe_values ( op, domain, uri,
+							      a->a_desc,
+							      a->a_vals,
+							      a->a_nvals,
+							      &up );
 				}
 			}
 
 			/* skip this domain-uri if it isn't involved */
 			if ( !ks ) continue;
 
+			/* or if the index already answered */
+			rc = unique_probe_result ( op, rs, &up );
+			if ( rc == LDAP_SUCCESS ) {
+				rc = SLAP_CB_CONTINUE;
+				continue;
+			}
+			if ( rc != SLAP_CB_CONTINUE ) break;
+
 			/* terminating NUL */
 			ks += sizeof("(|)");
 
@@ -1203,6 +1444,7 @@ unique_modify(
 		{
 			int len;
 			int ks = 0;
+			unique_probe up = { 0 };
 
 			if ( uri->ndn.bv_val
 			     && !dnIsSuffix( &op->o_req_ndn, &uri->ndn ))
@@ -1210,16 +1452,31 @@ unique_modify(
 
 			for ( m = op->orm_modlist; m; m = m->sml_next)
 				if ( (m->sml_op & LDAP_MOD_OP)
-				     != LDAP_MOD_DELETE )
+				     != LDAP_MOD_DELETE ) {
 					ks += count_filter_len
 						( domain,
 						  uri,
 						  m->sml_desc,
 						  m->sml_values);
+					unique_probe_values
+						( op, domain, uri,
+						  m->sml_desc,
+						  m->sml_values,
+						  m->sml_nvalues,
+						  &up );
+				}
 
 			/* skip this domain-uri if it isn't involved */
 			if ( !ks ) continue;
 
+			/* or if the index already answered */
+			rc = unique_probe_result ( op, rs, &up );
+			if ( rc == LDAP_SUCCESS ) {
+				rc = SLAP_CB_CONTINUE;
+				continue;
+			}
+			if ( rc != SLAP_CB_CONTINUE ) break;
+
 			/* terminating NUL */
 			ks += sizeof("(|)");
 
@@ -1326,6 +1583,7 @@ unique_modrdn(
 		{
 			int i, len;
 			int ks = 0;
+			unique_probe up = { 0 };
 
 			if ( uri->ndn.bv_val
 			     && !dnIsSuffix( &op->o_req_ndn, &uri->ndn )
@@ -1363,16 +1621,41 @@ unique_modrdn(
 			bv[1].bv_len = 0;
 
 			for ( i=0; newrdn[i]; i++ ) {
+				struct berval nbv[2];
+
 				bv[0] = newrdn[i]->la_value;
 				ks += count_filter_len ( domain,
 							 uri,
 							 newrdn[i]->la_private,
 							 bv);
+
+				BER_BVZERO( &nbv[1] );
+				if ( attr_normalize_one ( newrdn[i]->la_private,
+							  &bv[0], &nbv[0],
+							  op->o_tmpmemctx ) ) {
+					up.missed++;
+					continue;
+				}
+				unique_probe_values ( op, domain, uri,
+						      newrdn[i]->la_private,
+						      bv,
+						      BER_BVISNULL( &nbv[0] ) ? NULL : nbv,
+						      &up );
+				if ( !BER_BVISNULL( &nbv[0] ) )
+					op->o_tmpfree( nbv[0].bv_val, op->o_tmpmemctx );
 			}
 
 			/* skip this domain if it isn't involved */
 			if ( !ks ) continue;
 
+			/* or if the index already answered */
+			rc = unique_probe_result ( op, rs, &up );
+			if ( rc == LDAP_SUCCESS ) {
+				rc = SLAP_CB_CONTINUE;
+				continue;
+			}
+			if ( rc != SLAP_CB_CONTINUE ) break;
+
 			/* terminating NUL */
 			ks += sizeof("(|)");
 
@@ -339,6 +339,8 @@ LDAP_SLAPD_F (void) ava_free LDAP_P((
 #define be_match( be1, be2 )	( (be1) == (be2) || \
 				  ( (be1) && (be2) && (be1)->be_nsuffix == (be2)->be_nsuffix ) )
 
+LDAP_SLAPD_V (int) slap_sorthint_key;
+
 LDAP_SLAPD_F (int) backend_init LDAP_P((void));
 LDAP_SLAPD_F (int) backend_add LDAP_P((BackendInfo *aBackendInfo));
 LDAP_SLAPD_F (int) backend_num LDAP_P((Backend *be));
@@ -1025,6 +1027,8 @@ LDAP_SLAPD_F (Entry *) str2entry LDAP_P(( char	*s ));
 LDAP_SLAPD_F (Entry *) str2entry2 LDAP_P(( char	*s, int checkvals ));
 LDAP_SLAPD_F (char *) entry2str LDAP_P(( Entry *e, int *len ));
 LDAP_SLAPD_F (char *) entry2str_wrap LDAP_P(( Entry *e, int *len, ber_len_t wrap ));
+LDAP_SLAPD_F (char *) entry2str_wrap_r LDAP_P(( Entry *e, int *len, ber_len_t wrap,
+	char **bufp, int *sizep ));
 
 LDAP_SLAPD_F (ber_len_t) entry_flatsize LDAP_P(( Entry *e, int norm ));
 LDAP_SLAPD_F (void) entry_partsize LDAP_P(( Entry *e, ber_len_t *len,
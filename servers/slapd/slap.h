@@ -1826,6 +1826,8 @@ struct BackendDB {
  * (in previous use there was a flaw with back-bdb; now it is fixed).
  */
 #define		be_has_subordinates bd_info->bi_has_subordinates
+#define		be_value_count	bd_info->bi_value_count
+#define		be_purge	bd_info->bi_purge
 
 #define		be_connection_init	bd_info->bi_connection_init
 #define		be_connection_destroy	bd_info->bi_connection_destroy
@@ -2193,6 +2195,20 @@ typedef int (BI_entry_get_rw) LDAP_P(( Operation *op, struct berval *ndn,
 typedef int (BI_operational) LDAP_P(( Operation *op, SlapReply *rs ));
 typedef int (BI_has_subordinates) LDAP_P(( Operation *op,
 	Entry *e, int *hasSubs ));
+/* Count the entries under base/scope, other than skip, holding the
+ * normalized value nval of ad, straight from an equality index.
+ * Returns LDAP_UNWILLING_TO_PERFORM if ad isn't indexed that way.
+ */
+typedef int (BI_value_count) LDAP_P(( Operation *op, struct berval *base,
+	int scope, AttributeDescription *ad, struct berval *nval,
+	struct berval *skip, int *count ));
+/* Delete the leaf entries under base/scope matching f, in bulk and
+ * without ACLs or callbacks; maxcsn, if set, receives the newest
+ * entryCSN of the deleted entries into its LDAP_PVT_CSNSTR_BUFSIZE
+ * buffer.
+ */
+typedef int (BI_purge) LDAP_P(( Operation *op, struct berval *base,
+	int scope, Filter *f, struct berval *maxcsn, int *count ));
 typedef int (BI_access_allowed) LDAP_P(( Operation *op, Entry *e,
 	AttributeDescription *desc, struct berval *val, slap_access_t access,
 	AccessControlState *state, slap_mask_t *maskp ));
@@ -2381,6 +2397,11 @@ struct BackendInfo {
 	void	*bi_extra;		/* backend type-specific APIs */
 	void	*bi_private;	/* backend type-specific config data */
 	LDAP_STAILQ_ENTRY(BackendInfo) bi_next ;
+
+	/* Newer hooks go last, so the offsets of the ones above stay
+	 * the same for backends built against an older slap.h */
+	BI_value_count		*bi_value_count;
+	BI_purge		*bi_purge;
 };
 
 #define c_authtype	c_authz.sai_method
@@ -2613,6 +2634,34 @@ typedef struct OpExtraDB {
 	BackendDB *oe_db;
 } OpExtraDB;
 
+/* A sorted search offered to the backend by a server side sort
+ * (slapo-sssvlv), keyed by &slap_sorthint_key. A backend with an
+ * ordered index for os_ad under os_mr sets SLAP_SORT_SERVED and
+ * returns the entries in that order, limited to the window asked
+ * for; otherwise it ignores the hint and the overlay sorts.
+ */
+typedef struct OpExtraSort {
+	OpExtra oe;
+	Operation *os_op;	/* the search it is for, not copies of it */
+	AttributeDescription *os_ad;
+	MatchingRule *os_mr;
+	int os_flags;
+#define SLAP_SORT_REVERSE	0x01
+#define SLAP_SORT_SERVED	0x02	/* set by the backend */
+#define SLAP_SORT_MORE	0x04	/* entries remain after os_limit */
+#define SLAP_SORT_RANGE	0x08	/* os_offset is out of range */
+	int os_offset;		/* VLV target position, 0 for by value */
+	int os_count;		/* client's content count estimate */
+	struct berval os_value;	/* VLV target value, normalized */
+	int os_before;		/* entries wanted before the target */
+	int os_after;		/* entries wanted after the target */
+	int os_limit;		/* max entries to send, 0 for all */
+	struct berval os_resume;	/* in: end of the previous page, out: a
+				 * new allocation for the end of this one */
+	int os_target;		/* returned VLV target position */
+	int os_total;		/* returned content count estimate */
+} OpExtraSort;
+
 struct Operation {
 	Opheader *o_hdr;
 
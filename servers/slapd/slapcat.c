@@ -40,6 +40,199 @@ slapcat_sig( int sig )
 	gotsig=1;
 }
 
+/*
+ * Threaded output: when tool-threads is greater than 1, the main
+ * thread keeps walking the database and fetching entries, while
+ * worker threads apply the filter and format the LDIF. Entries are
+ * handed over in batches through a ring of slots, and the main
+ * thread writes the results back out in the original order.
+ */
+#define SLAPCAT_BATCH	64
+#define SLAPCAT_SLOTS_PER_THREAD	4
+
+enum {
+	SLOT_FREE = 0,
+	SLOT_READY,
+	SLOT_DONE
+};
+
+typedef struct slapcat_slot {
+	int ss_state;
+	int ss_count;
+	ID ss_id[SLAPCAT_BATCH];
+	Entry *ss_e[SLAPCAT_BATCH];
+	int ss_len[SLAPCAT_BATCH];	/* 0 if filtered out, -1 on error */
+	char *ss_buf;		/* LDIF of the whole batch */
+	int ss_size;
+	int ss_used;
+	char *ss_tmp;		/* scratch for a single entry */
+	int ss_tmpsize;
+} slapcat_slot;
+
+static ldap_pvt_thread_mutex_t sc_mutex;
+static ldap_pvt_thread_cond_t sc_cond_work;
+static ldap_pvt_thread_cond_t sc_cond_main;
+static slapcat_slot *sc_slots;
+static unsigned long sc_nslots;
+static unsigned long sc_fill, sc_work, sc_out;
+static int sc_done;
+static int sc_idle;		/* workers waiting for input */
+static int sc_waiting;		/* main thread waiting for output */
+static int sc_doBSF;
+static int sc_rc = EXIT_SUCCESS;
+static int sc_stop;
+
+static void
+slapcat_encode( Operation *op, slapcat_slot *ss )
+{
+	int i;
+
+	ss->ss_used = 0;
+	for ( i = 0; i < ss->ss_count; i++ ) {
+		Entry *e = ss->ss_e[i];
+		int len = 0;
+
+		if ( sc_doBSF && (
+			( sub_ndn.bv_len &&
+				!dnIsSuffixScope( &e->e_nname, &sub_ndn, scope ) ) ||
+			( filter != NULL &&
+				test_filter( NULL, e, filter ) != LDAP_COMPARE_TRUE ) ) )
+		{
+			len = 0;
+
+		} else if ( entry2str_wrap_r( e, &len, ldif_wrap,
+				&ss->ss_tmp, &ss->ss_tmpsize ) == NULL )
+		{
+			len = -1;
+
+		} else {
+			if ( ss->ss_used + len + 1 > ss->ss_size ) {
+				ss->ss_size = ss->ss_used + len + 1 + BUFSIZ;
+				ss->ss_buf = ch_realloc( ss->ss_buf, ss->ss_size );
+			}
+			AC_MEMCPY( ss->ss_buf + ss->ss_used, ss->ss_tmp, len );
+			ss->ss_used += len;
+		}
+		ss->ss_len[i] = len;
+
+		be_entry_release_r( op, e );
+		ss->ss_e[i] = NULL;
+	}
+}
+
+static void *
+slapcat_thr( void *ctx )
+{
+	Operation op = {0};
+
+	op.o_bd = be;
+
+	ldap_pvt_thread_mutex_lock( &sc_mutex );
+	for (;;) {
+		slapcat_slot *ss;
+
+		while ( sc_work == sc_fill && !sc_done ) {
+			sc_idle++;
+			ldap_pvt_thread_cond_wait( &sc_cond_work, &sc_mutex );
+			sc_idle--;
+		}
+		if ( sc_work == sc_fill )
+			break;
+
+		ss = &sc_slots[ sc_work % sc_nslots ];
+		sc_work++;
+		ldap_pvt_thread_mutex_unlock( &sc_mutex );
+
+		slapcat_encode( &op, ss );
+
+		ldap_pvt_thread_mutex_lock( &sc_mutex );
+		ss->ss_state = SLOT_DONE;
+		if ( sc_waiting )
+			ldap_pvt_thread_cond_signal( &sc_cond_main );
+	}
+	ldap_pvt_thread_mutex_unlock( &sc_mutex );
+
+	return NULL;
+}
+
+/* Hand the batch being filled over to the workers */
+static void
+slapcat_submit( void )
+{
+	slapcat_slot *ss = &sc_slots[ sc_fill % sc_nslots ];
+
+	if ( !ss->ss_count )
+		return;
+
+	ldap_pvt_thread_mutex_lock( &sc_mutex );
+	ss->ss_state = SLOT_READY;
+	sc_fill++;
+	if ( sc_idle )
+		ldap_pvt_thread_cond_signal( &sc_cond_work );
+	ldap_pvt_thread_mutex_unlock( &sc_mutex );
+}
+
+/*
+ * Write out finished batches in order. If wait is set, block until
+ * every submitted batch has been written; otherwise only wait as
+ * long as needed for the next slot to become free.
+ */
+static int
+slapcat_flush( const char *progname, int wait )
+{
+	ldap_pvt_thread_mutex_lock( &sc_mutex );
+	while ( sc_out != sc_fill ) {
+		slapcat_slot *ss = &sc_slots[ sc_out % sc_nslots ];
+		char *data;
+		int i;
+
+		if ( ss->ss_state != SLOT_DONE ) {
+			if ( !wait && sc_fill - sc_out < sc_nslots )
+				break;
+			sc_waiting = 1;
+			ldap_pvt_thread_cond_wait( &sc_cond_main, &sc_mutex );
+			sc_waiting = 0;
+			continue;
+		}
+		ldap_pvt_thread_mutex_unlock( &sc_mutex );
+
+		data = ss->ss_buf;
+		for ( i = 0; i < ss->ss_count && !sc_stop; i++ ) {
+			if ( ss->ss_len[i] == 0 )
+				continue;
+
+			if ( verbose ) {
+				printf( "# id=%08lx\n", (long) ss->ss_id[i] );
+			}
+
+			if ( ss->ss_len[i] < 0 ) {
+				printf("# bad data for entry id=%08lx\n\n", (long) ss->ss_id[i] );
+				sc_rc = EXIT_FAILURE;
+				if ( !continuemode )
+					sc_stop = 1;
+				continue;
+			}
+
+			if ( fwrite( data, ss->ss_len[i], 1, ldiffp->fp ) != 1 ||
+				fputs( "\n", ldiffp->fp ) == EOF ) {
+				fprintf(stderr, "%s: error writing output.\n",
+					progname);
+				sc_rc = EXIT_FAILURE;
+				sc_stop = 1;
+			}
+			data += ss->ss_len[i];
+		}
+
+		ldap_pvt_thread_mutex_lock( &sc_mutex );
+		ss->ss_count = 0;
+		ss->ss_state = SLOT_FREE;
+		sc_out++;
+	}
+	ldap_pvt_thread_mutex_unlock( &sc_mutex );
+
+	return sc_stop ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
 int
 slapcat( int argc, char **argv )
 {
@@ -49,6 +242,8 @@ slapcat( int argc, char **argv )
 	const char *progname = "slapcat";
 	int requestBSF;
 	int doBSF = 0;
+	int nthreads = 0, i;
+	ldap_pvt_thread_t *thr = NULL;
 
 	slap_tool_init( progname, SLAPCAT, argc, argv );
 
@@ -96,6 +291,20 @@ slapcat( int argc, char **argv )
 		}
 	}
 
+	if ( slap_tool_thread_max > 1 ) {
+		nthreads = slap_tool_thread_max - 1;
+		sc_nslots = nthreads * SLAPCAT_SLOTS_PER_THREAD;
+		sc_slots = ch_calloc( sc_nslots, sizeof( slapcat_slot ));
+		sc_doBSF = doBSF;
+		ldap_pvt_thread_mutex_init( &sc_mutex );
+		ldap_pvt_thread_cond_init( &sc_cond_work );
+		ldap_pvt_thread_cond_init( &sc_cond_main );
+		thr = ch_malloc( nthreads * sizeof( ldap_pvt_thread_t ));
+		for ( i = 0; i < nthreads; i++ ) {
+			ldap_pvt_thread_create( &thr[i], 0, slapcat_thr, NULL );
+		}
+	}
+
 	for ( ; id != NOID; id = be->be_entry_next( be ) )
 	{
 		char *data;
@@ -106,6 +315,14 @@ slapcat( int argc, char **argv )
 			break;
 
 		e = be->be_entry_get( be, id );
+		if ( e == NULL && nthreads ) {
+			/* keep the diagnostics in sequence with the output */
+			slapcat_submit();
+			if ( slapcat_flush( progname, 1 ) != EXIT_SUCCESS ) {
+				rc = EXIT_FAILURE;
+				break;
+			}
+		}
 		if ( e == NULL ) {
 			printf("# no data for entry id=%08lx\n\n", (long) id );
 			rc = EXIT_FAILURE;
@@ -127,6 +344,22 @@ slapcat( int argc, char **argv )
 			if ( e == NULL ) break;
 		}
 
+		if ( nthreads ) {
+			slapcat_slot *ss = &sc_slots[ sc_fill % sc_nslots ];
+
+			ss->ss_id[ ss->ss_count ] = id;
+			ss->ss_e[ ss->ss_count ] = e;
+			if ( ++ss->ss_count < SLAPCAT_BATCH )
+				continue;
+
+			slapcat_submit();
+			if ( slapcat_flush( progname, 0 ) != EXIT_SUCCESS ) {
+				rc = EXIT_FAILURE;
+				break;
+			}
+			continue;
+		}
+
 		if ( doBSF ) {
 			if ( sub_ndn.bv_len && !dnIsSuffixScope( &e->e_nname, &sub_ndn, scope ) )
 			{
@@ -167,6 +400,29 @@ slapcat( int argc, char **argv )
 		}
 	}
 
+	if ( nthreads ) {
+		slapcat_submit();
+		slapcat_flush( progname, 1 );
+		if ( sc_rc != EXIT_SUCCESS )
+			rc = EXIT_FAILURE;
+		ldap_pvt_thread_mutex_lock( &sc_mutex );
+		sc_done = 1;
+		ldap_pvt_thread_cond_broadcast( &sc_cond_work );
+		ldap_pvt_thread_mutex_unlock( &sc_mutex );
+		for ( i = 0; i < nthreads; i++ ) {
+			ldap_pvt_thread_join( thr[i], NULL );
+		}
+		ch_free( thr );
+		for ( i = 0; i < (int)sc_nslots; i++ ) {
+			ch_free( sc_slots[i].ss_buf );
+			ch_free( sc_slots[i].ss_tmp );
+		}
+		ch_free( sc_slots );
+		ldap_pvt_thread_cond_destroy( &sc_cond_main );
+		ldap_pvt_thread_cond_destroy( &sc_cond_work );
+		ldap_pvt_thread_mutex_destroy( &sc_mutex );
+	}
+
 	be->be_entry_close( be );
 
 	if ( slap_tool_destroy())
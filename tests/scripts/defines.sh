@@ -38,6 +38,7 @@ PPOLICY=${AC_ppolicy-ppolicyno}
 REFINT=${AC_refint-refintno}
 RETCODE=${AC_retcode-retcodeno}
 RWM=${AC_rwm-rwmno}
+SSSVLV=${AC_sssvlv-sssvlvno}
 SYNCPROV=${AC_syncprov-syncprovno}
 TRANSLUCENT=${AC_translucent-translucentno}
 UNIQUE=${AC_unique-uniqueno}
@@ -106,6 +107,11 @@ REFSLAVECONF=$DATADIR/slapd-ref-slave.conf
 SCHEMACONF=$DATADIR/slapd-schema.conf
 GLUECONF=$DATADIR/slapd-glue.conf
 REFINTCONF=$DATADIR/slapd-refint.conf
+REFINTQUEUECONF=$DATADIR/slapd-refint-queue.conf
+LOGPURGECONF=$DATADIR/slapd-accesslog-purge.conf
+MULTIVALCONF=$DATADIR/slapd-multival.conf
+GROUPCOMMITCONF=$DATADIR/slapd-groupcommit.conf
+COMPACTCONF=$DATADIR/slapd-compact.conf
 RETCODECONF=$DATADIR/slapd-retcode.conf
 UNIQUECONF=$DATADIR/slapd-unique.conf
 LIMITSCONF=$DATADIR/slapd-limits.conf
@@ -130,6 +136,7 @@ METACONF2=$DATADIR/slapd-meta-target2.conf
 GLUELDAPCONF=$DATADIR/slapd-glue-ldap.conf
 ACICONF=$DATADIR/slapd-aci.conf
 VALSORTCONF=$DATADIR/slapd-valsort.conf
+SSSVLVCONF=$DATADIR/slapd-sssvlv.conf
 DYNLISTCONF=$DATADIR/slapd-dynlist.conf
 RSLAVECONF=$DATADIR/slapd-repl-slave-remote.conf
 PLSRSLAVECONF=$DATADIR/slapd-syncrepl-slave-persist-ldap.conf
@@ -139,6 +146,7 @@ PASSWDCONF=$DATADIR/slapd-passwd.conf
 UNDOCONF=$DATADIR/slapd-config-undo.conf
 NAKEDCONF=$DATADIR/slapd-config-naked.conf
 VALREGEXCONF=$DATADIR/slapd-valregex.conf
+WIDESCOPECONF=$DATADIR/slapd-widescope.conf
 
 DYNAMICCONF=$DATADIR/slapd-dynamic.ldif
 